@@ -0,0 +1,893 @@
+/**
+ * @file db_bench.cpp
+ * @brief Micro benchmarks for KVSQLite, modeled after leveldb's db_bench.
+ *
+ * Usage: db_bench [--benchmarks=fillseq,readrandom,...] [--num=N]
+ *                 [--value_size=N] [--batch_size=N] [--sync=0|1]
+ *                 [--transaction_mode=deferred|immediate|exclusive] [--db=path]
+ *                 [--encode_keys=0|1] [--shards=1,2,...] [--threads=N]
+ *                 [--compression=0|1] [--compression_ratio=R]
+ *                 [--page_compression=0..9] [--io_stats=0|1]
+ *                 [--mmap_size=N] [--cache_size=N] [--warm_up_bytes=N]
+ *                 [--direct_reads=0|1]
+ *
+ * fillrandomint and readrandomint use 64 bit integer keys, in a separate
+ * database file named after --db with an ".int" suffix. Run them with
+ * --encode_keys=0 and 1 to compare native keys with encoded ones.
+ *
+ * fillbatchattached is fillbatch with every batch split over two files, the
+ * second one named after --db with a ".shard" suffix and attached to the
+ * connection of the first, so that each batch is a cross-file commit.
+ *
+ * fillsharded and fillbatchsharded, not run by default, write into a
+ * ShardedDB named after --db with a ".sharded" suffix, once for each shard
+ * count of --shards. fillsharded runs --threads writers doing random puts,
+ * fillbatchsharded a single writer whose batches of 1000 keys fan out to
+ * the shards in parallel.
+ *
+ * Values are made of random bytes that compress to about
+ * --compression_ratio of their size. With --compression=1 the databases
+ * compress them with the built-in compressor; the fill benchmarks report
+ * the size of the database file they leave, so that runs with and without
+ * compression compare throughput against space. compress and uncompress
+ * time the built-in compressor alone on such values. --page_compression=L
+ * stores the pages of the databases compressed with Compressor::lz(L)
+ * instead, see Options::page_compressor.
+ *
+ * --io_stats=1 counts the I/O of the databases, see Options::enable_io_stats,
+ * and reports after each benchmark the bytes written to the files per byte
+ * of keys and values it wrote, the syncs and their 99th percentile.
+ *
+ * --mmap_size and --cache_size set the bytes SQLite maps and caches, see
+ * Options::mmap_size. reopen, not run by default, closes and opens the
+ * database again with an empty page cache, and warmup reads its file ahead
+ * with DB::warmUp(). With a database larger than --cache_size,
+ * --benchmarks=fillrandom,reopen,readrandom,reopen,warmup,readrandom run
+ * with and without --mmap_size compares read() calls with mapped pages.
+ * --warm_up_bytes reads back the pages read most before the last close
+ * when the databases open, see Options::warm_up_bytes; reopen then reports
+ * how many bytes it loaded.
+ *
+ * reopenimmutable, not run by default, opens the database again with
+ * Options::immutable, for the read benchmarks that follow it; writes then
+ * fail. With --direct_reads=1 gets walk the mapped B-tree instead of running
+ * SQL, see Options::direct_reads:
+ * --benchmarks=fillrandom,reopenimmutable,readrandom run with and without it
+ * compares the two.
+ */
+
+#include "KVSQLite/DB.h"
+#include "KVSQLite/ShardedDB.h"
+#include "KVSQLite/Slice.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+/* Benchmarks run by default, in this order. */
+const char * FLAGS_benchmarks =
+    "fillseq,"
+    "fillrandom,"
+    "overwrite,"
+    "readrandom,"
+    "fillbatch,"
+    "fillbatchattached,"
+    "deleterandom,"
+    "fillrandomint,"
+    "readrandomint,"
+    "compress,"
+    "uncompress,";
+
+/* Number of key/values to place in database */
+int FLAGS_num = 100000;
+
+/* Size of each value */
+int FLAGS_value_size = 100;
+
+/* Number of operations applied by a single WriteBatch in fillbatch */
+int FLAGS_batch_size = 4;
+
+/* Sync all writes to disk */
+bool FLAGS_sync = false;
+
+/* Lock mode used by write() */
+KVSQLite::Options::TransactionMode FLAGS_transaction_mode = KVSQLite::Options::Immediate;
+
+/* Database file used by the benchmarks */
+const char * FLAGS_db = "db_bench.db";
+
+/* Store keys in the order-preserving binary form, see Options::encode_keys */
+bool FLAGS_encode_keys = false;
+
+/* Shard counts run by the sharded benchmarks */
+const char * FLAGS_shards = "1,2,4,8,16,32";
+
+/* Number of concurrent writers of fillsharded */
+int FLAGS_threads = 8;
+
+/* Compress values with Compressor::lz(), see Options::compressor */
+bool FLAGS_compression = false;
+
+/* Share of its size a value compresses to */
+double FLAGS_compression_ratio = 0.5;
+
+/* Level of Compressor::lz() the pages are compressed with, 0 for none */
+int FLAGS_page_compression = 0;
+
+/* Report the I/O of each benchmark, see Options::enable_io_stats */
+bool FLAGS_io_stats = false;
+
+/* Bytes of the database file read through a memory mapping, see Options::mmap_size */
+long long FLAGS_mmap_size = 0;
+
+/* Bytes of SQLite's page cache, 0 for its default */
+long long FLAGS_cache_size = 0;
+
+/* Bytes of the pages traced at close loaded again on open, see Options::warm_up_bytes */
+long long FLAGS_warm_up_bytes = 0;
+
+/* Look keys up in the mapped file after reopenimmutable, see Options::direct_reads */
+bool FLAGS_direct_reads = false;
+
+typedef KVSQLite::DB<std::string, KVSQLite::Slice> BenchDB;
+typedef KVSQLite::DB<int64_t, KVSQLite::Slice> IntBenchDB;
+typedef KVSQLite::ShardedDB<std::string, std::string> ShardedBenchDB;
+
+class Benchmark
+{
+public:
+    Benchmark() : m_rand(301), m_value(FLAGS_value_size, 'x')
+    {
+        /* A random piece of the compressed size, repeated */
+        size_t piece = std::max<size_t>(1, (size_t)(m_value.size() * FLAGS_compression_ratio));
+        for(size_t i = 0; i < m_value.size(); i++)
+        {
+            m_value[i] = (i < piece) ? ' ' + (m_rand() % 95) : m_value[i % piece];
+        }
+    }
+
+    ~Benchmark()
+    {
+        delete m_shardDb;
+        delete m_db;
+        delete m_intDb;
+    }
+
+    void run()
+    {
+        std::fprintf(stdout, "Keys:       16 bytes each\n");
+        std::fprintf(stdout, "Values:     %d bytes each\n", FLAGS_value_size);
+        std::fprintf(stdout, "Entries:    %d\n", FLAGS_num);
+        std::fprintf(stdout, "Batch size: %d\n", FLAGS_batch_size);
+        std::fprintf(stdout, "Compression: %s, values compress to %.0f%%\n", FLAGS_compression ? "lz" : "none", FLAGS_compression_ratio * 100);
+        std::fprintf(stdout, "Page compression: %d\n", FLAGS_page_compression);
+        std::fprintf(stdout, "------------------------------------------------\n");
+
+        std::string benchmarks = FLAGS_benchmarks;
+        size_t start = 0;
+        while(start < benchmarks.size())
+        {
+            size_t sep = benchmarks.find(',', start);
+            if(std::string::npos == sep)
+            {
+                sep = benchmarks.size();
+            }
+            std::string name = benchmarks.substr(start, sep - start);
+            start = sep + 1;
+            if(name.empty())
+            {
+                continue;
+            }
+
+            if(name == "fillsharded" || name == "fillbatchsharded")
+            {
+                runSharded(name);
+                continue;
+            }
+
+            bool fresh = false;
+            bool intKeys = false;
+            bool attached = false;
+            bool codecOnly = false;
+            void (Benchmark::*method)() = nullptr;
+            if(name == "fillseq")
+            {
+                fresh = true;
+                method = &Benchmark::fillSeq;
+            }
+            else if(name == "fillrandom")
+            {
+                fresh = true;
+                method = &Benchmark::fillRandom;
+            }
+            else if(name == "overwrite")
+            {
+                method = &Benchmark::fillRandom;
+            }
+            else if(name == "fillbatch")
+            {
+                fresh = true;
+                method = &Benchmark::fillBatch;
+            }
+            else if(name == "fillbatchattached")
+            {
+                fresh = true;
+                attached = true;
+                method = &Benchmark::fillBatchAttached;
+            }
+            else if(name == "readrandom")
+            {
+                method = &Benchmark::readRandom;
+            }
+            else if(name == "reopen")
+            {
+                method = &Benchmark::reopen;
+            }
+            else if(name == "reopenimmutable")
+            {
+                method = &Benchmark::reopenImmutable;
+            }
+            else if(name == "warmup")
+            {
+                method = &Benchmark::warmUp;
+            }
+            else if(name == "deleterandom")
+            {
+                method = &Benchmark::deleteRandom;
+            }
+            else if(name == "fillrandomint")
+            {
+                fresh = true;
+                intKeys = true;
+                method = &Benchmark::fillRandomInt;
+            }
+            else if(name == "readrandomint")
+            {
+                intKeys = true;
+                method = &Benchmark::readRandomInt;
+            }
+            else if(name == "compress")
+            {
+                codecOnly = true;
+                method = &Benchmark::compress;
+            }
+            else if(name == "uncompress")
+            {
+                codecOnly = true;
+                method = &Benchmark::uncompress;
+            }
+            else
+            {
+                std::fprintf(stderr, "unknown benchmark '%s'\n", name.c_str());
+                continue;
+            }
+
+            if(codecOnly)
+            {
+                /* No database */
+            }
+            else if(intKeys && (fresh || nullptr == m_intDb))
+            {
+                openInt(fresh);
+            }
+            else if(!intKeys && (fresh || nullptr == m_db))
+            {
+                open(fresh);
+            }
+            if(attached)
+            {
+                openShard();
+            }
+
+            m_bytes = 0;
+            m_done = 0;
+            int64_t ioBefore[2] = {0, 0};
+            if(!codecOnly)
+            {
+                intKeys ? readIo(m_intDb, ioBefore) : readIo(m_db, ioBefore);
+            }
+            auto begin = std::chrono::steady_clock::now();
+            (this->*method)();
+            auto end = std::chrono::steady_clock::now();
+            if(fresh)
+            {
+                reportFileSize(intKeys ? std::string(FLAGS_db) + ".int" : std::string(FLAGS_db));
+            }
+            if(!codecOnly)
+            {
+                intKeys ? reportIo(m_intDb, ioBefore) : reportIo(m_db, ioBefore);
+            }
+            report(name, std::chrono::duration<double, std::micro>(end - begin).count());
+        }
+    }
+
+private:
+    /* immutable reopens the file read-only, with --direct_reads if set */
+    void open(bool fresh, bool immutable = false)
+    {
+        delete m_shardDb;
+        m_shardDb = nullptr;
+        delete m_db;
+        m_db = nullptr;
+        if(fresh)
+        {
+            std::remove(FLAGS_db);
+            std::remove((std::string(FLAGS_db) + "-journal").c_str());
+            std::remove((std::string(FLAGS_db) + "-pagetrace").c_str());
+        }
+
+        KVSQLite::Options options;
+        options.transaction_mode = FLAGS_transaction_mode;
+        options.encode_keys = FLAGS_encode_keys;
+        options.compressor = FLAGS_compression ? KVSQLite::Compressor::lz() : nullptr;
+        options.page_compressor = (FLAGS_page_compression > 0) ? KVSQLite::Compressor::lz(FLAGS_page_compression) : nullptr;
+        options.enable_io_stats = FLAGS_io_stats;
+        options.mmap_size = FLAGS_mmap_size;
+        options.cache_size = FLAGS_cache_size;
+        options.warm_up_bytes = FLAGS_warm_up_bytes;
+        options.immutable = immutable;
+        options.direct_reads = immutable && FLAGS_direct_reads;
+        KVSQLite::Status status = BenchDB::open(options, FLAGS_db, &m_db);
+        if(!status.ok())
+        {
+            std::fprintf(stderr, "open error: %s\n", status.toString().c_str());
+            std::exit(1);
+        }
+    }
+
+    /* A fresh second file, attached to the connection of m_db */
+    void openShard()
+    {
+        delete m_shardDb;
+        m_shardDb = nullptr;
+        std::string path = std::string(FLAGS_db) + ".shard";
+        std::remove(path.c_str());
+        std::remove((path + "-journal").c_str());
+
+        KVSQLite::Options options;
+        options.transaction_mode = FLAGS_transaction_mode;
+        KVSQLite::Status status = BenchDB::open(options, m_db, path, &m_shardDb);
+        if(!status.ok())
+        {
+            std::fprintf(stderr, "open error: %s\n", status.toString().c_str());
+            std::exit(1);
+        }
+    }
+
+    /* Run a sharded benchmark on a fresh database for each count of --shards */
+    void runSharded(const std::string & name)
+    {
+        std::string counts = FLAGS_shards;
+        size_t start = 0;
+        while(start < counts.size())
+        {
+            size_t sep = counts.find(',', start);
+            if(std::string::npos == sep)
+            {
+                sep = counts.size();
+            }
+            int shards = std::atoi(counts.substr(start, sep - start).c_str());
+            start = sep + 1;
+            if(shards <= 0)
+            {
+                continue;
+            }
+
+            std::string path = std::string(FLAGS_db) + ".sharded";
+            for(int i = 0; i < shards; i++)
+            {
+                std::string file = path + "." + std::to_string(i);
+                std::remove(file.c_str());
+                std::remove((file + "-journal").c_str());
+            }
+            KVSQLite::Options options;
+            options.transaction_mode = FLAGS_transaction_mode;
+            ShardedBenchDB * db = nullptr;
+            KVSQLite::Status status = ShardedBenchDB::open(options, path, shards, &db);
+            if(!status.ok())
+            {
+                std::fprintf(stderr, "open error: %s\n", status.toString().c_str());
+                std::exit(1);
+            }
+
+            m_bytes = 0;
+            m_done = 0;
+            auto begin = std::chrono::steady_clock::now();
+            if(name == "fillsharded")
+            {
+                fillSharded(db);
+            }
+            else
+            {
+                fillBatchSharded(db);
+            }
+            auto end = std::chrono::steady_clock::now();
+            delete db;
+            report(name + "/" + std::to_string(shards), std::chrono::duration<double, std::micro>(end - begin).count());
+        }
+    }
+
+    /* --threads writers doing random puts, each key going to the lock of its own shard */
+    void fillSharded(ShardedBenchDB * db)
+    {
+        KVSQLite::WriteOptions options;
+        options.sync = FLAGS_sync;
+        std::atomic<int64_t> bytes(0);
+        std::vector<std::thread> writers;
+        for(int t = 0; t < FLAGS_threads; t++)
+        {
+            writers.emplace_back([&, t]()
+            {
+                std::mt19937 rand(301 + t);
+                int64_t written = 0;
+                for(int i = t; i < FLAGS_num; i += FLAGS_threads)
+                {
+                    std::string k = key(rand() % FLAGS_num);
+                    check(db->put(options, k, m_value));
+                    written += k.size() + m_value.size();
+                }
+                bytes += written;
+            });
+        }
+        for(auto & writer : writers)
+        {
+            writer.join();
+        }
+        m_bytes = bytes;
+        m_done = FLAGS_num;
+    }
+
+    /* A single writer, each batch being split and applied to the shards in parallel */
+    void fillBatchSharded(ShardedBenchDB * db)
+    {
+        KVSQLite::WriteOptions options;
+        options.sync = FLAGS_sync;
+        KVSQLite::WriteBatch<std::string, std::string> batch;
+        for(int i = 0; i < FLAGS_num; i += 1000)
+        {
+            batch.clear();
+            for(int j = i; j < i + 1000 && j < FLAGS_num; j++)
+            {
+                std::string k = key(randomKey());
+                batch.put(k, m_value);
+                m_bytes += k.size() + m_value.size();
+                m_done++;
+            }
+            check(db->write(options, &batch));
+        }
+    }
+
+    void openInt(bool fresh)
+    {
+        delete m_intDb;
+        m_intDb = nullptr;
+        std::string path = std::string(FLAGS_db) + ".int";
+        if(fresh)
+        {
+            std::remove(path.c_str());
+            std::remove((path + "-journal").c_str());
+        }
+
+        KVSQLite::Options options;
+        options.transaction_mode = FLAGS_transaction_mode;
+        options.encode_keys = FLAGS_encode_keys;
+        options.compressor = FLAGS_compression ? KVSQLite::Compressor::lz() : nullptr;
+        options.page_compressor = (FLAGS_page_compression > 0) ? KVSQLite::Compressor::lz(FLAGS_page_compression) : nullptr;
+        options.enable_io_stats = FLAGS_io_stats;
+        options.mmap_size = FLAGS_mmap_size;
+        options.cache_size = FLAGS_cache_size;
+        options.warm_up_bytes = FLAGS_warm_up_bytes;
+        KVSQLite::Status status = IntBenchDB::open(options, path, &m_intDb);
+        if(!status.ok())
+        {
+            std::fprintf(stderr, "open error: %s\n", status.toString().c_str());
+            std::exit(1);
+        }
+    }
+
+    std::string key(int k) const
+    {
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "%016d", k);
+        return buf;
+    }
+
+    int randomKey()
+    {
+        return m_rand() % FLAGS_num;
+    }
+
+    void check(const KVSQLite::Status & status)
+    {
+        if(!status.ok() && status.type() != KVSQLite::Status::NotFound)
+        {
+            std::fprintf(stderr, "error: %s\n", status.toString().c_str());
+            std::exit(1);
+        }
+    }
+
+    void write(bool seq)
+    {
+        KVSQLite::WriteOptions options;
+        options.sync = FLAGS_sync;
+        for(int i = 0; i < FLAGS_num; i++)
+        {
+            std::string k = key(seq ? i : randomKey());
+            check(m_db->put(options, k, m_value));
+            m_bytes += k.size() + m_value.size();
+            m_done++;
+        }
+    }
+
+    void fillSeq()
+    {
+        write(true);
+    }
+
+    void fillRandom()
+    {
+        write(false);
+    }
+
+    /* Measures the fixed cost of write() by applying many small batches. */
+    void fillBatch()
+    {
+        KVSQLite::WriteOptions options;
+        options.sync = FLAGS_sync;
+        KVSQLite::WriteBatch<std::string, KVSQLite::Slice> batch;
+        for(int i = 0; i < FLAGS_num; i += FLAGS_batch_size)
+        {
+            batch.clear();
+            for(int j = i; j < i + FLAGS_batch_size && j < FLAGS_num; j++)
+            {
+                std::string k = key(j);
+                batch.put(k, m_value);
+                m_bytes += k.size() + m_value.size();
+                m_done++;
+            }
+            check(m_db->write(options, &batch));
+        }
+    }
+
+    /* fillbatch over two files: the cost of the super-journal that commits them together */
+    void fillBatchAttached()
+    {
+        KVSQLite::WriteOptions options;
+        options.sync = FLAGS_sync;
+        KVSQLite::WriteBatch<std::string, KVSQLite::Slice> batches[2];
+        KVSQLite::MultiWriteBatch batch;
+        batch.add(m_db, &batches[0]);
+        batch.add(m_shardDb, &batches[1]);
+        for(int i = 0; i < FLAGS_num; i += FLAGS_batch_size)
+        {
+            batches[0].clear();
+            batches[1].clear();
+            for(int j = i; j < i + FLAGS_batch_size && j < FLAGS_num; j++)
+            {
+                std::string k = key(j);
+                batches[j % 2].put(k, m_value);
+                m_bytes += k.size() + m_value.size();
+                m_done++;
+            }
+            check(m_db->write(options, &batch));
+        }
+    }
+
+    void readRandom()
+    {
+        int found = 0;
+        KVSQLite::Slice value;
+        for(int i = 0; i < FLAGS_num; i++)
+        {
+            KVSQLite::Status status = m_db->get(key(randomKey()), value);
+            check(status);
+            if(status.ok())
+            {
+                found++;
+                m_bytes += value.size();
+            }
+            m_done++;
+        }
+        char msg[64];
+        std::snprintf(msg, sizeof(msg), "(%d of %d found)", found, FLAGS_num);
+        m_message = msg;
+    }
+
+    void reopen()
+    {
+        open(false);
+        m_done = 1;
+        int64_t bytes = 0;
+        if(FLAGS_warm_up_bytes > 0 && m_db->getProperty("kvsqlite.warm-up-bytes", bytes).ok())
+        {
+            char msg[64];
+            std::snprintf(msg, sizeof(msg), "(warmed up %lld bytes)", (long long)bytes);
+            m_message = msg;
+        }
+    }
+
+    void reopenImmutable()
+    {
+        open(false, true);
+        m_done = 1;
+    }
+
+    void warmUp()
+    {
+        int64_t bytes = 0;
+        check(m_db->warmUp(0, &bytes));
+        m_bytes = bytes;
+        m_done = 1;
+    }
+
+    /* Spreads keys over the whole int64_t range, so that native keys take 8 bytes too */
+    int64_t intKey(int k) const
+    {
+        return (int64_t)((uint64_t)k * 0x9E3779B97F4A7C15ULL);
+    }
+
+    void fillRandomInt()
+    {
+        KVSQLite::WriteOptions options;
+        options.sync = FLAGS_sync;
+        for(int i = 0; i < FLAGS_num; i++)
+        {
+            check(m_intDb->put(options, intKey(randomKey()), m_value));
+            m_bytes += sizeof(int64_t) + m_value.size();
+            m_done++;
+        }
+    }
+
+    void readRandomInt()
+    {
+        int found = 0;
+        KVSQLite::Slice value;
+        for(int i = 0; i < FLAGS_num; i++)
+        {
+            KVSQLite::Status status = m_intDb->get(intKey(randomKey()), value);
+            check(status);
+            if(status.ok())
+            {
+                found++;
+                m_bytes += value.size();
+            }
+            m_done++;
+        }
+        char msg[64];
+        std::snprintf(msg, sizeof(msg), "(%d of %d found)", found, FLAGS_num);
+        m_message = msg;
+    }
+
+    void deleteRandom()
+    {
+        KVSQLite::WriteOptions options;
+        options.sync = FLAGS_sync;
+        for(int i = 0; i < FLAGS_num; i++)
+        {
+            check(m_db->del(options, key(randomKey())));
+            m_done++;
+        }
+    }
+
+    /* Throughput of the built-in compressor on one value */
+    void compress()
+    {
+        const KVSQLite::Compressor * lz = KVSQLite::Compressor::lz();
+        std::string output;
+        for(int i = 0; i < FLAGS_num; i++)
+        {
+            output.clear();
+            lz->compress(m_value.data(), m_value.size(), output);
+            m_bytes += m_value.size();
+            m_done++;
+        }
+        char msg[64];
+        std::snprintf(msg, sizeof(msg), "(output: %.1f%%)", output.empty() ? 100.0 : output.size() * 100.0 / m_value.size());
+        m_message = msg;
+    }
+
+    void uncompress()
+    {
+        const KVSQLite::Compressor * lz = KVSQLite::Compressor::lz();
+        std::string compressed;
+        if(!lz->compress(m_value.data(), m_value.size(), compressed))
+        {
+            m_message = "(value does not compress)";
+            return;
+        }
+        std::string output;
+        for(int i = 0; i < FLAGS_num; i++)
+        {
+            output.clear();
+            lz->uncompress(compressed.data(), compressed.size(), output);
+            m_bytes += output.size();
+            m_done++;
+        }
+    }
+
+    void reportFileSize(const std::string & path)
+    {
+        FILE * pF = std::fopen(path.c_str(), "rb");
+        if(nullptr == pF)
+        {
+            return;
+        }
+        std::fseek(pF, 0, SEEK_END);
+        long size = std::ftell(pF);
+        std::fclose(pF);
+        char msg[64];
+        std::snprintf(msg, sizeof(msg), "(%.1f MB file)", size / 1048576.0);
+        m_message += (m_message.empty() ? "" : " ") + std::string(msg);
+    }
+
+    /* Bytes written to the files and syncs so far */
+    template<typename D>
+    void readIo(D * db, int64_t io[2])
+    {
+        if(FLAGS_io_stats)
+        {
+            db->getProperty("kvsqlite.io.all.write-bytes", io[0]);
+            db->getProperty("kvsqlite.io.all.syncs", io[1]);
+        }
+    }
+
+    template<typename D>
+    void reportIo(D * db, const int64_t before[2])
+    {
+        if(!FLAGS_io_stats)
+        {
+            return;
+        }
+        int64_t after[2] = {0, 0};
+        int64_t p99 = 0;
+        readIo(db, after);
+        db->getProperty("kvsqlite.io.all.sync-p99-micros", p99);
+        char msg[128];
+        if(after[0] > before[0] && m_bytes > 0)
+        {
+            std::snprintf(msg, sizeof(msg), "(write amp %.1f, %lld syncs, p99 %lld us)", (double)(after[0] - before[0]) / m_bytes,
+                (long long)(after[1] - before[1]), (long long)p99);
+            m_message += (m_message.empty() ? "" : " ") + std::string(msg);
+        }
+    }
+
+    void report(const std::string & name, double micros)
+    {
+        std::string extra;
+        if(m_bytes > 0)
+        {
+            char rate[64];
+            std::snprintf(rate, sizeof(rate), "%6.1f MB/s", (m_bytes / 1048576.0) / (micros / 1e6));
+            extra = rate;
+        }
+        if(!m_message.empty())
+        {
+            extra += (extra.empty() ? "" : " ") + m_message;
+        }
+        std::fprintf(stdout, "%-12s : %11.3f micros/op;%s%s\n", name.c_str(),
+                m_done ? micros / m_done : 0.0, extra.empty() ? "" : " ", extra.c_str());
+        std::fflush(stdout);
+        m_message.clear();
+    }
+
+private:
+    BenchDB * m_db = nullptr;
+    BenchDB * m_shardDb = nullptr;
+    IntBenchDB * m_intDb = nullptr;
+    std::mt19937 m_rand;
+    std::string m_value;
+    std::string m_message;
+    int64_t m_bytes = 0;
+    int64_t m_done = 0;
+};
+
+}/* end of anonymous namespace */
+
+int main(int argc, char ** argv)
+{
+    for(int i = 1; i < argc; i++)
+    {
+        int n = 0;
+        long long bytes = 0;
+        double ratio = 0;
+        char junk = 0;
+        if(0 == std::strncmp(argv[i], "--benchmarks=", 13))
+        {
+            FLAGS_benchmarks = argv[i] + 13;
+        }
+        else if(1 == std::sscanf(argv[i], "--num=%d%c", &n, &junk))
+        {
+            FLAGS_num = n;
+        }
+        else if(1 == std::sscanf(argv[i], "--value_size=%d%c", &n, &junk))
+        {
+            FLAGS_value_size = n;
+        }
+        else if(1 == std::sscanf(argv[i], "--batch_size=%d%c", &n, &junk) && n > 0)
+        {
+            FLAGS_batch_size = n;
+        }
+        else if(1 == std::sscanf(argv[i], "--sync=%d%c", &n, &junk) && (0 == n || 1 == n))
+        {
+            FLAGS_sync = n;
+        }
+        else if(0 == std::strcmp(argv[i], "--transaction_mode=deferred"))
+        {
+            FLAGS_transaction_mode = KVSQLite::Options::Deferred;
+        }
+        else if(0 == std::strcmp(argv[i], "--transaction_mode=immediate"))
+        {
+            FLAGS_transaction_mode = KVSQLite::Options::Immediate;
+        }
+        else if(0 == std::strcmp(argv[i], "--transaction_mode=exclusive"))
+        {
+            FLAGS_transaction_mode = KVSQLite::Options::Exclusive;
+        }
+        else if(1 == std::sscanf(argv[i], "--encode_keys=%d%c", &n, &junk) && (0 == n || 1 == n))
+        {
+            FLAGS_encode_keys = n;
+        }
+        else if(0 == std::strncmp(argv[i], "--shards=", 9))
+        {
+            FLAGS_shards = argv[i] + 9;
+        }
+        else if(1 == std::sscanf(argv[i], "--threads=%d%c", &n, &junk) && n > 0)
+        {
+            FLAGS_threads = n;
+        }
+        else if(1 == std::sscanf(argv[i], "--compression=%d%c", &n, &junk) && (0 == n || 1 == n))
+        {
+            FLAGS_compression = n;
+        }
+        else if(1 == std::sscanf(argv[i], "--mmap_size=%lld%c", &bytes, &junk) && bytes >= 0)
+        {
+            FLAGS_mmap_size = bytes;
+        }
+        else if(1 == std::sscanf(argv[i], "--cache_size=%lld%c", &bytes, &junk) && bytes >= 0)
+        {
+            FLAGS_cache_size = bytes;
+        }
+        else if(1 == std::sscanf(argv[i], "--warm_up_bytes=%lld%c", &bytes, &junk) && bytes >= 0)
+        {
+            FLAGS_warm_up_bytes = bytes;
+        }
+        else if(1 == std::sscanf(argv[i], "--direct_reads=%d%c", &n, &junk) && (0 == n || 1 == n))
+        {
+            FLAGS_direct_reads = n;
+        }
+        else if(1 == std::sscanf(argv[i], "--io_stats=%d%c", &n, &junk) && (0 == n || 1 == n))
+        {
+            FLAGS_io_stats = n;
+        }
+        else if(1 == std::sscanf(argv[i], "--page_compression=%d%c", &n, &junk) && n >= 0 && n <= 9)
+        {
+            FLAGS_page_compression = n;
+        }
+        else if(1 == std::sscanf(argv[i], "--compression_ratio=%lf%c", &ratio, &junk) && ratio > 0 && ratio <= 1)
+        {
+            FLAGS_compression_ratio = ratio;
+        }
+        else if(0 == std::strncmp(argv[i], "--db=", 5))
+        {
+            FLAGS_db = argv[i] + 5;
+        }
+        else
+        {
+            std::fprintf(stderr, "Invalid flag '%s'\n", argv[i]);
+            return 1;
+        }
+    }
+
+    Benchmark benchmark;
+    benchmark.run();
+    return 0;
+}
@@ -0,0 +1,65 @@
+/**
+ * @file Compressor.h
+ * @brief The Compressor interface, see Options::compressor.
+ */
+
+#ifndef _KVSQLITE_COMPRESSOR_H_
+#define _KVSQLITE_COMPRESSOR_H_
+
+#include <cstddef>
+#include <string>
+#include "Export.h"
+
+namespace KVSQLite
+{
+
+/**
+ * @brief A Compressor turns values into a smaller form and back, see Options::compressor.
+ *
+ * Every compressed value is stored with the id() of its compressor, so that
+ * values written with different compressors, or without any, can be read
+ * from the same table. The methods are called concurrently by the DBs using
+ * the compressor, which must outlive them.
+ */
+class KVSQLITE_EXPORT Compressor
+{
+public:
+    virtual ~Compressor() = default;
+
+    /**
+     * @brief      Return the id stored with the values compressed by this compressor.
+     * @return     int : between 2 and 255, 0 and 1 are used by KVSQLite
+     */
+    virtual int id() const = 0;
+
+    /**
+     * @brief      Compress "size" bytes at "data".
+     * @param[in]  data : bytes of the value
+     * @param[in]  size : number of bytes
+     * @param[out] output : the compressed form is appended to it
+     * @return     bool : false if the value is stored as it is
+     */
+    virtual bool compress(const char * data, size_t size, std::string & output) const = 0;
+
+    /**
+     * @brief      Restore a value from the form compress() gave it.
+     * @param[in]  data : bytes of the compressed form
+     * @param[in]  size : number of bytes
+     * @param[out] output : the value is appended to it
+     * @return     bool : false if the compressed form is corrupted
+     */
+    virtual bool uncompress(const char * data, size_t size, std::string & output) const = 0;
+
+    /**
+     * @brief      Return the built-in compressor, id 1: a byte-oriented LZ77
+     *             codec that favours speed over ratio and needs no library.
+     * @param[in]  level : from 1, the fastest, to 9, the smallest output. Every
+     *             level writes the same format, any of them reads all the others.
+     * @return     const Compressor* : shared instance, never deleted
+     */
+    static const Compressor * lz(int level = 1);
+};
+
+}/* end of namespace KVSQLite */
+
+#endif
@@ -6,23 +6,66 @@
 #ifndef __KVSQLITE_DB_H__
 #define __KVSQLITE_DB_H__
 
+#include <chrono>
+#include <cstdint>
+#include <functional>
 #include <string>
+#include <tuple>
+#include <vector>
 #include "Export.h"
 #include "Status.h"
 #include "Options.h"
+#include "MergeOperator.h"
 #include "WriteBatch.h"
+#include "MultiWriteBatch.h"
+#include "WriteBatchWithIndex.h"
+#include "Transaction.h"
+#include "Iterator.h"
+#include "Snapshot.h"
+#include "ValueStream.h"
+#include "Compressor.h"
 
 namespace KVSQLite
 {
 
 class DBImpl;
+template<typename K, typename V> class ShardedDBImpl;
+
+/**
+ * @brief Statistics of one file of a value log, see DB::getValueLogStats().
+ */
+struct KVSQLITE_EXPORT ValueLogSegment
+{
+    /* Number of the file, the n of "<file>-<table>.vlog.<n>" */
+    int64_t id = 0;
+    /* Size of the file */
+    int64_t fileBytes = 0;
+    /* Values committed to the file, and the bytes they take in it */
+    int64_t records = 0;
+    int64_t bytes = 0;
+    /* Those of them since overwritten or deleted */
+    int64_t deadRecords = 0;
+    int64_t deadBytes = 0;
+};
+
 /**
  * @brief The DB class implements the database operation interface.
+ *
+ * K is int, int64_t, double, std::string or Slice, or a std::tuple of two of
+ * int64_t, double and std::string, which is stored as a primary key of two
+ * typed columns. V is int, int64_t, double, std::string or Slice.
  */
 template<typename K, typename V>
 class KVSQLITE_EXPORT DB
 {
 public:
+    /**
+     * @brief      A user merge function. existingValue is nullptr when the key does not exist.
+     *             It runs inside SQLite while the statement executes and must not throw or
+     *             call back into the DB. A returned Slice must stay valid until the next call.
+     */
+    typedef std::function<V(const V * existingValue, const V & operand)> MergeFunction;
+
     /**
      * @brief      Open a database
      * @param[in]  options : options to control the behavior of a database. see @ref Options for details. 
@@ -31,6 +74,46 @@ public:
      * @return     Status : on success Status::ok() is true. See @ref Status for details. 
      */
     static Status open(const Options & options, const std::string & filename, DB ** ppDB);
+
+    /**
+     * @brief      Open keyspace Options::keyspace on the connection of another DB, as a separate
+     *             table of the same file. The two share the connection, its page cache and its
+     *             lock, and can be written together atomically with a MultiWriteBatch. The
+     *             connection is closed with the last DB using it. If "shared" was opened on an
+     *             attached file, the keyspace is in that file too.
+     * @param[in]  options : options to control the behavior of a database. see @ref Options for details.
+     *             Options::create_if_missing and Options::error_if_exists do not apply.
+     * @param[in]  shared : an open DB, of any key and value types
+     * @param[out] ppDB : pointer to a database pointer
+     * @return     Status : on success Status::ok() is true. See @ref Status for details.
+     */
+    template<typename K2, typename V2>
+    static Status open(const Options & options, DB<K2, V2> * shared, DB ** ppDB)
+    {
+        return openShared(options, (nullptr != shared) ? shared->m_DBImpl : nullptr, nullptr, ppDB);
+    }
+
+    /**
+     * @brief      Open the database file "filename" on the connection of another DB, by attaching
+     *             it to that connection. The data stays where it is, in its own file, but the two
+     *             DBs share one lock, and a MultiWriteBatch over them commits as one transaction.
+     *             In rollback journal mode SQLite then commits the files together through a
+     *             super-journal, so a crash leaves either all of them or none updated. Files in
+     *             WAL mode, and a main file that is in memory or temporary, only commit
+     *             atomically one file at a time. The file is detached with the last DB using it.
+     *             A file must be attached only once per connection, and SQLite allows at most
+     *             10 attached files by default.
+     * @param[in]  options : options to control the behavior of a database. see @ref Options for details.
+     * @param[in]  shared : an open DB, of any key and value types
+     * @param[in]  filename : database path
+     * @param[out] ppDB : pointer to a database pointer
+     * @return     Status : on success Status::ok() is true. See @ref Status for details.
+     */
+    template<typename K2, typename V2>
+    static Status open(const Options & options, DB<K2, V2> * shared, const std::string & filename, DB ** ppDB)
+    {
+        return openShared(options, (nullptr != shared) ? shared->m_DBImpl : nullptr, &filename, ppDB);
+    }
     virtual ~DB();
 
     /**
@@ -42,6 +125,56 @@ public:
      */
     Status put(const WriteOptions & options, const K & key, const V & value);
 
+    /**
+     * @brief      Set "key" to "value", which expires "ttl" from now. Requires Options::enable_ttl.
+     * @param[in]  options : Options that control write operations. see @ref WriteOptions for details.
+     * @param[in]  key : key of data
+     * @param[in]  value : value of data
+     * @param[in]  ttl : time to live of the entry
+     * @return     Status : on success Status::ok() is true, Status::InvalidArgument if TTL is not
+     *             enabled. See @ref Status for details.
+     */
+    Status put(const WriteOptions & options, const K & key, const V & value, std::chrono::milliseconds ttl);
+
+    /**
+     * @brief      Set "key" to "value", which expires at "expireAt". Requires Options::enable_ttl.
+     *
+     * Once expired, the entry reads as missing. It is removed by the background
+     * purger or by purgeExpired(). A plain put() of the key clears its expiry.
+     * @param[in]  options : Options that control write operations. see @ref WriteOptions for details.
+     * @param[in]  key : key of data
+     * @param[in]  value : value of data
+     * @param[in]  expireAt : time at which the entry expires
+     * @return     Status : on success Status::ok() is true, Status::InvalidArgument if TTL is not
+     *             enabled. See @ref Status for details.
+     */
+    Status put(const WriteOptions & options, const K & key, const V & value, std::chrono::system_clock::time_point expireAt);
+
+    /**
+     * @brief      Remove every expired entry now, in transactions of Options::ttl_purge_batch_size keys.
+     * @param[out] purged : if not nullptr, receives the number of entries removed
+     * @return     Status : on success Status::ok() is true, Status::InvalidArgument if TTL is not
+     *             enabled. See @ref Status for details.
+     */
+    Status purgeExpired(int64_t * purged = nullptr);
+
+    /**
+     * @brief      Collect every value log file whose share of garbage reaches Options::value_log_gc_ratio
+     *             now, moving Options::value_log_gc_batch_size values per transaction.
+     * @param[out] reclaimed : if not nullptr, receives the number of bytes of the files removed
+     * @return     Status : on success Status::ok() is true, Status::InvalidArgument if the table
+     *             has no value log. See @ref Status for details.
+     */
+    Status collectValueLogGarbage(int64_t * reclaimed = nullptr);
+
+    /**
+     * @brief      Read the statistics of the files of the value log, see Options::value_log_threshold.
+     * @param[out] segments : receives one entry per file holding committed values, oldest first
+     * @return     Status : on success Status::ok() is true, Status::InvalidArgument if the table
+     *             has no value log. See @ref Status for details.
+     */
+    Status getValueLogStats(std::vector<ValueLogSegment> & segments);
+
     /**
      * @brief      If the database contains an entry for "key" store the corresponding value in value.
      * @param[in]  key : key of data
@@ -50,6 +183,171 @@ public:
      */
     Status get(const K & key, V & value);
 
+    /**
+     * @brief      Read "key" as if "batch" had already been written: the latest update staged in
+     *             the batch wins, otherwise the value is read from the database.
+     * @param[in]  batch : staged updates that are not written yet
+     * @param[in]  key : key of data
+     * @param[out] value : value of data
+     * @return     Status : on success Status::ok() is true, Status::NotFound if the key is
+     *             deleted by the batch or missing. See @ref Status for details.
+     */
+    Status get(const WriteBatchWithIndex<K, V> & batch, const K & key, V & value);
+
+    /**
+     * @brief      Read "key", from ReadOptions::snapshot if it is set.
+     * @param[in]  options : Options that control read operations. see @ref ReadOptions for details.
+     * @param[in]  key : key of data
+     * @param[out] value : value of data
+     * @return     Status : on success Status::ok() is true, Status::NotFound if the key is
+     *             missing. See @ref Status for details.
+     */
+    Status get(const ReadOptions & options, const K & key, V & value);
+
+    /**
+     * @brief      Read several keys at once, from ReadOptions::snapshot if it is set.
+     * @param[in]  options : Options that control read operations. see @ref ReadOptions for details.
+     * @param[in]  keys : keys to read
+     * @param[out] values : receives one value per key, left default constructed if missing.
+     *             Slice values are valid until the next multiGet() on the same DB or snapshot.
+     * @param[out] statuses : receives the status of the read of each key
+     * @return     Status : ok unless a read failed with something else than Status::NotFound,
+     *             in which case that error is returned. See @ref Status for details.
+     */
+    Status multiGet(const ReadOptions & options, const std::vector<K> & keys, std::vector<V> & values, std::vector<Status> & statuses);
+
+    /**
+     * @brief      Open a reader of the value of "key", to read it piece by piece or only in
+     *             part. Only for Slice values, Status::InvalidArgument is returned otherwise.
+     * @param[in]  key : key of data
+     * @param[out] ppReader : pointer to a reader pointer, the caller deletes it when done,
+     *             before deleting the DB.
+     * @return     Status : on success Status::ok() is true, Status::NotFound if the key is
+     *             missing. See @ref Status for details.
+     */
+    Status openValueReader(const K & key, ValueReader ** ppReader);
+
+    /**
+     * @brief      Set the value of "key" to "size" zero bytes and open a writer to fill them
+     *             in piece by piece, without holding the whole value in memory. Only for Slice
+     *             values, Status::InvalidArgument is returned otherwise.
+     * @param[in]  options : Options that control write operations, for this put and every
+     *             write of the writer. see @ref WriteOptions for details.
+     * @param[in]  key : key of data
+     * @param[in]  size : size of the value in bytes, less than 2 GB
+     * @param[out] ppWriter : pointer to a writer pointer, the caller deletes it when done,
+     *             before deleting the DB.
+     * @return     Status : on success Status::ok() is true and false on error. See @ref Status for details.
+     */
+    Status openValueWriter(const WriteOptions & options, const K & key, int64_t size, ValueWriter ** ppWriter);
+
+    /**
+     * @brief      Iterate in key order over the entries with begin <= key < end.
+     * @param[in]  options : Options that control read operations. see @ref ReadOptions for details.
+     * @param[in]  begin : first key of the range
+     * @param[in]  end : end of the range, not included
+     * @param[out] ppIter : pointer to an iterator pointer, the caller deletes it when done,
+     *             before deleting the DB.
+     * @return     Status : on success Status::ok() is true and false on error. See @ref Status for details.
+     */
+    Status scanRange(const ReadOptions & options, const K & begin, const K & end, Iterator<K, V> ** ppIter);
+
+    /**
+     * @brief      Iterate in key order over the entries whose key starts with "prefix". The prefix
+     *             is turned into a key range, so only the matching part of the key index is read.
+     *             Only for std::string and Slice keys, Status::InvalidArgument is returned otherwise.
+     * @param[in]  options : Options that control read operations. see @ref ReadOptions for details.
+     * @param[in]  prefix : prefix of the keys to visit
+     * @param[out] ppIter : pointer to an iterator pointer, the caller deletes it when done,
+     *             before deleting the DB.
+     * @return     Status : on success Status::ok() is true and false on error. See @ref Status for details.
+     */
+    Status scanPrefix(const ReadOptions & options, const K & prefix, Iterator<K, V> ** ppIter);
+
+    /**
+     * @brief      Iterate in key order over the entries of a tuple key whose first "components"
+     *             components equal those of "prefix", e.g. every timestamp of a series keyed by
+     *             std::tuple<std::string, int64_t>. This is an index range scan on the leading
+     *             key columns. Status::InvalidArgument is returned for other key types.
+     * @param[in]  options : Options that control read operations. see @ref ReadOptions for details.
+     * @param[in]  prefix : key holding the leading components, the other components are ignored
+     * @param[in]  components : number of leading components to match, at least 1 and less than the
+     *             size of the tuple
+     * @param[out] ppIter : pointer to an iterator pointer, the caller deletes it when done,
+     *             before deleting the DB.
+     * @return     Status : on success Status::ok() is true and false on error. See @ref Status for details.
+     */
+    Status scanPrefix(const ReadOptions & options, const K & prefix, int components, Iterator<K, V> ** ppIter);
+
+    /**
+     * @brief      Count the entries with begin <= key < end exactly, using the key index.
+     * @param[in]  begin : first key of the range
+     * @param[in]  end : end of the range, not included
+     * @param[out] count : number of entries
+     * @return     Status : on success Status::ok() is true and false on error. See @ref Status for details.
+     */
+    Status count(const K & begin, const K & end, int64_t & count);
+
+    /**
+     * @brief      Estimate the number of entries with begin <= key < end, reading a few B-tree
+     *             pages instead of the entries. Exact when no estimate is possible, e.g. for an
+     *             in-memory or WAL mode database.
+     * @param[in]  begin : first key of the range
+     * @param[in]  end : end of the range, not included
+     * @param[out] count : estimated number of entries
+     * @return     Status : on success Status::ok() is true and false on error. See @ref Status for details.
+     */
+    Status approximateCount(const K & begin, const K & end, int64_t & count);
+
+    /**
+     * @brief      Estimate the number of bytes used by the entries with begin <= key < end, as a
+     *             share of the key and value bytes when Options::enable_stats is set, or of the
+     *             used database pages otherwise. Falls back to summing the entries like
+     *             approximateCount().
+     * @param[in]  begin : first key of the range
+     * @param[in]  end : end of the range, not included
+     * @param[out] size : estimated number of bytes
+     * @return     Status : on success Status::ok() is true and false on error. See @ref Status for details.
+     */
+    Status approximateSize(const K & begin, const K & end, int64_t & size);
+
+    /**
+     * @brief      Read a numeric property of the database. Valid properties are:
+     *             "kvsqlite.num-keys", "kvsqlite.total-key-bytes", "kvsqlite.total-value-bytes":
+     *             totals kept up to date by every write, they need Options::enable_stats;
+     *             "kvsqlite.estimate-num-keys": the exact number of keys with Options::enable_stats,
+     *             an estimate from the B-tree otherwise;
+     *             "kvsqlite.value-log-files", "kvsqlite.value-log-bytes", "kvsqlite.value-log-live-bytes":
+     *             the files of the value log, their size and the bytes of the values still in use in
+     *             them, they need a value log, see getValueLogStats();
+     *             "kvsqlite.io.<file>.<counter>": the I/O of the files of the DB, it needs
+     *             Options::enable_io_stats. <file> is one of "db", "journal", "wal", "other"
+     *             or "all" for their sum, <counter> one of "reads", "read-bytes", "writes",
+     *             "write-bytes", "syncs", "truncates", or "read-", "write-" or "sync-" followed
+     *             by "micros" for the total time, "p50-micros" or "p99-micros" for the
+     *             percentiles, rounded up to a power of 2, and "max-micros";
+     *             "kvsqlite.mmap-size": the bytes of the file SQLite maps at most, Options::mmap_size
+     *             as capped by SQLite;
+     *             "kvsqlite.warm-up-bytes": the bytes of the file read so far by the warm-up of
+     *             Options::warm_up_bytes;
+     *             "kvsqlite.direct-lookups", "kvsqlite.direct-fallbacks": the get() calls answered
+     *             from the mapped B-tree of Options::direct_reads, and those that fell back to SQL.
+     * @param[in]  property : name of the property
+     * @param[out] value : value of the property
+     * @return     Status : on success Status::ok() is true, Status::InvalidArgument for an unknown
+     *             or unavailable property. See @ref Status for details.
+     */
+    Status getProperty(const std::string & property, int64_t & value);
+
+    /**
+     * @brief      Read the database file and its WAL sequentially, so that the operating system caches
+     *             them and later lookups, through Options::mmap_size or not, do not wait for the disk.
+     * @param[in]  maxBytes : stop after reading that many bytes, 0 to read the whole files
+     * @param[out] bytesRead : if not null, the number of bytes read
+     * @return     Status : on success Status::ok() is true and false on error. See @ref Status for details.
+     */
+    Status warmUp(int64_t maxBytes = 0, int64_t * bytesRead = nullptr);
+
     /**
      * @brief      Remove the database entry (if any) for "key". It is not an error if "key" did not exist in the database.
      * @param[in]  options : Options that control write operations. see @ref WriteOptions for details. 
@@ -59,15 +357,156 @@ public:
     Status del(const WriteOptions & options, const K & key);
 
     /**
-     * @brief      
+     * @brief      Remove every entry with begin <= key < end, in a single statement.
+     * @param[in]  options : Options that control write operations. see @ref WriteOptions for details.
+     *             With WriteOptions::delete_chunk_size the range is removed in several transactions.
+     * @param[in]  begin : first key of the range
+     * @param[in]  end : end of the range, not included
+     * @return     Status : on success Status::ok() is true and false on error. See @ref Status for details.
+     */
+    Status deleteRange(const WriteOptions & options, const K & begin, const K & end);
+
+    /**
+     * @brief      Remove every entry whose key starts with "prefix", in a single statement.
+     *             Only for std::string and Slice keys, Status::InvalidArgument is returned otherwise.
+     * @param[in]  options : Options that control write operations. see @ref WriteOptions for details.
+     *             With WriteOptions::delete_chunk_size the keys are removed in several transactions.
+     * @param[in]  prefix : prefix of the keys to remove
+     * @return     Status : on success Status::ok() is true and false on error. See @ref Status for details.
+     */
+    Status deletePrefix(const WriteOptions & options, const K & prefix);
+
+    /**
+     * @brief      Remove every entry. Unless WriteOptions::delete_chunk_size is set, the table is
+     *             emptied in one step without visiting each row.
+     * @param[in]  options : Options that control write operations. see @ref WriteOptions for details.
+     * @return     Status : on success Status::ok() is true and false on error. See @ref Status for details.
+     */
+    Status clear(const WriteOptions & options);
+
+    /**
+     * @brief      Combine the stored value of "key" with "operand" using a built-in operator, in a
+     *             single statement. If "key" does not exist, "operand" is stored.
+     * @param[in]  options : Options that control write operations. see @ref WriteOptions for details.
+     * @param[in]  key : key of data
+     * @param[in]  operand : value combined with the stored one
+     * @param[in]  op : see @ref MergeOperator. MERGE_ADD needs a numeric value type and
+     *             MERGE_APPEND a std::string or Slice one, otherwise Status::InvalidArgument is returned.
+     * @return     Status : on success Status::ok() is true and false on error. See @ref Status for details.
+     */
+    Status merge(const WriteOptions & options, const K & key, const V & operand, MergeOperator op);
+
+    /**
+     * @brief      Register a merge function under "name", for use by merge(options, key, operand, name).
+     *             Registering the same name again replaces the function.
+     * @param[in]  name : made of [A-Za-z0-9_]
+     * @param[in]  func : see @ref MergeFunction
+     * @return     Status : on success Status::ok() is true and false on error. See @ref Status for details.
+     */
+    Status registerMergeOperator(const std::string & name, const MergeFunction & func);
+
+    /**
+     * @brief      Combine the stored value of "key" with "operand" using a registered merge function,
+     *             in a single statement.
+     * @param[in]  options : Options that control write operations. see @ref WriteOptions for details.
+     * @param[in]  key : key of data
+     * @param[in]  operand : value combined with the stored one
+     * @param[in]  name : name given to registerMergeOperator()
+     * @return     Status : on success Status::ok() is true and false on error. See @ref Status for details.
+     */
+    Status merge(const WriteOptions & options, const K & key, const V & operand, const std::string & name);
+
+    /**
+     * @brief      Store "value" under "key" only if "key" does not exist yet, in a single statement.
+     * @param[in]  options : Options that control write operations. see @ref WriteOptions for details.
+     * @param[in]  key : key of data
+     * @param[in]  value : value of data
+     * @return     Status : on success Status::ok() is true, Status::ConditionNotMet if "key" already
+     *             exists. See @ref Status for details.
+     */
+    Status putIfAbsent(const WriteOptions & options, const K & key, const V & value);
+
+    /**
+     * @brief      Replace the value of "key" with "desired" only if it currently equals "expected",
+     *             in a single statement.
+     * @param[in]  options : Options that control write operations. see @ref WriteOptions for details.
+     * @param[in]  key : key of data
+     * @param[in]  expected : value "key" must currently have
+     * @param[in]  desired : new value of "key"
+     * @return     Status : on success Status::ok() is true, Status::ConditionNotMet if "key" is missing
+     *             or its value differs from "expected". See @ref Status for details.
+     */
+    Status compareAndSwap(const WriteOptions & options, const K & key, const V & expected, const V & desired);
+
+    /**
+     * @brief      Set "key" to "value" and return the value it had before, in a single statement.
+     * @param[in]  options : Options that control write operations. see @ref WriteOptions for details.
+     * @param[in]  key : key of data
+     * @param[in]  value : new value of "key"
+     * @param[out] oldValue : previous value, left untouched if "key" did not exist. A Slice is
+     *             valid until the next getAndSet() call.
+     * @param[out] existed : if not nullptr, set to whether "key" existed before
+     * @return     Status : on success Status::ok() is true and false on error. See @ref Status for details.
+     */
+    Status getAndSet(const WriteOptions & options, const K & key, const V & value, V & oldValue, bool * existed = nullptr);
+
+    /**
+     * @brief      Apply all updates in "updates" atomically, in order.
      * @param[in]  options : Options that control write operations. see @ref WriteOptions for details. 
-     * @param[in]  updates : 
+     * @param[in]  updates : the batch of updates to apply
      * @return     Status : on success Status::ok() is true and false on error. See @ref Status for details. 
      */
     Status write(const WriteOptions & options, WriteBatch<K, V>* updates);
+
+    /**
+     * @brief      Apply the batches of several keyspaces atomically, in order. Every DB in
+     *             "updates" must share this DB's connection, see open().
+     * @param[in]  options : Options that control write operations. see @ref WriteOptions for details.
+     * @param[in]  updates : the batches to apply
+     * @return     Status : on success Status::ok() is true and false on error. See @ref Status for details.
+     */
+    Status write(const WriteOptions & options, MultiWriteBatch * updates);
+
+    /**
+     * @brief      Start a transaction for atomic read-modify-write of several keys.
+     *             See @ref Transaction for how conflicts are detected.
+     * @param[out] ppTxn : pointer to a transaction pointer, the caller deletes it when done,
+     *             before deleting the DB.
+     * @return     Status : on success Status::ok() is true and false on error. See @ref Status for details.
+     */
+    Status beginTransaction(Transaction<K, V> ** ppTxn);
+
+    /**
+     * @brief      Take a snapshot of the current state of the database. Reads given the
+     *             snapshot in ReadOptions::snapshot see the data as it is now, while writes
+     *             go on without waiting for them and nothing is copied. The snapshot holds a
+     *             read transaction on a connection of its own, which also keeps the WAL from
+     *             being checkpointed past it: release it as soon as it is no longer needed.
+     * @param[out] ppSnapshot : pointer to a snapshot pointer, to be given to releaseSnapshot()
+     *             after the iterators reading from it are deleted and before deleting the DB.
+     * @return     Status : on success Status::ok() is true, Status::InvalidArgument if the
+     *             database is not a file in WAL mode, see Options::wal_mode, or an immutable
+     *             one, see Options::immutable. See @ref Status for details.
+     */
+    Status getSnapshot(const Snapshot ** ppSnapshot);
+
+    /**
+     * @brief      Release a snapshot taken by getSnapshot().
+     * @param[in]  snapshot : the snapshot, no longer valid afterwards
+     */
+    void releaseSnapshot(const Snapshot * snapshot);
 private:
+    template<typename K2, typename V2> friend class DB;
+    friend class ShardedDBImpl<K, V>;
+    friend class MultiWriteBatch;
     DB();
     void close();
+    /* Open on the connection of shared, in the file of shared or, if not null, in filename attached to it */
+    static Status openShared(const Options & options, DBImpl * shared, const std::string * filename, DB ** ppDB);
+    Status init(const Options & options);
+    /* Must be called with the connection locked, inside a transaction */
+    Status applyBatch(WriteBatch<K, V> * updates);
+    Status newIterator(const ReadOptions & options, const K * lower, const K * upper, int prefixComponents, Iterator<K, V> ** ppIter);
 private:
     DB(const DB&) = delete;
     DB& operator=(const DB&) = delete;
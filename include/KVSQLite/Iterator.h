@@ -0,0 +1,91 @@
+/**
+ * @file Iterator.h
+ * @brief The Iterator class implements.
+ */
+
+#ifndef _KVSQLITE_ITERATOR_H_
+#define _KVSQLITE_ITERATOR_H_
+
+#include <string>
+#include "Export.h"
+#include "Status.h"
+#include "Options.h"
+
+namespace KVSQLite
+{
+
+class DBImpl;
+template<typename K, typename V> class DB;
+template<typename K, typename V> class IteratorImpl;
+
+/**
+ * @brief An Iterator walks the entries of a key range of a DB in key order.
+ *
+ * Entries are fetched from the database a page at a time (see
+ * ReadOptions::prefetch) by seeking on the key index right after the last key
+ * seen, so no lock or statement is held between two pages. Writes made in the
+ * meantime may or may not be seen by later pages.
+ *
+ * A scan can be stopped at any point and resumed later, even by another
+ * process, from continuationToken(). An Iterator is not thread safe and must
+ * be deleted before the DB that created it.
+ */
+template<typename K, typename V>
+class KVSQLITE_EXPORT Iterator
+{
+public:
+    /**
+     * @brief      Destroy the iterator.
+     */
+    virtual ~Iterator();
+
+    /**
+     * @brief      Return true if the iterator is positioned on an entry.
+     * @return     bool : false once the range or ReadOptions::limit is exhausted, or on error.
+     */
+    bool valid() const;
+
+    /**
+     * @brief      Move to the next entry. REQUIRES: valid()
+     */
+    void next();
+
+    /**
+     * @brief      Return the key of the current entry. REQUIRES: valid()
+     * @return     K : a Slice key stays valid until the next call to next().
+     */
+    K key() const;
+
+    /**
+     * @brief      Return the value of the current entry. REQUIRES: valid()
+     * @return     V : a Slice value stays valid until the next call to next().
+     */
+    V value() const;
+
+    /**
+     * @brief      Return the error met while fetching entries, if any.
+     * @return     Status : Status::ok() is true if no error happened. See @ref Status for details.
+     */
+    Status status() const;
+
+    /**
+     * @brief      Return a token that resumes the scan right after the current entry, or
+     *             after the last one if the iterator stopped on ReadOptions::limit.
+     * @return     std::string : opaque token for ReadOptions::continuation, empty once the
+     *             whole range has been read.
+     */
+    std::string continuationToken() const;
+private:
+    friend class DB<K, V>;
+    Iterator(DBImpl * pDBImpl, const ReadOptions & options, const K * lower, const K * upper, int prefixComponents);
+    Status start();
+private:
+    Iterator(const Iterator&) = delete;
+    Iterator& operator=(const Iterator&) = delete;
+private:
+    IteratorImpl<K, V> * m_impl = nullptr;
+};
+
+}/* end of namespace KVSQLite */
+
+#endif
@@ -0,0 +1,26 @@
+/**
+ * @file MergeOperator.h
+ * @brief Built-in operators for DB::merge() and WriteBatch::merge().
+ */
+
+#ifndef _KVSQLITE_MERGE_OPERATOR_H_
+#define _KVSQLITE_MERGE_OPERATOR_H_
+
+namespace KVSQLite
+{
+
+/**
+ * @brief Built-in merge operators. A merge combines the stored value of a key
+ * with an operand inside SQLite, in a single UPSERT statement. If the key
+ * does not exist yet, the operand is stored as it is.
+ */
+enum MergeOperator
+{
+    MERGE_ADD,      /* value + operand, for int, int64_t and double values */
+    MERGE_MIN,      /* the smaller of value and operand */
+    MERGE_MAX,      /* the larger of value and operand */
+    MERGE_APPEND    /* value followed by operand, for std::string and Slice values */
+};
+
+}/* end of namespace KVSQLite */
+#endif
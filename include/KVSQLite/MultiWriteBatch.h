@@ -0,0 +1,50 @@
+#ifndef _KVSQLITE_MULTI_WRITE_BATCH_H_
+#define _KVSQLITE_MULTI_WRITE_BATCH_H_
+
+#include <functional>
+#include <list>
+#include "Status.h"
+#include "WriteBatch.h"
+
+namespace KVSQLite
+{
+
+class DBImpl;
+template<typename K, typename V> class DB;
+
+/**
+ * @brief A MultiWriteBatch groups the WriteBatch objects of several keyspaces
+ *        or attached files sharing one connection, so that DB::write() applies
+ *        them in a single transaction. The batches are referenced, not copied: they must stay
+ *        alive and unchanged until the write returns.
+ */
+class MultiWriteBatch
+{
+public:
+    struct Node
+    {
+        DBImpl * dbImpl;
+        /* Apply the batch, inside the transaction of the write */
+        std::function<Status()> apply;
+    };
+public:
+    virtual ~MultiWriteBatch() = default;
+    template<typename K, typename V>
+    void add(DB<K, V> * db, WriteBatch<K, V> * batch)
+    {
+        m_list.push_back({db->m_DBImpl, [db, batch]() { return db->applyBatch(batch); }});
+    }
+    virtual void clear()
+    {
+        m_list.clear();
+    }
+    const std::list<Node> & getList() const
+    {
+        return m_list;
+    }
+private:
+    std::list<Node> m_list;
+};
+
+}/* end of namespace KVSQLite */
+#endif
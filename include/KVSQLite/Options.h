@@ -1,10 +1,15 @@
 #ifndef _KVSQLITE_OPTIONS_H_
 #define _KVSQLITE_OPTIONS_H_
+#include <cstdint>
+#include <string>
 #include "Export.h"
 
 namespace KVSQLite
 {
 
+class Snapshot;
+class Compressor;
+
 /**
  * Options to control the behavior of a database (passed to DB::Open)
  */
@@ -18,6 +23,205 @@ struct KVSQLITE_EXPORT Options
 
     /* If true, an error is raised if the database already exists. */
     bool error_if_exists = false;
+
+    /* If true, the database file is opened read-only: it must exist with
+     * the table of the keyspace, nothing is created or altered in it and no
+     * writer statement is prepared. Writes return Status::InvalidArgument.
+     * Options that would change the file, such as wal_mode, encode_keys on
+     * a new file or value_log_threshold, are ignored, while what the file
+     * already has, key encoding, TTLs, statistics and the value log, is
+     * still read. */
+    bool read_only = false;
+
+    /* If true, the database file is promised not to change while it is
+     * open, by this process or any other, and read_only is implied. SQLite
+     * then takes no file lock and never checks whether another connection
+     * changed the file, see the "immutable" URI parameter of SQLite; reads
+     * of a file changed anyway may fail or return wrong results. A file in
+     * WAL mode must have been checkpointed, its WAL is not read. */
+    bool immutable = false;
+
+    /* If true, which needs immutable, get() finds keys by walking the
+     * B-tree pages of a read-only memory mapping of the file instead of
+     * running SQL, and a Slice value points into the mapping. Values that
+     * spill to overflow pages, or whose type is not the one of V, are still
+     * read through SQLite, as are tables with tuple keys, TTLs, compressed
+     * values or a value log, files of page_compressor and keyspaces of an
+     * attached file. The mapped pages are not counted by enable_io_stats.
+     * See the "kvsqlite.direct-lookups" property of DB::getProperty(). */
+    bool direct_reads = false;
+
+    /* How the transaction that applies a WriteBatch acquires its locks. */
+    enum TransactionMode
+    {
+        /* BEGIN DEFERRED: the write lock is only taken by the first write.
+         * If another process upgrades its lock at the same time, the batch
+         * can fail with SQLITE_BUSY halfway through. */
+        Deferred,
+        /* BEGIN IMMEDIATE: the write lock is taken when the batch starts. */
+        Immediate,
+        /* BEGIN EXCLUSIVE: like Immediate, and also keeps readers in other
+         * processes out until the batch is committed. */
+        Exclusive
+    };
+    TransactionMode transaction_mode = Immediate;
+
+    /* If true, keys may be given a time to live by put(). The expiry time is
+     * kept in an indexed column added to the table; expired keys read as
+     * missing and are removed in the background. Existing databases are
+     * upgraded in place when opened with this option. */
+    bool enable_ttl = false;
+
+    /* Milliseconds between two runs of the background purger of expired
+     * keys. 0 disables the purger, see DB::purgeExpired(). */
+    int ttl_purge_interval_ms = 1000;
+
+    /* Maximum number of expired keys removed by one run of the purger.
+     * Each run is a single short transaction, so this bounds both the time
+     * the write lock is held and the rate at which keys are purged. */
+    int ttl_purge_batch_size = 1000;
+
+    /* If true, the number of keys and the bytes of all keys and values are
+     * kept in a table updated by triggers on every write, see
+     * DB::getProperty(). This costs an extra row update per write, and
+     * clear() then has to visit every row. Once enabled, the triggers stay
+     * in the database file. */
+    bool enable_stats = false;
+
+    /* Bytes of the database file SQLite reads through a memory mapping
+     * instead of read() calls into its page cache, see PRAGMA mmap_size.
+     * Pages then come straight from the operating system cache without
+     * being copied, and a smaller cache_size avoids caching them twice.
+     * Capped at 2 GB by default builds of SQLite; 0 disables the mapping,
+     * as do page_compressor and WAL pages not checkpointed yet. Files
+     * attached to the DB are mapped as well. See DB::warmUp(). */
+    int64_t mmap_size = 0;
+
+    /* If not 0, the database file grows and shrinks by chunks of this many
+     * bytes instead of page by page, so that the mapping of mmap_size is
+     * extended less often as the file grows, see SQLITE_FCNTL_CHUNK_SIZE. */
+    int mmap_chunk_size = 0;
+
+    /* Bytes of SQLite's page cache of the connection, 0 keeps the default
+     * of SQLite, 2 MB. */
+    int64_t cache_size = 0;
+
+    /* If true, the reads, writes, syncs and truncates SQLite makes on the
+     * files of the DB are counted, with their bytes and a histogram of their
+     * latencies, for the database file, its journal, its WAL and other
+     * temporary files apart, see the "kvsqlite.io." properties of
+     * DB::getProperty(). Files attached to the DB and snapshots count with
+     * it. With page_compressor, the bytes are those of the pages before
+     * compression; pages read through a memory mapping are not counted, and
+     * neither is the value log. */
+    bool enable_io_stats = false;
+
+    /* If not 0, the pages of the database file read while the DB is open
+     * are traced, and the ones read most are saved on close to a file named
+     * after it with "-pagetrace" appended, at most this many bytes of them.
+     * The next open reads them back, first into the operating system cache
+     * in file order and then, as many as cache_size holds, into SQLite's
+     * page cache, before open returns or with warm_up_in_background. Without
+     * a trace, the pages of the key index are loaded instead. Not for
+     * ":memory:" or temporary databases. See DB::warmUp() and the
+     * "kvsqlite.warm-up-bytes" property of DB::getProperty(). */
+    int64_t warm_up_bytes = 0;
+
+    /* If not 0, the warm-up of warm_up_bytes stops after this many
+     * milliseconds even if it has not read all of its pages. */
+    int warm_up_ms = 0;
+
+    /* If true, the warm-up of warm_up_bytes runs on a thread of the DB while
+     * it is in use instead of delaying open. Reads and writes then wait for
+     * it a few pages at a time, and close() stops it. */
+    bool warm_up_in_background = false;
+
+    /* If true, keys are stored as BLOBs in an order-preserving binary form
+     * instead of SQLite's native INTEGER, REAL and TEXT values: integers as
+     * 8 big-endian bytes with the sign bit flipped, doubles as their IEEE
+     * bits arranged to sort numerically (all NaNs as one value sorting after
+     * +infinity, -0.0 as 0.0), strings as their bytes. Keys then sort with a
+     * plain memcmp() of their stored bytes. Only valid for a new, empty
+     * database; the choice is recorded in the file and applies to every later
+     * open, whatever this option says. */
+    bool encode_keys = false;
+
+    /* Name of the keyspace, made of [A-Za-z0-9_]. Each keyspace is a table
+     * of its own in the database file, with its own key and value types;
+     * the default, empty name is the table of earlier versions. Keyspaces
+     * of one file can share a connection, see DB::open(). Names ending in
+     * "Meta", "Stats", "_expire", "_stats_insert", "_stats_update",
+     * "_stats_delete", "_vlog", "_vlog_insert", "_vlog_update",
+     * "_vlog_delete" or "_vlog_position", in any case, are taken by the
+     * tables kept next to a keyspace and rejected. */
+    std::string keyspace;
+
+    /* If true, the database file is switched to write-ahead logging
+     * (PRAGMA journal_mode=WAL): readers then see the last commit made
+     * before they started and neither block nor are blocked by a writer.
+     * Required by DB::getSnapshot(). The mode is recorded in the file and
+     * stays on for later opens; it has no effect on in-memory databases. */
+    bool wal_mode = false;
+
+    /* If greater than 0, put() writes values of at least this many bytes
+     * (std::string and Slice values only) to append-only value log files
+     * next to the database, "<file>-<table>.vlog.<n>", and the table only
+     * keeps their position: the B-tree stays small and dense however large
+     * the values are. Once a table has a value log, later opens keep reading
+     * it whatever this option says, and 0 only stops moving new values
+     * there. merge(), compareAndSwap(), getAndSet() and the value streams of
+     * openValueReader()/openValueWriter() are not available on such a table,
+     * and the statistics of enable_stats count a moved value as 8 bytes.
+     * Needs a database file. A single DB object may write the table: while
+     * it is open, opening another one on the table, in this process or in
+     * another, fails with Status::Busy. */
+    int64_t value_log_threshold = 0;
+
+    /* Bytes after which a value log file is closed and the next started. */
+    int64_t value_log_segment_size = 64 * 1024 * 1024;
+
+    /* A closed value log file is collected once this share of its bytes
+     * belongs to values that were overwritten or deleted: its live values
+     * are copied to the end of the log and the file removed. */
+    double value_log_gc_ratio = 0.5;
+
+    /* Milliseconds between two runs of the background value log collector.
+     * 0 disables it, see DB::collectValueLogGarbage(). */
+    int value_log_gc_interval_ms = 1000;
+
+    /* Maximum number of values moved by one run of the collector, in a
+     * single transaction. */
+    int value_log_gc_batch_size = 100;
+
+    /* If not null, std::string and Slice values of at least
+     * compression_threshold bytes are compressed with it before they are
+     * stored, or moved to the value log, whenever that makes them smaller.
+     * Compressor::lz() is a fast built-in compressor. Each compressed value
+     * records the id of its compressor, so that compressed and plain values
+     * coexist: tables can turn compression on at any time, and stay readable
+     * without this option as long as they only hold values of the built-in
+     * compressor. Once a table has compressed values, merge(),
+     * compareAndSwap(), getAndSet() and the value streams are not available
+     * on it, and the statistics of enable_stats count compressed bytes. The
+     * compressor must outlive the DB. */
+    const Compressor * compressor = nullptr;
+
+    /* Size in bytes below which values are stored uncompressed. */
+    int64_t compression_threshold = 64;
+
+    /* If not null, a database file created by this open stores every page
+     * compressed with it, through a VFS of KVSQLite between SQLite and the
+     * file: indexes and small rows shrink too, not only large values.
+     * Compressor::lz(level) trades speed for size from level 1 to 9. Pages
+     * take variable-size extents found through a page map kept in the file,
+     * and SQLite does not memory-map it. Existing plain files are opened as
+     * they are; journals, WAL files and temporary files stay plain, while
+     * files attached to the DB are compressed too when they are created.
+     * Compressed files need this option to be opened again, with a compressor
+     * of the same id or any level of the built-in one, by a single process at
+     * a time: the sqlite3 shell and other processes cannot read them. The
+     * compressor must outlive the process. */
+    const Compressor * page_compressor = nullptr;
 };
 
 /* Options that control write operations */
@@ -30,6 +234,48 @@ struct KVSQLITE_EXPORT WriteOptions
      * If this flag is true, writes will be slower.
      */
     bool sync = false;
+
+    /* Used by deleteRange(), deletePrefix() and clear(). If greater than 0,
+     * keys are deleted in separate transactions of at most this many keys,
+     * and the database lock is released in between, so that a huge delete
+     * does not stall other writers. The delete is then no longer atomic: an
+     * error or a crash can leave part of the keys in place.
+     */
+    int delete_chunk_size = 0;
+};
+
+/* Options that control read operations */
+struct KVSQLITE_EXPORT ReadOptions
+{
+    ReadOptions() = default;
+
+    /* Maximum number of entries returned by an iterator, 0 for no limit. */
+    int limit = 0;
+
+    /* Number of entries an iterator reads from the database at once. */
+    int prefetch = 100;
+
+    /* If not empty, an iterator starts right after the entry this token was
+     * taken from, see Iterator::continuationToken(). The token must come
+     * from a scan of the same database. */
+    std::string continuation;
+
+    /* If not null, reads see the database as it was when this snapshot was
+     * taken by DB::getSnapshot(), instead of its current state. */
+    const Snapshot * snapshot = nullptr;
+};
+
+/* Options that control the copy of ShardedDB::reshard() */
+struct KVSQLITE_EXPORT ReshardOptions
+{
+    ReshardOptions() = default;
+
+    /* Bytes of keys and values copied per second, 0 for no limit. Keys
+     * written while the copy runs are copied again, and count too. */
+    int64_t bytes_per_second = 0;
+
+    /* Number of entries read and written by one step of the copy. */
+    int batch_size = 1000;
 };
 
 };
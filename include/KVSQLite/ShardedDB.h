@@ -0,0 +1,262 @@
+/**
+ * @file ShardedDB.h
+ * @brief The ShardedDB class implements.
+ */
+
+#ifndef _KVSQLITE_SHARDED_DB_H_
+#define _KVSQLITE_SHARDED_DB_H_
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "Export.h"
+#include "Status.h"
+#include "Options.h"
+#include "DB.h"
+
+namespace KVSQLite
+{
+
+template<typename K, typename V> class ShardedDB;
+template<typename K, typename V> class ShardedDBImpl;
+
+/**
+ * @brief A ShardedIterator walks a key range of every shard of a ShardedDB and
+ *        merges them in key order.
+ *
+ * The iterators of the shards are started in parallel, each reading its first
+ * ReadOptions::prefetch entries; later pages are read as the merge reaches
+ * them. A ShardedIterator is not thread safe and must be deleted before the
+ * ShardedDB that created it.
+ */
+template<typename K, typename V>
+class KVSQLITE_EXPORT ShardedIterator
+{
+public:
+    /**
+     * @brief      Destroy the iterator.
+     */
+    virtual ~ShardedIterator();
+
+    /**
+     * @brief      Return true if the iterator is positioned on an entry.
+     * @return     bool : false once the range or ReadOptions::limit is exhausted, or on error.
+     */
+    bool valid() const;
+
+    /**
+     * @brief      Move to the next entry. REQUIRES: valid()
+     */
+    void next();
+
+    /**
+     * @brief      Return the key of the current entry. REQUIRES: valid()
+     * @return     K : a Slice key stays valid until the next call to next().
+     */
+    K key() const;
+
+    /**
+     * @brief      Return the value of the current entry. REQUIRES: valid()
+     * @return     V : value of the entry
+     */
+    V value() const;
+
+    /**
+     * @brief      Return the error met while fetching entries from any shard, if any.
+     * @return     Status : Status::ok() is true if no error happened. See @ref Status for details.
+     */
+    Status status() const;
+private:
+    friend class ShardedDB<K, V>;
+    ShardedIterator(const std::vector<Iterator<K, V> *> & iters, int limit);
+    void push(int shard);
+private:
+    ShardedIterator(const ShardedIterator&) = delete;
+    ShardedIterator& operator=(const ShardedIterator&) = delete;
+private:
+    std::vector<Iterator<K, V> *> m_iters;
+    /* Current key of each shard, so that the heap does not copy keys out of the iterators */
+    std::vector<K> m_keys;
+    /* Min-heap of the shards positioned on an entry */
+    std::vector<int> m_heap;
+    int m_limit = 0;
+    int m_returned = 0;
+    Status m_status;
+};
+
+/**
+ * @brief The ShardedDB class spreads the keys of one logical database over
+ *        several database files by hash, so that writers to different shards
+ *        do not wait for each other.
+ *
+ * SQLite allows one writer per file, and each DB serializes its calls on its
+ * connection, so a single DB uses one core for writes. A ShardedDB opens N
+ * files, each with its own connection and lock. The shard of a key is a hash
+ * of its bytes and depends only on the key and N, which is recorded in every
+ * shard at creation and can not change afterwards.
+ *
+ * Single key calls go to one shard. write(), multiGet(), count() and the
+ * scans fan out to the shards concerned on parallel threads; a write is
+ * atomic on each shard but not across shards. K is int, int64_t, double,
+ * std::string or Slice, V is int, int64_t, double or std::string.
+ *
+ * reshard() moves the data to a new set of files with another number of
+ * shards while the ShardedDB keeps serving reads and writes.
+ */
+template<typename K, typename V>
+class KVSQLITE_EXPORT ShardedDB
+{
+public:
+    /**
+     * @brief      Open a sharded database, made of the files "name.0" to "name.N-1".
+     * @param[in]  options : options applied to every shard. see @ref Options for details.
+     * @param[in]  name : path prefix of the shard files
+     * @param[in]  shards : number of shards N of a new database, or 0 to use the number
+     *             recorded in an existing one. Must match the recorded number otherwise.
+     * @param[out] ppDB : pointer to a database pointer
+     * @return     Status : on success Status::ok() is true, Status::InvalidArgument if
+     *             "shards" does not match the files. See @ref Status for details.
+     */
+    static Status open(const Options & options, const std::string & name, int shards, ShardedDB ** ppDB);
+    virtual ~ShardedDB();
+
+    /**
+     * @brief      Return the number of shards.
+     * @return     int : number of shards
+     */
+    int shardCount() const;
+
+    /**
+     * @brief      Return the shard holding "key".
+     * @param[in]  key : key of data
+     * @return     int : index of the shard, from 0 to shardCount() - 1
+     */
+    int shardOf(const K & key) const;
+
+    /**
+     * @brief      Return the DB of one shard, for the calls ShardedDB does not forward.
+     *             Keys written through it must belong to that shard, see shardOf(), and
+     *             are not tracked by reshard().
+     * @param[in]  index : index of the shard
+     * @return     DB : owned by the ShardedDB, nullptr if index is out of range
+     */
+    DB<K, V> * shard(int index) const;
+
+    /**
+     * @brief      Set the database entry for "key" to "value", in its shard.
+     * @param[in]  options : Options that control write operations. see @ref WriteOptions for details.
+     * @param[in]  key : key of data
+     * @param[in]  value : value of data
+     * @return     Status : on success Status::ok() is true and false on error. See @ref Status for details.
+     */
+    Status put(const WriteOptions & options, const K & key, const V & value);
+
+    /**
+     * @brief      Read the value of "key" from its shard.
+     * @param[in]  key : key of data
+     * @param[out] value : value of data
+     * @return     Status : on success Status::ok() is true, Status::NotFound if the key is
+     *             missing. See @ref Status for details.
+     */
+    Status get(const K & key, V & value);
+
+    /**
+     * @brief      Remove the database entry (if any) for "key" from its shard.
+     * @param[in]  options : Options that control write operations. see @ref WriteOptions for details.
+     * @param[in]  key : key of data
+     * @return     Status : on success Status::ok() is true and false on error. See @ref Status for details.
+     */
+    Status del(const WriteOptions & options, const K & key);
+
+    /**
+     * @brief      Split "updates" by shard and apply the parts in parallel, each atomically
+     *             and in order. On error, the parts of other shards may have been applied.
+     * @param[in]  options : Options that control write operations. see @ref WriteOptions for details.
+     * @param[in]  updates : the updates to apply
+     * @return     Status : on success Status::ok() is true, otherwise the error of the first
+     *             failed shard. See @ref Status for details.
+     */
+    Status write(const WriteOptions & options, WriteBatch<K, V> * updates);
+
+    /**
+     * @brief      Read several keys, the shards being read in parallel.
+     * @param[in]  keys : keys to read
+     * @param[out] values : receives one value per key, left default constructed if missing
+     * @param[out] statuses : receives the status of the read of each key
+     * @return     Status : ok unless a read failed with something else than Status::NotFound,
+     *             in which case that error is returned. See @ref Status for details.
+     */
+    Status multiGet(const std::vector<K> & keys, std::vector<V> & values, std::vector<Status> & statuses);
+
+    /**
+     * @brief      Count the entries with begin <= key < end exactly, on every shard in parallel.
+     * @param[in]  begin : first key of the range
+     * @param[in]  end : end of the range, not included
+     * @param[out] count : number of entries
+     * @return     Status : on success Status::ok() is true and false on error. See @ref Status for details.
+     */
+    Status count(const K & begin, const K & end, int64_t & count);
+
+    /**
+     * @brief      Iterate in key order over the entries with begin <= key < end of all shards.
+     * @param[in]  options : Options that control read operations. see @ref ReadOptions for details.
+     *             ReadOptions::continuation is not supported.
+     * @param[in]  begin : first key of the range
+     * @param[in]  end : end of the range, not included
+     * @param[out] ppIter : pointer to an iterator pointer, the caller deletes it when done,
+     *             before deleting the ShardedDB.
+     * @return     Status : on success Status::ok() is true and false on error. See @ref Status for details.
+     */
+    Status scanRange(const ReadOptions & options, const K & begin, const K & end, ShardedIterator<K, V> ** ppIter);
+
+    /**
+     * @brief      Iterate in key order over the entries of all shards whose key starts with "prefix".
+     *             Only for std::string and Slice keys, Status::InvalidArgument is returned otherwise.
+     * @param[in]  options : Options that control read operations. see @ref ReadOptions for details.
+     *             ReadOptions::continuation is not supported.
+     * @param[in]  prefix : prefix of the keys
+     * @param[out] ppIter : pointer to an iterator pointer, the caller deletes it when done,
+     *             before deleting the ShardedDB.
+     * @return     Status : on success Status::ok() is true and false on error. See @ref Status for details.
+     */
+    Status scanPrefix(const ReadOptions & options, const K & prefix, ShardedIterator<K, V> ** ppIter);
+
+    /**
+     * @brief      Start moving the data to "shards" new files "name.0" to "name.M-1", in the
+     *             background. Until the copy is done the current files stay the reference:
+     *             reads and writes go to them, and the keys written meanwhile are copied again.
+     *             Then reads and writes are held back for the short time it takes to copy the
+     *             last of those keys, and the ShardedDB switches to the new files at once. The old
+     *             files are left in place, and stay open for the iterators created before the
+     *             switch until the ShardedDB is deleted. If the copy does not complete, for a
+     *             crash or an error, the old files are still complete and the new ones are
+     *             cleared by the next reshard() to them.
+     * @param[in]  options : throttling of the copy. see @ref ReshardOptions for details.
+     * @param[in]  name : path prefix of the new shard files, different from the current one
+     * @param[in]  shards : number of new shards
+     * @return     Status : on success Status::ok() is true and the copy has started,
+     *             Status::InvalidArgument if a reshard is already running. See @ref Status for details.
+     */
+    Status reshard(const ReshardOptions & options, const std::string & name, int shards);
+
+    /**
+     * @brief      Wait for the copy started by reshard() to end.
+     * @return     Status : Status::ok() is true once the ShardedDB uses the new files, or if
+     *             no reshard was started, otherwise the error that stopped the copy.
+     */
+    Status waitForReshard();
+private:
+    ShardedDB();
+    Status newIterator(const ReadOptions & options, const std::function<Status(DB<K, V> *, Iterator<K, V> **)> & scan, ShardedIterator<K, V> ** ppIter);
+private:
+    ShardedDB(const ShardedDB&) = delete;
+    ShardedDB& operator=(const ShardedDB&) = delete;
+private:
+    friend class ShardedDBImpl<K, V>;
+    ShardedDBImpl<K, V> * m_impl = nullptr;
+};
+
+}/* end of namespace KVSQLite */
+
+#endif
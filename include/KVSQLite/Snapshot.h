@@ -0,0 +1,27 @@
+/**
+ * @file Snapshot.h
+ * @brief The Snapshot class implements.
+ */
+
+#ifndef _KVSQLITE_SNAPSHOT_H_
+#define _KVSQLITE_SNAPSHOT_H_
+
+#include "Export.h"
+
+namespace KVSQLite
+{
+
+/**
+ * @brief A Snapshot is a consistent, read-only view of a DB, taken by
+ *        DB::getSnapshot() and passed to reads through ReadOptions::snapshot.
+ *        It is released by DB::releaseSnapshot(), not deleted.
+ */
+class KVSQLITE_EXPORT Snapshot
+{
+protected:
+    virtual ~Snapshot() = default;
+};
+
+}/* end of namespace KVSQLite */
+
+#endif
@@ -16,7 +16,9 @@ public:
         NotFound,
         InvalidArgument,
         IOError,
-        UnknownError
+        UnknownError,
+        Busy,
+        ConditionNotMet
     };
     Status();
     Status(const std::string &driverText,
@@ -0,0 +1,91 @@
+/**
+ * @file Transaction.h
+ * @brief The Transaction class implements.
+ */
+
+#ifndef _KVSQLITE_TRANSACTION_H_
+#define _KVSQLITE_TRANSACTION_H_
+
+#include "Export.h"
+#include "Status.h"
+#include "Options.h"
+
+namespace KVSQLite
+{
+
+class DBImpl;
+template<typename K, typename V> class DB;
+template<typename K, typename V> class TransactionImpl;
+
+/**
+ * @brief A Transaction groups reads and writes on a DB into one atomic unit.
+ *
+ * Transactions are optimistic: writes are buffered in the transaction and
+ * no lock is held until commit(). Reads see the transaction's own writes
+ * first and fall through to the database otherwise. At commit time every
+ * key read from the database is checked again; if any of them was changed
+ * by someone else in the meantime, commit() fails with Status::Busy and
+ * nothing is written, and the caller may retry from the start.
+ *
+ * Many transactions may run at the same time from different threads. A
+ * single Transaction object may also be shared between threads. A
+ * Transaction must be deleted before the DB that created it.
+ */
+template<typename K, typename V>
+class KVSQLITE_EXPORT Transaction
+{
+public:
+    /**
+     * @brief      Destroy the transaction, discarding it if it was neither committed nor rolled back.
+     */
+    virtual ~Transaction();
+
+    /**
+     * @brief      Read "key", seeing the writes made earlier in this transaction.
+     * @param[in]  key : key of data
+     * @param[out] value : value of data
+     * @return     Status : on success Status::ok() is true, Status::NotFound if there is no such key. See @ref Status for details.
+     */
+    Status get(const K & key, V & value);
+
+    /**
+     * @brief      Buffer setting "key" to "value" in this transaction.
+     * @param[in]  key : key of data
+     * @param[in]  value : value of data
+     * @return     Status : on success Status::ok() is true and false on error. See @ref Status for details.
+     */
+    Status put(const K & key, const V & value);
+
+    /**
+     * @brief      Buffer removing "key" in this transaction.
+     * @param[in]  key : key of data
+     * @return     Status : on success Status::ok() is true and false on error. See @ref Status for details.
+     */
+    Status del(const K & key);
+
+    /**
+     * @brief      Validate the keys read by this transaction and apply its writes atomically.
+     * @param[in]  options : Options that control write operations. see @ref WriteOptions for details.
+     * @return     Status : on success Status::ok() is true, Status::Busy if a key read by
+     *             the transaction has been changed since it was read. See @ref Status for details.
+     */
+    Status commit(const WriteOptions & options);
+
+    /**
+     * @brief      Discard every write buffered in this transaction.
+     * @return     Status : on success Status::ok() is true and false on error. See @ref Status for details.
+     */
+    Status rollback();
+private:
+    friend class DB<K, V>;
+    explicit Transaction(DBImpl * pDBImpl);
+private:
+    Transaction(const Transaction&) = delete;
+    Transaction& operator=(const Transaction&) = delete;
+private:
+    TransactionImpl<K, V> * m_impl = nullptr;
+};
+
+}/* end of namespace KVSQLite */
+
+#endif
@@ -0,0 +1,131 @@
+/**
+ * @file ValueStream.h
+ * @brief The ValueReader and ValueWriter classes implement.
+ */
+
+#ifndef _KVSQLITE_VALUE_STREAM_H_
+#define _KVSQLITE_VALUE_STREAM_H_
+
+#include <cstdint>
+#include <string>
+#include "Export.h"
+#include "Status.h"
+#include "Options.h"
+#include "Slice.h"
+
+struct sqlite3_blob;
+
+namespace KVSQLite
+{
+
+class DBImpl;
+template<typename K, typename V> class DB;
+
+/**
+ * @brief A ValueReader reads any part of one value of a DB in place, without
+ *        loading the whole value into memory, see DB::openValueReader().
+ *
+ * The reader keeps reading the value as it was when it was opened; once the
+ * entry is changed or deleted, read() fails with Status::ConditionNotMet.
+ * While it is open it holds a read transaction on the file of the DB. A
+ * ValueReader may be used from any thread and must be deleted before the DB.
+ */
+class KVSQLITE_EXPORT ValueReader
+{
+public:
+    /**
+     * @brief      Destroy the reader.
+     */
+    virtual ~ValueReader();
+
+    /**
+     * @brief      Return the size of the value.
+     * @return     int64_t : number of bytes of the value
+     */
+    int64_t size() const;
+
+    /**
+     * @brief      Read at most "length" bytes of the value starting at "offset".
+     * @param[in]  offset : position of the first byte to read, at most size()
+     * @param[in]  length : maximum number of bytes to read
+     * @param[out] data : receives the bytes read, empty at the end of the value
+     * @return     Status : on success Status::ok() is true, Status::ConditionNotMet if the
+     *             entry has changed since the reader was opened. See @ref Status for details.
+     */
+    Status read(int64_t offset, int length, std::string & data);
+private:
+    template<typename K, typename V> friend class DB;
+    ValueReader(DBImpl * pDBImpl, sqlite3_blob * blob, int64_t size);
+private:
+    ValueReader(const ValueReader&) = delete;
+    ValueReader& operator=(const ValueReader&) = delete;
+private:
+    DBImpl * m_DBImpl = nullptr;
+    sqlite3_blob * m_blob = nullptr;
+    int64_t m_size = 0;
+};
+
+/**
+ * @brief A ValueWriter fills in a value of a size fixed in advance, piece by
+ *        piece, see DB::openValueWriter().
+ *
+ * Each write() or append() is a transaction of its own, written in place
+ * into the room reserved for the value: the pieces become visible one by one
+ * and a crash keeps those already written, the rest of the value reading as
+ * zeros. Nothing else should write the entry until the writer is deleted,
+ * otherwise write() fails with Status::ConditionNotMet. A ValueWriter holds
+ * no lock between calls, may be used from any thread and must be deleted
+ * before the DB.
+ */
+class KVSQLITE_EXPORT ValueWriter
+{
+public:
+    /**
+     * @brief      Destroy the writer. The value keeps the bytes written so far.
+     */
+    virtual ~ValueWriter();
+
+    /**
+     * @brief      Return the size of the value, as given to DB::openValueWriter().
+     * @return     int64_t : number of bytes of the value
+     */
+    int64_t size() const;
+
+    /**
+     * @brief      Return the position the next append() writes at.
+     * @return     int64_t : number of bytes appended so far
+     */
+    int64_t position() const;
+
+    /**
+     * @brief      Overwrite the bytes of the value starting at "offset" with "data".
+     * @param[in]  offset : position of the first byte to write
+     * @param[in]  data : bytes to write, offset + data.size() must not exceed size()
+     * @return     Status : on success Status::ok() is true, Status::ConditionNotMet if the
+     *             entry was changed by somebody else. See @ref Status for details.
+     */
+    Status write(int64_t offset, const Slice & data);
+
+    /**
+     * @brief      Write "data" at position() and move position() past it.
+     * @param[in]  data : bytes to write, position() + data.size() must not exceed size()
+     * @return     Status : on success Status::ok() is true and false on error. See @ref Status for details.
+     */
+    Status append(const Slice & data);
+private:
+    template<typename K, typename V> friend class DB;
+    ValueWriter(DBImpl * pDBImpl, const WriteOptions & options, int64_t rowid, int64_t size);
+private:
+    ValueWriter(const ValueWriter&) = delete;
+    ValueWriter& operator=(const ValueWriter&) = delete;
+private:
+    DBImpl * m_DBImpl = nullptr;
+    WriteOptions m_options;
+    int64_t m_rowid = 0;
+    int64_t m_size = 0;
+    int64_t m_position = 0;
+};
+
+}/* end of namespace KVSQLite */
+
+#endif
@@ -2,6 +2,7 @@
 #define _KVSQLITE_WRITE_BATCH_H_
 
 #include <list>
+#include "MergeOperator.h"
 
 namespace KVSQLite
 {
@@ -13,28 +14,35 @@ public:
     enum NodeType
     {
         PUT,
-        DEL
+        DEL,
+        MERGE
     };
     struct Node
     {
         NodeType type;
         K key;
         V value;
+        MergeOperator mergeOperator;
     };
 public:
-    void put(const K & key, const V & value)
+    virtual ~WriteBatch() = default;
+    virtual void put(const K & key, const V & value)
     {
-        m_list.push_back({NodeType::PUT, key, value});
+        m_list.push_back({NodeType::PUT, key, value, MergeOperator()});
     }
-    void del(const K & key)
+    virtual void del(const K & key)
     {
-        m_list.push_back({NodeType::DEL, key});
+        m_list.push_back({NodeType::DEL, key, V(), MergeOperator()});
     }
-    void clear()
+    virtual void merge(const K & key, const V & operand, MergeOperator op)
+    {
+        m_list.push_back({NodeType::MERGE, key, operand, op});
+    }
+    virtual void clear()
     {
         m_list.clear();
     }
-    std::list<Node> getList()
+    const std::list<Node> & getList() const
     {
         return m_list;
     }
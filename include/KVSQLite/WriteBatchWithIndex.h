@@ -0,0 +1,144 @@
+/**
+ * @file WriteBatchWithIndex.h
+ * @brief A WriteBatch that can look up the updates it holds.
+ */
+
+#ifndef _KVSQLITE_WRITE_BATCH_WITH_INDEX_H_
+#define _KVSQLITE_WRITE_BATCH_WITH_INDEX_H_
+
+#include <iterator>
+#include <map>
+#include <vector>
+#include "Slice.h"
+#include "WriteBatch.h"
+
+namespace KVSQLite
+{
+
+template<typename K, typename V> class DB;
+
+template<typename K>
+struct WriteBatchKeyLess
+{
+    bool operator()(const K & a, const K & b) const
+    {
+        return a < b;
+    }
+};
+
+template<>
+struct WriteBatchKeyLess<Slice>
+{
+    bool operator()(const Slice & a, const Slice & b) const
+    {
+        return a.compare(b) < 0;
+    }
+};
+
+/**
+ * @brief WriteBatchWithIndex keeps an ordered index over the keys of the
+ * batch, so the latest staged update of a key is found in O(log n) instead
+ * of scanning the list. It can be passed to DB::write() like a WriteBatch,
+ * and DB::get() has an overload that reads through it.
+ */
+template<typename K, typename V>
+class WriteBatchWithIndex : public WriteBatch<K, V>
+{
+public:
+    enum LookupResult
+    {
+        FOUND,      /* the latest update of the key is a put */
+        DELETED,    /* the latest update of the key is a del */
+        NOT_FOUND,  /* the batch does not touch the key */
+        MERGED      /* the latest update of the key is a merge, DB::get() can resolve it */
+    };
+public:
+    WriteBatchWithIndex() = default;
+    /* The index points into the list, a copy indexes its own list */
+    WriteBatchWithIndex(const WriteBatchWithIndex & other) : WriteBatch<K, V>(other)
+    {
+        rebuildIndex();
+    }
+    WriteBatchWithIndex & operator=(const WriteBatchWithIndex & other)
+    {
+        if(this != &other)
+        {
+            WriteBatch<K, V>::operator=(other);
+            rebuildIndex();
+        }
+        return *this;
+    }
+
+    void put(const K & key, const V & value) override
+    {
+        WriteBatch<K, V>::put(key, value);
+        std::vector<NodeIterator> & chain = m_index[key];
+        chain.assign(1, std::prev(this->getList().end()));
+    }
+    void del(const K & key) override
+    {
+        WriteBatch<K, V>::del(key);
+        std::vector<NodeIterator> & chain = m_index[key];
+        chain.assign(1, std::prev(this->getList().end()));
+    }
+    void merge(const K & key, const V & operand, MergeOperator op) override
+    {
+        WriteBatch<K, V>::merge(key, operand, op);
+        m_index[key].push_back(std::prev(this->getList().end()));
+    }
+    void clear() override
+    {
+        m_index.clear();
+        WriteBatch<K, V>::clear();
+    }
+
+    /**
+     * @brief      Look "key" up among the updates staged in this batch.
+     * @param[in]  key : key of data
+     * @param[out] value : the staged value, only set when FOUND is returned
+     * @return     LookupResult : see @ref LookupResult
+     */
+    LookupResult getFromBatch(const K & key, V & value) const
+    {
+        auto iter = m_index.find(key);
+        if(iter == m_index.end())
+        {
+            return NOT_FOUND;
+        }
+        const NodeIterator & node = iter->second.back();
+        if(WriteBatch<K, V>::NodeType::DEL == node->type)
+        {
+            return DELETED;
+        }
+        if(WriteBatch<K, V>::NodeType::MERGE == node->type)
+        {
+            return MERGED;
+        }
+        value = node->value;
+        return FOUND;
+    }
+private:
+    friend class DB<K, V>;
+    typedef typename std::list<typename WriteBatch<K, V>::Node>::const_iterator NodeIterator;
+
+    void rebuildIndex()
+    {
+        m_index.clear();
+        const auto & list = this->getList();
+        for(auto iter = list.begin(); iter != list.end(); ++iter)
+        {
+            std::vector<NodeIterator> & chain = m_index[iter->key];
+            if(WriteBatch<K, V>::NodeType::MERGE != iter->type)
+            {
+                chain.clear();
+            }
+            chain.push_back(iter);
+        }
+    }
+private:
+    /* For each key, its updates since the last put or del of it, oldest first */
+    std::map<K, std::vector<NodeIterator>, WriteBatchKeyLess<K> > m_index;
+};
+
+}/* end of namespace KVSQLite */
+#endif
@@ -0,0 +1,600 @@
+/**
+ * @file BTreeReader.h
+ * @brief Minimal reader of SQLite B-tree pages, for estimates that SQL can not give cheaply and direct lookups. Not installed.
+ *
+ * The layout follows https://www.sqlite.org/fileformat2.html. Every offset
+ * read from a page is checked, a malformed page makes the caller fall back
+ * to SQL instead of crashing.
+ */
+
+#ifndef _KVSQLITE_BTREE_READER_H_
+#define _KVSQLITE_BTREE_READER_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "sqlite3.h"
+
+namespace KVSQLite
+{
+
+/* A single value as SQLite stores it */
+struct StoredValue
+{
+    int type = SQLITE_NULL;
+    int64_t i = 0;
+    double d = 0;
+    std::string bytes;
+};
+
+/* A single value of a record, text and blobs pointing into the page */
+struct RecordColumn
+{
+    int type = SQLITE_NULL;
+    int64_t i = 0;
+    double d = 0;
+    const char * bytes = nullptr;
+    size_t size = 0;
+};
+
+static inline const char * storedData(const StoredValue & value)
+{
+    return value.bytes.data();
+}
+
+static inline size_t storedSize(const StoredValue & value)
+{
+    return value.bytes.size();
+}
+
+static inline const char * storedData(const RecordColumn & value)
+{
+    return value.bytes;
+}
+
+static inline size_t storedSize(const RecordColumn & value)
+{
+    return value.size;
+}
+
+/* Read the value of column idx of a statement positioned on a row */
+static inline void captureValue(sqlite3_stmt * stmt, int idx, StoredValue & value)
+{
+    value = StoredValue();
+    value.type = sqlite3_column_type(stmt, idx);
+    switch(value.type)
+    {
+    case SQLITE_INTEGER:
+        value.i = sqlite3_column_int64(stmt, idx);
+        break;
+    case SQLITE_FLOAT:
+        value.d = sqlite3_column_double(stmt, idx);
+        break;
+    case SQLITE_TEXT:
+    case SQLITE_BLOB:
+        {
+            const char * p = (const char *)sqlite3_column_blob(stmt, idx);
+            if(p)
+            {
+                value.bytes.assign(p, sqlite3_column_bytes(stmt, idx));
+            }
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/* Bind a value read by captureValue() or decodeFirstColumn() to parameter idx */
+static inline int bindStored(sqlite3_stmt * stmt, int idx, const StoredValue & value)
+{
+    switch(value.type)
+    {
+    case SQLITE_INTEGER:
+        return sqlite3_bind_int64(stmt, idx, value.i);
+    case SQLITE_FLOAT:
+        return sqlite3_bind_double(stmt, idx, value.d);
+    case SQLITE_TEXT:
+        return sqlite3_bind_text(stmt, idx, value.bytes.data(), (int)value.bytes.size(), SQLITE_TRANSIENT);
+    case SQLITE_BLOB:
+        return sqlite3_bind_blob(stmt, idx, value.bytes.data(), (int)value.bytes.size(), SQLITE_TRANSIENT);
+    default:
+        return sqlite3_bind_null(stmt, idx);
+    }
+}
+
+/*
+ * Compare two values, StoredValue or RecordColumn, the way SQLite sorts them
+ * with the BINARY collation: NULL < INTEGER and REAL < TEXT < BLOB, text and
+ * blobs byte by byte.
+ */
+template<typename A, typename B>
+static inline int compareStored(const A & a, const B & b)
+{
+    auto rank = [](int type)
+    {
+        switch(type)
+        {
+        case SQLITE_NULL:
+            return 0;
+        case SQLITE_INTEGER:
+        case SQLITE_FLOAT:
+            return 1;
+        case SQLITE_TEXT:
+            return 2;
+        default:
+            return 3;
+        }
+    };
+
+    int ra = rank(a.type);
+    int rb = rank(b.type);
+    if(ra != rb)
+    {
+        return (ra < rb) ? -1 : 1;
+    }
+
+    switch(ra)
+    {
+    case 0:
+        return 0;
+    case 1:
+        if(SQLITE_INTEGER == a.type && SQLITE_INTEGER == b.type)
+        {
+            return (a.i < b.i) ? -1 : ((a.i > b.i) ? 1 : 0);
+        }
+        else
+        {
+            double x = (SQLITE_INTEGER == a.type) ? (double)a.i : a.d;
+            double y = (SQLITE_INTEGER == b.type) ? (double)b.i : b.d;
+            return (x < y) ? -1 : ((x > y) ? 1 : 0);
+        }
+    default:
+        {
+            size_t n = std::min(storedSize(a), storedSize(b));
+            int c = (n > 0) ? memcmp(storedData(a), storedData(b), n) : 0;
+            if(0 != c)
+            {
+                return c;
+            }
+            return (storedSize(a) < storedSize(b)) ? -1 : ((storedSize(a) > storedSize(b)) ? 1 : 0);
+        }
+    }
+}
+
+static inline uint32_t getBigEndian(const uint8_t * p, int n)
+{
+    uint32_t v = 0;
+    for(int i = 0; i < n; i++)
+    {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+/* Decode an SQLite varint from [p, end), return its length or 0 if truncated */
+static inline int getVarint(const uint8_t * p, const uint8_t * end, uint64_t & v)
+{
+    v = 0;
+    for(int i = 0; i < 9; i++)
+    {
+        if(p + i >= end)
+        {
+            return 0;
+        }
+        if(8 == i)
+        {
+            v = (v << 8) | p[i];
+            return 9;
+        }
+        v = (v << 7) | (p[i] & 0x7f);
+        if(0 == (p[i] & 0x80))
+        {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Decode the first column of a record, the key of an index entry. Only the
+ * local part of a record that spills to overflow pages is available, so a
+ * long text or blob key may come out truncated.
+ */
+static inline bool decodeFirstColumn(const uint8_t * p, const uint8_t * end, StoredValue & value)
+{
+    value = StoredValue();
+    uint64_t headerSize = 0;
+    int n = getVarint(p, end, headerSize);
+    if(0 == n || headerSize < (uint64_t)n + 1 || (uint64_t)(end - p) < headerSize)
+    {
+        return false;
+    }
+
+    uint64_t serialType = 0;
+    if(0 == getVarint(p + n, p + headerSize, serialType))
+    {
+        return false;
+    }
+
+    const uint8_t * body = p + headerSize;
+    static const int intSize[] = {0, 1, 2, 3, 4, 6, 8};
+    if(0 == serialType)
+    {
+        value.type = SQLITE_NULL;
+    }
+    else if(serialType <= 6)
+    {
+        int size = intSize[serialType];
+        if(end - body < size)
+        {
+            return false;
+        }
+        uint64_t u = 0;
+        for(int i = 0; i < size; i++)
+        {
+            u = (u << 8) | body[i];
+        }
+        /* Sign extend */
+        if(size < 8 && (body[0] & 0x80))
+        {
+            u |= ~((((uint64_t)1) << (size * 8)) - 1);
+        }
+        value.type = SQLITE_INTEGER;
+        value.i = (int64_t)u;
+    }
+    else if(7 == serialType)
+    {
+        if(end - body < 8)
+        {
+            return false;
+        }
+        uint64_t u = 0;
+        for(int i = 0; i < 8; i++)
+        {
+            u = (u << 8) | body[i];
+        }
+        value.type = SQLITE_FLOAT;
+        memcpy(&value.d, &u, sizeof(u));
+    }
+    else if(8 == serialType || 9 == serialType)
+    {
+        value.type = SQLITE_INTEGER;
+        value.i = serialType - 8;
+    }
+    else if(serialType >= 12)
+    {
+        value.type = (serialType & 1) ? SQLITE_TEXT : SQLITE_BLOB;
+        uint64_t size = (serialType - ((serialType & 1) ? 13 : 12)) / 2;
+        uint64_t available = end - body;
+        value.bytes.assign((const char *)body, (size_t)std::min(size, available));
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Decode the first count columns of a record held whole in [p, end), a
+ * record of fewer columns leaving the others NULL. Text and blobs point
+ * into the record.
+ */
+static inline bool decodeRecord(const uint8_t * p, const uint8_t * end, RecordColumn * columns, int count)
+{
+    uint64_t headerSize = 0;
+    int n = getVarint(p, end, headerSize);
+    if(0 == n || headerSize < (uint64_t)n || (uint64_t)(end - p) < headerSize)
+    {
+        return false;
+    }
+
+    const uint8_t * type = p + n;
+    const uint8_t * headerEnd = p + headerSize;
+    const uint8_t * body = headerEnd;
+    static const int intSize[] = {0, 1, 2, 3, 4, 6, 8};
+    for(int column = 0; column < count; column++)
+    {
+        RecordColumn & value = columns[column];
+        value = RecordColumn();
+        uint64_t serialType = 0;
+        if(type >= headerEnd)
+        {
+            continue;
+        }
+        n = getVarint(type, headerEnd, serialType);
+        if(0 == n)
+        {
+            return false;
+        }
+        type += n;
+
+        uint64_t size = 0;
+        if(serialType <= 6)
+        {
+            size = intSize[serialType];
+        }
+        else if(7 == serialType)
+        {
+            size = 8;
+        }
+        else if(serialType >= 12)
+        {
+            size = (serialType - ((serialType & 1) ? 13 : 12)) / 2;
+        }
+        else if(10 == serialType || 11 == serialType)
+        {
+            return false;
+        }
+        if((uint64_t)(end - body) < size)
+        {
+            return false;
+        }
+
+        if(0 == serialType)
+        {
+            value.type = SQLITE_NULL;
+        }
+        else if(serialType <= 7)
+        {
+            uint64_t u = 0;
+            for(uint64_t i = 0; i < size; i++)
+            {
+                u = (u << 8) | body[i];
+            }
+            if(7 == serialType)
+            {
+                value.type = SQLITE_FLOAT;
+                memcpy(&value.d, &u, sizeof(u));
+            }
+            else
+            {
+                /* Sign extend */
+                if(size < 8 && (body[0] & 0x80))
+                {
+                    u |= ~((((uint64_t)1) << (size * 8)) - 1);
+                }
+                value.type = SQLITE_INTEGER;
+                value.i = (int64_t)u;
+            }
+        }
+        else if(8 == serialType || 9 == serialType)
+        {
+            value.type = SQLITE_INTEGER;
+            value.i = serialType - 8;
+        }
+        else
+        {
+            value.type = (serialType & 1) ? SQLITE_TEXT : SQLITE_BLOB;
+            value.bytes = (const char *)body;
+            value.size = (size_t)size;
+        }
+        body += size;
+    }
+    return true;
+}
+
+/*
+ * Pages of a database file of the connection, read through its VFS.
+ * Only valid while the caller holds a read transaction, and only when the
+ * file holds every committed page, i.e. not in WAL mode.
+ */
+class FilePageSource
+{
+public:
+    bool open(sqlite3 * db, const std::string & schema = "main")
+    {
+        file = nullptr;
+        if(SQLITE_OK != sqlite3_file_control(db, schema.c_str(), SQLITE_FCNTL_FILE_POINTER, &file) ||
+            nullptr == file || nullptr == file->pMethods)
+        {
+            return false;
+        }
+
+        /* Page size and reserved bytes per page, from the database header */
+        uint8_t header[100];
+        if(SQLITE_OK != file->pMethods->xRead(file, header, sizeof(header), 0) ||
+            0 != memcmp(header, "SQLite format 3", 16))
+        {
+            return false;
+        }
+        pageSize = getBigEndian(header + 16, 2);
+        if(1 == pageSize)
+        {
+            pageSize = 65536;
+        }
+        if(pageSize < 512 || pageSize > 65536 || header[20] >= pageSize - 480)
+        {
+            return false;
+        }
+        usableSize = pageSize - header[20];
+        buffer.resize(pageSize);
+        return true;
+    }
+
+    const uint8_t * read(uint32_t pgno)
+    {
+        if(0 == pgno ||
+            SQLITE_OK != file->pMethods->xRead(file, &buffer[0], pageSize, (sqlite3_int64)(pgno - 1) * pageSize))
+        {
+            return nullptr;
+        }
+        return (const uint8_t *)buffer.data();
+    }
+public:
+    sqlite3_file * file = nullptr;
+    uint32_t pageSize = 0;
+    uint32_t usableSize = 0;
+private:
+    std::string buffer;
+};
+
+/*
+ * Estimate where "key" falls in an index B-tree by descending from the root
+ * towards it: at each level the child taken splits the remaining share of
+ * the tree evenly between the children of the page. position receives the
+ * estimated fraction of entries sorting before key, entries an estimate of
+ * the number of entries, from the fan-out seen on the way down.
+ */
+template<typename Source>
+static bool estimateIndexPosition(Source & source, uint32_t root, const StoredValue & key, double & position, double & entries)
+{
+    position = 0;
+    entries = 1;
+    double width = 1;
+    uint32_t pgno = root;
+
+    /* A B-tree of 4GB pages is well below 20 levels */
+    for(int depth = 0; depth < 20; depth++)
+    {
+        const uint8_t * page = source.read(pgno);
+        if(nullptr == page)
+        {
+            return false;
+        }
+        const uint8_t * end = page + source.usableSize;
+        const uint8_t * header = page + ((1 == pgno) ? 100 : 0);
+        bool interior = (0x02 == header[0]);
+        if(!interior && 0x0a != header[0])
+        {
+            return false;
+        }
+
+        uint32_t cells = getBigEndian(header + 3, 2);
+        const uint8_t * cellPointers = header + (interior ? 12 : 8);
+        if(cellPointers + 2 * cells > end)
+        {
+            return false;
+        }
+
+        /* Largest payload kept on the page, see "Cell Payload Overflow Pages" */
+        const uint64_t maxLocal = ((source.usableSize - 12) * 64 / 255) - 23;
+        const uint64_t minLocal = ((source.usableSize - 12) * 32 / 255) - 23;
+
+        /* Binary search for the first cell whose key is not less than key */
+        uint32_t lo = 0;
+        uint32_t hi = cells;
+        uint32_t child = 0;
+        while(lo < hi)
+        {
+            uint32_t mid = lo + (hi - lo) / 2;
+            uint32_t offset = getBigEndian(cellPointers + 2 * mid, 2);
+            const uint8_t * cell = page + offset;
+            if(cell >= end || (interior && cell + 4 > end))
+            {
+                return false;
+            }
+            const uint8_t * p = cell + (interior ? 4 : 0);
+            uint64_t payloadSize = 0;
+            int n = getVarint(p, end, payloadSize);
+            if(0 == n)
+            {
+                return false;
+            }
+            uint64_t local = payloadSize;
+            if(payloadSize > maxLocal)
+            {
+                local = minLocal + ((payloadSize - minLocal) % (source.usableSize - 4));
+                if(local > maxLocal)
+                {
+                    local = minLocal;
+                }
+            }
+            const uint8_t * payload = p + n;
+            const uint8_t * payloadEnd = (local < (uint64_t)(end - payload)) ? payload + local : end;
+
+            StoredValue cellKey;
+            if(!decodeFirstColumn(payload, payloadEnd, cellKey))
+            {
+                return false;
+            }
+            if(compareStored(cellKey, key) < 0)
+            {
+                lo = mid + 1;
+            }
+            else
+            {
+                hi = mid;
+                if(interior)
+                {
+                    child = getBigEndian(cell, 4);
+                }
+            }
+        }
+
+        if(!interior)
+        {
+            if(cells > 0)
+            {
+                position += width * lo / cells;
+            }
+            entries *= cells;
+            return true;
+        }
+
+        if(lo == cells)
+        {
+            child = getBigEndian(header + 8, 4);
+        }
+        position += width * lo / (cells + 1);
+        width /= (cells + 1);
+        entries *= (cells + 1);
+        pgno = child;
+    }
+    return false;
+}
+
+/*
+ * Append the pages of an index B-tree to pages, level by level from the
+ * root, until it holds maxPages of them: the pages every lookup reads come
+ * first.
+ */
+template<typename Source>
+static void collectIndexPages(Source & source, uint32_t root, size_t maxPages, std::vector<uint32_t> & pages)
+{
+    const size_t first = pages.size();
+    pages.push_back(root);
+    for(size_t next = first; next < pages.size() && pages.size() - first < maxPages; next++)
+    {
+        const uint32_t pgno = pages[next];
+        const uint8_t * page = source.read(pgno);
+        if(nullptr == page)
+        {
+            continue;
+        }
+        const uint8_t * end = page + source.usableSize;
+        const uint8_t * header = page + ((1 == pgno) ? 100 : 0);
+        if(0x02 != header[0])
+        {
+            continue;
+        }
+
+        /* The left child of each cell, then the right-most pointer */
+        uint32_t cells = getBigEndian(header + 3, 2);
+        const uint8_t * cellPointers = header + 12;
+        if(cellPointers + 2 * cells > end)
+        {
+            continue;
+        }
+        for(uint32_t i = 0; i <= cells && pages.size() - first < maxPages; i++)
+        {
+            const uint8_t * child = header + 8;
+            if(i < cells)
+            {
+                child = page + getBigEndian(cellPointers + 2 * i, 2);
+                if(child + 4 > end)
+                {
+                    break;
+                }
+            }
+            pages.push_back(getBigEndian(child, 4));
+        }
+    }
+}
+
+}/* end of namespace KVSQLite */
+
+#endif
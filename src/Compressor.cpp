@@ -0,0 +1,299 @@
+#include "KVSQLite/Compressor.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace KVSQLite
+{
+
+namespace
+{
+
+/*
+ * The LZ codec. Its output is the size of the value as a varint, then
+ * sequences of a token byte, literals, and a match: the token holds the
+ * number of literals in its high 4 bits and the length of the match minus
+ * minMatch in its low 4 bits, 15 meaning that bytes of 255 and a last byte
+ * below it follow and add up to the rest. Literals are copied as they are,
+ * a match is a 2 byte little-endian distance back into the output. The last
+ * sequence has literals only and ends the input.
+ *
+ * Level 1 looks at the last position of each hash only, and skips faster
+ * and faster through bytes that do not match. Higher levels keep a chain of
+ * all the previous positions of each hash, follow it up to 2^(level - 1)
+ * steps for the longest match, and index the positions inside matches too.
+ */
+class LZCompressor : public Compressor
+{
+public:
+    static const int minMatch = 4;
+    static const size_t maxDistance = 65535;
+    static const int maxLevel = 9;
+
+    explicit LZCompressor(int level = 1)
+        : m_depth(1 << (level - 1))
+    {
+    }
+
+    int id() const override
+    {
+        return 1;
+    }
+
+    bool compress(const char * data, size_t size, std::string & output) const override
+    {
+        if(size < 2 * minMatch || size > UINT32_MAX)
+        {
+            return false;
+        }
+
+        /* A table of 256 to 16K entries, about one per byte: small values do not pay for a large one */
+        int bits = 8;
+        while(bits < 14 && ((size_t)1 << bits) < size)
+        {
+            bits++;
+        }
+        std::vector<uint32_t> table((size_t)1 << bits, UINT32_MAX);
+        /* Previous position with the same hash, for the levels above 1 */
+        std::vector<uint32_t> chain((m_depth > 1) ? size : 0);
+
+        const unsigned char * in = (const unsigned char *)data;
+        const size_t start = output.size();
+        putVarint(output, (uint32_t)size);
+        size_t anchor = 0;
+        size_t i = 0;
+        /* A match never starts in the last minMatch bytes, there is nothing to read past them */
+        while(i + minMatch <= size)
+        {
+            uint32_t sequence = read32(in + i);
+            size_t candidate = insert(table, chain, bits, in, i);
+            size_t best = 0;
+            size_t length = 0;
+            for(int step = 0; step < m_depth && UINT32_MAX != candidate && i - candidate <= maxDistance; step++)
+            {
+                if(read32(in + candidate) == sequence)
+                {
+                    size_t n = minMatch;
+                    while(i + n < size && in[candidate + n] == in[i + n])
+                    {
+                        n++;
+                    }
+                    if(n > length)
+                    {
+                        best = candidate;
+                        length = n;
+                    }
+                }
+                candidate = (m_depth > 1) ? chain[candidate] : UINT32_MAX;
+            }
+            if(0 == length)
+            {
+                /* Skip faster through data that does not compress */
+                i += (m_depth > 1) ? 1 : 1 + ((i - anchor) >> 6);
+                continue;
+            }
+
+            putSequence(output, in + anchor, i - anchor, i - best, length);
+            if(m_depth > 1)
+            {
+                for(size_t k = i + 1; k < i + length && k + minMatch <= size; k++)
+                {
+                    insert(table, chain, bits, in, k);
+                }
+            }
+            i += length;
+            anchor = i;
+            if(output.size() - start >= size)
+            {
+                output.resize(start);
+                return false;
+            }
+        }
+        putSequence(output, in + anchor, size - anchor, 0, 0);
+        if(output.size() - start >= size)
+        {
+            output.resize(start);
+            return false;
+        }
+        return true;
+    }
+
+    bool uncompress(const char * data, size_t size, std::string & output) const override
+    {
+        const unsigned char * in = (const unsigned char *)data;
+        const unsigned char * end = in + size;
+        uint32_t expected = 0;
+        /* A byte of input never stands for more than 255 bytes of output */
+        if(!getVarint(in, end, expected) || expected > (uint64_t)size * 255)
+        {
+            return false;
+        }
+
+        const size_t start = output.size();
+        output.resize(start + expected);
+        unsigned char * out = (unsigned char *)&output[0] + start;
+        size_t done = 0;
+        while(in < end)
+        {
+            unsigned token = *in++;
+            size_t literals = token >> 4;
+            if(15 == literals && !getLength(in, end, literals))
+            {
+                break;
+            }
+            if(literals > (size_t)(end - in) || literals > expected - done)
+            {
+                break;
+            }
+            std::memcpy(out + done, in, literals);
+            in += literals;
+            done += literals;
+            if(in == end)
+            {
+                /* The last sequence */
+                if(done == expected && 0 == (token & 15))
+                {
+                    return true;
+                }
+                break;
+            }
+
+            if(end - in < 2)
+            {
+                break;
+            }
+            size_t distance = (size_t)in[0] | ((size_t)in[1] << 8);
+            in += 2;
+            size_t length = token & 15;
+            if(15 == length && !getLength(in, end, length))
+            {
+                break;
+            }
+            length += minMatch;
+            if(0 == distance || distance > done || length > expected - done)
+            {
+                break;
+            }
+            /* The match may overlap the bytes it produces, copy them one by one */
+            const unsigned char * from = out + done - distance;
+            for(size_t k = 0; k < length; k++)
+            {
+                out[done + k] = from[k];
+            }
+            done += length;
+        }
+        output.resize(start);
+        return false;
+    }
+private:
+    static uint32_t read32(const unsigned char * p)
+    {
+        uint32_t value;
+        std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    static size_t hash(uint32_t sequence, int bits)
+    {
+        return (sequence * 2654435761u) >> (32 - bits);
+    }
+
+    /* Record position i under its hash, and return the previous position there */
+    static size_t insert(std::vector<uint32_t> & table, std::vector<uint32_t> & chain, int bits, const unsigned char * in, size_t i)
+    {
+        uint32_t & slot = table[hash(read32(in + i), bits)];
+        size_t previous = slot;
+        if(!chain.empty())
+        {
+            chain[i] = slot;
+        }
+        slot = (uint32_t)i;
+        return previous;
+    }
+
+    static void putVarint(std::string & output, uint32_t value)
+    {
+        while(value >= 0x80)
+        {
+            output.push_back((char)(value | 0x80));
+            value >>= 7;
+        }
+        output.push_back((char)value);
+    }
+
+    static bool getVarint(const unsigned char *& in, const unsigned char * end, uint32_t & value)
+    {
+        value = 0;
+        for(int shift = 0; shift <= 28 && in < end; shift += 7)
+        {
+            uint32_t byte = *in++;
+            value |= (byte & 0x7f) << shift;
+            if(byte < 0x80)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static void putLength(std::string & output, size_t rest)
+    {
+        for(; rest >= 255; rest -= 255)
+        {
+            output.push_back((char)255);
+        }
+        output.push_back((char)rest);
+    }
+
+    static bool getLength(const unsigned char *& in, const unsigned char * end, size_t & length)
+    {
+        while(in < end)
+        {
+            unsigned byte = *in++;
+            length += byte;
+            if(byte < 255)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /* length 0 writes the last sequence, made of literals only */
+    static void putSequence(std::string & output, const unsigned char * literals, size_t count, size_t distance, size_t length)
+    {
+        size_t matchCode = (length > 0) ? length - minMatch : 0;
+        output.push_back((char)(((count < 15 ? count : 15) << 4) | (matchCode < 15 ? matchCode : 15)));
+        if(count >= 15)
+        {
+            putLength(output, count - 15);
+        }
+        output.append((const char *)literals, count);
+        if(0 == length)
+        {
+            return;
+        }
+        output.push_back((char)(distance & 0xff));
+        output.push_back((char)(distance >> 8));
+        if(matchCode >= 15)
+        {
+            putLength(output, matchCode - 15);
+        }
+    }
+private:
+    int m_depth = 1;
+};
+
+}/* end of anonymous namespace */
+
+const Compressor * Compressor::lz(int level)
+{
+    static const LZCompressor compressors[LZCompressor::maxLevel] = {
+        LZCompressor(1), LZCompressor(2), LZCompressor(3), LZCompressor(4), LZCompressor(5),
+        LZCompressor(6), LZCompressor(7), LZCompressor(8), LZCompressor(9)
+    };
+    return &compressors[std::min(std::max(level, 1), (int)LZCompressor::maxLevel) - 1];
+}
+
+}/* end of namespace KVSQLite */
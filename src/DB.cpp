@@ -1,476 +1,1354 @@
 #include "KVSQLite/DB.h"
 #include "KVSQLite/Slice.h"
 #include <cstdio>
-#include "sqlite3.h"
-#include <mutex>
+#include <limits>
+#include <type_traits>
+#include "DBImpl.h"
+#include "PageCompression.h"
 
 namespace KVSQLite
 {
 
-class DBImpl
+template<typename K, typename V>
+Status DB<K, V>::open(const Options & options, const std::string & filename, DB ** ppDB)
+{
+    if(nullptr == ppDB)
+    {
+        return Status("", "Invalid argument, ppDB is null.", Status::InvalidArgument, "0");
+    }
+
+    int sqlRet = 0;
+    Status status;
+
+    DB * & pDB = *ppDB;
+    pDB = new(std::nothrow) DB();
+    if(nullptr == pDB)
+    {
+        return Status("", "Fail to new.", Status::UnknownError, "0");
+    }
+
+    do
+    {
+        if(options.error_if_exists)
+        {
+#ifdef _WIN32
+            /* if open success, then file exist */
+            FILE * pF = nullptr;
+            int errRet = fopen_s(&pF, filename.c_str(), "r");
+            if(0 != errRet)
+            {
+                fclose(pF);
+                std::string databaseErr = "File already exist:" + filename;
+                status = Status("", databaseErr, Status::IOError, "0");
+                break;
+            }
+#else
+            /* if open success, then file exist */
+            FILE * pF = fopen(filename.c_str(), "r");
+            if(nullptr != pF)
+            {
+                fclose(pF);
+                std::string databaseErr = "File already exist:" + filename;
+                status = Status("", databaseErr, Status::IOError, "0");
+                break;
+            }
+#endif
+        }
+        /* open or create database file.
+         * If the filename is an empty string, then a private, temporary on-disk
+         * database will be created. This private database will be automatically
+         * deleted as soon as the database connection is closed.
+         */
+        const bool readOnly = options.read_only || options.immutable;
+        int flags = readOnly ? SQLITE_OPEN_READONLY : SQLITE_OPEN_READWRITE;
+        if(options.create_if_missing && !readOnly)
+        {
+            flags |= SQLITE_OPEN_CREATE;
+        }
+        /* No lock is taken and no change looked for on a file that never changes */
+        std::string path = filename;
+        if(options.immutable && !filename.empty() && ":memory:" != filename)
+        {
+            path = immutableUri(filename);
+            flags |= SQLITE_OPEN_URI;
+        }
+        /* Compressed pages go through a VFS of their own */
+        std::string vfsName;
+        if(nullptr != options.page_compressor)
+        {
+            if(!validCompressor(options.page_compressor))
+            {
+                status = Status("", "Invalid argument, page compressor id out of range.", Status::InvalidArgument, "0");
+                break;
+            }
+            status = pageCompressionVfs(options.page_compressor, vfsName);
+            if(!status.ok())
+            {
+                break;
+            }
+        }
+        /* The pages read for the warm-up of the next open are traced by the same VFS as the I/O statistics */
+        const bool warmsUp = options.warm_up_bytes > 0 && !filename.empty() && ":memory:" != filename;
+        if(options.enable_io_stats || warmsUp)
+        {
+            Connection & connection = *pDB->m_DBImpl->connection;
+            status = IoStats::create(vfsName.empty() ? nullptr : vfsName.c_str(), connection.ioStats);
+            if(!status.ok())
+            {
+                break;
+            }
+            vfsName = connection.ioStats->vfsName();
+            connection.countsIo = options.enable_io_stats;
+            if(warmsUp)
+            {
+                connection.ioStats->tracePages(filename + "-pagetrace", options.warm_up_bytes);
+            }
+        }
+        sqlRet = sqlite3_open_v2(path.c_str(), &pDB->m_DBImpl->connection->db, flags, vfsName.empty() ? nullptr : vfsName.c_str());
+        pDB->m_DBImpl->db = pDB->m_DBImpl->connection->db;
+        pDB->m_DBImpl->connection->readOnly = readOnly;
+        pDB->m_DBImpl->connection->immutable = options.immutable;
+        if(SQLITE_OK != sqlRet)
+        {
+            std::string databaseErr = "Fail to open:" + filename;
+            status = Status(sqlite3_errmsg(pDB->m_DBImpl->db), databaseErr, Status::IOError, std::to_string(sqlRet));
+            break;
+        }
+
+        /* By default, write is asynchronous */
+        status = setSync(pDB->m_DBImpl->db, false);
+        if(!status.ok())
+        {
+            break;
+        }
+
+        status = setCaching(pDB->m_DBImpl->db, options);
+        if(!status.ok())
+        {
+            break;
+        }
+
+        status = pDB->init(options);
+        if(!status.ok() || !warmsUp)
+        {
+            break;
+        }
+        /* The reads of the warm-up are traced too, the pages they load stay in the next trace unless others are read more */
+        pDB->m_DBImpl->connection->savesTrace = true;
+        if(options.warm_up_in_background)
+        {
+            pDB->m_DBImpl->startWarmer(filename + "-pagetrace", options.warm_up_bytes, options.warm_up_ms);
+        }
+        else
+        {
+            pDB->m_DBImpl->warmUp(filename + "-pagetrace", options.warm_up_bytes, options.warm_up_ms);
+        }
+    }while(0);
+
+    if(!status.ok())
+    {
+        delete pDB;
+        pDB = nullptr;
+    }
+    return status;
+}
+
+/* Create the table of the keyspace if needed and prepare its statements, shared by both open() */
+template<typename K, typename V>
+Status DB<K, V>::init(const Options & options)
+{
+    int sqlRet = 0;
+    Status status;
+
+    if(!options.keyspace.empty())
+    {
+        for(char c : options.keyspace)
+        {
+            if(!(('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || ('0' <= c && c <= '9') || '_' == c))
+            {
+                return Status("", "Invalid argument, keyspace name may only use [A-Za-z0-9_]:" + options.keyspace, Status::InvalidArgument, "0");
+            }
+        }
+        m_DBImpl->tableName = "KVTable_" + options.keyspace;
+        if(hasSideTableSuffix(m_DBImpl->tableName))
+        {
+            return Status("", "Invalid argument, keyspace name ends like a table KVSQLite keeps next to a keyspace:" + options.keyspace, Status::InvalidArgument, "0");
+        }
+    }
+
+    const std::string tableName = m_DBImpl->table();
+    m_DBImpl->keyComponents = key_traits<K>::components;
+    const bool readOnly = m_DBImpl->connection->readOnly;
+    if(readOnly)
+    {
+        /* Nothing can be created, the table must be there already */
+        int64_t exists = 0;
+        if(!queryInt64(m_DBImpl->db, "SELECT count(*) FROM " + m_DBImpl->schema + ".sqlite_master WHERE type = 'table' AND name = '" + m_DBImpl->tableName + "'", exists))
+        {
+            return Status(sqlite3_errmsg(m_DBImpl->db), "Fail to read the schema.", Status::UnknownError, "0");
+        }
+        if(0 == exists)
+        {
+            return Status("", "Table does not exist:" + m_DBImpl->tableName, Status::NotFound, "0");
+        }
+    }
+    else
+    {
+        char *errmsg = nullptr;
+        /* A tuple key gets a typed column per component, all of them forming the primary key */
+        const std::string query = (1 == m_DBImpl->keyComponents) ?
+            "CREATE TABLE IF NOT EXISTS " + tableName + "(key PRIMARY KEY, value)" :
+            "CREATE TABLE IF NOT EXISTS " + tableName + "(" + key_traits<K>::columns() + ", value, "
+                "PRIMARY KEY(" + m_DBImpl->keyColumns() + "))";
+
+        /*
+         * If the 5th parameter to sqlite3_exec() is not NULL and no errors occur,
+         * then sqlite3_exec() sets the pointer in its 5th parameter to NULL before
+         * returning.
+         */
+        sqlRet = sqlite3_exec(m_DBImpl->db, query.c_str(), nullptr, nullptr, &errmsg);
+        if(SQLITE_OK != sqlRet)
+        {
+            std::string databaseErr = "Fail to exec:" + query;
+            status = Status(errmsg ? errmsg : "", databaseErr, Status::UnknownError, std::to_string(sqlRet));
+            return status;
+        }
+    }
+
+    if(options.wal_mode && !readOnly)
+    {
+        status = m_DBImpl->enableWAL();
+        if(!status.ok())
+        {
+            return status;
+        }
+    }
+
+    status = m_DBImpl->setupKeyEncoding(options.encode_keys && !readOnly);
+    if(!status.ok())
+    {
+        return status;
+    }
+
+    status = m_DBImpl->enableValueFrames(options, value_log_traits<V>::separable);
+    if(!status.ok())
+    {
+        return status;
+    }
+
+    if(options.enable_ttl)
+    {
+        status = m_DBImpl->enableTTL(options.ttl_purge_batch_size);
+        if(!status.ok())
+        {
+            return status;
+        }
+    }
+
+    if(options.enable_stats)
+    {
+        status = m_DBImpl->enableStats();
+        if(!status.ok())
+        {
+            return status;
+        }
+    }
+
+    status = prepareSQL(m_DBImpl->db, m_DBImpl->getQuery(), &m_DBImpl->getSQL);
+    if(!status.ok())
+    {
+        return status;
+    }
+
+    if(options.direct_reads)
+    {
+        if(!m_DBImpl->connection->immutable)
+        {
+            return Status("", "Invalid argument, direct_reads needs Options::immutable.", Status::InvalidArgument, "0");
+        }
+        status = m_DBImpl->enableDirectReads();
+        if(!status.ok())
+        {
+            return status;
+        }
+    }
+
+    /* No writer statement for a read-only file */
+    if(readOnly)
+    {
+        return status;
+    }
+
+    /*
+     * An UPSERT rather than INSERT OR REPLACE: an existing row is updated
+     * in place instead of being deleted and inserted again with a new
+     * rowid, which leaves the key index alone and fires UPDATE triggers
+     * instead of DELETE ones. A plain put also clears the expire column.
+     */
+    const std::string keyColumns = m_DBImpl->keyColumns();
+    const std::string putQuery = "INSERT INTO " + tableName + "(" + keyColumns + ", " + m_DBImpl->valueColumns() + ") VALUES (" + m_DBImpl->keyParams(1) + ", " + m_DBImpl->valueParams() + ") "
+        "ON CONFLICT(" + keyColumns + ") DO UPDATE SET " + m_DBImpl->valueUpdate() + (m_DBImpl->ttl ? ", expire = NULL" : "");
+    status = prepareSQL(m_DBImpl->db, putQuery, &m_DBImpl->putSQL);
+    if(!status.ok())
+    {
+        return status;
+    }
+
+    status = prepareSQL(m_DBImpl->db, "DELETE FROM " + tableName + " WHERE " + m_DBImpl->keyCompare("=", 1), &m_DBImpl->delSQL);
+    if(!status.ok())
+    {
+        return status;
+    }
+
+    /*
+     * Transaction control statements are prepared once here, instead of
+     * being parsed by sqlite3_exec() for every batch.
+     */
+    status = prepareSQL(m_DBImpl->db, beginQuery(options.transaction_mode), &m_DBImpl->beginSQL);
+    if(!status.ok())
+    {
+        return status;
+    }
+
+    status = prepareSQL(m_DBImpl->db, "COMMIT", &m_DBImpl->commitSQL);
+    if(!status.ok())
+    {
+        return status;
+    }
+
+    status = prepareSQL(m_DBImpl->db, "ROLLBACK", &m_DBImpl->rollbackSQL);
+    if(!status.ok())
+    {
+        return status;
+    }
+
+    if(m_DBImpl->ttl && options.ttl_purge_interval_ms > 0)
+    {
+        m_DBImpl->startPurger(options.ttl_purge_interval_ms);
+    }
+
+    if(m_DBImpl->valueLog && options.value_log_gc_interval_ms > 0)
+    {
+        m_DBImpl->startCollector(options.value_log_gc_interval_ms);
+    }
+
+    return status;
+}
+
+static FILE * openForReading(const std::string & filename)
+{
+#ifdef _WIN32
+    FILE * pF = nullptr;
+    if(0 != fopen_s(&pF, filename.c_str(), "rb"))
+    {
+        return nullptr;
+    }
+    return pF;
+#else
+    return fopen(filename.c_str(), "rb");
+#endif
+}
+
+static bool fileExists(const std::string & filename)
+{
+    FILE * pF = openForReading(filename);
+    if(nullptr == pF)
+    {
+        return false;
+    }
+    fclose(pF);
+    return true;
+}
+
+template<typename K, typename V>
+Status DB<K, V>::openShared(const Options & options, DBImpl * shared, const std::string * filename, DB ** ppDB)
+{
+    if(nullptr == ppDB || nullptr == shared)
+    {
+        return Status("", "Invalid argument, ppDB or the shared DB is null.", Status::InvalidArgument, "0");
+    }
+
+    /* ATTACH always creates a missing file, so the options are checked first */
+    if(nullptr != filename && !filename->empty() && ":memory:" != *filename)
+    {
+        bool exists = fileExists(*filename);
+        if(exists && options.error_if_exists)
+        {
+            return Status("", "File already exist:" + *filename, Status::IOError, "0");
+        }
+        if(!exists && !options.create_if_missing)
+        {
+            return Status("", "File does not exist:" + *filename, Status::IOError, "0");
+        }
+    }
+
+    DB * & pDB = *ppDB;
+    pDB = new(std::nothrow) DB();
+    if(nullptr == pDB)
+    {
+        return Status("", "Fail to new.", Status::UnknownError, "0");
+    }
+
+    /* Same connection, lock and page cache, only the table, and maybe the file, differ */
+    delete pDB->m_DBImpl;
+    pDB->m_DBImpl = new DBImpl(shared->connection);
+
+    /* The other keyspaces may be in use, and a transaction of theirs must not take in our schema changes */
+    Status status;
+    {
+        std::lock_guard<std::mutex> locker(pDB->m_DBImpl->mutex);
+        if(nullptr != filename)
+        {
+            status = pDB->m_DBImpl->attachFile(*filename);
+        }
+        else
+        {
+            pDB->m_DBImpl->useSchema(shared->schema);
+        }
+        if(status.ok())
+        {
+            status = pDB->init(options);
+        }
+    }
+    if(!status.ok())
+    {
+        delete pDB;
+        pDB = nullptr;
+    }
+    return status;
+}
+
+template<typename K, typename V>
+DB<K, V>::~DB()
+{
+    close();
+
+    delete m_DBImpl;
+    m_DBImpl = nullptr;
+}
+
+template<typename K, typename V>
+Status DB<K, V>::put(const WriteOptions & options, const K & key, const V & value)
+{
+    std::lock_guard<std::mutex> locker(m_DBImpl->mutex);
+
+    Status status = m_DBImpl->applyWriteOptions(options);
+    if(!status.ok())
+    {
+        return status;
+    }
+
+    return m_DBImpl->putRow(key, value);
+}
+
+static inline Status ttlDisabled()
+{
+    return Status("", "Invalid argument, the database is not opened with Options::enable_ttl.", Status::InvalidArgument, "0");
+}
+
+template<typename K, typename V>
+Status DB<K, V>::put(const WriteOptions & options, const K & key, const V & value, std::chrono::milliseconds ttl)
+{
+    return put(options, key, value, std::chrono::system_clock::now() + ttl);
+}
+
+template<typename K, typename V>
+Status DB<K, V>::put(const WriteOptions & options, const K & key, const V & value, std::chrono::system_clock::time_point expireAt)
+{
+    std::lock_guard<std::mutex> locker(m_DBImpl->mutex);
+
+    if(!m_DBImpl->ttl)
+    {
+        return ttlDisabled();
+    }
+
+    Status status = m_DBImpl->applyWriteOptions(options);
+    if(!status.ok())
+    {
+        return status;
+    }
+
+    return m_DBImpl->putExpireRow(key, value, toExpireTime(expireAt));
+}
+
+template<typename K, typename V>
+Status DB<K, V>::purgeExpired(int64_t * purged)
+{
+    int64_t total = 0;
+    Status status;
+    while(true)
+    {
+        /* The lock is released between two batches, so that other calls can run in between */
+        std::lock_guard<std::mutex> locker(m_DBImpl->mutex);
+        if(!m_DBImpl->ttl)
+        {
+            return ttlDisabled();
+        }
+        if(m_DBImpl->connection->readOnly)
+        {
+            return readOnlyDB();
+        }
+
+        int64_t count = 0;
+        status = m_DBImpl->purgeExpiredRows(count);
+        total += count;
+        if(!status.ok() || count < m_DBImpl->purgeBatchSize)
+        {
+            break;
+        }
+    }
+
+    if(nullptr != purged)
+    {
+        *purged = total;
+    }
+    return status;
+}
+
+static inline Status noValueLog()
 {
-public:
-    sqlite3 *db = nullptr;
-    sqlite3_stmt *putSQL = nullptr;
-    sqlite3_stmt *getSQL = nullptr;
-    sqlite3_stmt *delSQL = nullptr;
-    std::mutex mutex;
-    bool syncWrite = false;
-};
+    return Status("", "Invalid argument, the table has no value log, see Options::value_log_threshold.", Status::InvalidArgument, "0");
+}
+
+/* Must be called with the connection locked */
+static Status readValueLogStats(DBImpl * dbImpl, std::vector<ValueLogSegment> & segments)
+{
+    segments.clear();
+    sqlite3_stmt * stmt = nullptr;
+    Status status = prepareSQL(dbImpl->db, "SELECT segment, records, bytes, dead_records, dead_bytes FROM " + dbImpl->table("_vlog") + " ORDER BY segment", &stmt);
+    if(!status.ok())
+    {
+        return status;
+    }
+    int sqlRet = 0;
+    while(SQLITE_ROW == (sqlRet = sqlite3_step(stmt)))
+    {
+        ValueLogSegment segment;
+        segment.id = sqlite3_column_int64(stmt, 0);
+        segment.fileBytes = dbImpl->valueLog->fileSize(segment.id);
+        segment.records = sqlite3_column_int64(stmt, 1);
+        segment.bytes = sqlite3_column_int64(stmt, 2);
+        segment.deadRecords = sqlite3_column_int64(stmt, 3);
+        segment.deadBytes = sqlite3_column_int64(stmt, 4);
+        segments.push_back(segment);
+    }
+    if(SQLITE_DONE != sqlRet)
+    {
+        status = Status(sqlite3_errmsg(dbImpl->db), "Fail to read the value log segments.", Status::UnknownError, std::to_string(sqlRet));
+    }
+    sqlite3_finalize(stmt);
+    return status;
+}
 
-template<typename T>
-struct mapping_traits
+template<typename K, typename V>
+Status DB<K, V>::collectValueLogGarbage(int64_t * reclaimed)
 {
-};
+    int64_t total = 0;
+    Status status;
+    while(true)
+    {
+        /* The lock is released between two steps, so that other calls can run in between */
+        std::lock_guard<std::mutex> locker(m_DBImpl->mutex);
+        if(!m_DBImpl->valueLog)
+        {
+            return noValueLog();
+        }
+        if(m_DBImpl->connection->readOnly)
+        {
+            return readOnlyDB();
+        }
+
+        bool more = false;
+        status = m_DBImpl->collectValueLog(total, more);
+        if(!status.ok() || !more)
+        {
+            break;
+        }
+    }
+
+    if(nullptr != reclaimed)
+    {
+        *reclaimed = total;
+    }
+    return status;
+}
 
-template<>
-struct mapping_traits<int>
+template<typename K, typename V>
+Status DB<K, V>::getValueLogStats(std::vector<ValueLogSegment> & segments)
 {
-public:
-    static int bind(sqlite3_stmt *stmt, const int &idx, const int &val)
+    std::lock_guard<std::mutex> locker(m_DBImpl->mutex);
+    if(!m_DBImpl->valueLog)
     {
-        return sqlite3_bind_int(stmt, idx, val);
+        return noValueLog();
     }
-    static int getColumn(sqlite3_stmt *stmt, const int &idx)
+    return readValueLogStats(m_DBImpl, segments);
+}
+
+template<typename K, typename V>
+Status DB<K, V>::get(const K & key, V & value)
+{
+    std::lock_guard<std::mutex> locker(m_DBImpl->mutex);
+
+    return m_DBImpl->getRow(key, value);
+}
+
+template<typename K, typename V>
+Status DB<K, V>::get(const ReadOptions & options, const K & key, V & value)
+{
+    DBImpl * reader = nullptr;
+    Status status = m_DBImpl->readerFor(options, &reader);
+    if(!status.ok())
     {
-        return sqlite3_column_int(stmt, idx);
+        return status;
     }
-};
 
-template<>
-struct mapping_traits<int64_t>
+    std::lock_guard<std::mutex> locker(reader->mutex);
+    return reader->getRow(key, value);
+}
+
+template<typename K, typename V>
+Status DB<K, V>::multiGet(const ReadOptions & options, const std::vector<K> & keys, std::vector<V> & values, std::vector<Status> & statuses)
 {
-public:
-    static int bind(sqlite3_stmt *stmt, const int &idx, const int64_t &val)
+    DBImpl * reader = nullptr;
+    Status status = m_DBImpl->readerFor(options, &reader);
+    if(!status.ok())
     {
-        return sqlite3_bind_int64(stmt, idx, val);
+        return status;
     }
-    static int64_t getColumn(sqlite3_stmt *stmt, const int &idx)
+
+    values.assign(keys.size(), V());
+    statuses.assign(keys.size(), Status());
+
+    /* One lock for all the keys, so that a multiGet without snapshot sees no write half applied */
+    std::lock_guard<std::mutex> locker(reader->mutex);
+    reader->multiGetBuffer.clear();
+    for(size_t i = 0; i < keys.size(); i++)
     {
-        return sqlite3_column_int64(stmt, idx);
+        statuses[i] = reader->getRow(keys[i], values[i]);
+        if(statuses[i].ok())
+        {
+            values[i] = reader->keepValue(values[i]);
+        }
+        else if(statuses[i].type() != Status::NotFound && status.ok())
+        {
+            status = statuses[i];
+        }
     }
-};
+    return status;
+}
 
-template<>
-struct mapping_traits<double>
+template<typename K, typename V>
+Status DB<K, V>::openValueReader(const K & key, ValueReader ** ppReader)
 {
-public:
-    static int bind(sqlite3_stmt *stmt, const int &idx, const double &val)
+    if(nullptr == ppReader)
+    {
+        return Status("", "Invalid argument, ppReader is null.", Status::InvalidArgument, "0");
+    }
+    *ppReader = nullptr;
+    if(!std::is_same<V, Slice>::value)
+    {
+        return Status("", "Invalid argument, only Slice values can be streamed.", Status::InvalidArgument, "0");
+    }
+
+    std::lock_guard<std::mutex> locker(m_DBImpl->mutex);
+    if(m_DBImpl->framedValues)
+    {
+        return framedValueUnsupported();
+    }
+
+    int64_t rowid = 0;
+    int64_t size = 0;
+    Status status = m_DBImpl->locateRow(key, rowid, size);
+    if(!status.ok())
+    {
+        return status;
+    }
+
+    sqlite3_blob * blob = nullptr;
+    status = m_DBImpl->openBlob(rowid, false, &blob);
+    if(!status.ok())
     {
-        return sqlite3_bind_double(stmt, idx, val);
+        return status;
     }
-    static double getColumn(sqlite3_stmt *stmt, const int &idx)
+
+    *ppReader = new(std::nothrow) ValueReader(m_DBImpl, blob, size);
+    if(nullptr == *ppReader)
     {
-        return sqlite3_column_double(stmt, idx);
+        sqlite3_blob_close(blob);
+        return Status("", "Fail to new.", Status::UnknownError, "0");
     }
-};
+    return Status();
+}
 
-template<>
-struct mapping_traits<std::string>
+template<typename K, typename V>
+Status DB<K, V>::openValueWriter(const WriteOptions & options, const K & key, int64_t size, ValueWriter ** ppWriter)
 {
-public:
-    static int bind(sqlite3_stmt *stmt, const int &idx, const std::string &val)
+    if(nullptr == ppWriter)
+    {
+        return Status("", "Invalid argument, ppWriter is null.", Status::InvalidArgument, "0");
+    }
+    *ppWriter = nullptr;
+    if(!std::is_same<V, Slice>::value)
+    {
+        return Status("", "Invalid argument, only Slice values can be streamed.", Status::InvalidArgument, "0");
+    }
+    /* Offsets of the blob functions are int */
+    if(size < 0 || size > std::numeric_limits<int>::max())
+    {
+        return Status("", "Invalid argument, value size out of range.", Status::InvalidArgument, "0");
+    }
+
+    std::lock_guard<std::mutex> locker(m_DBImpl->mutex);
+    if(m_DBImpl->framedValues)
+    {
+        return framedValueUnsupported();
+    }
+
+    Status status = m_DBImpl->applyWriteOptions(options);
+    if(!status.ok())
+    {
+        return status;
+    }
+
+    /* The zeros are written to the pages once, the writer then overwrites them in place */
+    status = m_DBImpl->putRow(key, ZeroBlob{size});
+    if(!status.ok())
+    {
+        return status;
+    }
+
+    int64_t rowid = 0;
+    status = m_DBImpl->locateRow(key, rowid, size);
+    if(!status.ok())
     {
-        return sqlite3_bind_text(stmt, idx, val.c_str(), val.length() + 1, SQLITE_TRANSIENT);
+        return status;
     }
-    static std::string getColumn(sqlite3_stmt *stmt, const int &idx) 
+
+    *ppWriter = new(std::nothrow) ValueWriter(m_DBImpl, options, rowid, size);
+    if(nullptr == *ppWriter)
     {
-        const char * p = (char *)sqlite3_column_text(stmt, idx);
-        return p ? p : "";
+        return Status("", "Fail to new.", Status::UnknownError, "0");
     }
-};
+    return Status();
+}
 
-template<>
-struct mapping_traits<KVSQLite::Slice>
+template<typename K, typename V>
+Status DB<K, V>::get(const WriteBatchWithIndex<K, V> & batch, const K & key, V & value)
 {
-public:
-    static int bind(sqlite3_stmt *stmt, const int &idx, const Slice &val)
+    switch(batch.getFromBatch(key, value))
     {
-        return sqlite3_bind_blob(stmt, idx, val.data(), val.size(), SQLITE_STATIC);
+    case WriteBatchWithIndex<K, V>::FOUND:
+        return Status();
+    case WriteBatchWithIndex<K, V>::DELETED:
+        return Status("", "Not found.", Status::NotFound, "0");
+    case WriteBatchWithIndex<K, V>::MERGED:
+        break;
+    default:
+        return get(key, value);
     }
-    static KVSQLite::Slice getColumn(sqlite3_stmt *stmt, const int &idx)
+
+    /* Fold the merges staged after the last put or del of key onto its base value */
+    std::lock_guard<std::mutex> locker(m_DBImpl->mutex);
+    const auto & chain = batch.m_index.find(key)->second;
+    auto iter = chain.begin();
+    bool exists = false;
+    if(WriteBatch<K, V>::NodeType::MERGE == (*iter)->type)
     {
-        const char * p = (char *)sqlite3_column_blob(stmt, idx);
-        int size = sqlite3_column_bytes(stmt, idx);
-        if(p)
+        Status status = m_DBImpl->getRow(key, value);
+        if(!status.ok() && Status::NotFound != status.type())
         {
-            return Slice(p, size);
+            return status;
         }
-        else
+        exists = status.ok();
+    }
+    else
+    {
+        exists = (WriteBatch<K, V>::NodeType::PUT == (*iter)->type);
+        if(exists)
         {
-            return Slice();
+            value = (*iter)->value;
         }
+        ++iter;
+    }
+
+    for(; iter != chain.end(); ++iter)
+    {
+        if(!mergeSupported((*iter)->mergeOperator, mapping_traits<V>::storage))
+        {
+            return Status("", "Invalid argument, merge operator does not apply to this value type.", Status::InvalidArgument, "0");
+        }
+        value = exists ? merge_traits<V>::merge((*iter)->mergeOperator, value, (*iter)->value, m_DBImpl->mergeBuffer) : (*iter)->value;
+        exists = true;
+    }
+    return Status();
+}
+
+template<typename K, typename V>
+Status DB<K, V>::newIterator(const ReadOptions & options, const K * lower, const K * upper, int prefixComponents, Iterator<K, V> ** ppIter)
+{
+    if(nullptr == ppIter)
+    {
+        return Status("", "Invalid argument, ppIter is null.", Status::InvalidArgument, "0");
+    }
+
+    DBImpl * reader = nullptr;
+    Status status = m_DBImpl->readerFor(options, &reader);
+    if(!status.ok())
+    {
+        *ppIter = nullptr;
+        return status;
+    }
+
+    Iterator<K, V> * pIter = new(std::nothrow) Iterator<K, V>(reader, options, lower, upper, prefixComponents);
+    if(nullptr == pIter)
+    {
+        *ppIter = nullptr;
+        return Status("", "Fail to new.", Status::UnknownError, "0");
+    }
+
+    status = pIter->start();
+    if(!status.ok())
+    {
+        delete pIter;
+        pIter = nullptr;
     }
-};
+    *ppIter = pIter;
+    return status;
+}
 
-static inline Status execSQL(sqlite3 * p, const std::string & sql)
+template<typename K, typename V>
+Status DB<K, V>::scanRange(const ReadOptions & options, const K & begin, const K & end, Iterator<K, V> ** ppIter)
 {
-    char *errmsg = nullptr;
+    return newIterator(options, &begin, &end, 0, ppIter);
+}
 
-    /*
-     * If the 5th parameter to sqlite3_exec() is not NULL and no errors occur,
-     * then sqlite3_exec() sets the pointer in its 5th parameter to NULL before
-     * returning.
-     */
-    int sqlRet = sqlite3_exec(p, sql.c_str(), nullptr, nullptr, &errmsg);
-    if(SQLITE_OK != sqlRet)
+template<typename K, typename V>
+Status DB<K, V>::scanPrefix(const ReadOptions & options, const K & prefix, Iterator<K, V> ** ppIter)
+{
+    if(!prefix_traits<K>::supported)
     {
-        std::string databaseErr = "Fail to exec:" + sql;
-        return Status(errmsg ? errmsg : "", databaseErr, Status::UnknownError, std::to_string(sqlRet));
+        return Status("", "Invalid argument, prefix operations need std::string or Slice keys.", Status::InvalidArgument, "0");
     }
-    return Status();
+
+    std::string buffer;
+    K upper;
+    bool bounded = prefix_traits<K>::upperBound(prefix, buffer, upper);
+    return newIterator(options, &prefix, bounded ? &upper : nullptr, 0, ppIter);
 }
 
-static inline Status setSync(sqlite3 *p, bool sync = true)
+template<typename K, typename V>
+Status DB<K, V>::scanPrefix(const ReadOptions & options, const K & prefix, int components, Iterator<K, V> ** ppIter)
 {
-    const std::string query = sync ? "PRAGMA synchronous = FULL;" : "PRAGMA synchronous = OFF;";
-    return execSQL(p, query);
+    if(components < 1 || components >= key_traits<K>::components)
+    {
+        return Status("", "Invalid argument, components must be at least 1 and less than the size of a tuple key.", Status::InvalidArgument, "0");
+    }
+
+    /* Equality on the leading columns of the primary key is an index range scan */
+    return newIterator(options, &prefix, nullptr, components, ppIter);
 }
 
 template<typename K, typename V>
-Status DB<K, V>::open(const Options & options, const std::string & filename, DB ** ppDB)
+Status DB<K, V>::count(const K & begin, const K & end, int64_t & count)
 {
-    if(nullptr == ppDB)
+    std::lock_guard<std::mutex> locker(m_DBImpl->mutex);
+
+    return m_DBImpl->countRows(begin, end, count);
+}
+
+template<typename K, typename V>
+Status DB<K, V>::approximateCount(const K & begin, const K & end, int64_t & count)
+{
+    std::lock_guard<std::mutex> locker(m_DBImpl->mutex);
+
+    /* The page reader only compares the first column, too coarse for a range of tuple keys */
+    if(m_DBImpl->keyComponents > 1)
     {
-        return Status("", "Invalid argument, ppDB is null.", Status::InvalidArgument, "0");
+        return m_DBImpl->countRows(begin, end, count);
     }
 
-    int sqlRet = 0;
-    Status status;
+    StoredValue lower;
+    StoredValue upper;
+    Status status = m_DBImpl->storedKey(begin, lower);
+    if(status.ok())
+    {
+        status = m_DBImpl->storedKey(end, upper);
+    }
+    if(!status.ok())
+    {
+        return status;
+    }
 
-    DB * & pDB = *ppDB;
-    pDB = new(std::nothrow) DB();
-    if(nullptr == pDB)
+    double fraction = 0;
+    double entries = 0;
+    int64_t bytesInUse = 0;
+    if(!m_DBImpl->estimateRange(&lower, &upper, fraction, entries, bytesInUse))
     {
-        return Status("", "Fail to new.", Status::UnknownError, "0");
+        return m_DBImpl->countRows(begin, end, count);
     }
 
-    do
+    if(m_DBImpl->stats)
     {
-        if(options.error_if_exists)
+        int64_t keyBytes = 0;
+        int64_t valueBytes = 0;
+        int64_t keys = 0;
+        status = m_DBImpl->readStats(keys, keyBytes, valueBytes);
+        if(!status.ok())
         {
-#ifdef _WIN32
-            /* if open success, then file exist */
-            FILE * pF = nullptr;
-            int errRet = fopen_s(&pF, filename.c_str(), "r");
-            if(0 != errRet)
-            {
-                fclose(pF);
-                std::string databaseErr = "File already exist:" + filename;
-                status = Status("", databaseErr, Status::IOError, "0");
-                break;
-            }
-#else
-            /* if open success, then file exist */
-            FILE * pF = fopen(filename.c_str(), "r");
-            if(nullptr != pF)
-            {
-                fclose(pF);
-                std::string databaseErr = "File already exist:" + filename;
-                status = Status("", databaseErr, Status::IOError, "0");
-                break;
-            }
-#endif
+            return status;
         }
-        /* open or create database file.
-         * If the filename is an empty string, then a private, temporary on-disk
-         * database will be created. This private database will be automatically
-         * deleted as soon as the database connection is closed.
-         */
-        int flags = SQLITE_OPEN_READWRITE;
-        if(options.create_if_missing)
+        entries = (double)keys;
+    }
+    count = (int64_t)(fraction * entries + 0.5);
+    return Status();
+}
+
+template<typename K, typename V>
+Status DB<K, V>::approximateSize(const K & begin, const K & end, int64_t & size)
+{
+    std::lock_guard<std::mutex> locker(m_DBImpl->mutex);
+
+    if(m_DBImpl->keyComponents > 1)
+    {
+        return m_DBImpl->sizeRows(begin, end, size);
+    }
+
+    StoredValue lower;
+    StoredValue upper;
+    Status status = m_DBImpl->storedKey(begin, lower);
+    if(status.ok())
+    {
+        status = m_DBImpl->storedKey(end, upper);
+    }
+    if(!status.ok())
+    {
+        return status;
+    }
+
+    double fraction = 0;
+    double entries = 0;
+    int64_t bytesInUse = 0;
+    if(!m_DBImpl->estimateRange(&lower, &upper, fraction, entries, bytesInUse))
+    {
+        return m_DBImpl->sizeRows(begin, end, size);
+    }
+
+    if(m_DBImpl->stats)
+    {
+        int64_t keys = 0;
+        int64_t keyBytes = 0;
+        int64_t valueBytes = 0;
+        status = m_DBImpl->readStats(keys, keyBytes, valueBytes);
+        if(!status.ok())
+        {
+            return status;
+        }
+        bytesInUse = keyBytes + valueBytes;
+    }
+    size = (int64_t)(fraction * bytesInUse + 0.5);
+    return Status();
+}
+
+template<typename K, typename V>
+Status DB<K, V>::getProperty(const std::string & property, int64_t & value)
+{
+    std::lock_guard<std::mutex> locker(m_DBImpl->mutex);
+
+    int64_t keys = 0;
+    int64_t keyBytes = 0;
+    int64_t valueBytes = 0;
+    if(m_DBImpl->stats)
+    {
+        Status status = m_DBImpl->readStats(keys, keyBytes, valueBytes);
+        if(!status.ok())
+        {
+            return status;
+        }
+    }
+
+    if("kvsqlite.estimate-num-keys" == property)
+    {
+        /* NULL sorts first, the fan-out is taken along the leftmost path */
+        StoredValue first;
+        double fraction = 0;
+        double entries = 0;
+        int64_t bytesInUse = 0;
+        if(m_DBImpl->stats)
+        {
+            value = keys;
+        }
+        else if(m_DBImpl->estimateRange(&first, nullptr, fraction, entries, bytesInUse))
         {
-            flags |= SQLITE_OPEN_CREATE;
+            value = (int64_t)entries;
         }
-        sqlRet = sqlite3_open_v2(filename.c_str(), &pDB->m_DBImpl->db, flags, nullptr);
-        if(SQLITE_OK != sqlRet)
+        else if(!queryInt64(m_DBImpl->db, "SELECT count(*) FROM " + m_DBImpl->table(), value))
         {
-            std::string databaseErr = "Fail to open:" + filename;
-            status = Status(sqlite3_errmsg(pDB->m_DBImpl->db), databaseErr, Status::IOError, std::to_string(sqlRet));
-            break;
+            return Status(sqlite3_errmsg(m_DBImpl->db), "Fail to count keys.", Status::UnknownError, "0");
         }
+        return Status();
+    }
 
-        /* By default, write is asynchronous */
-        status = setSync(pDB->m_DBImpl->db, false);
+    if(m_DBImpl->valueLog && 0 == property.compare(0, 19, "kvsqlite.value-log-"))
+    {
+        std::vector<ValueLogSegment> segments;
+        Status status = readValueLogStats(m_DBImpl, segments);
         if(!status.ok())
         {
             return status;
         }
-
-        const std::string tableName = "KVTable";
+        int64_t fileBytes = 0;
+        int64_t liveBytes = 0;
+        for(const ValueLogSegment & segment : segments)
         {
-            char *errmsg = nullptr;
-            const std::string query = "CREATE TABLE IF NOT EXISTS " + tableName + "(key PRIMARY KEY, value)";
-
-            /*
-             * If the 5th parameter to sqlite3_exec() is not NULL and no errors occur,
-             * then sqlite3_exec() sets the pointer in its 5th parameter to NULL before
-             * returning.
-             */
-            sqlRet = sqlite3_exec(pDB->m_DBImpl->db, query.c_str(), nullptr, nullptr, &errmsg);
-            if(SQLITE_OK != sqlRet)
-            {
-                std::string databaseErr = "Fail to exec:" + query;
-                status = Status(errmsg ? errmsg : "", databaseErr, Status::UnknownError, std::to_string(sqlRet));
-                break;
-            }
+            fileBytes += segment.fileBytes;
+            liveBytes += segment.bytes - segment.deadBytes;
         }
-
+        if("kvsqlite.value-log-files" == property)
         {
-            const std::string query = "INSERT OR REPLACE INTO " + tableName + "(key, value) VALUES (?, ?)";
-            sqlRet = sqlite3_prepare_v2(pDB->m_DBImpl->db, query.c_str(), query.size(), &pDB->m_DBImpl->putSQL, nullptr);
-            if(SQLITE_OK != sqlRet)
-            {
-                std::string databaseErr = "Fail to exec:" + query;
-                status = Status(sqlite3_errmsg(pDB->m_DBImpl->db), databaseErr, Status::InvalidArgument, std::to_string(sqlRet));
-                break;
-            }
+            value = segments.size();
+            return Status();
         }
-
+        if("kvsqlite.value-log-bytes" == property)
         {
-            const std::string query = "SELECT value FROM " + tableName + " WHERE key = ?";
-            sqlRet = sqlite3_prepare_v2(pDB->m_DBImpl->db, query.c_str(), query.size(), &pDB->m_DBImpl->getSQL, nullptr);
-            if(SQLITE_OK != sqlRet)
-            {
-                std::string databaseErr = "Fail to exec:" + query;
-                status = Status(sqlite3_errmsg(pDB->m_DBImpl->db), databaseErr, Status::InvalidArgument, std::to_string(sqlRet));
-                break;
-            }
+            value = fileBytes;
+            return Status();
+        }
+        if("kvsqlite.value-log-live-bytes" == property)
+        {
+            value = liveBytes;
+            return Status();
         }
+    }
 
+    if(m_DBImpl->stats)
+    {
+        if("kvsqlite.num-keys" == property)
         {
-            const std::string query = "DELETE FROM " + tableName + " WHERE key = ?";
-            sqlRet = sqlite3_prepare_v2(pDB->m_DBImpl->db, query.c_str(), query.size(), &pDB->m_DBImpl->delSQL, nullptr);
-            if(SQLITE_OK != sqlRet)
-            {
-                std::string databaseErr = "Fail to exec:" + query;
-                status = Status(sqlite3_errmsg(pDB->m_DBImpl->db), databaseErr, Status::InvalidArgument, std::to_string(sqlRet));
-                break;
-            }
+            value = keys;
+            return Status();
         }
-    }while(0);
+        if("kvsqlite.total-key-bytes" == property)
+        {
+            value = keyBytes;
+            return Status();
+        }
+        if("kvsqlite.total-value-bytes" == property)
+        {
+            value = valueBytes;
+            return Status();
+        }
+    }
+    if("kvsqlite.mmap-size" == property)
+    {
+        if(!queryInt64(m_DBImpl->db, "PRAGMA " + m_DBImpl->schema + ".mmap_size", value))
+        {
+            return Status(sqlite3_errmsg(m_DBImpl->db), "Fail to read mmap_size.", Status::UnknownError, "0");
+        }
+        return Status();
+    }
 
-    if(!status.ok())
+    if("kvsqlite.direct-lookups" == property)
     {
-        delete pDB;
-        pDB = nullptr;
+        value = m_DBImpl->directLookups;
+        return Status();
     }
-    return status;
+    if("kvsqlite.direct-fallbacks" == property)
+    {
+        value = m_DBImpl->directFallbacks;
+        return Status();
+    }
+
+    if("kvsqlite.warm-up-bytes" == property)
+    {
+        value = m_DBImpl->warmedBytes;
+        return Status();
+    }
+
+    if(m_DBImpl->connection->countsIo && 0 == property.compare(0, 12, "kvsqlite.io.") &&
+        m_DBImpl->connection->ioStats->property(property.substr(12), value))
+    {
+        return Status();
+    }
+    return Status("", "Invalid argument, unknown or unavailable property:" + property, Status::InvalidArgument, "0");
 }
 
 template<typename K, typename V>
-DB<K, V>::~DB()
+Status DB<K, V>::warmUp(int64_t maxBytes, int64_t * bytesRead)
 {
-    close();
+    std::string filename;
+    {
+        std::lock_guard<std::mutex> locker(m_DBImpl->mutex);
+        const char * name = sqlite3_db_filename(m_DBImpl->db, m_DBImpl->schema.c_str());
+        filename = (nullptr != name) ? name : "";
+    }
 
-    delete m_DBImpl;
-    m_DBImpl = nullptr;
+    /* Large reads, which the operating system also reads ahead of */
+    int64_t total = 0;
+    std::vector<char> buffer(1024 * 1024);
+    const std::string files[] = {filename, filename + "-wal"};
+    for(const std::string & file : files)
+    {
+        FILE * pF = filename.empty() ? nullptr : openForReading(file);
+        if(nullptr == pF)
+        {
+            continue;
+        }
+        while(0 == maxBytes || total < maxBytes)
+        {
+            size_t want = (0 == maxBytes) ? buffer.size() : (size_t)std::min<int64_t>(buffer.size(), maxBytes - total);
+            size_t got = fread(buffer.data(), 1, want, pF);
+            total += got;
+            if(got < want)
+            {
+                break;
+            }
+        }
+        fclose(pF);
+    }
+    if(nullptr != bytesRead)
+    {
+        *bytesRead = total;
+    }
+    return Status();
 }
 
 template<typename K, typename V>
-Status DB<K, V>::put(const WriteOptions & options, const K & key, const V & value)
+Status DB<K, V>::del(const WriteOptions & options, const K & key)
 {
-    int sqlRet = 0;
     std::lock_guard<std::mutex> locker(m_DBImpl->mutex);
 
-    if(m_DBImpl->syncWrite != options.sync)
+    Status status = m_DBImpl->applyWriteOptions(options);
+    if(!status.ok())
+    {
+        return status;
+    }
+
+    return m_DBImpl->delRow(key);
+}
+
+/* Shared by deleteRange(), deletePrefix() and clear() */
+template<typename K>
+static Status deleteRows(DBImpl * impl, const WriteOptions & options, const K * lower, const K * upper)
+{
+    Status status;
+    int64_t deleted = 0;
+    do
     {
-        m_DBImpl->syncWrite = options.sync;
-        Status status = setSync(m_DBImpl->db, false);
+        std::lock_guard<std::mutex> locker(impl->mutex);
+
+        status = impl->applyWriteOptions(options);
         if(!status.ok())
         {
             return status;
         }
-    }
 
-    sqlRet= sqlite3_reset(m_DBImpl->putSQL);
-    if(SQLITE_OK != sqlRet)
-    {
-        std::string databaseErr = "Fail to sqlite3_reset.";
-        return Status(sqlite3_errmsg(m_DBImpl->db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
-    }
+        status = impl->deleteRangeRows(lower, upper, options.delete_chunk_size, deleted);
+    }while(status.ok() && options.delete_chunk_size > 0 && deleted == options.delete_chunk_size);
+
+    return status;
+}
+
+template<typename K, typename V>
+Status DB<K, V>::deleteRange(const WriteOptions & options, const K & begin, const K & end)
+{
+    return deleteRows(m_DBImpl, options, &begin, &end);
+}
 
-    sqlRet = mapping_traits<K>::bind(m_DBImpl->putSQL, 1, key);
-    if(SQLITE_OK != sqlRet)
+template<typename K, typename V>
+Status DB<K, V>::deletePrefix(const WriteOptions & options, const K & prefix)
+{
+    if(!prefix_traits<K>::supported)
     {
-        std::string databaseErr = "Fail to bind key.";
-        return Status(sqlite3_errmsg(m_DBImpl->db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+        return Status("", "Invalid argument, prefix operations need std::string or Slice keys.", Status::InvalidArgument, "0");
     }
 
-    sqlRet = mapping_traits<V>::bind(m_DBImpl->putSQL, 2, value);
-    if(SQLITE_OK != sqlRet)
+    std::string buffer;
+    K upper;
+    bool bounded = prefix_traits<K>::upperBound(prefix, buffer, upper);
+    return deleteRows(m_DBImpl, options, &prefix, bounded ? &upper : nullptr);
+}
+
+template<typename K, typename V>
+Status DB<K, V>::clear(const WriteOptions & options)
+{
+    return deleteRows<K>(m_DBImpl, options, nullptr, nullptr);
+}
+
+template<typename K, typename V>
+Status DB<K, V>::merge(const WriteOptions & options, const K & key, const V & operand, MergeOperator op)
+{
+    std::lock_guard<std::mutex> locker(m_DBImpl->mutex);
+
+    Status status = m_DBImpl->applyWriteOptions(options);
+    if(!status.ok())
     {
-        std::string databaseErr = "Fail to bind value.";
-        return Status(sqlite3_errmsg(m_DBImpl->db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+        return status;
     }
 
-    sqlRet = sqlite3_step(m_DBImpl->putSQL);
-    if(SQLITE_DONE != sqlRet)
+    return m_DBImpl->mergeRow(key, operand, op);
+}
+
+template<typename K, typename V>
+Status DB<K, V>::registerMergeOperator(const std::string & name, const MergeFunction & func)
+{
+    std::lock_guard<std::mutex> locker(m_DBImpl->mutex);
+
+    return m_DBImpl->registerMergeFunction<V>(name, func);
+}
+
+template<typename K, typename V>
+Status DB<K, V>::merge(const WriteOptions & options, const K & key, const V & operand, const std::string & name)
+{
+    std::lock_guard<std::mutex> locker(m_DBImpl->mutex);
+
+    Status status = m_DBImpl->applyWriteOptions(options);
+    if(!status.ok())
     {
-        std::string databaseErr = "Fail to sqlite3_step.";
-        return Status(sqlite3_errmsg(m_DBImpl->db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+        return status;
     }
 
-    return Status();
+    return m_DBImpl->mergeRow(key, operand, name);
 }
 
 template<typename K, typename V>
-Status DB<K, V>::get(const K & key, V & value)
+Status DB<K, V>::putIfAbsent(const WriteOptions & options, const K & key, const V & value)
 {
     std::lock_guard<std::mutex> locker(m_DBImpl->mutex);
 
-    int sqlRet= sqlite3_reset(m_DBImpl->getSQL);
-    if(SQLITE_OK != sqlRet)
+    Status status = m_DBImpl->applyWriteOptions(options);
+    if(!status.ok())
     {
-        std::string databaseErr = "Fail to sqlite3_reset.";
-        return Status(sqlite3_errmsg(m_DBImpl->db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+        return status;
     }
 
-    sqlRet = mapping_traits<K>::bind(m_DBImpl->getSQL, 1, key);
-    if(SQLITE_OK != sqlRet)
+    return m_DBImpl->putIfAbsentRow(key, value);
+}
+
+template<typename K, typename V>
+Status DB<K, V>::compareAndSwap(const WriteOptions & options, const K & key, const V & expected, const V & desired)
+{
+    std::lock_guard<std::mutex> locker(m_DBImpl->mutex);
+
+    Status status = m_DBImpl->applyWriteOptions(options);
+    if(!status.ok())
     {
-        std::string databaseErr = "Fail to bind key.";
-        return Status(sqlite3_errmsg(m_DBImpl->db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+        return status;
     }
 
-    sqlRet = sqlite3_step(m_DBImpl->getSQL);
+    return m_DBImpl->compareAndSwapRow(key, expected, desired);
+}
+
+template<typename K, typename V>
+Status DB<K, V>::getAndSet(const WriteOptions & options, const K & key, const V & value, V & oldValue, bool * existed)
+{
+    std::lock_guard<std::mutex> locker(m_DBImpl->mutex);
 
-    if(SQLITE_ROW != sqlRet)
+    Status status = m_DBImpl->applyWriteOptions(options);
+    if(!status.ok())
     {
-        std::string databaseErr = "Not found.";
-        return Status(sqlite3_errmsg(m_DBImpl->db), databaseErr, Status::NotFound, std::to_string(sqlRet));
+        return status;
     }
 
-    value = mapping_traits<V>::getColumn(m_DBImpl->getSQL, 0);
-    return Status();
+    return m_DBImpl->getAndSetRow(key, value, oldValue, existed);
 }
 
 template<typename K, typename V>
-Status DB<K, V>::del(const WriteOptions & options, const K & key)
+Status DB<K, V>::write(const WriteOptions & options, WriteBatch<K, V>* updates)
 {
-    int sqlRet = 0;
+    Status status;
     std::lock_guard<std::mutex> locker(m_DBImpl->mutex);
 
-    if(m_DBImpl->syncWrite != options.sync)
+    status = m_DBImpl->applyWriteOptions(options);
+    if(!status.ok())
     {
-        m_DBImpl->syncWrite = options.sync;
-        Status status = setSync(m_DBImpl->db, m_DBImpl->syncWrite);
-        if(!status.ok())
-        {
-            return status;
-        }
+        return status;
     }
 
-    sqlRet= sqlite3_reset(m_DBImpl->delSQL);
-    if(SQLITE_OK != sqlRet)
+    status = stepSQL(m_DBImpl->db, m_DBImpl->beginSQL);
+    if(!status.ok())
     {
-        std::string databaseErr = "Fail to sqlite3_reset.";
-        return Status(sqlite3_errmsg(m_DBImpl->db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+        return status;
     }
 
-    sqlRet = mapping_traits<K>::bind(m_DBImpl->delSQL, 1, key);
-    if(SQLITE_OK != sqlRet)
+    status = applyBatch(updates);
+    if(!status.ok())
     {
-        std::string databaseErr = "Fail to bind key.";
-        return Status(sqlite3_errmsg(m_DBImpl->db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+        stepSQL(m_DBImpl->db, m_DBImpl->rollbackSQL);
+        return status;
     }
 
-    sqlRet = sqlite3_step(m_DBImpl->delSQL);
-    if(SQLITE_DONE != sqlRet)
+    status = stepSQL(m_DBImpl->db, m_DBImpl->commitSQL);
+    if(!status.ok())
     {
-        std::string databaseErr = "Fail to sqlite3_step.";
-        return Status(sqlite3_errmsg(m_DBImpl->db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+        stepSQL(m_DBImpl->db, m_DBImpl->rollbackSQL);
+        return status;
     }
-
-    return Status();
+    return status;
 }
 
 template<typename K, typename V>
-Status DB<K, V>::write(const WriteOptions & options, WriteBatch<K, V>* updates)
+Status DB<K, V>::write(const WriteOptions & options, MultiWriteBatch * updates)
 {
-    Status status;
-    int sqlRet = 0;
-    std::lock_guard<std::mutex> locker(m_DBImpl->mutex);
-
-    if(m_DBImpl->syncWrite != options.sync)
+    const auto & list = updates->getList();
+    for(auto iter = list.begin(); iter != list.end(); ++iter)
     {
-        m_DBImpl->syncWrite = options.sync;
-        status = setSync(m_DBImpl->db, m_DBImpl->syncWrite);
-        if(!status.ok())
+        if(iter->dbImpl->connection != m_DBImpl->connection)
         {
-            return status;
+            return Status("", "Invalid argument, a batch belongs to a DB on another connection.", Status::InvalidArgument, "0");
         }
     }
 
+    std::lock_guard<std::mutex> locker(m_DBImpl->mutex);
+
+    Status status = m_DBImpl->applyWriteOptions(options);
+    if(!status.ok())
     {
-        status = execSQL(m_DBImpl->db, "BEGIN");
-        if(!status.ok())
-        {
-            return status;
-        }
+        return status;
+    }
+
+    /* A single transaction of the shared connection covers every keyspace */
+    status = stepSQL(m_DBImpl->db, m_DBImpl->beginSQL);
+    if(!status.ok())
+    {
+        return status;
+    }
+
+    for(auto iter = list.begin(); iter != list.end() && status.ok(); ++iter)
+    {
+        status = iter->apply();
+    }
+    if(!status.ok())
+    {
+        stepSQL(m_DBImpl->db, m_DBImpl->rollbackSQL);
+        return status;
+    }
+
+    status = stepSQL(m_DBImpl->db, m_DBImpl->commitSQL);
+    if(!status.ok())
+    {
+        stepSQL(m_DBImpl->db, m_DBImpl->rollbackSQL);
     }
+    return status;
+}
 
-    auto list = updates->getList();
+template<typename K, typename V>
+Status DB<K, V>::applyBatch(WriteBatch<K, V> * updates)
+{
+    Status status;
+    const auto & list = updates->getList();
     for(auto iter = list.begin(); iter != list.end(); ++iter)
     {
         if(WriteBatch<K, V>::NodeType::PUT == iter->type)
         {
-            status = [&]()->Status {
-                sqlRet= sqlite3_reset(m_DBImpl->putSQL);
-                if(SQLITE_OK != sqlRet)
-                {
-                    std::string databaseErr = "Fail to sqlite3_reset.";
-                    return Status(sqlite3_errmsg(m_DBImpl->db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
-                }
-
-                sqlRet = mapping_traits<K>::bind(m_DBImpl->putSQL, 1, iter->key);
-                if(SQLITE_OK != sqlRet)
-                {
-                    std::string databaseErr = "Fail to bind key.";
-                    return Status(sqlite3_errmsg(m_DBImpl->db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
-                }
-
-                sqlRet = mapping_traits<V>::bind(m_DBImpl->putSQL, 2, iter->value);
-                if(SQLITE_OK != sqlRet)
-                {
-                    std::string databaseErr = "Fail to bind value.";
-                    return Status(sqlite3_errmsg(m_DBImpl->db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
-                }
-
-                sqlRet = sqlite3_step(m_DBImpl->putSQL);
-                if(SQLITE_DONE != sqlRet)
-                {
-                    std::string databaseErr = "Fail to sqlite3_step.";
-                    return Status(sqlite3_errmsg(m_DBImpl->db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
-                }
-                return Status();
-            }();
+            status = m_DBImpl->putRow(iter->key, iter->value);
         }
         else if(WriteBatch<K, V>::NodeType::DEL == iter->type)
         {
-            status = [&]()->Status {
-                sqlRet= sqlite3_reset(m_DBImpl->delSQL);
-                if(SQLITE_OK != sqlRet)
-                {
-                    std::string databaseErr = "Fail to sqlite3_reset.";
-                    return Status(sqlite3_errmsg(m_DBImpl->db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
-                }
-
-                sqlRet = mapping_traits<K>::bind(m_DBImpl->delSQL, 1, iter->key);
-                if(SQLITE_OK != sqlRet)
-                {
-                    std::string databaseErr = "Fail to bind key.";
-                    return Status(sqlite3_errmsg(m_DBImpl->db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
-                }
-
-                sqlRet = sqlite3_step(m_DBImpl->delSQL);
-                if(SQLITE_DONE != sqlRet)
-                {
-                    std::string databaseErr = "Fail to sqlite3_step.";
-                    return Status(sqlite3_errmsg(m_DBImpl->db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
-                }
-                return Status();
-            }();
+            status = m_DBImpl->delRow(iter->key);
+        }
+        else if(WriteBatch<K, V>::NodeType::MERGE == iter->type)
+        {
+            status = m_DBImpl->mergeRow(iter->key, iter->value, iter->mergeOperator);
         }
 
         if(!status.ok())
@@ -478,24 +1356,46 @@ Status DB<K, V>::write(const WriteOptions & options, WriteBatch<K, V>* updates)
             break;
         }
     }
+    return status;
+}
 
-    if(!status.ok())
+template<typename K, typename V>
+Status DB<K, V>::beginTransaction(Transaction<K, V> ** ppTxn)
+{
+    if(nullptr == ppTxn)
     {
-        execSQL(m_DBImpl->db, "ROLLBACK");
-        return status;
+        return Status("", "Invalid argument, ppTxn is null.", Status::InvalidArgument, "0");
     }
 
+    *ppTxn = new(std::nothrow) Transaction<K, V>(m_DBImpl);
+    if(nullptr == *ppTxn)
     {
-        status = execSQL(m_DBImpl->db, "COMMIT");
-        if(!status.ok())
-        {
-            execSQL(m_DBImpl->db, "ROLLBACK");
-            return status;
-        }
+        return Status("", "Fail to new.", Status::UnknownError, "0");
+    }
+    return Status();
+}
+
+template<typename K, typename V>
+Status DB<K, V>::getSnapshot(const Snapshot ** ppSnapshot)
+{
+    if(nullptr == ppSnapshot)
+    {
+        return Status("", "Invalid argument, ppSnapshot is null.", Status::InvalidArgument, "0");
     }
+
+    std::lock_guard<std::mutex> locker(m_DBImpl->mutex);
+    SnapshotImpl * pSnapshot = nullptr;
+    Status status = m_DBImpl->newSnapshot(&pSnapshot);
+    *ppSnapshot = pSnapshot;
     return status;
 }
 
+template<typename K, typename V>
+void DB<K, V>::releaseSnapshot(const Snapshot * snapshot)
+{
+    delete static_cast<const SnapshotImpl *>(snapshot);
+}
+
 template<typename K, typename V>
 DB<K, V>::DB()
 {
@@ -505,6 +1405,10 @@ DB<K, V>::DB()
 template<typename K, typename V>
 void DB<K, V>::close()
 {
+    m_DBImpl->stopPurger();
+    m_DBImpl->stopCollector();
+    m_DBImpl->stopWarmer();
+
     std::lock_guard<std::mutex> locker(m_DBImpl->mutex);
 
     if(m_DBImpl->getSQL)
@@ -522,11 +1426,84 @@ void DB<K, V>::close()
         sqlite3_finalize(m_DBImpl->delSQL);
         m_DBImpl->delSQL = nullptr;
     }
+    if(m_DBImpl->beginSQL)
+    {
+        sqlite3_finalize(m_DBImpl->beginSQL);
+        m_DBImpl->beginSQL = nullptr;
+    }
+    if(m_DBImpl->commitSQL)
+    {
+        sqlite3_finalize(m_DBImpl->commitSQL);
+        m_DBImpl->commitSQL = nullptr;
+    }
+    if(m_DBImpl->rollbackSQL)
+    {
+        sqlite3_finalize(m_DBImpl->rollbackSQL);
+        m_DBImpl->rollbackSQL = nullptr;
+    }
+    for(auto & stmt : m_DBImpl->mergeSQL)
+    {
+        sqlite3_finalize(stmt);
+        stmt = nullptr;
+    }
+    for(auto & item : m_DBImpl->customMergeSQL)
+    {
+        sqlite3_finalize(item.second);
+    }
+    m_DBImpl->customMergeSQL.clear();
+    if(m_DBImpl->putIfAbsentSQL)
+    {
+        sqlite3_finalize(m_DBImpl->putIfAbsentSQL);
+        m_DBImpl->putIfAbsentSQL = nullptr;
+    }
+    if(m_DBImpl->compareAndSwapSQL)
+    {
+        sqlite3_finalize(m_DBImpl->compareAndSwapSQL);
+        m_DBImpl->compareAndSwapSQL = nullptr;
+    }
+    if(m_DBImpl->getAndSetSQL)
+    {
+        sqlite3_finalize(m_DBImpl->getAndSetSQL);
+        m_DBImpl->getAndSetSQL = nullptr;
+    }
+    if(m_DBImpl->putExpireSQL)
+    {
+        sqlite3_finalize(m_DBImpl->putExpireSQL);
+        m_DBImpl->putExpireSQL = nullptr;
+    }
+    if(m_DBImpl->purgeSQL)
+    {
+        sqlite3_finalize(m_DBImpl->purgeSQL);
+        m_DBImpl->purgeSQL = nullptr;
+    }
+    if(m_DBImpl->countSQL)
+    {
+        sqlite3_finalize(m_DBImpl->countSQL);
+        m_DBImpl->countSQL = nullptr;
+    }
+    if(m_DBImpl->locateSQL)
+    {
+        sqlite3_finalize(m_DBImpl->locateSQL);
+        m_DBImpl->locateSQL = nullptr;
+    }
+    if(m_DBImpl->echoSQL)
+    {
+        sqlite3_finalize(m_DBImpl->echoSQL);
+        m_DBImpl->echoSQL = nullptr;
+    }
+    if(m_DBImpl->statsSQL)
+    {
+        sqlite3_finalize(m_DBImpl->statsSQL);
+        m_DBImpl->statsSQL = nullptr;
+    }
+    sqlite3_value_free(m_DBImpl->exchangedValue);
+    m_DBImpl->exchangedValue = nullptr;
+    /* The connection itself is closed with the last DB using it */
     if(m_DBImpl->db)
     {
-        sqlite3_close(m_DBImpl->db);
-        m_DBImpl->db = nullptr;
+        m_DBImpl->releaseSchema();
     }
+    m_DBImpl->db = nullptr;
 }
 
 /* Those stupid code in order to put template class implementation in .cpp file.
@@ -562,5 +1539,60 @@ template class DB<Slice, double>;
 template class DB<Slice, std::string>;
 template class DB<Slice, Slice>;
 
+/* Tuple keys, see the description of DB */
+template class DB<std::tuple<int64_t, int64_t>, int>;
+template class DB<std::tuple<int64_t, int64_t>, int64_t>;
+template class DB<std::tuple<int64_t, int64_t>, double>;
+template class DB<std::tuple<int64_t, int64_t>, std::string>;
+template class DB<std::tuple<int64_t, int64_t>, Slice>;
+
+template class DB<std::tuple<int64_t, double>, int>;
+template class DB<std::tuple<int64_t, double>, int64_t>;
+template class DB<std::tuple<int64_t, double>, double>;
+template class DB<std::tuple<int64_t, double>, std::string>;
+template class DB<std::tuple<int64_t, double>, Slice>;
+
+template class DB<std::tuple<int64_t, std::string>, int>;
+template class DB<std::tuple<int64_t, std::string>, int64_t>;
+template class DB<std::tuple<int64_t, std::string>, double>;
+template class DB<std::tuple<int64_t, std::string>, std::string>;
+template class DB<std::tuple<int64_t, std::string>, Slice>;
+
+template class DB<std::tuple<double, int64_t>, int>;
+template class DB<std::tuple<double, int64_t>, int64_t>;
+template class DB<std::tuple<double, int64_t>, double>;
+template class DB<std::tuple<double, int64_t>, std::string>;
+template class DB<std::tuple<double, int64_t>, Slice>;
+
+template class DB<std::tuple<double, double>, int>;
+template class DB<std::tuple<double, double>, int64_t>;
+template class DB<std::tuple<double, double>, double>;
+template class DB<std::tuple<double, double>, std::string>;
+template class DB<std::tuple<double, double>, Slice>;
+
+template class DB<std::tuple<double, std::string>, int>;
+template class DB<std::tuple<double, std::string>, int64_t>;
+template class DB<std::tuple<double, std::string>, double>;
+template class DB<std::tuple<double, std::string>, std::string>;
+template class DB<std::tuple<double, std::string>, Slice>;
+
+template class DB<std::tuple<std::string, int64_t>, int>;
+template class DB<std::tuple<std::string, int64_t>, int64_t>;
+template class DB<std::tuple<std::string, int64_t>, double>;
+template class DB<std::tuple<std::string, int64_t>, std::string>;
+template class DB<std::tuple<std::string, int64_t>, Slice>;
+
+template class DB<std::tuple<std::string, double>, int>;
+template class DB<std::tuple<std::string, double>, int64_t>;
+template class DB<std::tuple<std::string, double>, double>;
+template class DB<std::tuple<std::string, double>, std::string>;
+template class DB<std::tuple<std::string, double>, Slice>;
+
+template class DB<std::tuple<std::string, std::string>, int>;
+template class DB<std::tuple<std::string, std::string>, int64_t>;
+template class DB<std::tuple<std::string, std::string>, double>;
+template class DB<std::tuple<std::string, std::string>, std::string>;
+template class DB<std::tuple<std::string, std::string>, Slice>;
+
 }/* end of namespace KVSQLite */
 
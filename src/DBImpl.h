@@ -0,0 +1,3193 @@
+/**
+ * @file DBImpl.h
+ * @brief Internal state shared by DB and the objects it hands out. Not installed.
+ */
+
+#ifndef _KVSQLITE_DB_IMPL_H_
+#define _KVSQLITE_DB_IMPL_H_
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <tuple>
+#include "sqlite3.h"
+#include "BTreeReader.h"
+#include "DirectReader.h"
+#include "IoStats.h"
+#include "KeyEncoding.h"
+#include "ValueLog.h"
+#include "KVSQLite/Compressor.h"
+#include "KVSQLite/MergeOperator.h"
+#include "KVSQLite/Options.h"
+#include "KVSQLite/Slice.h"
+#include "KVSQLite/Snapshot.h"
+#include "KVSQLite/Status.h"
+
+namespace KVSQLite
+{
+
+template<typename T>
+struct mapping_traits
+{
+};
+
+template<>
+struct mapping_traits<int>
+{
+public:
+    static constexpr int storage = SQLITE_INTEGER;
+    static int bind(sqlite3_stmt *stmt, const int &idx, const int &val)
+    {
+        return sqlite3_bind_int(stmt, idx, val);
+    }
+    static int getColumn(sqlite3_stmt *stmt, const int &idx)
+    {
+        return sqlite3_column_int(stmt, idx);
+    }
+    static int fromValue(sqlite3_value *val)
+    {
+        return sqlite3_value_int(val);
+    }
+    static void result(sqlite3_context *ctx, const int &val)
+    {
+        sqlite3_result_int(ctx, val);
+    }
+    /* The value as bound, and read back from a record of the file: false where getColumn() would convert */
+    static void toStored(const int &val, StoredValue &stored)
+    {
+        stored.type = SQLITE_INTEGER;
+        stored.i = val;
+    }
+    static bool fromColumn(const RecordColumn &column, int &val)
+    {
+        val = (int)column.i;
+        return SQLITE_INTEGER == column.type;
+    }
+};
+
+template<>
+struct mapping_traits<int64_t>
+{
+public:
+    static constexpr int storage = SQLITE_INTEGER;
+    static int bind(sqlite3_stmt *stmt, const int &idx, const int64_t &val)
+    {
+        return sqlite3_bind_int64(stmt, idx, val);
+    }
+    static int64_t getColumn(sqlite3_stmt *stmt, const int &idx)
+    {
+        return sqlite3_column_int64(stmt, idx);
+    }
+    static int64_t fromValue(sqlite3_value *val)
+    {
+        return sqlite3_value_int64(val);
+    }
+    static void result(sqlite3_context *ctx, const int64_t &val)
+    {
+        sqlite3_result_int64(ctx, val);
+    }
+    static void toStored(const int64_t &val, StoredValue &stored)
+    {
+        stored.type = SQLITE_INTEGER;
+        stored.i = val;
+    }
+    static bool fromColumn(const RecordColumn &column, int64_t &val)
+    {
+        val = column.i;
+        return SQLITE_INTEGER == column.type;
+    }
+};
+
+template<>
+struct mapping_traits<double>
+{
+public:
+    static constexpr int storage = SQLITE_FLOAT;
+    static int bind(sqlite3_stmt *stmt, const int &idx, const double &val)
+    {
+        return sqlite3_bind_double(stmt, idx, val);
+    }
+    static double getColumn(sqlite3_stmt *stmt, const int &idx)
+    {
+        return sqlite3_column_double(stmt, idx);
+    }
+    static double fromValue(sqlite3_value *val)
+    {
+        return sqlite3_value_double(val);
+    }
+    static void result(sqlite3_context *ctx, const double &val)
+    {
+        sqlite3_result_double(ctx, val);
+    }
+    static void toStored(const double &val, StoredValue &stored)
+    {
+        stored.type = SQLITE_FLOAT;
+        stored.d = val;
+    }
+    static bool fromColumn(const RecordColumn &column, double &val)
+    {
+        val = column.d;
+        return SQLITE_FLOAT == column.type;
+    }
+};
+
+template<>
+struct mapping_traits<std::string>
+{
+public:
+    static constexpr int storage = SQLITE_TEXT;
+    static int bind(sqlite3_stmt *stmt, const int &idx, const std::string &val)
+    {
+        return sqlite3_bind_text(stmt, idx, val.c_str(), val.length() + 1, SQLITE_TRANSIENT);
+    }
+    static std::string getColumn(sqlite3_stmt *stmt, const int &idx) 
+    {
+        const char * p = (char *)sqlite3_column_text(stmt, idx);
+        return p ? p : "";
+    }
+    static std::string fromValue(sqlite3_value *val)
+    {
+        const char * p = (char *)sqlite3_value_text(val);
+        return p ? p : "";
+    }
+    /* Like bind(), the terminating NUL is stored too */
+    static void result(sqlite3_context *ctx, const std::string &val)
+    {
+        sqlite3_result_text(ctx, val.c_str(), val.length() + 1, SQLITE_TRANSIENT);
+    }
+    static void toStored(const std::string &val, StoredValue &stored)
+    {
+        stored.type = SQLITE_TEXT;
+        stored.bytes.assign(val.c_str(), val.length() + 1);
+    }
+    /* Up to the first NUL, as sqlite3_column_text() is read */
+    static bool fromColumn(const RecordColumn &column, std::string &val)
+    {
+        if(SQLITE_TEXT != column.type)
+        {
+            return false;
+        }
+        const char * nul = (const char *)memchr(column.bytes, '\0', column.size);
+        val.assign(column.bytes, nul ? nul - column.bytes : column.size);
+        return true;
+    }
+};
+
+template<>
+struct mapping_traits<KVSQLite::Slice>
+{
+public:
+    static constexpr int storage = SQLITE_BLOB;
+    static int bind(sqlite3_stmt *stmt, const int &idx, const Slice &val)
+    {
+        return sqlite3_bind_blob(stmt, idx, val.data(), val.size(), SQLITE_STATIC);
+    }
+    static KVSQLite::Slice getColumn(sqlite3_stmt *stmt, const int &idx)
+    {
+        const char * p = (char *)sqlite3_column_blob(stmt, idx);
+        int size = sqlite3_column_bytes(stmt, idx);
+        if(p)
+        {
+            return Slice(p, size);
+        }
+        else
+        {
+            return Slice();
+        }
+    }
+    static KVSQLite::Slice fromValue(sqlite3_value *val)
+    {
+        const char * p = (char *)sqlite3_value_blob(val);
+        int size = sqlite3_value_bytes(val);
+        return p ? Slice(p, size) : Slice();
+    }
+    static void result(sqlite3_context *ctx, const Slice &val)
+    {
+        sqlite3_result_blob(ctx, val.data(), val.size(), SQLITE_TRANSIENT);
+    }
+    static void toStored(const Slice &val, StoredValue &stored)
+    {
+        stored.type = SQLITE_BLOB;
+        stored.bytes.assign(val.data(), val.size());
+    }
+    /* Not copied: the Slice points into the record */
+    static bool fromColumn(const RecordColumn &column, Slice &val)
+    {
+        val = (column.size > 0) ? Slice(column.bytes, column.size) : Slice();
+        return SQLITE_BLOB == column.type;
+    }
+};
+
+/* A value of size zero bytes, bound to reserve the room a ValueWriter fills in */
+struct ZeroBlob
+{
+    int64_t size;
+};
+
+template<>
+struct mapping_traits<ZeroBlob>
+{
+public:
+    static int bind(sqlite3_stmt *stmt, const int &idx, const ZeroBlob &val)
+    {
+        return sqlite3_bind_zeroblob64(stmt, idx, val.size);
+    }
+};
+
+/*
+ * Type used to keep a copy of a key or value after the caller's object is
+ * gone. A Slice only refers to memory owned by somebody else.
+ */
+template<typename T>
+struct storage_traits
+{
+public:
+    typedef T type;
+    static const T & store(const T & val)
+    {
+        return val;
+    }
+    static const T & view(const T & val)
+    {
+        return val;
+    }
+};
+
+template<>
+struct storage_traits<KVSQLite::Slice>
+{
+public:
+    typedef std::string type;
+    static std::string store(const Slice & val)
+    {
+        return val.toString();
+    }
+    static Slice view(const std::string & val)
+    {
+        return Slice(val);
+    }
+};
+
+/*
+ * Values that may be moved to the value log or compressed: their bytes, and
+ * the value read back from the log or uncompressed, a Slice pointing into
+ * buffer.
+ */
+template<typename T>
+struct value_log_traits
+{
+public:
+    static constexpr bool separable = false;
+    static bool bytes(const T &, const char *&, size_t &)
+    {
+        return false;
+    }
+    static T fromBytes(const std::string &)
+    {
+        return T();
+    }
+};
+
+template<>
+struct value_log_traits<std::string>
+{
+public:
+    static constexpr bool separable = true;
+    static bool bytes(const std::string & val, const char *& data, size_t & size)
+    {
+        data = val.data();
+        size = val.size();
+        return true;
+    }
+    static std::string fromBytes(const std::string & buffer)
+    {
+        return buffer;
+    }
+};
+
+template<>
+struct value_log_traits<KVSQLite::Slice>
+{
+public:
+    static constexpr bool separable = true;
+    static bool bytes(const Slice & val, const char *& data, size_t & size)
+    {
+        data = val.data();
+        size = val.size();
+        return true;
+    }
+    static Slice fromBytes(const std::string & buffer)
+    {
+        return Slice(buffer);
+    }
+};
+
+/*
+ * The same merge operators applied in C++, for updates that are staged in a
+ * WriteBatchWithIndex and not written yet. A Slice result is kept in buffer.
+ */
+template<typename T>
+struct merge_traits
+{
+public:
+    static T merge(MergeOperator op, const T & value, const T & operand, std::string &)
+    {
+        switch(op)
+        {
+        case MERGE_ADD:
+            return value + operand;
+        case MERGE_MIN:
+            return std::min(value, operand);
+        case MERGE_MAX:
+            return std::max(value, operand);
+        default:
+            return operand;
+        }
+    }
+};
+
+template<>
+struct merge_traits<std::string>
+{
+public:
+    static std::string merge(MergeOperator op, const std::string & value, const std::string & operand, std::string &)
+    {
+        switch(op)
+        {
+        case MERGE_MIN:
+            return std::min(value, operand);
+        case MERGE_MAX:
+            return std::max(value, operand);
+        case MERGE_APPEND:
+            return value + operand;
+        default:
+            return operand;
+        }
+    }
+};
+
+template<>
+struct merge_traits<KVSQLite::Slice>
+{
+public:
+    static Slice merge(MergeOperator op, const Slice & value, const Slice & operand, std::string & buffer)
+    {
+        switch(op)
+        {
+        case MERGE_MIN:
+            return (operand.compare(value) < 0) ? operand : value;
+        case MERGE_MAX:
+            return (operand.compare(value) > 0) ? operand : value;
+        case MERGE_APPEND:
+            {
+                /* value may already point into buffer */
+                std::string merged;
+                merged.reserve(value.size() + operand.size());
+                merged.append(value.data(), value.size());
+                merged.append(operand.data(), operand.size());
+                buffer.swap(merged);
+                return Slice(buffer);
+            }
+        default:
+            return operand;
+        }
+    }
+};
+
+static inline bool mergeSupported(MergeOperator op, int storage)
+{
+    bool numeric = (SQLITE_INTEGER == storage) || (SQLITE_FLOAT == storage);
+    switch(op)
+    {
+    case MERGE_ADD:
+        return numeric;
+    case MERGE_MIN:
+    case MERGE_MAX:
+        return true;
+    case MERGE_APPEND:
+        return !numeric;
+    default:
+        return false;
+    }
+}
+
+/* SQL expression that combines the stored "value" with the operand bound to ?2 */
+static inline std::string mergeExpression(MergeOperator op, int storage)
+{
+    switch(op)
+    {
+    case MERGE_ADD:
+        return "value + ?2";
+    case MERGE_MIN:
+        return "min(value, ?2)";
+    case MERGE_MAX:
+        return "max(value, ?2)";
+    case MERGE_APPEND:
+    default:
+        /* Text is stored with its terminating NUL, length() stops right before it */
+        return (SQLITE_TEXT == storage) ? "substr(value, 1, length(value)) || ?2" : "CAST(value || ?2 AS BLOB)";
+    }
+}
+
+/*
+ * Smallest byte string greater than every string starting with prefix, false
+ * if there is none (prefix is empty or made of 0xff bytes only).
+ */
+static inline bool prefixSuccessor(const char * data, size_t size, std::string & buffer)
+{
+    buffer.assign(data, size);
+    while(!buffer.empty() && '\xff' == buffer.back())
+    {
+        buffer.pop_back();
+    }
+    if(buffer.empty())
+    {
+        return false;
+    }
+    buffer.back() = (char)((unsigned char)buffer.back() + 1);
+    return true;
+}
+
+/*
+ * Prefix queries turn a prefix into the key range [prefix, upper), which the
+ * primary key index answers with a seek. Only keys compared as bytes, i.e.
+ * std::string and Slice, have such a range. A std::string is bound with its
+ * terminating NUL, which sorts before any other byte, so binding the prefix
+ * and the successor the same way as keys gives the right bounds.
+ */
+template<typename K>
+struct prefix_traits
+{
+    static constexpr bool supported = false;
+    static bool upperBound(const K &, std::string &, K &)
+    {
+        return false;
+    }
+};
+
+template<>
+struct prefix_traits<std::string>
+{
+    static constexpr bool supported = true;
+    static bool upperBound(const std::string & prefix, std::string & buffer, std::string & upper)
+    {
+        if(!prefixSuccessor(prefix.data(), prefix.size(), buffer))
+        {
+            return false;
+        }
+        upper = buffer;
+        return true;
+    }
+};
+
+template<>
+struct prefix_traits<Slice>
+{
+    static constexpr bool supported = true;
+    static bool upperBound(const Slice & prefix, std::string & buffer, Slice & upper)
+    {
+        if(!prefixSuccessor(prefix.data(), prefix.size(), buffer))
+        {
+            return false;
+        }
+        upper = Slice(buffer);
+        return true;
+    }
+};
+
+/*
+ * A tuple key is stored in one column per component, "key", "key_1",
+ * "key_2"... and the primary key spans all of them. Component i of a key
+ * bound to ?n is bound to ?(n + i * keyParamStride), so that statements can
+ * keep numbering their other parameters as for a single column key.
+ */
+static const int keyParamStride = 10;
+
+template<typename K>
+struct key_traits
+{
+    static constexpr int components = 1;
+    /* Definitions of the key columns, a single key column has no declared type */
+    static std::string columns()
+    {
+        return "key";
+    }
+    /* Bind key to parameter idx, in its order-preserving form if encode is set */
+    static int bind(sqlite3_stmt * stmt, int idx, const K & key, bool encode, int)
+    {
+        if(!encode)
+        {
+            return mapping_traits<K>::bind(stmt, idx, key);
+        }
+        std::string bytes;
+        key_encoding<K>::encode(key, bytes);
+        return sqlite3_bind_blob(stmt, idx, bytes.data(), bytes.size(), SQLITE_TRANSIENT);
+    }
+    /* The key as stored in the file, see DirectReader */
+    static bool stored(const K & key, bool encode, StoredValue & value)
+    {
+        if(!encode)
+        {
+            mapping_traits<K>::toStored(key, value);
+            return true;
+        }
+        value.type = SQLITE_BLOB;
+        key_encoding<K>::encode(key, value.bytes);
+        return true;
+    }
+    /* Read a key from column idx, false if an encoded key is malformed */
+    static bool column(sqlite3_stmt * stmt, int idx, K & key, bool encode)
+    {
+        if(!encode)
+        {
+            key = mapping_traits<K>::getColumn(stmt, idx);
+            return true;
+        }
+        const char * p = (const char *)sqlite3_column_blob(stmt, idx);
+        int size = sqlite3_column_bytes(stmt, idx);
+        return key_encoding<K>::decode(p ? p : "", size, key);
+    }
+};
+
+/* Declared type of a column holding values of the storage class */
+static inline const char * columnType(int storage)
+{
+    switch(storage)
+    {
+    case SQLITE_INTEGER:
+        return "INTEGER";
+    case SQLITE_FLOAT:
+        return "REAL";
+    case SQLITE_TEXT:
+        return "TEXT";
+    default:
+        return "BLOB";
+    }
+}
+
+/* Components I and up of a tuple key */
+template<typename Tuple, size_t I = 0, bool End = (I == std::tuple_size<Tuple>::value)>
+struct tuple_key_traits
+{
+    typedef typename std::tuple_element<I, Tuple>::type Component;
+    /* Each component column gets the type of the component */
+    static std::string columns()
+    {
+        const std::string name = (0 == I) ? "key" : ", key_" + std::to_string(I);
+        return name + " " + columnType(mapping_traits<Component>::storage) + tuple_key_traits<Tuple, I + 1>::columns();
+    }
+    static int bind(sqlite3_stmt * stmt, int idx, const Tuple & key, bool encode, int count)
+    {
+        if((int)I >= count)
+        {
+            return SQLITE_OK;
+        }
+        int sqlRet = key_traits<Component>::bind(stmt, idx + (int)I * keyParamStride, std::get<I>(key), encode, 1);
+        if(SQLITE_OK != sqlRet)
+        {
+            return sqlRet;
+        }
+        return tuple_key_traits<Tuple, I + 1>::bind(stmt, idx, key, encode, count);
+    }
+    static bool column(sqlite3_stmt * stmt, int idx, Tuple & key, bool encode)
+    {
+        return key_traits<Component>::column(stmt, idx + (int)I, std::get<I>(key), encode) &&
+            tuple_key_traits<Tuple, I + 1>::column(stmt, idx, key, encode);
+    }
+};
+
+template<typename Tuple, size_t I>
+struct tuple_key_traits<Tuple, I, true>
+{
+    static std::string columns()
+    {
+        return "";
+    }
+    static int bind(sqlite3_stmt *, int, const Tuple &, bool, int)
+    {
+        return SQLITE_OK;
+    }
+    static bool column(sqlite3_stmt *, int, Tuple &, bool)
+    {
+        return true;
+    }
+};
+
+/* count limits the binding to the leading components, see DBImpl::keyPrefixEquals() */
+template<typename... Ks>
+struct key_traits<std::tuple<Ks...>>
+{
+    static constexpr int components = sizeof...(Ks);
+    static std::string columns()
+    {
+        return tuple_key_traits<std::tuple<Ks...>>::columns();
+    }
+    static int bind(sqlite3_stmt * stmt, int idx, const std::tuple<Ks...> & key, bool encode, int count)
+    {
+        return tuple_key_traits<std::tuple<Ks...>>::bind(stmt, idx, key, encode, count);
+    }
+    static bool column(sqlite3_stmt * stmt, int idx, std::tuple<Ks...> & key, bool encode)
+    {
+        return tuple_key_traits<std::tuple<Ks...>>::column(stmt, idx, key, encode);
+    }
+    /* Tuple keys span several columns, they are only looked up through SQL */
+    static bool stored(const std::tuple<Ks...> &, bool, StoredValue &)
+    {
+        return false;
+    }
+};
+
+template<typename V>
+struct MergeFunctionHolder
+{
+    std::function<V(const V *, const V &)> func;
+};
+
+/* SQL function (existing, operand) wrapping a merge function registered by the user */
+template<typename V>
+static void mergeFunctionCallback(sqlite3_context *ctx, int, sqlite3_value **argv)
+{
+    MergeFunctionHolder<V> * holder = (MergeFunctionHolder<V> *)sqlite3_user_data(ctx);
+    const V operand = mapping_traits<V>::fromValue(argv[1]);
+    if(SQLITE_NULL == sqlite3_value_type(argv[0]))
+    {
+        mapping_traits<V>::result(ctx, holder->func(nullptr, operand));
+    }
+    else
+    {
+        const V existing = mapping_traits<V>::fromValue(argv[0]);
+        mapping_traits<V>::result(ctx, holder->func(&existing, operand));
+    }
+}
+
+template<typename V>
+static void destroyMergeFunction(void * p)
+{
+    delete (MergeFunctionHolder<V> *)p;
+}
+
+static inline Status execSQL(sqlite3 * p, const std::string & sql)
+{
+    char *errmsg = nullptr;
+
+    /*
+     * If the 5th parameter to sqlite3_exec() is not NULL and no errors occur,
+     * then sqlite3_exec() sets the pointer in its 5th parameter to NULL before
+     * returning.
+     */
+    int sqlRet = sqlite3_exec(p, sql.c_str(), nullptr, nullptr, &errmsg);
+    if(SQLITE_OK != sqlRet)
+    {
+        std::string databaseErr = "Fail to exec:" + sql;
+        return Status(errmsg ? errmsg : "", databaseErr, Status::UnknownError, std::to_string(sqlRet));
+    }
+    return Status();
+}
+
+static inline Status prepareSQL(sqlite3 * p, const std::string & sql, sqlite3_stmt ** ppStmt)
+{
+    int sqlRet = sqlite3_prepare_v2(p, sql.c_str(), sql.size(), ppStmt, nullptr);
+    if(SQLITE_OK != sqlRet)
+    {
+        std::string databaseErr = "Fail to prepare:" + sql;
+        return Status(sqlite3_errmsg(p), databaseErr, Status::InvalidArgument, std::to_string(sqlRet));
+    }
+    return Status();
+}
+
+/* Run a query returning a single integer */
+static inline bool queryInt64(sqlite3 * p, const std::string & sql, int64_t & value)
+{
+    sqlite3_stmt * stmt = nullptr;
+    bool ok = (SQLITE_OK == sqlite3_prepare_v2(p, sql.c_str(), sql.size(), &stmt, nullptr)) &&
+        (SQLITE_ROW == sqlite3_step(stmt));
+    if(ok)
+    {
+        value = sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    return ok;
+}
+
+/* Id 0 means no compression, 1 is used by the levels of the built-in compressor only */
+static inline bool validCompressor(const Compressor * compressor)
+{
+    const int id = compressor->id();
+    if(1 == id)
+    {
+        for(int level = 1; level <= 9; level++)
+        {
+            if(Compressor::lz(level) == compressor)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+    return id > 1 && id <= 255;
+}
+
+static inline Status framedValueUnsupported()
+{
+    return Status("", "Invalid argument, not available on a table with a value log or compressed values.", Status::InvalidArgument, "0");
+}
+
+static inline Status readOnlyDB()
+{
+    return Status("", "Invalid argument, the database is opened with Options::read_only.", Status::InvalidArgument, "0");
+}
+
+/*
+ * Run a prepared statement that returns no rows and reset it, so that it can
+ * be reused without being parsed again.
+ */
+static inline Status stepSQL(sqlite3 * p, sqlite3_stmt * stmt)
+{
+    int sqlRet = sqlite3_step(stmt);
+    if(SQLITE_DONE != sqlRet)
+    {
+        std::string databaseErr = std::string("Fail to exec:") + sqlite3_sql(stmt);
+        Status status(sqlite3_errmsg(p), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+        sqlite3_reset(stmt);
+        return status;
+    }
+    sqlite3_reset(stmt);
+    return Status();
+}
+
+static inline const char * beginQuery(Options::TransactionMode mode)
+{
+    switch(mode)
+    {
+    case Options::Deferred:
+        return "BEGIN DEFERRED";
+    case Options::Exclusive:
+        return "BEGIN EXCLUSIVE";
+    case Options::Immediate:
+    default:
+        return "BEGIN IMMEDIATE";
+    }
+}
+
+/*
+ * URI of filename with the immutable parameter, for sqlite3_open_v2() with
+ * SQLITE_OPEN_URI: the characters a URI path can not hold as they are are
+ * escaped.
+ */
+static inline std::string immutableUri(const std::string & filename)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    std::string uri = "file:";
+#ifdef _WIN32
+    /* "C:\dir\file" becomes "file:/C:/dir/file" */
+    if(filename.size() >= 2 && ':' == filename[1])
+    {
+        uri += '/';
+    }
+#endif
+    for(unsigned char c : filename)
+    {
+#ifdef _WIN32
+        if('\\' == c)
+        {
+            uri += '/';
+            continue;
+        }
+#endif
+        if(('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || ('0' <= c && c <= '9') ||
+            '/' == c || '.' == c || '-' == c || '_' == c || '~' == c || ':' == c)
+        {
+            uri += (char)c;
+        }
+        else
+        {
+            uri += '%';
+            uri += hex[c >> 4];
+            uri += hex[c & 15];
+        }
+    }
+    return uri + "?immutable=1";
+}
+
+/*
+ * True if the table name ends like one of the side tables kept next to a
+ * table, see DBImpl::table(), so a keyspace of that name could be taken for
+ * a side table of another. SQLite compares table names case-insensitively.
+ */
+static inline bool hasSideTableSuffix(const std::string & name)
+{
+    static const char * const suffixes[] = {
+        "Meta", "Stats", "_expire", "_stats_insert", "_stats_update", "_stats_delete",
+        "_vlog", "_vlog_insert", "_vlog_update", "_vlog_delete", "_vlog_position"
+    };
+    for(const char * suffix : suffixes)
+    {
+        const size_t size = strlen(suffix);
+        if(name.size() >= size && 0 == sqlite3_strnicmp(name.c_str() + name.size() - size, suffix, (int)size))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Milliseconds since the epoch, the unit of the expire column */
+static inline int64_t toExpireTime(std::chrono::system_clock::time_point time)
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count();
+}
+
+/*
+ * SQL expression for the number of bytes of a key or a value: 8 for numbers,
+ * the size of a std::string without the terminating NUL it is stored with.
+ */
+static inline std::string byteLengthExpression(const std::string & column)
+{
+    return "(CASE typeof(" + column + ") WHEN 'integer' THEN 8 WHEN 'real' THEN 8 "
+        "WHEN 'text' THEN max(length(CAST(" + column + " AS BLOB)) - 1, 0) WHEN 'blob' THEN length(" + column + ") ELSE 0 END)";
+}
+
+/* PRAGMA synchronous is a setting of each attached database file, not of the connection */
+static inline Status setSync(sqlite3 *p, bool sync = true, const std::string & schema = "main")
+{
+    const std::string query = "PRAGMA " + schema + (sync ? ".synchronous = FULL;" : ".synchronous = OFF;");
+    return execSQL(p, query);
+}
+
+/* The memory mapping and the page cache of the connection, see Options::mmap_size */
+static inline Status setCaching(sqlite3 *p, const Options & options)
+{
+    Status status;
+    if(options.mmap_size > 0)
+    {
+        status = execSQL(p, "PRAGMA mmap_size = " + std::to_string(options.mmap_size));
+    }
+    if(status.ok() && options.cache_size > 0)
+    {
+        /* A negative cache_size is a number of KiB */
+        status = execSQL(p, "PRAGMA cache_size = -" + std::to_string((options.cache_size + 1023) / 1024));
+    }
+    if(status.ok() && options.mmap_chunk_size > 0)
+    {
+        int chunkSize = options.mmap_chunk_size;
+        sqlite3_file_control(p, "main", SQLITE_FCNTL_CHUNK_SIZE, &chunkSize);
+    }
+    return status;
+}
+
+/*
+ * A database connection, shared by the DB objects of all the keyspaces opened
+ * on it. Its mutex serializes every use of the connection, and it is closed
+ * once the last of them is gone, after each has finalized its statements.
+ */
+class Connection
+{
+public:
+    ~Connection()
+    {
+        sqlite3_close(db);
+        if(savesTrace)
+        {
+            ioStats->saveTrace();
+        }
+    }
+public:
+    sqlite3 *db = nullptr;
+    std::mutex mutex;
+    /* Last value given to PRAGMA synchronous, on every attached file alike */
+    bool syncWrite = false;
+    /* Opened with Options::read_only: nothing is created, no writer statement is prepared */
+    bool readOnly = false;
+    /* Opened with Options::immutable: the file never changes under the connection */
+    bool immutable = false;
+    struct AttachedFile
+    {
+        std::string filename;
+        /* DB objects using the file; at 0, DETACH failed and is tried again */
+        int users;
+    };
+    /* Database files attached to the connection, by schema name */
+    std::map<std::string, AttachedFile> attached;
+    int nextSchema = 0;
+    /*
+     * The VFS counting the I/O of db, released once db is closed. It is also
+     * there for the page trace of Options::warm_up_bytes, which the owner of
+     * the connection saves on close, but only shows its counters with
+     * Options::enable_io_stats.
+     */
+    std::shared_ptr<IoStats> ioStats;
+    bool countsIo = false;
+    bool savesTrace = false;
+};
+
+class SnapshotImpl;
+
+class DBImpl
+{
+public:
+    DBImpl(std::shared_ptr<Connection> shared = std::make_shared<Connection>())
+        : connection(shared), db(shared->db), mutex(shared->mutex)
+    {
+    }
+public:
+    std::shared_ptr<Connection> connection;
+    sqlite3 *db = nullptr;
+    sqlite3_stmt *putSQL = nullptr;
+    sqlite3_stmt *getSQL = nullptr;
+    sqlite3_stmt *delSQL = nullptr;
+    sqlite3_stmt *beginSQL = nullptr;
+    sqlite3_stmt *commitSQL = nullptr;
+    sqlite3_stmt *rollbackSQL = nullptr;
+    sqlite3_stmt *mergeSQL[MERGE_APPEND + 1] = {};
+    std::map<std::string, sqlite3_stmt *> customMergeSQL;
+    sqlite3_stmt *putIfAbsentSQL = nullptr;
+    sqlite3_stmt *compareAndSwapSQL = nullptr;
+    sqlite3_stmt *getAndSetSQL = nullptr;
+    sqlite3_stmt *putExpireSQL = nullptr;
+    sqlite3_stmt *purgeSQL = nullptr;
+    sqlite3_stmt *countSQL = nullptr;
+    sqlite3_stmt *locateSQL = nullptr;
+    sqlite3_stmt *echoSQL = nullptr;
+    sqlite3_stmt *statsSQL = nullptr;
+    sqlite3_value *exchangedValue = nullptr;
+    std::string mergeBuffer;
+    /* Slice values returned by the last multiGet() */
+    std::deque<std::string> multiGetBuffer;
+    /* Database the table lives in, "main" or the name a file is attached under */
+    std::string schema = "main";
+    std::string tableName = "KVTable";
+    std::mutex & mutex;
+    bool ttl = false;
+    bool stats = false;
+    bool encodeKeys = false;
+    int keyComponents = 1;
+    int purgeBatchSize = 1000;
+    std::thread purger;
+    std::condition_variable purgerWakeup;
+    bool purgerStopping = false;
+    /*
+     * Set when the table has the vsize column: a row where it is not NULL
+     * holds a frame, the id of a compressor (0 for none) followed by the
+     * bytes it made of the value, either in the value column or in the value
+     * log at the position stored there. vsize is the size of the frame.
+     */
+    bool framedValues = false;
+    /* Set to compress values, see Options::compressor */
+    const Compressor * compressor = nullptr;
+    int64_t compressionThreshold = INT64_MAX;
+    /* The frame of the value bound by bindValue(), until the statement is run */
+    std::string frameBuffer;
+    /* Set when the table keeps large values in a value log, see Options::value_log_threshold */
+    std::shared_ptr<ValueLog> valueLog;
+    int64_t valueLogThreshold = INT64_MAX;
+    double valueLogGCRatio = 0.5;
+    int valueLogBatchSize = 100;
+    /* Set when getRow() looks keys up in a mapping of the file, see Options::direct_reads */
+    std::shared_ptr<DirectReader> directReader;
+    int64_t directLookups = 0;
+    int64_t directFallbacks = 0;
+    /* A Slice value read from the value log or uncompressed by getRow() */
+    std::string valueLogBuffer;
+    std::thread collector;
+    std::condition_variable collectorWakeup;
+    bool collectorStopping = false;
+    /* The warm-up of Options::warm_up_in_background, and the bytes of the file it read */
+    std::thread warmer;
+    bool warmerStopping = false;
+    int64_t warmedBytes = 0;
+
+    /* Name of the table, or of one of its side tables, qualified by its schema for use in SQL */
+    std::string table(const std::string & suffix = "") const
+    {
+        return schema + "." + tableName + suffix;
+    }
+
+    /* Attach filename to the connection under a new schema, and keep the table there */
+    Status attachFile(const std::string & filename);
+
+    /* Keep the table in the schema of another DB of the connection */
+    void useSchema(const std::string & name);
+
+    /* Called by close(), detaches the file of the schema once no DB uses it */
+    void releaseSchema();
+
+    /*
+     * DETACH the files no DB uses. DETACH fails while a statement of the
+     * connection reads the file: those stay attached, and are tried again
+     * by the next attachFile() or releaseSchema().
+     */
+    void detachUnused();
+
+    /* Called by open() before any other statement is prepared */
+    Status enableTTL(int batchSize);
+
+    /*
+     * Called by open() before any statement using values is prepared: add
+     * the vsize column if values are to be compressed or moved, and open the
+     * value log of the table if it has one, or create it if requested.
+     */
+    Status enableValueFrames(const Options & options, bool separable);
+
+    /* Columns and parameters of a value in statements using one, "value, vsize" and "?2, ?6" with frames */
+    std::string valueColumns() const;
+    std::string valueParams() const;
+
+    /* SET clause of an UPSERT taking the value of the row it failed to insert */
+    std::string valueUpdate() const;
+
+    /* Called by open(), switches the file of the schema to WAL mode */
+    Status enableWAL();
+
+    /* Query of getSQL, ?1 being the key and ?2 the current time */
+    std::string getQuery() const;
+
+    /* Open a read transaction on a new connection to the file of the schema */
+    Status newSnapshot(SnapshotImpl ** ppSnapshot);
+
+    /* The DBImpl reads with options go to: this one, or the one of their snapshot */
+    Status readerFor(const ReadOptions & options, DBImpl ** ppReader);
+
+    /* Called by open(), creates the statistics table and its triggers if needed */
+    Status enableStats();
+
+    /*
+     * Called by open() on an immutable file, last: map it for getRow() if the
+     * table is one DirectReader can read, otherwise keys stay looked up
+     * through SQL.
+     */
+    Status enableDirectReads();
+
+    /*
+     * Called by open(), before any statement using keys is prepared: use the
+     * key encoding recorded in the database, or record the requested one.
+     */
+    Status setupKeyEncoding(bool requested);
+
+    /* Settings of the database file, kept in a side table created on first write */
+    Status readMeta(const std::string & name, std::string & value, bool & found);
+    Status writeMeta(const std::string & name, const std::string & value);
+
+    /* Key columns "key, key_1, ...", each name preceded by prefix, e.g. "NEW." */
+    std::string keyColumns(const std::string & prefix = "") const;
+
+    /* Parameters a key bound by bindKey(stmt, idx, key) takes, "?1, ?11, ..." */
+    std::string keyParams(int idx) const;
+
+    /*
+     * Compare the key columns with the key bound to idx, as a row value for a
+     * tuple key. Only the columns from component first on are compared.
+     */
+    std::string keyCompare(const std::string & op, int idx, int first = 0) const;
+
+    /* The leading components of the key equal those of the key bound to idx */
+    std::string keyPrefixEquals(int components, int idx) const;
+
+    /* SQL expression for the number of bytes of the key, see byteLengthExpression() */
+    std::string keyBytesExpression(const std::string & prefix = "") const;
+
+    void startPurger(int intervalMs);
+
+    /* Must be called without mutex held */
+    void stopPurger();
+
+    void startCollector(int intervalMs);
+
+    /* Must be called without mutex held */
+    void stopCollector();
+
+    /*
+     * Load the pages of the trace saved by the last close, or of the key index
+     * without one, into the operating system cache and then into SQLite's, up
+     * to budget bytes and timeMs milliseconds if not 0, see
+     * Options::warm_up_bytes. Takes mutex for a few pages at a time; must be
+     * called without it held.
+     */
+    void warmUp(const std::string & tracePath, int64_t budget, int timeMs);
+
+    void startWarmer(const std::string & tracePath, int64_t budget, int timeMs);
+
+    /* Must be called without mutex held */
+    void stopWarmer();
+
+    /* The following helpers must be called with mutex held. */
+
+    Status applyWriteOptions(const WriteOptions & options);
+
+    /* Bind the current time to parameter idx of stmt, for comparison with the expire column */
+    Status bindNow(sqlite3_stmt * stmt, int idx);
+
+    /* SET clause of an UPSERT that treats an expired row as missing, ?3 being bound to the current time */
+    std::string upsertSet(const std::string & liveValue, const std::string & expiredValue) const;
+
+    /* Remove at most purgeBatchSize expired rows, the earliest expired first */
+    Status purgeExpiredRows(int64_t & purged);
+
+    /*
+     * One step of the value log collector: move at most valueLogBatchSize
+     * values out of the closed segment with the largest share of garbage,
+     * or delete it once empty, adding its size to reclaimed. more is false
+     * when no segment needs collecting.
+     */
+    Status collectValueLog(int64_t & reclaimed, bool & more);
+
+    /*
+     * Bind value to ?2 of a statement writing it, or with frames, bind the
+     * frame of a compressed value, or the position of the frame in the value
+     * log, to ?2 and the size of the frame to ?6.
+     */
+    template<typename V>
+    Status bindValue(sqlite3_stmt * stmt, const V & value);
+
+    /* Replace value, read from column idx, by the one its frame holds if column idx + 1 is not NULL */
+    template<typename V>
+    Status resolveValue(sqlite3_stmt * stmt, int idx, V & value, std::string & buffer);
+
+    /* Decode a frame read from the table or the value log into value */
+    Status decodeFrame(const char * frame, size_t size, std::string & value);
+
+    template<typename K, typename V>
+    Status putExpireRow(const K & key, const V & value, int64_t expireAt);
+
+    /* Number of keys with lower <= key < upper, counted on the key index */
+    template<typename K>
+    Status countRows(const K & lower, const K & upper, int64_t & count);
+
+    /* Number of bytes of the keys and values with lower <= key < upper, read row by row */
+    template<typename K>
+    Status sizeRows(const K & lower, const K & upper, int64_t & size);
+
+    /* key as SQLite stores it */
+    template<typename K>
+    Status storedKey(const K & key, StoredValue & value);
+
+    /* Totals kept by the statistics triggers, see Options::enable_stats */
+    Status readStats(int64_t & keys, int64_t & keyBytes, int64_t & valueBytes);
+
+    /*
+     * Estimate the share of the key index in [lower, upper) and the number of
+     * entries in the whole index by descending the B-tree, and the bytes used
+     * by the database. false if the pages can not be read directly.
+     */
+    bool estimateRange(const StoredValue * lower, const StoredValue * upper, double & fraction, double & entries, int64_t & bytesInUse);
+
+    template<typename K, typename V>
+    Status putRow(const K & key, const V & value);
+
+    template<typename K, typename V>
+    Status mergeRow(const K & key, const V & operand, MergeOperator op);
+
+    template<typename K, typename V>
+    Status mergeRow(const K & key, const V & operand, const std::string & name);
+
+    template<typename K, typename V>
+    Status putIfAbsentRow(const K & key, const V & value);
+
+    template<typename K, typename V>
+    Status compareAndSwapRow(const K & key, const V & expected, const V & desired);
+
+    template<typename K, typename V>
+    Status getAndSetRow(const K & key, const V & value, V & oldValue, bool * existed);
+
+    template<typename V>
+    Status registerMergeFunction(const std::string & name, const std::function<V(const V *, const V &)> & func);
+
+    /* Bind a key to parameter idx, encoded if encodeKeys is set. Only the first
+     * components of a tuple key are bound. */
+    template<typename K>
+    int bindKey(sqlite3_stmt * stmt, int idx, const K & key, int components = key_traits<K>::components);
+
+    /* Read a key from column idx and up, false if an encoded key is malformed */
+    template<typename K>
+    bool columnKey(sqlite3_stmt * stmt, int idx, K & key);
+
+    /* Bind key to ?1 and value to ?2 of a statement returning no rows, and run it. See bindValue(). */
+    template<typename K, typename V>
+    Status stepRow(sqlite3_stmt * stmt, const K & key, const V & value);
+
+    template<typename K>
+    Status delRow(const K & key);
+
+    /*
+     * Delete the rows with lower <= key < upper, a null bound leaves that side
+     * open. With chunkSize > 0 at most chunkSize rows are deleted.
+     */
+    template<typename K>
+    Status deleteRangeRows(const K * lower, const K * upper, int chunkSize, int64_t & deleted);
+
+    template<typename K, typename V>
+    Status getRow(const K & key, V & value);
+
+    /* getRow() through directReader, false when SQL has to answer instead */
+    template<typename K, typename V>
+    bool directGetRow(const K & key, V & value, Status & status);
+
+    /* Rowid of the row of key and size of its value, for the blob handles of ValueReader and ValueWriter */
+    template<typename K>
+    Status locateRow(const K & key, int64_t & rowid, int64_t & size);
+
+    /* Open a blob handle on the value of rowid */
+    Status openBlob(int64_t rowid, bool write, sqlite3_blob ** ppBlob);
+
+    /* A value read by multiGet(), a Slice being copied to multiGetBuffer first */
+    template<typename V>
+    V keepValue(const V & value)
+    {
+        return value;
+    }
+};
+
+template<>
+inline Slice DBImpl::keepValue<Slice>(const Slice & value)
+{
+    multiGetBuffer.push_back(value.toString());
+    return Slice(multiGetBuffer.back());
+}
+
+/*
+ * A Snapshot is a read transaction left open on a connection of its own to
+ * the database file. In WAL mode it keeps reading the pages as of its first
+ * read while the DB goes on committing. reader describes the same table as
+ * the DB, in the main schema of that connection, and only prepares getSQL;
+ * iterators reading from the snapshot prepare theirs on it too.
+ */
+class SnapshotImpl : public Snapshot
+{
+public:
+    SnapshotImpl(const DBImpl * pOwner)
+        : owner(pOwner)
+    {
+        reader.tableName = owner->tableName;
+        reader.ttl = owner->ttl;
+        reader.encodeKeys = owner->encodeKeys;
+        reader.keyComponents = owner->keyComponents;
+        reader.framedValues = owner->framedValues;
+        reader.compressor = owner->compressor;
+        reader.valueLog = owner->valueLog;
+        if(reader.valueLog)
+        {
+            reader.valueLog->pin();
+        }
+    }
+    ~SnapshotImpl()
+    {
+        /* Closing the connection ends the read transaction */
+        sqlite3_finalize(reader.getSQL);
+        if(reader.valueLog)
+        {
+            reader.valueLog->unpin();
+        }
+    }
+public:
+    const DBImpl * owner = nullptr;
+    DBImpl reader;
+};
+
+inline Status DBImpl::applyWriteOptions(const WriteOptions & options)
+{
+    if(connection->readOnly)
+    {
+        return readOnlyDB();
+    }
+    if(connection->syncWrite != options.sync)
+    {
+        connection->syncWrite = options.sync;
+        Status status = setSync(db, connection->syncWrite);
+        for(auto iter = connection->attached.begin(); iter != connection->attached.end() && status.ok(); ++iter)
+        {
+            status = setSync(db, connection->syncWrite, iter->first);
+        }
+        return status;
+    }
+    return Status();
+}
+
+inline Status DBImpl::attachFile(const std::string & filename)
+{
+    /* A file still attached from an earlier use is taken again rather than attached twice */
+    detachUnused();
+    for(auto & item : connection->attached)
+    {
+        if(0 == item.second.users && filename == item.second.filename)
+        {
+            schema = item.first;
+            item.second.users = 1;
+            return Status();
+        }
+    }
+
+    const std::string name = "kvsqlite_" + std::to_string(connection->nextSchema++);
+    sqlite3_stmt * stmt = nullptr;
+    Status status = prepareSQL(db, "ATTACH DATABASE ?1 AS " + name, &stmt);
+    if(!status.ok())
+    {
+        return status;
+    }
+    sqlite3_bind_text(stmt, 1, filename.c_str(), filename.size(), SQLITE_TRANSIENT);
+    status = stepSQL(db, stmt);
+    sqlite3_finalize(stmt);
+    if(!status.ok())
+    {
+        return status;
+    }
+
+    /* The new file starts with the synchronous setting the others have */
+    status = setSync(db, connection->syncWrite, name);
+    if(!status.ok())
+    {
+        execSQL(db, "DETACH DATABASE " + name);
+        return status;
+    }
+    schema = name;
+    connection->attached[name] = Connection::AttachedFile{filename, 1};
+    return Status();
+}
+
+inline void DBImpl::useSchema(const std::string & name)
+{
+    schema = name;
+    if("main" != name)
+    {
+        connection->attached[name].users++;
+    }
+}
+
+inline void DBImpl::releaseSchema()
+{
+    auto iter = connection->attached.find(schema);
+    if(iter == connection->attached.end() || --iter->second.users > 0)
+    {
+        return;
+    }
+    detachUnused();
+}
+
+inline void DBImpl::detachUnused()
+{
+    for(auto iter = connection->attached.begin(); iter != connection->attached.end(); )
+    {
+        if(0 == iter->second.users && execSQL(db, "DETACH DATABASE " + iter->first).ok())
+        {
+            iter = connection->attached.erase(iter);
+        }
+        else
+        {
+            ++iter;
+        }
+    }
+}
+
+inline Status DBImpl::enableValueFrames(const Options & options, bool separable)
+{
+    const bool compress = separable && nullptr != options.compressor;
+    if(compress && !validCompressor(options.compressor))
+    {
+        return Status("", "Invalid argument, compressor id out of range.", Status::InvalidArgument, "0");
+    }
+
+    /* Tables created without frames get the size column when they are first needed */
+    sqlite3_stmt * probe = nullptr;
+    int sqlRet = sqlite3_prepare_v2(db, ("SELECT vsize FROM " + table()).c_str(), -1, &probe, nullptr);
+    sqlite3_finalize(probe);
+    const bool present = (SQLITE_OK == sqlRet);
+    const bool newLog = separable && options.value_log_threshold > 0 && !connection->readOnly;
+    if(!present && (connection->readOnly || (!newLog && !compress)))
+    {
+        return Status();
+    }
+    if(!present)
+    {
+        Status status = execSQL(db, "ALTER TABLE " + table() + " ADD COLUMN vsize INTEGER");
+        if(!status.ok())
+        {
+            return status;
+        }
+    }
+    framedValues = true;
+    if(compress)
+    {
+        compressor = options.compressor;
+        compressionThreshold = std::max<int64_t>(options.compression_threshold, 1);
+    }
+
+    int64_t segments = 0;
+    if(!queryInt64(db, "SELECT count(*) FROM " + schema + ".sqlite_master WHERE type = 'table' AND name = '" + tableName + "_vlog'", segments))
+    {
+        return Status(sqlite3_errmsg(db), "Fail to look for the value log.", Status::UnknownError, "0");
+    }
+    if(0 == segments && !newLog)
+    {
+        return Status();
+    }
+
+    const char * filename = sqlite3_db_filename(db, schema.c_str());
+    if(nullptr == filename || '\0' == filename[0])
+    {
+        return Status("", "Invalid argument, a value log needs a database file.", Status::InvalidArgument, "0");
+    }
+
+    /*
+     * The frame of a value moved to the log is stored as its position, an
+     * INTEGER no std::string or Slice value can be.
+     * The triggers keep the bytes of each segment, and those of values
+     * overwritten or deleted since, for the collector. The partial index
+     * lets it find the rows pointing into a segment.
+     */
+    if(connection->readOnly)
+    {
+        /* Segments are opened on their first read, none is started for writing */
+        valueLog = std::make_shared<ValueLog>(std::string(filename) + "-" + tableName + ".vlog", options.value_log_segment_size);
+        return Status();
+    }
+
+    const std::string segmentsTable = tableName + "_vlog";
+    const std::string addNew = "INSERT OR IGNORE INTO " + segmentsTable + "(segment) SELECT NEW.value >> 40 WHERE typeof(NEW.value) = 'integer';"
+        "UPDATE " + segmentsTable + " SET records = records + 1, bytes = bytes + NEW.vsize WHERE typeof(NEW.value) = 'integer' AND segment = NEW.value >> 40;";
+    const std::string dropOld = "UPDATE " + segmentsTable + " SET dead_records = dead_records + 1, dead_bytes = dead_bytes + OLD.vsize "
+        "WHERE typeof(OLD.value) = 'integer' AND segment = OLD.value >> 40;";
+    const std::string query = "BEGIN IMMEDIATE;"
+        "CREATE TABLE IF NOT EXISTS " + table("_vlog") + "(segment INTEGER PRIMARY KEY, records INTEGER DEFAULT 0, bytes INTEGER DEFAULT 0, "
+            "dead_records INTEGER DEFAULT 0, dead_bytes INTEGER DEFAULT 0);"
+        "CREATE INDEX IF NOT EXISTS " + table("_vlog_position") + " ON " + tableName + "(value) WHERE typeof(value) = 'integer';"
+        "CREATE TRIGGER IF NOT EXISTS " + table("_vlog_insert") + " AFTER INSERT ON " + tableName + " BEGIN " + addNew + " END;"
+        "CREATE TRIGGER IF NOT EXISTS " + table("_vlog_delete") + " AFTER DELETE ON " + tableName + " BEGIN " + dropOld + " END;"
+        "CREATE TRIGGER IF NOT EXISTS " + table("_vlog_update") + " AFTER UPDATE OF value ON " + tableName + " BEGIN " + dropOld + addNew + " END;"
+        "COMMIT;";
+    Status status = execSQL(db, query);
+    if(!status.ok())
+    {
+        if(!sqlite3_get_autocommit(db))
+        {
+            execSQL(db, "ROLLBACK");
+        }
+        return status;
+    }
+
+    int64_t last = 0;
+    if(!queryInt64(db, "SELECT coalesce(max(segment), 0) FROM " + table("_vlog"), last))
+    {
+        return Status(sqlite3_errmsg(db), "Fail to read the value log segments.", Status::UnknownError, "0");
+    }
+
+    /* Each open appends to a segment of its own, the previous ones become collectable */
+    std::shared_ptr<ValueLog> log = std::make_shared<ValueLog>(std::string(filename) + "-" + tableName + ".vlog", options.value_log_segment_size);
+    status = log->open(last + 1);
+    if(!status.ok())
+    {
+        return status;
+    }
+    valueLog = log;
+    valueLogThreshold = (options.value_log_threshold > 0) ? options.value_log_threshold : INT64_MAX;
+    valueLogGCRatio = options.value_log_gc_ratio;
+    valueLogBatchSize = options.value_log_gc_batch_size;
+    return Status();
+}
+
+inline std::string DBImpl::valueColumns() const
+{
+    return framedValues ? "value, vsize" : "value";
+}
+
+inline std::string DBImpl::valueParams() const
+{
+    return framedValues ? "?2, ?6" : "?2";
+}
+
+inline std::string DBImpl::valueUpdate() const
+{
+    return framedValues ? "value = excluded.value, vsize = excluded.vsize" : "value = excluded.value";
+}
+
+inline Status DBImpl::enableWAL()
+{
+    /* The mode can not change inside a transaction, open() runs outside of any */
+    return execSQL(db, "PRAGMA " + schema + ".journal_mode = WAL");
+}
+
+inline std::string DBImpl::getQuery() const
+{
+    return "SELECT " + valueColumns() + " FROM " + table() + " WHERE " + keyCompare("=", 1) +
+        (ttl ? " AND (expire IS NULL OR expire > ?2)" : "");
+}
+
+inline Status DBImpl::newSnapshot(SnapshotImpl ** ppSnapshot)
+{
+    /* Without WAL the read lock of the snapshot would keep every writer out */
+    bool wal = false;
+    sqlite3_stmt * stmt = nullptr;
+    if(SQLITE_OK == sqlite3_prepare_v2(db, ("PRAGMA " + schema + ".journal_mode").c_str(), -1, &stmt, nullptr) && SQLITE_ROW == sqlite3_step(stmt))
+    {
+        const char * mode = (const char *)sqlite3_column_text(stmt, 0);
+        wal = (nullptr != mode) && (0 == sqlite3_stricmp(mode, "wal"));
+    }
+    sqlite3_finalize(stmt);
+
+    /* An immutable file has no writer to keep out, and is read as it is */
+    const char * filename = sqlite3_db_filename(db, schema.c_str());
+    if(!(wal || connection->immutable) || nullptr == filename || '\0' == filename[0])
+    {
+        return Status("", "Invalid argument, snapshots need a database file in WAL mode.", Status::InvalidArgument, "0");
+    }
+
+    SnapshotImpl * pSnapshot = new(std::nothrow) SnapshotImpl(this);
+    if(nullptr == pSnapshot)
+    {
+        return Status("", "Fail to new.", Status::UnknownError, "0");
+    }
+
+    Status status;
+    do
+    {
+        DBImpl & reader = pSnapshot->reader;
+        /* The same VFS, compressed files are only readable through it */
+        sqlite3_vfs * vfs = nullptr;
+        sqlite3_file_control(db, schema.c_str(), SQLITE_FCNTL_VFS_POINTER, &vfs);
+        reader.connection->ioStats = connection->ioStats;
+        /* Without the immutable parameter, the snapshot would take the locks the DB does not */
+        std::string path = filename;
+        int flags = connection->readOnly ? SQLITE_OPEN_READONLY : SQLITE_OPEN_READWRITE;
+        if(connection->immutable)
+        {
+            path = immutableUri(filename);
+            flags |= SQLITE_OPEN_URI;
+        }
+        int sqlRet = sqlite3_open_v2(path.c_str(), &reader.connection->db, flags, vfs ? vfs->zName : nullptr);
+        reader.db = reader.connection->db;
+        if(SQLITE_OK != sqlRet)
+        {
+            std::string databaseErr = std::string("Fail to open:") + filename;
+            status = Status(sqlite3_errmsg(reader.db), databaseErr, Status::IOError, std::to_string(sqlRet));
+            break;
+        }
+
+        status = prepareSQL(reader.db, reader.getQuery(), &reader.getSQL);
+        if(!status.ok())
+        {
+            break;
+        }
+
+        /* The caller holds mutex, so every write of the DB is committed: the first read pins them all */
+        status = execSQL(reader.db, "BEGIN; SELECT 1 FROM main.sqlite_master LIMIT 1");
+    }while(0);
+
+    if(!status.ok())
+    {
+        delete pSnapshot;
+        pSnapshot = nullptr;
+    }
+    *ppSnapshot = pSnapshot;
+    return status;
+}
+
+inline Status DBImpl::readerFor(const ReadOptions & options, DBImpl ** ppReader)
+{
+    if(nullptr == options.snapshot)
+    {
+        *ppReader = this;
+        return Status();
+    }
+
+    const SnapshotImpl * pSnapshot = static_cast<const SnapshotImpl *>(options.snapshot);
+    if(pSnapshot->owner != this)
+    {
+        return Status("", "Invalid argument, the snapshot was taken from another DB.", Status::InvalidArgument, "0");
+    }
+    *ppReader = const_cast<DBImpl *>(&pSnapshot->reader);
+    return Status();
+}
+
+inline Status DBImpl::openBlob(int64_t rowid, bool write, sqlite3_blob ** ppBlob)
+{
+    int sqlRet = sqlite3_blob_open(db, schema.c_str(), tableName.c_str(), "value", rowid, write ? 1 : 0, ppBlob);
+    if(SQLITE_OK != sqlRet)
+    {
+        /* A failed open may still hand out a handle */
+        sqlite3_blob_close(*ppBlob);
+        *ppBlob = nullptr;
+        /* The table and its value column are there: SQLITE_ERROR means the row is gone or its value is not a blob any more */
+        if(SQLITE_ERROR == sqlRet)
+        {
+            return Status(sqlite3_errmsg(db), "Value changed, its row is gone.", Status::ConditionNotMet, std::to_string(sqlRet));
+        }
+        std::string databaseErr = "Fail to open the value.";
+        return Status(sqlite3_errmsg(db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+    }
+    return Status();
+}
+
+inline Status DBImpl::enableTTL(int batchSize)
+{
+    /* Tables created without TTL get the column on their first open with it */
+    sqlite3_stmt * probe = nullptr;
+    int sqlRet = sqlite3_prepare_v2(db, ("SELECT expire FROM " + table()).c_str(), -1, &probe, nullptr);
+    sqlite3_finalize(probe);
+    if(connection->readOnly)
+    {
+        /* Expired keys are still hidden, but never purged */
+        ttl = (SQLITE_OK == sqlRet);
+        return Status();
+    }
+    if(SQLITE_OK != sqlRet)
+    {
+        Status status = execSQL(db, "ALTER TABLE " + table() + " ADD COLUMN expire INTEGER");
+        if(!status.ok())
+        {
+            return status;
+        }
+    }
+
+    /* Only keys with a TTL are indexed, so keys without one cost nothing extra */
+    Status status = execSQL(db, "CREATE INDEX IF NOT EXISTS " + table("_expire") + " ON " + tableName + "(expire) WHERE expire IS NOT NULL");
+    if(!status.ok())
+    {
+        return status;
+    }
+
+    status = prepareSQL(db, "INSERT INTO " + table() + "(" + keyColumns() + ", " + valueColumns() + ", expire) VALUES (" + keyParams(1) + ", " + valueParams() + ", ?3) "
+        "ON CONFLICT(" + keyColumns() + ") DO UPDATE SET " + valueUpdate() + ", expire = excluded.expire", &putExpireSQL);
+    if(!status.ok())
+    {
+        return status;
+    }
+
+    const std::string query = "DELETE FROM " + table() + " WHERE rowid IN "
+        "(SELECT rowid FROM " + table() + " WHERE expire <= ?1 ORDER BY expire LIMIT ?2)";
+    status = prepareSQL(db, query, &purgeSQL);
+    if(!status.ok())
+    {
+        return status;
+    }
+
+    ttl = true;
+    purgeBatchSize = std::max(batchSize, 1);
+    return Status();
+}
+
+inline Status DBImpl::enableStats()
+{
+    /* Triggers only see the tables of their own schema, so their statements can not qualify them */
+    const std::string statsTable = tableName + "Stats";
+    const std::string keyBytes = keyBytesExpression("NEW.");
+    const std::string valueBytes = byteLengthExpression("NEW.value");
+    const std::string oldKeyBytes = keyBytesExpression("OLD.");
+    const std::string oldValueBytes = byteLengthExpression("OLD.value");
+
+    if(connection->readOnly)
+    {
+        /* The totals are there if a writer enabled them */
+        int64_t exists = 0;
+        if(!queryInt64(db, "SELECT count(*) FROM " + schema + ".sqlite_master WHERE type = 'table' AND name = '" + statsTable + "'", exists))
+        {
+            return Status(sqlite3_errmsg(db), "Fail to read the schema.", Status::UnknownError, "0");
+        }
+        if(0 == exists)
+        {
+            return Status();
+        }
+    }
+    else
+    {
+        /*
+         * The triggers are part of the schema: once created they keep the totals
+         * right for every writer, whether it asked for statistics or not. Keys
+         * are never updated in place, put() updates the value of an existing key.
+         */
+        const std::string query = "BEGIN IMMEDIATE;"
+            "CREATE TABLE IF NOT EXISTS " + table("Stats") + "(id INTEGER PRIMARY KEY CHECK (id = 0), keys INTEGER, key_bytes INTEGER, value_bytes INTEGER);"
+            "INSERT OR IGNORE INTO " + table("Stats") + " SELECT 0, count(*), coalesce(sum(" + keyBytesExpression() + "), 0), "
+                "coalesce(sum(" + byteLengthExpression("value") + "), 0) FROM " + table() + ";"
+            "CREATE TRIGGER IF NOT EXISTS " + table("_stats_insert") + " AFTER INSERT ON " + tableName + " BEGIN "
+                "UPDATE " + statsTable + " SET keys = keys + 1, key_bytes = key_bytes + " + keyBytes + ", "
+                "value_bytes = value_bytes + " + valueBytes + " WHERE id = 0; END;"
+            "CREATE TRIGGER IF NOT EXISTS " + table("_stats_delete") + " AFTER DELETE ON " + tableName + " BEGIN "
+                "UPDATE " + statsTable + " SET keys = keys - 1, key_bytes = key_bytes - " + oldKeyBytes + ", "
+                "value_bytes = value_bytes - " + oldValueBytes + " WHERE id = 0; END;"
+            "CREATE TRIGGER IF NOT EXISTS " + table("_stats_update") + " AFTER UPDATE OF value ON " + tableName + " BEGIN "
+                "UPDATE " + statsTable + " SET value_bytes = value_bytes + " + valueBytes + " - " + oldValueBytes + " WHERE id = 0; END;"
+            "COMMIT;";
+        Status status = execSQL(db, query);
+        if(!status.ok())
+        {
+            if(!sqlite3_get_autocommit(db))
+            {
+                execSQL(db, "ROLLBACK");
+            }
+            return status;
+        }
+    }
+
+    Status status = prepareSQL(db, "SELECT keys, key_bytes, value_bytes FROM " + table("Stats") + " WHERE id = 0", &statsSQL);
+    if(!status.ok())
+    {
+        return status;
+    }
+    stats = true;
+    return Status();
+}
+
+inline Status DBImpl::enableDirectReads()
+{
+    /*
+     * Only rows of a key and a plain value, the only columns DirectReader
+     * reads, and only in the main file: an attached file is not opened
+     * immutable, so it may change under the mapping.
+     */
+    const char * filename = sqlite3_db_filename(db, schema.c_str());
+    if("main" != schema || 1 != keyComponents || framedValues || ttl || nullptr == filename || '\0' == filename[0])
+    {
+        return Status();
+    }
+
+    int64_t tableRoot = 0;
+    int64_t indexRoot = 0;
+    if(!queryInt64(db, "SELECT rootpage FROM " + schema + ".sqlite_master WHERE type = 'table' AND name = '" + tableName + "'", tableRoot) ||
+        !queryInt64(db, "SELECT rootpage FROM " + schema + ".sqlite_master WHERE name = 'sqlite_autoindex_" + tableName + "_1'", indexRoot))
+    {
+        return Status(sqlite3_errmsg(db), "Fail to read the schema.", Status::UnknownError, "0");
+    }
+
+    std::shared_ptr<DirectReader> reader = std::make_shared<DirectReader>();
+    if(tableRoot > 0 && tableRoot <= UINT32_MAX && indexRoot > 0 && indexRoot <= UINT32_MAX &&
+        reader->open(filename, (uint32_t)tableRoot, (uint32_t)indexRoot))
+    {
+        directReader = reader;
+    }
+    return Status();
+}
+
+inline Status DBImpl::readStats(int64_t & keys, int64_t & keyBytes, int64_t & valueBytes)
+{
+    int sqlRet = sqlite3_step(statsSQL);
+    if(SQLITE_ROW != sqlRet)
+    {
+        std::string databaseErr = std::string("Fail to exec:") + sqlite3_sql(statsSQL);
+        Status status(sqlite3_errmsg(db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+        sqlite3_reset(statsSQL);
+        return status;
+    }
+    keys = sqlite3_column_int64(statsSQL, 0);
+    keyBytes = sqlite3_column_int64(statsSQL, 1);
+    valueBytes = sqlite3_column_int64(statsSQL, 2);
+    sqlite3_reset(statsSQL);
+    return Status();
+}
+
+inline bool DBImpl::estimateRange(const StoredValue * lower, const StoredValue * upper, double & fraction, double & entries, int64_t & bytesInUse)
+{
+    /* In WAL mode recent pages live in the WAL file, the main file alone would be stale */
+    sqlite3_stmt * stmt = nullptr;
+    bool wal = false;
+    if(SQLITE_OK == sqlite3_prepare_v2(db, ("PRAGMA " + schema + ".journal_mode").c_str(), -1, &stmt, nullptr) && SQLITE_ROW == sqlite3_step(stmt))
+    {
+        const char * mode = (const char *)sqlite3_column_text(stmt, 0);
+        wal = (nullptr != mode) && (0 == sqlite3_stricmp(mode, "wal"));
+    }
+    sqlite3_finalize(stmt);
+    if(wal || !sqlite3_get_autocommit(db))
+    {
+        return false;
+    }
+
+    /* A read transaction keeps other processes from changing the file under the reader */
+    sqlite3_reset(getSQL);
+    if(!execSQL(db, "BEGIN").ok())
+    {
+        return false;
+    }
+
+    bool ok = false;
+    do
+    {
+        int64_t root = 0;
+        int64_t pageCount = 0;
+        int64_t freePages = 0;
+        if(!queryInt64(db, "SELECT rootpage FROM " + schema + ".sqlite_master WHERE name = 'sqlite_autoindex_" + tableName + "_1'", root) ||
+            !queryInt64(db, "PRAGMA " + schema + ".page_count", pageCount) ||
+            !queryInt64(db, "PRAGMA " + schema + ".freelist_count", freePages))
+        {
+            break;
+        }
+
+        FilePageSource source;
+        if(root <= 0 || !source.open(db, schema))
+        {
+            break;
+        }
+        bytesInUse = (pageCount - freePages) * (int64_t)source.pageSize;
+
+        double begin = 0;
+        double end = 1;
+        double beginEntries = 0;
+        double endEntries = 0;
+        int paths = 0;
+        if(nullptr != lower)
+        {
+            if(!estimateIndexPosition(source, (uint32_t)root, *lower, begin, beginEntries))
+            {
+                break;
+            }
+            paths++;
+        }
+        if(nullptr != upper)
+        {
+            if(!estimateIndexPosition(source, (uint32_t)root, *upper, end, endEntries))
+            {
+                break;
+            }
+            paths++;
+        }
+        fraction = std::max(end - begin, 0.0);
+        entries = (paths > 0) ? (beginEntries + endEntries) / paths : 0;
+        ok = true;
+    }while(0);
+
+    execSQL(db, "COMMIT");
+    return ok;
+}
+
+inline Status DBImpl::readMeta(const std::string & name, std::string & value, bool & found)
+{
+    found = false;
+    int64_t exists = 0;
+    if(!queryInt64(db, "SELECT count(*) FROM " + schema + ".sqlite_master WHERE type = 'table' AND name = '" + tableName + "Meta'", exists))
+    {
+        return Status(sqlite3_errmsg(db), "Fail to read the schema.", Status::UnknownError, "0");
+    }
+    if(0 == exists)
+    {
+        return Status();
+    }
+
+    sqlite3_stmt * stmt = nullptr;
+    Status status = prepareSQL(db, "SELECT value FROM " + table("Meta") + " WHERE name = ?1", &stmt);
+    if(!status.ok())
+    {
+        return status;
+    }
+    sqlite3_bind_text(stmt, 1, name.c_str(), name.size(), SQLITE_TRANSIENT);
+    int sqlRet = sqlite3_step(stmt);
+    if(SQLITE_ROW == sqlRet)
+    {
+        const char * p = (const char *)sqlite3_column_text(stmt, 0);
+        value = p ? p : "";
+        found = true;
+    }
+    else if(SQLITE_DONE != sqlRet)
+    {
+        std::string databaseErr = "Fail to read setting:" + name;
+        status = Status(sqlite3_errmsg(db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+    }
+    sqlite3_finalize(stmt);
+    return status;
+}
+
+inline Status DBImpl::writeMeta(const std::string & name, const std::string & value)
+{
+    Status status = execSQL(db, "CREATE TABLE IF NOT EXISTS " + table("Meta") + "(name TEXT PRIMARY KEY, value TEXT)");
+    if(!status.ok())
+    {
+        return status;
+    }
+
+    sqlite3_stmt * stmt = nullptr;
+    status = prepareSQL(db, "INSERT INTO " + table("Meta") + "(name, value) VALUES (?1, ?2) "
+        "ON CONFLICT(name) DO UPDATE SET value = excluded.value", &stmt);
+    if(!status.ok())
+    {
+        return status;
+    }
+    sqlite3_bind_text(stmt, 1, name.c_str(), name.size(), SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 2, value.c_str(), value.size(), SQLITE_TRANSIENT);
+    status = stepSQL(db, stmt);
+    sqlite3_finalize(stmt);
+    return status;
+}
+
+inline Status DBImpl::setupKeyEncoding(bool requested)
+{
+    std::string encoding;
+    bool found = false;
+    Status status = readMeta("key_encoding", encoding, found);
+    if(!status.ok())
+    {
+        return status;
+    }
+
+    /* The file decides, keys written one way can not be read the other way */
+    if(found)
+    {
+        encodeKeys = ("order-preserving" == encoding);
+        return Status();
+    }
+    if(!requested)
+    {
+        return Status();
+    }
+
+    int64_t rows = 0;
+    if(!queryInt64(db, "SELECT count(*) FROM (SELECT 1 FROM " + table() + " LIMIT 1)", rows))
+    {
+        return Status(sqlite3_errmsg(db), "Fail to read the table.", Status::UnknownError, "0");
+    }
+    if(rows > 0)
+    {
+        return Status("", "Invalid argument, encode_keys can not be enabled on a database that already has keys.", Status::InvalidArgument, "0");
+    }
+
+    status = writeMeta("key_encoding", "order-preserving");
+    if(status.ok())
+    {
+        encodeKeys = true;
+    }
+    return status;
+}
+
+inline std::string DBImpl::keyColumns(const std::string & prefix) const
+{
+    std::string columns = prefix + "key";
+    for(int i = 1; i < keyComponents; i++)
+    {
+        columns += ", " + prefix + "key_" + std::to_string(i);
+    }
+    return columns;
+}
+
+inline std::string DBImpl::keyParams(int idx) const
+{
+    std::string params = "?" + std::to_string(idx);
+    for(int i = 1; i < keyComponents; i++)
+    {
+        params += ", ?" + std::to_string(idx + i * keyParamStride);
+    }
+    return params;
+}
+
+inline std::string DBImpl::keyCompare(const std::string & op, int idx, int first) const
+{
+    /* SQLite seeks on the primary key index for row value comparisons too */
+    std::string columns;
+    std::string params;
+    for(int i = first; i < keyComponents; i++)
+    {
+        columns += std::string((i > first) ? ", " : "") + ((0 == i) ? "key" : "key_" + std::to_string(i));
+        params += std::string((i > first) ? ", " : "") + "?" + std::to_string(idx + i * keyParamStride);
+    }
+    if(first + 1 == keyComponents)
+    {
+        return columns + " " + op + " " + params;
+    }
+    return "(" + columns + ") " + op + " (" + params + ")";
+}
+
+inline std::string DBImpl::keyPrefixEquals(int components, int idx) const
+{
+    std::string where = "key = ?" + std::to_string(idx);
+    for(int i = 1; i < components; i++)
+    {
+        where += " AND key_" + std::to_string(i) + " = ?" + std::to_string(idx + i * keyParamStride);
+    }
+    return where;
+}
+
+inline std::string DBImpl::keyBytesExpression(const std::string & prefix) const
+{
+    std::string expression = byteLengthExpression(prefix + "key");
+    for(int i = 1; i < keyComponents; i++)
+    {
+        expression += " + " + byteLengthExpression(prefix + "key_" + std::to_string(i));
+    }
+    return expression;
+}
+
+inline void DBImpl::startPurger(int intervalMs)
+{
+    purger = std::thread([this, intervalMs]()
+    {
+        /* mutex is released while waiting, each run holds it for one bounded DELETE */
+        std::unique_lock<std::mutex> locker(mutex);
+        while(!purgerStopping)
+        {
+            purgerWakeup.wait_for(locker, std::chrono::milliseconds(intervalMs));
+            if(purgerStopping)
+            {
+                break;
+            }
+            /* A failed run, e.g. SQLITE_BUSY, is simply retried by the next one */
+            int64_t purged = 0;
+            purgeExpiredRows(purged);
+        }
+    });
+}
+
+inline void DBImpl::stopPurger()
+{
+    {
+        std::lock_guard<std::mutex> locker(mutex);
+        purgerStopping = true;
+    }
+    purgerWakeup.notify_all();
+    if(purger.joinable())
+    {
+        purger.join();
+    }
+}
+
+inline void DBImpl::startCollector(int intervalMs)
+{
+    collector = std::thread([this, intervalMs]()
+    {
+        /* Like the purger, each run holds mutex for one bounded transaction */
+        std::unique_lock<std::mutex> locker(mutex);
+        while(!collectorStopping)
+        {
+            collectorWakeup.wait_for(locker, std::chrono::milliseconds(intervalMs));
+            if(collectorStopping)
+            {
+                break;
+            }
+            int64_t reclaimed = 0;
+            bool more = false;
+            collectValueLog(reclaimed, more);
+        }
+    });
+}
+
+inline void DBImpl::stopCollector()
+{
+    {
+        std::lock_guard<std::mutex> locker(mutex);
+        collectorStopping = true;
+    }
+    collectorWakeup.notify_all();
+    if(collector.joinable())
+    {
+        collector.join();
+    }
+}
+
+inline void DBImpl::warmUp(const std::string & tracePath, int64_t budget, int timeMs)
+{
+    const auto start = std::chrono::steady_clock::now();
+    auto stopping = [&]()
+    {
+        return warmerStopping || (timeMs > 0 && std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(timeMs));
+    };
+
+    /* The pages, the most useful first */
+    FilePageSource source;
+    std::vector<uint32_t> pages;
+    int64_t cachePages = 0;
+    {
+        std::lock_guard<std::mutex> locker(mutex);
+        if(stopping() || !source.open(db, schema))
+        {
+            return;
+        }
+        uint32_t pageSize = 0;
+        int64_t root = 0;
+        if((!IoStats::loadTrace(tracePath, pageSize, pages) || pageSize != source.pageSize) &&
+            queryInt64(db, "SELECT rootpage FROM " + schema + ".sqlite_master WHERE name = 'sqlite_autoindex_" + tableName + "_1'", root) && root > 0)
+        {
+            pages.clear();
+            collectIndexPages(source, (uint32_t)root, (size_t)(budget / source.pageSize), pages);
+        }
+        int64_t cacheSize = 0;
+        if(queryInt64(db, "PRAGMA " + schema + ".cache_size", cacheSize))
+        {
+            /* Negative sizes are in KiB */
+            cachePages = (cacheSize < 0) ? -cacheSize * 1024 / source.pageSize : cacheSize;
+        }
+    }
+    pages.resize(std::min<size_t>(pages.size(), (size_t)(budget / source.pageSize)));
+
+    /* The operating system cache first, reading the file forward */
+    const size_t step = 64;
+    std::vector<uint32_t> inFileOrder(pages);
+    std::sort(inFileOrder.begin(), inFileOrder.end());
+    for(size_t i = 0; i < inFileOrder.size(); )
+    {
+        std::lock_guard<std::mutex> locker(mutex);
+        if(stopping())
+        {
+            return;
+        }
+        for(size_t end = std::min(i + step, inFileOrder.size()); i < end; i++)
+        {
+            if(nullptr != source.read(inFileOrder[i]))
+            {
+                warmedBytes += source.pageSize;
+            }
+        }
+    }
+
+    /*
+     * Then SQLite's cache, as much of it as the pages fill: looking up the
+     * first key of an index leaf, or the first rowid of a table leaf, reads
+     * the page and the pages above it.
+     */
+    sqlite3_stmt * byKey = nullptr;
+    sqlite3_stmt * byRowid = nullptr;
+    pages.resize(std::min<size_t>(pages.size(), (size_t)std::max<int64_t>(cachePages, 0)));
+    for(size_t i = 0; i < pages.size(); )
+    {
+        std::lock_guard<std::mutex> locker(mutex);
+        if(stopping())
+        {
+            break;
+        }
+        if(nullptr == byKey && (!prepareSQL(db, "SELECT 1 FROM " + table() + " WHERE key >= ?1 ORDER BY key LIMIT 1", &byKey).ok() ||
+            !prepareSQL(db, "SELECT 1 FROM " + table() + " WHERE rowid = ?1", &byRowid).ok()))
+        {
+            break;
+        }
+        for(size_t end = std::min(i + step, pages.size()); i < end; i++)
+        {
+            const uint8_t * page = source.read(pages[i]);
+            if(nullptr == page)
+            {
+                continue;
+            }
+            const uint8_t * pageEnd = page + source.usableSize;
+            const uint8_t * header = page + ((1 == pages[i]) ? 100 : 0);
+            const uint8_t * cell = page + getBigEndian(header + 8, 2);
+            uint64_t payload = 0;
+            uint64_t rowid = 0;
+            StoredValue key;
+            int n = 0;
+            if(0 == getBigEndian(header + 3, 2) || cell >= pageEnd || 0 == (n = getVarint(cell, pageEnd, payload)))
+            {
+                continue;
+            }
+            if(0x0a == header[0] && decodeFirstColumn(cell + n, pageEnd, key))
+            {
+                bindStored(byKey, 1, key);
+                sqlite3_step(byKey);
+                sqlite3_reset(byKey);
+            }
+            else if(0x0d == header[0] && 0 != getVarint(cell + n, pageEnd, rowid))
+            {
+                sqlite3_bind_int64(byRowid, 1, (sqlite3_int64)rowid);
+                sqlite3_step(byRowid);
+                sqlite3_reset(byRowid);
+            }
+        }
+    }
+    sqlite3_finalize(byKey);
+    sqlite3_finalize(byRowid);
+}
+
+inline void DBImpl::startWarmer(const std::string & tracePath, int64_t budget, int timeMs)
+{
+    warmer = std::thread([this, tracePath, budget, timeMs]()
+    {
+        warmUp(tracePath, budget, timeMs);
+    });
+}
+
+inline void DBImpl::stopWarmer()
+{
+    {
+        std::lock_guard<std::mutex> locker(mutex);
+        warmerStopping = true;
+    }
+    if(warmer.joinable())
+    {
+        warmer.join();
+    }
+}
+
+inline Status DBImpl::bindNow(sqlite3_stmt * stmt, int idx)
+{
+    int sqlRet = sqlite3_reset(stmt);
+    if(SQLITE_OK == sqlRet)
+    {
+        sqlRet = sqlite3_bind_int64(stmt, idx, toExpireTime(std::chrono::system_clock::now()));
+    }
+    if(SQLITE_OK != sqlRet)
+    {
+        std::string databaseErr = "Fail to bind time.";
+        return Status(sqlite3_errmsg(db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+    }
+    return Status();
+}
+
+inline std::string DBImpl::upsertSet(const std::string & liveValue, const std::string & expiredValue) const
+{
+    if(!ttl)
+    {
+        return "value = " + liveValue;
+    }
+    /* Both assignments see the row as it was before the update */
+    return "value = CASE WHEN expire <= ?3 THEN " + expiredValue + " ELSE " + liveValue + " END, "
+        "expire = CASE WHEN expire <= ?3 THEN NULL ELSE expire END";
+}
+
+inline Status DBImpl::purgeExpiredRows(int64_t & purged)
+{
+    purged = 0;
+    Status status = bindNow(purgeSQL, 1);
+    if(!status.ok())
+    {
+        return status;
+    }
+
+    int sqlRet = sqlite3_bind_int(purgeSQL, 2, purgeBatchSize);
+    if(SQLITE_OK != sqlRet)
+    {
+        std::string databaseErr = "Fail to bind limit.";
+        return Status(sqlite3_errmsg(db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+    }
+
+    status = stepSQL(db, purgeSQL);
+    if(status.ok())
+    {
+        purged = sqlite3_changes(db);
+    }
+    return status;
+}
+
+inline Status DBImpl::collectValueLog(int64_t & reclaimed, bool & more)
+{
+    more = false;
+    const int64_t active = valueLog->activeSegment();
+
+    /*
+     * The garbage of a segment is whatever its file holds beyond the records
+     * of live values: overwritten and deleted values, and the records of
+     * writes that were rolled back.
+     */
+    sqlite3_stmt * stmt = nullptr;
+    Status status = prepareSQL(db, "SELECT segment, bytes - dead_bytes, records - dead_records FROM " + table("_vlog"), &stmt);
+    if(!status.ok())
+    {
+        return status;
+    }
+    std::set<int64_t> known;
+    int64_t victim = 0;
+    int64_t victimSize = 0;
+    double worst = -1;
+    while(SQLITE_ROW == sqlite3_step(stmt))
+    {
+        int64_t segment = sqlite3_column_int64(stmt, 0);
+        known.insert(segment);
+        if(segment == active)
+        {
+            continue;
+        }
+        int64_t fileSize = valueLog->fileSize(segment);
+        int64_t live = sqlite3_column_int64(stmt, 1) + sqlite3_column_int64(stmt, 2) * ValueLog::headerSize;
+        double garbage = (fileSize > 0) ? 1.0 - (double)live / fileSize : 1.0;
+        if(garbage >= valueLogGCRatio && garbage > worst)
+        {
+            victim = segment;
+            victimSize = fileSize;
+            worst = garbage;
+        }
+    }
+    sqlite3_finalize(stmt);
+
+    /* Segments of this run that no committed write ever used */
+    for(int64_t segment = valueLog->firstSegment(); segment < active; segment++)
+    {
+        if(0 == known.count(segment) && valueLog->fileSize(segment) > 0)
+        {
+            reclaimed += valueLog->fileSize(segment);
+            valueLog->remove(segment);
+        }
+    }
+
+    if(worst < 0)
+    {
+        return Status();
+    }
+    more = true;
+
+    status = prepareSQL(db, "SELECT rowid, value, vsize FROM " + table() + " WHERE typeof(value) = 'integer' AND value >= ?1 AND value < ?2 LIMIT ?3", &stmt);
+    if(!status.ok())
+    {
+        return status;
+    }
+    sqlite3_bind_int64(stmt, 1, ValueLog::firstPosition(victim));
+    sqlite3_bind_int64(stmt, 2, ValueLog::firstPosition(victim + 1));
+    sqlite3_bind_int(stmt, 3, valueLogBatchSize);
+    std::vector<std::tuple<int64_t, int64_t, int64_t>> rows;
+    while(SQLITE_ROW == sqlite3_step(stmt))
+    {
+        rows.push_back(std::make_tuple(sqlite3_column_int64(stmt, 0), sqlite3_column_int64(stmt, 1), sqlite3_column_int64(stmt, 2)));
+    }
+    sqlite3_finalize(stmt);
+
+    /* Copy the live values to the end of the log, and point their rows there */
+    status = prepareSQL(db, "UPDATE " + table() + " SET value = ?1 WHERE rowid = ?2", &stmt);
+    if(!status.ok())
+    {
+        return status;
+    }
+    status = stepSQL(db, beginSQL);
+    std::string buffer;
+    for(size_t i = 0; i < rows.size() && status.ok(); i++)
+    {
+        int64_t position = 0;
+        status = valueLog->read(std::get<1>(rows[i]), std::get<2>(rows[i]), buffer);
+        if(status.ok())
+        {
+            status = valueLog->append(buffer.data(), buffer.size(), false, position);
+        }
+        if(status.ok())
+        {
+            sqlite3_bind_int64(stmt, 1, position);
+            sqlite3_bind_int64(stmt, 2, std::get<0>(rows[i]));
+            status = stepSQL(db, stmt);
+        }
+    }
+    sqlite3_finalize(stmt);
+    /* The copies must be on disk before the rows stop pointing to the originals */
+    if(status.ok() && !rows.empty())
+    {
+        status = valueLog->sync();
+    }
+    if(status.ok())
+    {
+        status = stepSQL(db, commitSQL);
+    }
+    if(!status.ok())
+    {
+        if(!sqlite3_get_autocommit(db))
+        {
+            stepSQL(db, rollbackSQL);
+        }
+        return status;
+    }
+    if((int)rows.size() >= valueLogBatchSize)
+    {
+        return Status();
+    }
+
+    /*
+     * The segment is empty. Its row is dropped by a synchronous commit,
+     * which also makes the moves above durable, before the file goes.
+     */
+    status = setSync(db, true, schema);
+    if(status.ok())
+    {
+        status = execSQL(db, "DELETE FROM " + table("_vlog") + " WHERE segment = " + std::to_string(victim));
+    }
+    Status restore = setSync(db, connection->syncWrite, schema);
+    if(!status.ok())
+    {
+        return status;
+    }
+    valueLog->remove(victim);
+    reclaimed += victimSize;
+    return restore;
+}
+
+template<typename K, typename V>
+Status DBImpl::putExpireRow(const K & key, const V & value, int64_t expireAt)
+{
+    /* ?1 and ?2 are bound by stepRow() */
+    int sqlRet = sqlite3_reset(putExpireSQL);
+    if(SQLITE_OK == sqlRet)
+    {
+        sqlRet = sqlite3_bind_int64(putExpireSQL, 3, expireAt);
+    }
+    if(SQLITE_OK != sqlRet)
+    {
+        std::string databaseErr = "Fail to bind expire time.";
+        return Status(sqlite3_errmsg(db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+    }
+    return stepRow(putExpireSQL, key, value);
+}
+
+template<typename K>
+int DBImpl::bindKey(sqlite3_stmt * stmt, int idx, const K & key, int components)
+{
+    return key_traits<K>::bind(stmt, idx, key, encodeKeys, components);
+}
+
+template<typename K>
+bool DBImpl::columnKey(sqlite3_stmt * stmt, int idx, K & key)
+{
+    return key_traits<K>::column(stmt, idx, key, encodeKeys);
+}
+
+template<typename K, typename V>
+Status DBImpl::stepRow(sqlite3_stmt * stmt, const K & key, const V & value)
+{
+    int sqlRet= sqlite3_reset(stmt);
+    if(SQLITE_OK != sqlRet)
+    {
+        std::string databaseErr = "Fail to sqlite3_reset.";
+        return Status(sqlite3_errmsg(db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+    }
+
+    sqlRet = bindKey(stmt, 1, key);
+    if(SQLITE_OK != sqlRet)
+    {
+        std::string databaseErr = "Fail to bind key.";
+        return Status(sqlite3_errmsg(db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+    }
+
+    Status status = bindValue(stmt, value);
+    if(!status.ok())
+    {
+        return status;
+    }
+
+    sqlRet = sqlite3_step(stmt);
+    if(SQLITE_DONE != sqlRet)
+    {
+        std::string databaseErr = "Fail to sqlite3_step.";
+        status = Status(sqlite3_errmsg(db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+        /* Otherwise the next reset reports this error again */
+        sqlite3_reset(stmt);
+        return status;
+    }
+
+    return Status();
+}
+
+template<typename V>
+Status DBImpl::bindValue(sqlite3_stmt * stmt, const V & value)
+{
+    const char * data = nullptr;
+    size_t size = 0;
+    const bool separate = framedValues && value_log_traits<V>::bytes(value, data, size);
+    const bool moved = separate && valueLog && (int64_t)size >= valueLogThreshold;
+    bool compressed = false;
+    if(separate && (moved || (int64_t)size >= compressionThreshold))
+    {
+        frameBuffer.assign(1, '\0');
+        if(compressor && (int64_t)size >= compressionThreshold && compressor->compress(data, size, frameBuffer) && frameBuffer.size() <= size)
+        {
+            frameBuffer[0] = (char)compressor->id();
+            compressed = true;
+        }
+        else if(moved)
+        {
+            frameBuffer.resize(1);
+            frameBuffer.append(data, size);
+        }
+    }
+
+    int sqlRet = SQLITE_OK;
+    if(moved)
+    {
+        /* With synchronous writes the record reaches the disk before the row that points to it */
+        int64_t position = 0;
+        Status status = valueLog->append(frameBuffer.data(), frameBuffer.size(), connection->syncWrite, position);
+        if(!status.ok())
+        {
+            return status;
+        }
+        sqlRet = sqlite3_bind_int64(stmt, 2, position);
+    }
+    else if(compressed)
+    {
+        sqlRet = sqlite3_bind_blob(stmt, 2, frameBuffer.data(), (int)frameBuffer.size(), SQLITE_STATIC);
+    }
+    else
+    {
+        sqlRet = mapping_traits<V>::bind(stmt, 2, value);
+    }
+    if(SQLITE_OK == sqlRet && framedValues)
+    {
+        sqlRet = (moved || compressed) ? sqlite3_bind_int64(stmt, 6, (int64_t)frameBuffer.size()) : sqlite3_bind_null(stmt, 6);
+    }
+    if(SQLITE_OK != sqlRet)
+    {
+        std::string databaseErr = "Fail to bind value.";
+        return Status(sqlite3_errmsg(db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+    }
+    return Status();
+}
+
+inline Status DBImpl::decodeFrame(const char * frame, size_t size, std::string & value)
+{
+    value.clear();
+    if(0 == size)
+    {
+        return Status("", "Corrupted value frame.", Status::IOError, "0");
+    }
+    const int id = (unsigned char)frame[0];
+    if(0 == id)
+    {
+        value.assign(frame + 1, size - 1);
+        return Status();
+    }
+
+    /* The built-in compressor is always known, others only while the DB is given them */
+    const Compressor * codec = (Compressor::lz()->id() == id) ? Compressor::lz() : compressor;
+    if(nullptr == codec || codec->id() != id)
+    {
+        return Status("", "Invalid argument, value compressed by unknown compressor " + std::to_string(id) + ".", Status::InvalidArgument, "0");
+    }
+    if(!codec->uncompress(frame + 1, size - 1, value))
+    {
+        return Status("", "Corrupted compressed value.", Status::IOError, "0");
+    }
+    return Status();
+}
+
+template<typename V>
+Status DBImpl::resolveValue(sqlite3_stmt * stmt, int idx, V & value, std::string & buffer)
+{
+    if(!value_log_traits<V>::separable || SQLITE_NULL == sqlite3_column_type(stmt, idx + 1))
+    {
+        return Status();
+    }
+
+    Status status;
+    if(SQLITE_INTEGER == sqlite3_column_type(stmt, idx))
+    {
+        if(!valueLog)
+        {
+            return Status("", "Missing value log.", Status::IOError, "0");
+        }
+        std::string frame;
+        status = valueLog->read(sqlite3_column_int64(stmt, idx), sqlite3_column_int64(stmt, idx + 1), frame);
+        if(status.ok())
+        {
+            status = decodeFrame(frame.data(), frame.size(), buffer);
+        }
+    }
+    else
+    {
+        /* After mapping_traits<V>::getColumn(), which may have converted it to text: the bytes are the same */
+        status = decodeFrame((const char *)sqlite3_column_blob(stmt, idx), sqlite3_column_bytes(stmt, idx), buffer);
+    }
+    if(status.ok())
+    {
+        value = value_log_traits<V>::fromBytes(buffer);
+    }
+    return status;
+}
+
+template<typename K, typename V>
+Status DBImpl::putRow(const K & key, const V & value)
+{
+    return stepRow(putSQL, key, value);
+}
+
+template<typename K, typename V>
+Status DBImpl::mergeRow(const K & key, const V & operand, MergeOperator op)
+{
+    if(framedValues)
+    {
+        return framedValueUnsupported();
+    }
+    if(!mergeSupported(op, mapping_traits<V>::storage))
+    {
+        return Status("", "Invalid argument, merge operator does not apply to this value type.", Status::InvalidArgument, "0");
+    }
+
+    /* Prepared on first use, most databases never merge */
+    if(nullptr == mergeSQL[op])
+    {
+        const std::string query = "INSERT INTO " + table() + "(" + keyColumns() + ", value) VALUES (" + keyParams(1) + ", ?2) "
+            "ON CONFLICT(" + keyColumns() + ") DO UPDATE SET " + upsertSet(mergeExpression(op, mapping_traits<V>::storage), "?2");
+        Status status = prepareSQL(db, query, &mergeSQL[op]);
+        if(!status.ok())
+        {
+            return status;
+        }
+    }
+
+    if(ttl)
+    {
+        Status status = bindNow(mergeSQL[op], 3);
+        if(!status.ok())
+        {
+            return status;
+        }
+    }
+    return stepRow(mergeSQL[op], key, operand);
+}
+
+template<typename K, typename V>
+Status DBImpl::mergeRow(const K & key, const V & operand, const std::string & name)
+{
+    if(framedValues)
+    {
+        return framedValueUnsupported();
+    }
+    auto iter = customMergeSQL.find(name);
+    if(iter == customMergeSQL.end())
+    {
+        return Status("", "Invalid argument, merge operator is not registered:" + name, Status::InvalidArgument, "0");
+    }
+    if(ttl)
+    {
+        Status status = bindNow(iter->second, 3);
+        if(!status.ok())
+        {
+            return status;
+        }
+    }
+    return stepRow(iter->second, key, operand);
+}
+
+/*
+ * SQL function kvsqlite_exchange_<schema>_<table>(old, new) used by getAndSet(): it keeps a
+ * copy of the old value in DBImpl::exchangedValue and returns the new one, so
+ * the old value is captured by the same UPSERT that replaces it. RETURNING can
+ * not do this, it only sees the row after the update.
+ */
+static inline void exchangeFunctionCallback(sqlite3_context *ctx, int, sqlite3_value **argv)
+{
+    DBImpl * impl = (DBImpl *)sqlite3_user_data(ctx);
+    sqlite3_value_free(impl->exchangedValue);
+    impl->exchangedValue = nullptr;
+    /* NULL stands for an expired row, which did not exist as far as readers are concerned */
+    if(SQLITE_NULL != sqlite3_value_type(argv[0]))
+    {
+        impl->exchangedValue = sqlite3_value_dup(argv[0]);
+    }
+    sqlite3_result_value(ctx, argv[1]);
+}
+
+static inline Status conditionNotMet(const std::string & databaseText)
+{
+    return Status("", databaseText, Status::ConditionNotMet, "0");
+}
+
+template<typename K, typename V>
+Status DBImpl::putIfAbsentRow(const K & key, const V & value)
+{
+    if(nullptr == putIfAbsentSQL)
+    {
+        /* An expired row is replaced as if it were missing */
+        const std::string query = "INSERT INTO " + table() + "(" + keyColumns() + ", " + valueColumns() + ") VALUES (" + keyParams(1) + ", " + valueParams() + ") "
+            "ON CONFLICT(" + keyColumns() + ") " +
+            (ttl ? "DO UPDATE SET " + valueUpdate() + ", expire = NULL WHERE expire <= ?3" : "DO NOTHING");
+        Status status = prepareSQL(db, query, &putIfAbsentSQL);
+        if(!status.ok())
+        {
+            return status;
+        }
+    }
+
+    if(ttl)
+    {
+        Status status = bindNow(putIfAbsentSQL, 3);
+        if(!status.ok())
+        {
+            return status;
+        }
+    }
+
+    Status status = stepRow(putIfAbsentSQL, key, value);
+    if(status.ok() && 0 == sqlite3_changes(db))
+    {
+        return conditionNotMet("Key already exists.");
+    }
+    return status;
+}
+
+template<typename K, typename V>
+Status DBImpl::compareAndSwapRow(const K & key, const V & expected, const V & desired)
+{
+    if(framedValues)
+    {
+        return framedValueUnsupported();
+    }
+    if(nullptr == compareAndSwapSQL)
+    {
+        const std::string query = "UPDATE " + table() + " SET value = ?3 WHERE " + keyCompare("=", 1) + " AND value = ?2" +
+            (ttl ? " AND (expire IS NULL OR expire > ?4)" : "");
+        Status status = prepareSQL(db, query, &compareAndSwapSQL);
+        if(!status.ok())
+        {
+            return status;
+        }
+    }
+
+    if(ttl)
+    {
+        Status status = bindNow(compareAndSwapSQL, 4);
+        if(!status.ok())
+        {
+            return status;
+        }
+    }
+
+    /* ?1 and ?2 are bound by stepRow() */
+    int sqlRet = sqlite3_reset(compareAndSwapSQL);
+    if(SQLITE_OK == sqlRet)
+    {
+        sqlRet = mapping_traits<V>::bind(compareAndSwapSQL, 3, desired);
+    }
+    if(SQLITE_OK != sqlRet)
+    {
+        std::string databaseErr = "Fail to bind value.";
+        return Status(sqlite3_errmsg(db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+    }
+
+    Status status = stepRow(compareAndSwapSQL, key, expected);
+    if(status.ok() && 0 == sqlite3_changes(db))
+    {
+        return conditionNotMet("Key is missing or its value differs from the expected one.");
+    }
+    return status;
+}
+
+template<typename K, typename V>
+Status DBImpl::getAndSetRow(const K & key, const V & value, V & oldValue, bool * existed)
+{
+    if(framedValues)
+    {
+        return framedValueUnsupported();
+    }
+    if(nullptr == getAndSetSQL)
+    {
+        /* Functions belong to the connection, each keyspace sharing it needs its own */
+        const std::string function = "kvsqlite_exchange_" + schema + "_" + tableName;
+        int sqlRet = sqlite3_create_function_v2(db, function.c_str(), 2, SQLITE_UTF8, this,
+                &exchangeFunctionCallback, nullptr, nullptr, nullptr);
+        if(SQLITE_OK != sqlRet)
+        {
+            std::string databaseErr = "Fail to create function:" + function;
+            return Status(sqlite3_errmsg(db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+        }
+
+        /* Like put(), a getAndSet() clears the expiry of the key */
+        const std::string query = "INSERT INTO " + table() + "(" + keyColumns() + ", value) VALUES (" + keyParams(1) + ", ?2) "
+            "ON CONFLICT(" + keyColumns() + ") DO UPDATE SET " +
+            (ttl ? "value = " + function + "(CASE WHEN expire <= ?3 THEN NULL ELSE value END, excluded.value), expire = NULL"
+                 : "value = " + function + "(value, excluded.value)");
+        Status status = prepareSQL(db, query, &getAndSetSQL);
+        if(!status.ok())
+        {
+            return status;
+        }
+    }
+
+    if(ttl)
+    {
+        Status status = bindNow(getAndSetSQL, 3);
+        if(!status.ok())
+        {
+            return status;
+        }
+    }
+
+    /* The previous old value is released here, a Slice pointing into it is valid until now */
+    sqlite3_value_free(exchangedValue);
+    exchangedValue = nullptr;
+
+    Status status = stepRow(getAndSetSQL, key, value);
+    if(!status.ok())
+    {
+        return status;
+    }
+
+    if(nullptr != existed)
+    {
+        *existed = (nullptr != exchangedValue);
+    }
+    if(nullptr != exchangedValue)
+    {
+        oldValue = mapping_traits<V>::fromValue(exchangedValue);
+    }
+    return Status();
+}
+
+template<typename V>
+Status DBImpl::registerMergeFunction(const std::string & name, const std::function<V(const V *, const V &)> & func)
+{
+    if(name.empty() || !func)
+    {
+        return Status("", "Invalid argument, merge operator needs a name and a function.", Status::InvalidArgument, "0");
+    }
+    for(char c : name)
+    {
+        if(!(('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || ('0' <= c && c <= '9') || '_' == c))
+        {
+            return Status("", "Invalid argument, merge operator name may only use [A-Za-z0-9_]:" + name, Status::InvalidArgument, "0");
+        }
+    }
+
+    /* A function can not be replaced while a read is still positioned on a row */
+    sqlite3_reset(getSQL);
+
+    const std::string function = "kvsqlite_merge_" + schema + "_" + tableName + "_" + name;
+    MergeFunctionHolder<V> * holder = new MergeFunctionHolder<V>();
+    holder->func = func;
+
+    /* On failure SQLite calls destroyMergeFunction() itself */
+    int sqlRet = sqlite3_create_function_v2(db, function.c_str(), 2, SQLITE_UTF8, holder,
+            &mergeFunctionCallback<V>, nullptr, nullptr, &destroyMergeFunction<V>);
+    if(SQLITE_OK != sqlRet)
+    {
+        std::string databaseErr = "Fail to create function:" + function;
+        return Status(sqlite3_errmsg(db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+    }
+
+    if(customMergeSQL.find(name) == customMergeSQL.end())
+    {
+        /* The function also sees inserts, with a NULL existing value */
+        const std::string query = "INSERT INTO " + table() + "(" + keyColumns() + ", value) VALUES (" + keyParams(1) + ", " + function + "(NULL, ?2)) "
+            "ON CONFLICT(" + keyColumns() + ") DO UPDATE SET " + upsertSet(function + "(value, ?2)", function + "(NULL, ?2)");
+        sqlite3_stmt * stmt = nullptr;
+        Status status = prepareSQL(db, query, &stmt);
+        if(!status.ok())
+        {
+            return status;
+        }
+        customMergeSQL[name] = stmt;
+    }
+    return Status();
+}
+
+template<typename K>
+Status DBImpl::delRow(const K & key)
+{
+    int sqlRet= sqlite3_reset(delSQL);
+    if(SQLITE_OK != sqlRet)
+    {
+        std::string databaseErr = "Fail to sqlite3_reset.";
+        return Status(sqlite3_errmsg(db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+    }
+
+    sqlRet = bindKey(delSQL, 1, key);
+    if(SQLITE_OK != sqlRet)
+    {
+        std::string databaseErr = "Fail to bind key.";
+        return Status(sqlite3_errmsg(db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+    }
+
+    sqlRet = sqlite3_step(delSQL);
+    if(SQLITE_DONE != sqlRet)
+    {
+        std::string databaseErr = "Fail to sqlite3_step.";
+        Status status(sqlite3_errmsg(db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+        /* Otherwise the next reset reports this error again */
+        sqlite3_reset(delSQL);
+        return status;
+    }
+
+    return Status();
+}
+
+template<typename K>
+Status DBImpl::deleteRangeRows(const K * lower, const K * upper, int chunkSize, int64_t & deleted)
+{
+    deleted = 0;
+
+    std::string where;
+    if(nullptr != lower)
+    {
+        where = " WHERE " + keyCompare(">=", 1);
+    }
+    if(nullptr != upper)
+    {
+        where += ((nullptr != lower) ? " AND " : " WHERE ") + keyCompare("<", 2);
+    }
+
+    /*
+     * A DELETE without WHERE clause lets SQLite free the whole table at once
+     * (the truncate optimization) instead of visiting every row. Range deletes
+     * are rare and differ in shape, so they are prepared on each call.
+     */
+    const std::string query = (chunkSize > 0) ?
+        "DELETE FROM " + table() + " WHERE rowid IN (SELECT rowid FROM " + table() + where + " LIMIT ?3)" :
+        "DELETE FROM " + table() + where;
+    sqlite3_stmt * stmt = nullptr;
+    Status status = prepareSQL(db, query, &stmt);
+    if(!status.ok())
+    {
+        return status;
+    }
+
+    int sqlRet = SQLITE_OK;
+    if(nullptr != lower)
+    {
+        sqlRet = bindKey(stmt, 1, *lower);
+    }
+    if(SQLITE_OK == sqlRet && nullptr != upper)
+    {
+        sqlRet = bindKey(stmt, 2, *upper);
+    }
+    if(SQLITE_OK == sqlRet && chunkSize > 0)
+    {
+        sqlRet = sqlite3_bind_int(stmt, 3, chunkSize);
+    }
+
+    if(SQLITE_OK != sqlRet)
+    {
+        std::string databaseErr = "Fail to bind key.";
+        status = Status(sqlite3_errmsg(db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+    }
+    else
+    {
+        status = stepSQL(db, stmt);
+        if(status.ok())
+        {
+            deleted = sqlite3_changes(db);
+        }
+    }
+    sqlite3_finalize(stmt);
+    return status;
+}
+
+template<typename K>
+Status DBImpl::countRows(const K & lower, const K & upper, int64_t & count)
+{
+    if(nullptr == countSQL)
+    {
+        /* Without TTL the count is answered from the key index alone */
+        const std::string query = "SELECT count(*) FROM " + table() + " WHERE " + keyCompare(">=", 1) + " AND " + keyCompare("<", 2) +
+            (ttl ? " AND (expire IS NULL OR expire > ?3)" : "");
+        Status status = prepareSQL(db, query, &countSQL);
+        if(!status.ok())
+        {
+            return status;
+        }
+    }
+
+    if(ttl)
+    {
+        Status status = bindNow(countSQL, 3);
+        if(!status.ok())
+        {
+            return status;
+        }
+    }
+
+    int sqlRet = sqlite3_reset(countSQL);
+    if(SQLITE_OK == sqlRet)
+    {
+        sqlRet = bindKey(countSQL, 1, lower);
+    }
+    if(SQLITE_OK == sqlRet)
+    {
+        sqlRet = bindKey(countSQL, 2, upper);
+    }
+    if(SQLITE_OK != sqlRet)
+    {
+        std::string databaseErr = "Fail to bind key.";
+        return Status(sqlite3_errmsg(db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+    }
+
+    sqlRet = sqlite3_step(countSQL);
+    if(SQLITE_ROW != sqlRet)
+    {
+        std::string databaseErr = "Fail to sqlite3_step.";
+        Status status(sqlite3_errmsg(db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+        sqlite3_reset(countSQL);
+        return status;
+    }
+    count = sqlite3_column_int64(countSQL, 0);
+    sqlite3_reset(countSQL);
+    return Status();
+}
+
+template<typename K>
+Status DBImpl::sizeRows(const K & lower, const K & upper, int64_t & size)
+{
+    /* Only used when no estimate is possible, so prepared on each call */
+    const std::string query = "SELECT coalesce(sum(" + keyBytesExpression() + " + " + byteLengthExpression("value") + "), 0) "
+        "FROM " + table() + " WHERE " + keyCompare(">=", 1) + " AND " + keyCompare("<", 2);
+    sqlite3_stmt * stmt = nullptr;
+    Status status = prepareSQL(db, query, &stmt);
+    if(!status.ok())
+    {
+        return status;
+    }
+
+    int sqlRet = bindKey(stmt, 1, lower);
+    if(SQLITE_OK == sqlRet)
+    {
+        sqlRet = bindKey(stmt, 2, upper);
+    }
+    if(SQLITE_OK == sqlRet)
+    {
+        sqlRet = sqlite3_step(stmt);
+    }
+    if(SQLITE_ROW == sqlRet)
+    {
+        size = sqlite3_column_int64(stmt, 0);
+    }
+    else
+    {
+        std::string databaseErr = std::string("Fail to exec:") + query;
+        status = Status(sqlite3_errmsg(db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+    }
+    sqlite3_finalize(stmt);
+    return status;
+}
+
+template<typename K>
+Status DBImpl::storedKey(const K & key, StoredValue & value)
+{
+    /* Let SQLite apply its own conversions by echoing the bound key, the first component of a tuple */
+    if(nullptr == echoSQL)
+    {
+        Status status = prepareSQL(db, "SELECT ?1", &echoSQL);
+        if(!status.ok())
+        {
+            return status;
+        }
+    }
+
+    int sqlRet = bindKey(echoSQL, 1, key, 1);
+    if(SQLITE_OK == sqlRet)
+    {
+        sqlRet = sqlite3_step(echoSQL);
+    }
+    if(SQLITE_ROW != sqlRet)
+    {
+        std::string databaseErr = "Fail to bind key.";
+        Status status(sqlite3_errmsg(db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+        sqlite3_reset(echoSQL);
+        return status;
+    }
+    captureValue(echoSQL, 0, value);
+    sqlite3_reset(echoSQL);
+    return Status();
+}
+
+/*
+ * On success getSQL is left positioned on the row, so that a Slice value,
+ * which points into the statement, stays valid until the next read.
+ */
+template<typename K, typename V>
+Status DBImpl::getRow(const K & key, V & value)
+{
+    Status status;
+    if(directReader && directGetRow(key, value, status))
+    {
+        return status;
+    }
+
+    int sqlRet= sqlite3_reset(getSQL);
+    if(SQLITE_OK != sqlRet)
+    {
+        std::string databaseErr = "Fail to sqlite3_reset.";
+        return Status(sqlite3_errmsg(db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+    }
+
+    sqlRet = bindKey(getSQL, 1, key);
+    if(SQLITE_OK != sqlRet)
+    {
+        std::string databaseErr = "Fail to bind key.";
+        return Status(sqlite3_errmsg(db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+    }
+
+    /* Expired rows are filtered out here and left to the purger, reads never write */
+    if(ttl)
+    {
+        status = bindNow(getSQL, 2);
+        if(!status.ok())
+        {
+            return status;
+        }
+    }
+
+    sqlRet = sqlite3_step(getSQL);
+
+    if(SQLITE_ROW != sqlRet)
+    {
+        std::string databaseErr = "Not found.";
+        return Status(sqlite3_errmsg(db), databaseErr, Status::NotFound, std::to_string(sqlRet));
+    }
+
+    value = mapping_traits<V>::getColumn(getSQL, 0);
+    if(framedValues)
+    {
+        return resolveValue(getSQL, 0, value, valueLogBuffer);
+    }
+    return Status();
+}
+
+template<typename K, typename V>
+bool DBImpl::directGetRow(const K & key, V & value, Status & status)
+{
+    StoredValue stored;
+    RecordColumn column;
+    if(key_traits<K>::stored(key, encodeKeys, stored))
+    {
+        switch(directReader->lookup(stored, column))
+        {
+        case DirectReader::Missing:
+            directLookups++;
+            status = Status("", "Not found.", Status::NotFound, "0");
+            return true;
+        case DirectReader::Found:
+            /* A value of another type is converted by SQLite */
+            if(mapping_traits<V>::fromColumn(column, value))
+            {
+                directLookups++;
+                status = Status();
+                return true;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    directFallbacks++;
+    return false;
+}
+
+template<typename K>
+Status DBImpl::locateRow(const K & key, int64_t & rowid, int64_t & size)
+{
+    /* Prepared on first use, most databases never stream values */
+    if(nullptr == locateSQL)
+    {
+        const std::string query = "SELECT rowid, length(value) FROM " + table() + " WHERE " + keyCompare("=", 1) +
+            (ttl ? " AND (expire IS NULL OR expire > ?2)" : "");
+        Status status = prepareSQL(db, query, &locateSQL);
+        if(!status.ok())
+        {
+            return status;
+        }
+    }
+
+    if(ttl)
+    {
+        Status status = bindNow(locateSQL, 2);
+        if(!status.ok())
+        {
+            return status;
+        }
+    }
+
+    int sqlRet = sqlite3_reset(locateSQL);
+    if(SQLITE_OK == sqlRet)
+    {
+        sqlRet = bindKey(locateSQL, 1, key);
+    }
+    if(SQLITE_OK != sqlRet)
+    {
+        std::string databaseErr = "Fail to bind key.";
+        return Status(sqlite3_errmsg(db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+    }
+
+    sqlRet = sqlite3_step(locateSQL);
+    if(SQLITE_ROW != sqlRet)
+    {
+        std::string databaseErr = "Not found.";
+        Status status(sqlite3_errmsg(db), databaseErr, (SQLITE_DONE == sqlRet) ? Status::NotFound : Status::UnknownError, std::to_string(sqlRet));
+        sqlite3_reset(locateSQL);
+        return status;
+    }
+    rowid = sqlite3_column_int64(locateSQL, 0);
+    size = sqlite3_column_int64(locateSQL, 1);
+    sqlite3_reset(locateSQL);
+    return Status();
+}
+
+}/* end of namespace KVSQLite */
+
+#endif
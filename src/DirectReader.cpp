@@ -0,0 +1,329 @@
+#include "DirectReader.h"
+#include <cstring>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace KVSQLite
+{
+
+namespace
+{
+
+/* A B-tree of 4GB pages is well below 20 levels */
+const int maxDepth = 20;
+
+/* Map the whole file read-only, false if it is empty or can not be mapped */
+#ifdef _WIN32
+bool mapFile(const std::string & filename, const uint8_t *& data, uint64_t & size, void *& mapping)
+{
+    /* SQLite file names are UTF-8 */
+    int length = MultiByteToWideChar(CP_UTF8, 0, filename.c_str(), -1, nullptr, 0);
+    if(length <= 0)
+    {
+        return false;
+    }
+    std::wstring name(length, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, filename.c_str(), -1, &name[0], length);
+
+    HANDLE file = CreateFileW(name.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(INVALID_HANDLE_VALUE == file)
+    {
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    HANDLE handle = nullptr;
+    if(GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+    {
+        handle = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    }
+    CloseHandle(file);
+    if(nullptr == handle)
+    {
+        return false;
+    }
+    void * view = MapViewOfFile(handle, FILE_MAP_READ, 0, 0, 0);
+    if(nullptr == view)
+    {
+        CloseHandle(handle);
+        return false;
+    }
+    data = (const uint8_t *)view;
+    size = (uint64_t)fileSize.QuadPart;
+    mapping = handle;
+    return true;
+}
+#else
+bool mapFile(const std::string & filename, const uint8_t *& data, uint64_t & size)
+{
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    void * view = MAP_FAILED;
+    if(0 == fstat(fd, &st) && st.st_size > 0)
+    {
+        view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    /* The mapping keeps the file open */
+    ::close(fd);
+    if(MAP_FAILED == view)
+    {
+        return false;
+    }
+    data = (const uint8_t *)view;
+    size = (uint64_t)st.st_size;
+    return true;
+}
+#endif
+
+}/* end of anonymous namespace */
+
+DirectReader::~DirectReader()
+{
+    if(nullptr == m_data)
+    {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(m_data);
+    CloseHandle(m_mapping);
+#else
+    munmap((void *)m_data, (size_t)m_size);
+#endif
+}
+
+bool DirectReader::open(const std::string & filename, uint32_t tableRoot, uint32_t indexRoot)
+{
+    if(nullptr != m_data || 0 == tableRoot || 0 == indexRoot)
+    {
+        return false;
+    }
+#ifdef _WIN32
+    if(!mapFile(filename, m_data, m_size, m_mapping))
+#else
+    if(!mapFile(filename, m_data, m_size))
+#endif
+    {
+        m_data = nullptr;
+        return false;
+    }
+
+    /* Page size and reserved bytes per page from the database header, and UTF-8 text only: keys compare as bytes */
+    if(m_size < 100 || 0 != memcmp(m_data, "SQLite format 3", 16) || 1 != getBigEndian(m_data + 56, 4))
+    {
+        return false;
+    }
+    m_pageSize = getBigEndian(m_data + 16, 2);
+    if(1 == m_pageSize)
+    {
+        m_pageSize = 65536;
+    }
+    if(m_pageSize < 512 || m_pageSize > 65536 || m_data[20] >= m_pageSize - 480)
+    {
+        return false;
+    }
+    m_usableSize = m_pageSize - m_data[20];
+    m_pageCount = (uint32_t)std::min<uint64_t>(m_size / m_pageSize, UINT32_MAX);
+    m_tableRoot = tableRoot;
+    m_indexRoot = indexRoot;
+    return tableRoot <= m_pageCount && indexRoot <= m_pageCount;
+}
+
+const uint8_t * DirectReader::page(uint32_t pgno) const
+{
+    if(0 == pgno || pgno > m_pageCount)
+    {
+        return nullptr;
+    }
+    return m_data + (uint64_t)(pgno - 1) * m_pageSize;
+}
+
+DirectReader::Result DirectReader::lookup(const StoredValue & key, RecordColumn & value) const
+{
+    if(0 == m_pageCount)
+    {
+        return Fallback;
+    }
+    int64_t rowid = 0;
+    Result result = findRowid(key, rowid);
+    if(Found != result)
+    {
+        return result;
+    }
+    result = findRow(rowid, value);
+    /* The index names a row the table does not have: let SQLite tell */
+    return (Missing == result) ? Fallback : result;
+}
+
+/*
+ * The key index holds records (key, rowid) in interior pages as well as in
+ * leaves. Records too large to stay on their page are not read.
+ */
+DirectReader::Result DirectReader::findRowid(const StoredValue & key, int64_t & rowid) const
+{
+    /* Largest payload kept on an index page, see "Cell Payload Overflow Pages" */
+    const uint64_t maxLocal = ((m_usableSize - 12) * 64 / 255) - 23;
+    uint32_t pgno = m_indexRoot;
+    for(int depth = 0; depth < maxDepth; depth++)
+    {
+        const uint8_t * data = page(pgno);
+        if(nullptr == data)
+        {
+            return Fallback;
+        }
+        const uint8_t * end = data + m_usableSize;
+        const uint8_t * header = data + ((1 == pgno) ? 100 : 0);
+        const bool interior = (0x02 == header[0]);
+        if(!interior && 0x0a != header[0])
+        {
+            return Fallback;
+        }
+        const uint32_t cells = getBigEndian(header + 3, 2);
+        const uint8_t * cellPointers = header + (interior ? 12 : 8);
+        if(cellPointers + 2 * cells > end)
+        {
+            return Fallback;
+        }
+
+        /* Binary search for the first cell whose key is not less than key */
+        uint32_t lo = 0;
+        uint32_t hi = cells;
+        while(lo < hi)
+        {
+            const uint32_t mid = lo + (hi - lo) / 2;
+            const uint8_t * p = data + getBigEndian(cellPointers + 2 * mid, 2) + (interior ? 4 : 0);
+            uint64_t payloadSize = 0;
+            int n = (p < end) ? getVarint(p, end, payloadSize) : 0;
+            RecordColumn record[2];
+            if(0 == n || payloadSize > maxLocal || payloadSize > (uint64_t)(end - p - n) ||
+                !decodeRecord(p + n, p + n + payloadSize, record, 2))
+            {
+                return Fallback;
+            }
+            const int c = compareStored(record[0], key);
+            if(0 == c)
+            {
+                if(SQLITE_INTEGER != record[1].type)
+                {
+                    return Fallback;
+                }
+                rowid = record[1].i;
+                return Found;
+            }
+            if(c < 0)
+            {
+                lo = mid + 1;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+
+        if(!interior)
+        {
+            return Missing;
+        }
+        const uint8_t * child = (lo == cells) ? header + 8 : data + getBigEndian(cellPointers + 2 * lo, 2);
+        if(child + 4 > end)
+        {
+            return Fallback;
+        }
+        pgno = getBigEndian(child, 4);
+    }
+    return Fallback;
+}
+
+/* Interior table pages hold (child, largest rowid of the child) cells, leaves the rows */
+DirectReader::Result DirectReader::findRow(int64_t rowid, RecordColumn & value) const
+{
+    const uint64_t maxLocal = m_usableSize - 35;
+    uint32_t pgno = m_tableRoot;
+    for(int depth = 0; depth < maxDepth; depth++)
+    {
+        const uint8_t * data = page(pgno);
+        if(nullptr == data)
+        {
+            return Fallback;
+        }
+        const uint8_t * end = data + m_usableSize;
+        const uint8_t * header = data + ((1 == pgno) ? 100 : 0);
+        const bool interior = (0x05 == header[0]);
+        if(!interior && 0x0d != header[0])
+        {
+            return Fallback;
+        }
+        const uint32_t cells = getBigEndian(header + 3, 2);
+        const uint8_t * cellPointers = header + (interior ? 12 : 8);
+        if(cellPointers + 2 * cells > end)
+        {
+            return Fallback;
+        }
+
+        /* Binary search for the first cell whose rowid is not less than rowid */
+        uint32_t lo = 0;
+        uint32_t hi = cells;
+        const uint8_t * found = nullptr;
+        while(lo < hi)
+        {
+            const uint32_t mid = lo + (hi - lo) / 2;
+            const uint8_t * cell = data + getBigEndian(cellPointers + 2 * mid, 2);
+            const uint8_t * p = cell + (interior ? 4 : 0);
+            uint64_t payloadSize = 0;
+            uint64_t key = 0;
+            int n = 0;
+            if(p >= end || (!interior && 0 == (n = getVarint(p, end, payloadSize))) || 0 == getVarint(p + n, end, key))
+            {
+                return Fallback;
+            }
+            if((int64_t)key < rowid)
+            {
+                lo = mid + 1;
+            }
+            else
+            {
+                hi = mid;
+                found = ((int64_t)key == rowid) ? cell : nullptr;
+            }
+        }
+
+        if(interior)
+        {
+            const uint8_t * child = (lo == cells) ? header + 8 : data + getBigEndian(cellPointers + 2 * lo, 2);
+            if(child + 4 > end)
+            {
+                return Fallback;
+            }
+            pgno = getBigEndian(child, 4);
+            continue;
+        }
+        if(nullptr == found || lo == cells)
+        {
+            return Missing;
+        }
+
+        uint64_t payloadSize = 0;
+        uint64_t key = 0;
+        int n = getVarint(found, end, payloadSize);
+        n += getVarint(found + n, end, key);
+        RecordColumn record[2];
+        if(payloadSize > maxLocal || payloadSize > (uint64_t)(end - found - n) ||
+            !decodeRecord(found + n, found + n + payloadSize, record, 2))
+        {
+            return Fallback;
+        }
+        value = record[1];
+        return Found;
+    }
+    return Fallback;
+}
+
+}/* end of namespace KVSQLite */
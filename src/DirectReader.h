@@ -0,0 +1,73 @@
+/**
+ * @file DirectReader.h
+ * @brief Point lookups in the B-trees of a memory mapped immutable database file, see Options::direct_reads. Not installed.
+ */
+
+#ifndef _KVSQLITE_DIRECT_READER_H_
+#define _KVSQLITE_DIRECT_READER_H_
+
+#include <cstdint>
+#include <string>
+#include "BTreeReader.h"
+
+namespace KVSQLite
+{
+
+/*
+ * Finds the value of a key of a table (key PRIMARY KEY, value, ...) by
+ * walking its key index and then the table itself in a read-only mapping of
+ * the whole database file, without SQL. The file must not change while the
+ * reader is open, and must hold every committed page: not in WAL mode, not
+ * compressed by a VFS.
+ *
+ * Any record that spills to overflow pages, and any page that does not look
+ * right, makes the lookup give up with Fallback, for the caller to ask
+ * SQLite instead.
+ */
+class DirectReader
+{
+public:
+    enum Result
+    {
+        Found,
+        Missing,
+        Fallback
+    };
+
+    DirectReader() = default;
+    ~DirectReader();
+
+    /*
+     * Map the database file filename, whose table has its root at page
+     * tableRoot and its key index at indexRoot. False if the file can not be
+     * read this way.
+     */
+    bool open(const std::string & filename, uint32_t tableRoot, uint32_t indexRoot);
+
+    /* Look key up; on Found, value is the second column of its row, pointing into the mapping */
+    Result lookup(const StoredValue & key, RecordColumn & value) const;
+private:
+    DirectReader(const DirectReader &) = delete;
+    DirectReader & operator=(const DirectReader &) = delete;
+
+    /* Page pgno, null if it is not in the file */
+    const uint8_t * page(uint32_t pgno) const;
+
+    Result findRowid(const StoredValue & key, int64_t & rowid) const;
+    Result findRow(int64_t rowid, RecordColumn & value) const;
+private:
+    const uint8_t * m_data = nullptr;
+    uint64_t m_size = 0;
+#ifdef _WIN32
+    void * m_mapping = nullptr;
+#endif
+    uint32_t m_pageSize = 0;
+    uint32_t m_usableSize = 0;
+    uint32_t m_pageCount = 0;
+    uint32_t m_tableRoot = 0;
+    uint32_t m_indexRoot = 0;
+};
+
+}/* end of namespace KVSQLite */
+
+#endif
@@ -0,0 +1,670 @@
+#include "IoStats.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+namespace KVSQLite
+{
+
+namespace
+{
+
+/* A file of the counting VFS. The file of the VFS underneath follows it in memory. */
+struct CountedFile
+{
+    sqlite3_file base;
+    IoStats * stats;
+    IoStats::FileKind kind;
+    bool traced;
+    sqlite3_file * real;
+};
+
+int64_t microsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+int fileClose(sqlite3_file * pFile)
+{
+    CountedFile * p = (CountedFile *)pFile;
+    return p->real->pMethods->xClose(p->real);
+}
+
+int fileRead(sqlite3_file * pFile, void * buffer, int amount, sqlite3_int64 offset)
+{
+    CountedFile * p = (CountedFile *)pFile;
+    auto start = std::chrono::steady_clock::now();
+    int rc = p->real->pMethods->xRead(p->real, buffer, amount, offset);
+    p->stats->record(p->kind, IoStats::Read, amount, microsSince(start));
+    if(p->traced && SQLITE_OK == rc)
+    {
+        p->stats->recordPage(offset, amount);
+    }
+    return rc;
+}
+
+int fileWrite(sqlite3_file * pFile, const void * buffer, int amount, sqlite3_int64 offset)
+{
+    CountedFile * p = (CountedFile *)pFile;
+    auto start = std::chrono::steady_clock::now();
+    int rc = p->real->pMethods->xWrite(p->real, buffer, amount, offset);
+    p->stats->record(p->kind, IoStats::Write, amount, microsSince(start));
+    return rc;
+}
+
+int fileTruncate(sqlite3_file * pFile, sqlite3_int64 size)
+{
+    CountedFile * p = (CountedFile *)pFile;
+    p->stats->recordTruncate(p->kind);
+    return p->real->pMethods->xTruncate(p->real, size);
+}
+
+int fileSync(sqlite3_file * pFile, int flags)
+{
+    CountedFile * p = (CountedFile *)pFile;
+    auto start = std::chrono::steady_clock::now();
+    int rc = p->real->pMethods->xSync(p->real, flags);
+    p->stats->record(p->kind, IoStats::Sync, 0, microsSince(start));
+    return rc;
+}
+
+int fileSize(sqlite3_file * pFile, sqlite3_int64 * pSize)
+{
+    CountedFile * p = (CountedFile *)pFile;
+    return p->real->pMethods->xFileSize(p->real, pSize);
+}
+
+int fileLock(sqlite3_file * pFile, int lock)
+{
+    CountedFile * p = (CountedFile *)pFile;
+    return p->real->pMethods->xLock(p->real, lock);
+}
+
+int fileUnlock(sqlite3_file * pFile, int lock)
+{
+    CountedFile * p = (CountedFile *)pFile;
+    return p->real->pMethods->xUnlock(p->real, lock);
+}
+
+int fileCheckReservedLock(sqlite3_file * pFile, int * pResOut)
+{
+    CountedFile * p = (CountedFile *)pFile;
+    return p->real->pMethods->xCheckReservedLock(p->real, pResOut);
+}
+
+int fileControl(sqlite3_file * pFile, int op, void * pArg)
+{
+    CountedFile * p = (CountedFile *)pFile;
+    return p->real->pMethods->xFileControl(p->real, op, pArg);
+}
+
+int fileSectorSize(sqlite3_file * pFile)
+{
+    CountedFile * p = (CountedFile *)pFile;
+    return p->real->pMethods->xSectorSize(p->real);
+}
+
+int fileDeviceCharacteristics(sqlite3_file * pFile)
+{
+    CountedFile * p = (CountedFile *)pFile;
+    return p->real->pMethods->xDeviceCharacteristics(p->real);
+}
+
+int fileShmMap(sqlite3_file * pFile, int region, int size, int extend, void volatile ** pp)
+{
+    CountedFile * p = (CountedFile *)pFile;
+    return p->real->pMethods->xShmMap(p->real, region, size, extend, pp);
+}
+
+int fileShmLock(sqlite3_file * pFile, int offset, int n, int flags)
+{
+    CountedFile * p = (CountedFile *)pFile;
+    return p->real->pMethods->xShmLock(p->real, offset, n, flags);
+}
+
+void fileShmBarrier(sqlite3_file * pFile)
+{
+    CountedFile * p = (CountedFile *)pFile;
+    p->real->pMethods->xShmBarrier(p->real);
+}
+
+int fileShmUnmap(sqlite3_file * pFile, int deleteFlag)
+{
+    CountedFile * p = (CountedFile *)pFile;
+    return p->real->pMethods->xShmUnmap(p->real, deleteFlag);
+}
+
+/* Pages read through a memory mapping are not counted, there is no call to time, but they are traced */
+int fileFetch(sqlite3_file * pFile, sqlite3_int64 offset, int amount, void ** pp)
+{
+    CountedFile * p = (CountedFile *)pFile;
+    int rc = p->real->pMethods->xFetch(p->real, offset, amount, pp);
+    if(p->traced && SQLITE_OK == rc && nullptr != *pp)
+    {
+        p->stats->recordPage(offset, amount);
+    }
+    return rc;
+}
+
+int fileUnfetch(sqlite3_file * pFile, sqlite3_int64 offset, void * page)
+{
+    CountedFile * p = (CountedFile *)pFile;
+    return p->real->pMethods->xUnfetch(p->real, offset, page);
+}
+
+/* One table per version of the methods underneath, SQLite looks at iVersion before using the later ones */
+const sqlite3_io_methods countedMethods[3] = {
+    {
+        1, fileClose, fileRead, fileWrite, fileTruncate, fileSync, fileSize, fileLock, fileUnlock,
+        fileCheckReservedLock, fileControl, fileSectorSize, fileDeviceCharacteristics,
+        nullptr, nullptr, nullptr, nullptr, nullptr, nullptr
+    },
+    {
+        2, fileClose, fileRead, fileWrite, fileTruncate, fileSync, fileSize, fileLock, fileUnlock,
+        fileCheckReservedLock, fileControl, fileSectorSize, fileDeviceCharacteristics,
+        fileShmMap, fileShmLock, fileShmBarrier, fileShmUnmap, nullptr, nullptr
+    },
+    {
+        3, fileClose, fileRead, fileWrite, fileTruncate, fileSync, fileSize, fileLock, fileUnlock,
+        fileCheckReservedLock, fileControl, fileSectorSize, fileDeviceCharacteristics,
+        fileShmMap, fileShmLock, fileShmBarrier, fileShmUnmap, fileFetch, fileUnfetch
+    }
+};
+
+int vfsOpen(sqlite3_vfs * pVfs, const char * zName, sqlite3_file * pFile, int flags, int * pOutFlags)
+{
+    IoStats * stats = IoStats::fromVfs(pVfs);
+    sqlite3_vfs * real = stats->base();
+    CountedFile * p = (CountedFile *)pFile;
+    p->base.pMethods = nullptr;
+    p->stats = stats;
+    p->real = (sqlite3_file *)(p + 1);
+    p->real->pMethods = nullptr;
+    p->traced = false;
+    if(flags & SQLITE_OPEN_MAIN_DB)
+    {
+        p->kind = IoStats::MainDB;
+        p->traced = stats->traces(zName);
+    }
+    else if(flags & SQLITE_OPEN_MAIN_JOURNAL)
+    {
+        p->kind = IoStats::Journal;
+    }
+    else if(flags & SQLITE_OPEN_WAL)
+    {
+        p->kind = IoStats::WAL;
+    }
+    else
+    {
+        p->kind = IoStats::Other;
+    }
+
+    int rc = real->xOpen(real, zName, p->real, flags, pOutFlags);
+    if(nullptr != p->real->pMethods)
+    {
+        const int version = p->real->pMethods->iVersion;
+        p->base.pMethods = &countedMethods[(version < 1) ? 0 : ((version > 3) ? 2 : version - 1)];
+    }
+    return rc;
+}
+
+int vfsDelete(sqlite3_vfs * pVfs, const char * zName, int syncDir)
+{
+    sqlite3_vfs * real = IoStats::fromVfs(pVfs)->base();
+    return real->xDelete(real, zName, syncDir);
+}
+
+int vfsAccess(sqlite3_vfs * pVfs, const char * zName, int flags, int * pResOut)
+{
+    sqlite3_vfs * real = IoStats::fromVfs(pVfs)->base();
+    return real->xAccess(real, zName, flags, pResOut);
+}
+
+int vfsFullPathname(sqlite3_vfs * pVfs, const char * zName, int nOut, char * zOut)
+{
+    sqlite3_vfs * real = IoStats::fromVfs(pVfs)->base();
+    return real->xFullPathname(real, zName, nOut, zOut);
+}
+
+void * vfsDlOpen(sqlite3_vfs * pVfs, const char * zFilename)
+{
+    sqlite3_vfs * real = IoStats::fromVfs(pVfs)->base();
+    return real->xDlOpen(real, zFilename);
+}
+
+void vfsDlError(sqlite3_vfs * pVfs, int nByte, char * zErrMsg)
+{
+    sqlite3_vfs * real = IoStats::fromVfs(pVfs)->base();
+    real->xDlError(real, nByte, zErrMsg);
+}
+
+void (*vfsDlSym(sqlite3_vfs * pVfs, void * pHandle, const char * zSymbol))(void)
+{
+    sqlite3_vfs * real = IoStats::fromVfs(pVfs)->base();
+    return real->xDlSym(real, pHandle, zSymbol);
+}
+
+void vfsDlClose(sqlite3_vfs * pVfs, void * pHandle)
+{
+    sqlite3_vfs * real = IoStats::fromVfs(pVfs)->base();
+    real->xDlClose(real, pHandle);
+}
+
+int vfsRandomness(sqlite3_vfs * pVfs, int nByte, char * zOut)
+{
+    sqlite3_vfs * real = IoStats::fromVfs(pVfs)->base();
+    return real->xRandomness(real, nByte, zOut);
+}
+
+int vfsSleep(sqlite3_vfs * pVfs, int microseconds)
+{
+    sqlite3_vfs * real = IoStats::fromVfs(pVfs)->base();
+    return real->xSleep(real, microseconds);
+}
+
+int vfsCurrentTime(sqlite3_vfs * pVfs, double * pTime)
+{
+    sqlite3_vfs * real = IoStats::fromVfs(pVfs)->base();
+    return real->xCurrentTime(real, pTime);
+}
+
+int vfsGetLastError(sqlite3_vfs * pVfs, int nByte, char * zOut)
+{
+    sqlite3_vfs * real = IoStats::fromVfs(pVfs)->base();
+    return real->xGetLastError ? real->xGetLastError(real, nByte, zOut) : 0;
+}
+
+int vfsCurrentTimeInt64(sqlite3_vfs * pVfs, sqlite3_int64 * pTime)
+{
+    sqlite3_vfs * real = IoStats::fromVfs(pVfs)->base();
+    if(real->iVersion >= 2 && real->xCurrentTimeInt64)
+    {
+        return real->xCurrentTimeInt64(real, pTime);
+    }
+    double now = 0;
+    int rc = real->xCurrentTime(real, &now);
+    *pTime = (sqlite3_int64)(now * 86400000.0);
+    return rc;
+}
+
+const char traceMagic[16] = "KVSQLite trace";
+const uint32_t traceVersion = 1;
+/* Bounds the memory of the trace whatever its limit */
+const size_t maxTracedPages = 1 << 21;
+
+void putTrace32(std::vector<unsigned char> & out, uint32_t value)
+{
+    for(int i = 0; i < 4; i++)
+    {
+        out.push_back((unsigned char)(value >> (8 * i)));
+    }
+}
+
+uint32_t getTrace32(const unsigned char * p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+FILE * openFile(const std::string & filename, const char * mode)
+{
+#ifdef _WIN32
+    FILE * pF = nullptr;
+    return (0 == fopen_s(&pF, filename.c_str(), mode)) ? pF : nullptr;
+#else
+    return fopen(filename.c_str(), mode);
+#endif
+}
+
+/* Put from in place of to in one step, the old file staying there if it fails */
+bool replaceFile(const std::string & from, const std::string & to)
+{
+#ifdef _WIN32
+    /* rename() does not replace an existing file on Windows */
+    return 0 != MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+    return 0 == std::rename(from.c_str(), to.c_str());
+#endif
+}
+
+const char * kindNames[IoStats::FileKinds] = {"db", "journal", "wal", "other"};
+const char * operationNames[IoStats::Operations] = {"read", "write", "sync"};
+
+}/* end of anonymous namespace */
+
+IoStats::IoStats()
+{
+    for(Counters & counters : m_counters)
+    {
+        for(int op = 0; op < Operations; op++)
+        {
+            counters.count[op] = 0;
+            counters.bytes[op] = 0;
+            counters.micros[op] = 0;
+            counters.maxMicros[op] = 0;
+            for(int i = 0; i < buckets; i++)
+            {
+                counters.histogram[op][i] = 0;
+            }
+        }
+        counters.truncates = 0;
+    }
+}
+
+IoStats::~IoStats()
+{
+    if(m_registered)
+    {
+        sqlite3_vfs_unregister(&m_vfs);
+    }
+}
+
+Status IoStats::create(const char * base, std::shared_ptr<IoStats> & stats)
+{
+    static std::atomic<int> next(0);
+
+    sqlite3_vfs * real = sqlite3_vfs_find(base);
+    if(nullptr == real)
+    {
+        return Status("", std::string("No VFS to count the I/O of:") + (base ? base : "default"), Status::UnknownError, "0");
+    }
+    stats.reset(new(std::nothrow) IoStats());
+    if(nullptr == stats)
+    {
+        return Status("", "Fail to new.", Status::UnknownError, "0");
+    }
+
+    IoStats & self = *stats;
+    self.m_base = real;
+    self.m_name = "kvsqlite-io-" + std::to_string(++next);
+    sqlite3_vfs & vfs = self.m_vfs;
+    std::memset(&vfs, 0, sizeof(vfs));
+    vfs.iVersion = 2;
+    vfs.szOsFile = (int)sizeof(CountedFile) + real->szOsFile;
+    vfs.mxPathname = real->mxPathname;
+    vfs.zName = self.m_name.c_str();
+    vfs.pAppData = &self;
+    vfs.xOpen = vfsOpen;
+    vfs.xDelete = vfsDelete;
+    vfs.xAccess = vfsAccess;
+    vfs.xFullPathname = vfsFullPathname;
+    vfs.xDlOpen = vfsDlOpen;
+    vfs.xDlError = vfsDlError;
+    vfs.xDlSym = vfsDlSym;
+    vfs.xDlClose = vfsDlClose;
+    vfs.xRandomness = vfsRandomness;
+    vfs.xSleep = vfsSleep;
+    vfs.xCurrentTime = vfsCurrentTime;
+    vfs.xGetLastError = vfsGetLastError;
+    vfs.xCurrentTimeInt64 = vfsCurrentTimeInt64;
+
+    int sqlRet = sqlite3_vfs_register(&vfs, 0);
+    if(SQLITE_OK != sqlRet)
+    {
+        stats.reset();
+        return Status("", "Fail to register the I/O counting VFS.", Status::UnknownError, std::to_string(sqlRet));
+    }
+    self.m_registered = true;
+    return Status();
+}
+
+void IoStats::record(FileKind kind, Operation operation, int64_t bytes, int64_t micros)
+{
+    Counters & counters = m_counters[kind];
+    counters.count[operation]++;
+    counters.bytes[operation] += bytes;
+    counters.micros[operation] += micros;
+    int64_t max = counters.maxMicros[operation];
+    while(micros > max && !counters.maxMicros[operation].compare_exchange_weak(max, micros))
+    {
+    }
+    int bucket = 0;
+    while(bucket < buckets - 1 && micros >= ((int64_t)1 << bucket))
+    {
+        bucket++;
+    }
+    counters.histogram[operation][bucket]++;
+}
+
+int64_t IoStats::percentile(const int * kinds, int count, Operation operation, double share) const
+{
+    int64_t histogram[buckets] = {};
+    int64_t total = 0;
+    int64_t max = 0;
+    for(int k = 0; k < count; k++)
+    {
+        for(int i = 0; i < buckets; i++)
+        {
+            int64_t n = m_counters[kinds[k]].histogram[operation][i];
+            histogram[i] += n;
+            total += n;
+        }
+        max = std::max<int64_t>(max, m_counters[kinds[k]].maxMicros[operation]);
+    }
+
+    /* The bound of the bucket holding the operation at that rank, never above the slowest one */
+    const int64_t rank = (int64_t)(share * total + 0.5);
+    int64_t seen = 0;
+    for(int i = 0; i < buckets - 1 && share < 1; i++)
+    {
+        seen += histogram[i];
+        if(seen >= rank && seen > 0)
+        {
+            return std::min<int64_t>((int64_t)1 << i, max);
+        }
+    }
+    return max;
+}
+
+bool IoStats::property(const std::string & name, int64_t & value) const
+{
+    size_t dot = name.find('.');
+    if(std::string::npos == dot)
+    {
+        return false;
+    }
+    const std::string kindName = name.substr(0, dot);
+    const std::string stat = name.substr(dot + 1);
+
+    /* "all" sums the kinds */
+    int kinds[FileKinds] = {MainDB, Journal, WAL, Other};
+    int count = FileKinds;
+    if("all" != kindName)
+    {
+        count = 0;
+        for(int k = 0; k < FileKinds && 0 == count; k++)
+        {
+            if(kindName == kindNames[k])
+            {
+                kinds[0] = k;
+                count = 1;
+            }
+        }
+        if(0 == count)
+        {
+            return false;
+        }
+    }
+
+    if("truncates" == stat)
+    {
+        value = 0;
+        for(int k = 0; k < count; k++)
+        {
+            value += m_counters[kinds[k]].truncates;
+        }
+        return true;
+    }
+
+    for(int op = 0; op < Operations; op++)
+    {
+        const std::string prefix = operationNames[op];
+        if(0 != stat.compare(0, prefix.size(), prefix))
+        {
+            continue;
+        }
+        const std::string suffix = stat.substr(prefix.size());
+        if("s" == suffix)
+        {
+            value = 0;
+            for(int k = 0; k < count; k++)
+            {
+                value += m_counters[kinds[k]].count[op];
+            }
+            return true;
+        }
+        if("-bytes" == suffix && Sync != op)
+        {
+            value = 0;
+            for(int k = 0; k < count; k++)
+            {
+                value += m_counters[kinds[k]].bytes[op];
+            }
+            return true;
+        }
+        if("-micros" == suffix)
+        {
+            value = 0;
+            for(int k = 0; k < count; k++)
+            {
+                value += m_counters[kinds[k]].micros[op];
+            }
+            return true;
+        }
+        if("-p50-micros" == suffix)
+        {
+            value = percentile(kinds, count, (Operation)op, 0.5);
+            return true;
+        }
+        if("-p99-micros" == suffix)
+        {
+            value = percentile(kinds, count, (Operation)op, 0.99);
+            return true;
+        }
+        if("-max-micros" == suffix)
+        {
+            value = percentile(kinds, count, (Operation)op, 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void IoStats::tracePages(const std::string & tracePath, int64_t limitBytes)
+{
+    std::lock_guard<std::mutex> locker(m_traceMutex);
+    m_tracePath = tracePath;
+    m_traceLimit = limitBytes;
+}
+
+bool IoStats::traces(const char * path)
+{
+    std::lock_guard<std::mutex> locker(m_traceMutex);
+    if(m_tracePath.empty() || nullptr == path)
+    {
+        return false;
+    }
+    if(m_tracedFile.empty())
+    {
+        m_tracedFile = path;
+    }
+    return m_tracedFile == path;
+}
+
+void IoStats::recordPage(int64_t offset, int amount)
+{
+    /* Whole pages only, not the reads of the header */
+    if(amount < 512 || 0 != (amount & (amount - 1)) || 0 != offset % amount)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> locker(m_traceMutex);
+    const uint32_t pgno = (uint32_t)(offset / amount) + 1;
+    auto iter = m_tracedPages.find(pgno);
+    if(iter == m_tracedPages.end())
+    {
+        if(m_tracedPages.size() >= maxTracedPages)
+        {
+            return;
+        }
+        iter = m_tracedPages.insert(std::make_pair(pgno, TracedPage())).first;
+        iter->second.first = m_nextRead++;
+    }
+    iter->second.reads++;
+    m_pageSize = (uint32_t)amount;
+}
+
+void IoStats::saveTrace()
+{
+    std::lock_guard<std::mutex> locker(m_traceMutex);
+    if(m_tracePath.empty() || m_tracedPages.empty())
+    {
+        return;
+    }
+
+    std::vector<std::pair<uint32_t, TracedPage>> pages(m_tracedPages.begin(), m_tracedPages.end());
+    std::sort(pages.begin(), pages.end(), [](const std::pair<uint32_t, TracedPage> & a, const std::pair<uint32_t, TracedPage> & b)
+    {
+        return (a.second.reads != b.second.reads) ? (a.second.reads > b.second.reads) : (a.second.first < b.second.first);
+    });
+    pages.resize(std::min<size_t>(pages.size(), (size_t)std::max<int64_t>(m_traceLimit / m_pageSize, 1)));
+
+    std::vector<unsigned char> out(traceMagic, traceMagic + sizeof(traceMagic));
+    putTrace32(out, traceVersion);
+    putTrace32(out, m_pageSize);
+    putTrace32(out, (uint32_t)pages.size());
+    for(const auto & page : pages)
+    {
+        putTrace32(out, page.first);
+    }
+
+    /* Replaced in one step, a crash leaves the previous trace */
+    const std::string temporary = m_tracePath + ".tmp";
+    FILE * pF = openFile(temporary, "wb");
+    if(nullptr == pF)
+    {
+        return;
+    }
+    bool ok = (out.size() == fwrite(out.data(), 1, out.size(), pF));
+    ok = (0 == fclose(pF)) && ok;
+    if(!ok || !replaceFile(temporary, m_tracePath))
+    {
+        std::remove(temporary.c_str());
+    }
+}
+
+bool IoStats::loadTrace(const std::string & tracePath, uint32_t & pageSize, std::vector<uint32_t> & pages)
+{
+    pages.clear();
+    FILE * pF = openFile(tracePath, "rb");
+    if(nullptr == pF)
+    {
+        return false;
+    }
+    unsigned char header[sizeof(traceMagic) + 12];
+    bool ok = (sizeof(header) == fread(header, 1, sizeof(header), pF)) && 0 == std::memcmp(header, traceMagic, sizeof(traceMagic)) &&
+        traceVersion == getTrace32(header + 16);
+    if(ok)
+    {
+        pageSize = getTrace32(header + 20);
+        const uint32_t count = getTrace32(header + 24);
+        std::vector<unsigned char> body((size_t)std::min<uint32_t>(count, maxTracedPages) * 4);
+        ok = count <= maxTracedPages && (body.empty() || body.size() == fread(body.data(), 1, body.size(), pF));
+        for(size_t i = 0; ok && i < count; i++)
+        {
+            pages.push_back(getTrace32(&body[i * 4]));
+        }
+    }
+    fclose(pF);
+    if(!ok)
+    {
+        pages.clear();
+    }
+    return ok;
+}
+
+}/* end of namespace KVSQLite */
@@ -0,0 +1,144 @@
+/**
+ * @file IoStats.h
+ * @brief SQLite VFS counting the I/O of a connection, see Options::enable_io_stats. Not installed.
+ */
+
+#ifndef _KVSQLITE_IO_STATS_H_
+#define _KVSQLITE_IO_STATS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "sqlite3.h"
+#include "KVSQLite/Status.h"
+
+namespace KVSQLite
+{
+
+/*
+ * Counters of the reads, writes, syncs and truncates of the files a
+ * connection opens, by kind of file, with histograms of their latencies.
+ * Each IoStats registers a VFS of its own, passing everything on to another
+ * one and counting on the way, and unregisters it when destroyed: every
+ * connection using the VFS must be closed by then.
+ *
+ * It also records which pages of the database file are read, for the
+ * warm-up of Options::warm_up_bytes: the pages read most, then first, are
+ * saved to a trace file when the DB is closed.
+ */
+class IoStats
+{
+public:
+    enum FileKind
+    {
+        MainDB,
+        Journal,
+        WAL,
+        Other,
+        FileKinds
+    };
+
+    enum Operation
+    {
+        Read,
+        Write,
+        Sync,
+        Operations
+    };
+
+    /* Bucket i counts the operations that took less than 2^i microseconds, the last one the others */
+    static const int buckets = 24;
+
+    ~IoStats();
+
+    /* Register a VFS counting the I/O of the VFS named base, the default one if null */
+    static Status create(const char * base, std::shared_ptr<IoStats> & stats);
+
+    const std::string & vfsName() const
+    {
+        return m_name;
+    }
+
+    void record(FileKind kind, Operation operation, int64_t bytes, int64_t micros);
+
+    void recordTruncate(FileKind kind)
+    {
+        m_counters[kind].truncates++;
+    }
+
+    /* Value of "<kind>.<name>", see DB::getProperty(); false for an unknown name */
+    bool property(const std::string & name, int64_t & value) const;
+
+    /*
+     * Record the pages read from the first main database file opened through
+     * the VFS, and from any later one of the same name, to be saved to
+     * tracePath, at most limitBytes of them.
+     */
+    void tracePages(const std::string & tracePath, int64_t limitBytes);
+
+    /* Used by the VFS: whether the database file named path is traced */
+    bool traces(const char * path);
+
+    /* Used by the VFS: a read of amount bytes at offset of a traced file */
+    void recordPage(int64_t offset, int amount);
+
+    /* Write the trace, the pages read most first; nothing if no page was read */
+    void saveTrace();
+
+    /* Read a trace saved by saveTrace(), false if there is none or it is damaged */
+    static bool loadTrace(const std::string & tracePath, uint32_t & pageSize, std::vector<uint32_t> & pages);
+
+    /* The VFS underneath */
+    sqlite3_vfs * base() const
+    {
+        return m_base;
+    }
+
+    static IoStats * fromVfs(sqlite3_vfs * vfs)
+    {
+        return (IoStats *)vfs->pAppData;
+    }
+private:
+    struct Counters
+    {
+        std::atomic<int64_t> count[Operations];
+        std::atomic<int64_t> bytes[Operations];
+        std::atomic<int64_t> micros[Operations];
+        std::atomic<int64_t> maxMicros[Operations];
+        std::atomic<int64_t> histogram[Operations][buckets];
+        std::atomic<int64_t> truncates;
+    };
+
+    IoStats();
+
+    /* Upper bound in microseconds of the share of the operations of kinds, 1 for the slowest */
+    int64_t percentile(const int * kinds, int count, Operation operation, double share) const;
+private:
+    sqlite3_vfs m_vfs;
+    sqlite3_vfs * m_base = nullptr;
+    std::string m_name;
+    bool m_registered = false;
+    Counters m_counters[FileKinds];
+
+    /* Reads and order of first read of each traced page */
+    struct TracedPage
+    {
+        uint32_t reads = 0;
+        uint32_t first = 0;
+    };
+    std::mutex m_traceMutex;
+    std::string m_tracePath;
+    std::string m_tracedFile;
+    int64_t m_traceLimit = 0;
+    uint32_t m_pageSize = 0;
+    uint32_t m_nextRead = 0;
+    std::unordered_map<uint32_t, TracedPage> m_tracedPages;
+};
+
+}/* end of namespace KVSQLite */
+
+#endif
@@ -0,0 +1,562 @@
+#include "KVSQLite/Iterator.h"
+#include "KVSQLite/Slice.h"
+#include "DBImpl.h"
+#include <cerrno>
+#include <cstdlib>
+#include <vector>
+
+namespace KVSQLite
+{
+
+/*
+ * A continuation token is the key column of an entry exactly as stored, so a
+ * scan can seek after it without knowing the key type: one byte for the
+ * storage class followed by the value.
+ */
+static std::string encodeToken(sqlite3_stmt * stmt, int idx)
+{
+    std::string token;
+    switch(sqlite3_column_type(stmt, idx))
+    {
+    case SQLITE_INTEGER:
+        token = "i" + std::to_string(sqlite3_column_int64(stmt, idx));
+        break;
+    case SQLITE_FLOAT:
+        {
+            double d = sqlite3_column_double(stmt, idx);
+            token = "f";
+            token.append(reinterpret_cast<const char *>(&d), sizeof(d));
+        }
+        break;
+    case SQLITE_TEXT:
+    case SQLITE_BLOB:
+        {
+            token = (SQLITE_TEXT == sqlite3_column_type(stmt, idx)) ? "t" : "b";
+            const char * p = (const char *)sqlite3_column_blob(stmt, idx);
+            int size = sqlite3_column_bytes(stmt, idx);
+            if(p)
+            {
+                token.append(p, size);
+            }
+        }
+        break;
+    default:
+        break;
+    }
+    return token;
+}
+
+/* The integer of an "i" token: an optional '-' followed by digits, in range */
+static bool parseIntToken(const std::string & token, int64_t & value)
+{
+    const size_t digits = ('-' == token[1]) ? 2 : 1;
+    if(token.size() <= digits || std::string::npos != token.find_first_not_of("0123456789", digits))
+    {
+        return false;
+    }
+    const char * begin = token.c_str() + 1;
+    char * end = nullptr;
+    errno = 0;
+    long long parsed = std::strtoll(begin, &end, 10);
+    if(ERANGE == errno || end != token.c_str() + token.size())
+    {
+        return false;
+    }
+    value = parsed;
+    return true;
+}
+
+static bool validToken(const std::string & token)
+{
+    if(token.empty())
+    {
+        return false;
+    }
+    switch(token[0])
+    {
+    case 'i':
+        {
+            int64_t value = 0;
+            return parseIntToken(token, value);
+        }
+    case 'f':
+        return token.size() == 1 + sizeof(double);
+    case 't':
+    case 'b':
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+ * The token of a tuple key joins the tokens of its columns, each preceded by
+ * its length and a colon. Returns false if token is not made of n of them.
+ */
+static bool splitToken(const std::string & token, int n, std::vector<std::string> & parts)
+{
+    parts.clear();
+    if(1 == n)
+    {
+        parts.push_back(token);
+        return true;
+    }
+    size_t pos = 0;
+    for(int i = 0; i < n; i++)
+    {
+        size_t colon = token.find(':', pos);
+        if(std::string::npos == colon || colon == pos || colon - pos > 9)
+        {
+            return false;
+        }
+        const std::string length = token.substr(pos, colon - pos);
+        if(std::string::npos != length.find_first_not_of("0123456789"))
+        {
+            return false;
+        }
+        size_t size = std::stoul(length);
+        if(token.size() - (colon + 1) < size)
+        {
+            return false;
+        }
+        parts.push_back(token.substr(colon + 1, size));
+        pos = colon + 1 + size;
+    }
+    return pos == token.size();
+}
+
+static std::string encodeKeyToken(sqlite3_stmt * stmt, int n)
+{
+    if(1 == n)
+    {
+        return encodeToken(stmt, 0);
+    }
+    std::string token;
+    for(int i = 0; i < n; i++)
+    {
+        std::string part = encodeToken(stmt, i);
+        token += std::to_string(part.size()) + ":" + part;
+    }
+    return token;
+}
+
+static bool validKeyToken(const std::string & token, int n)
+{
+    std::vector<std::string> parts;
+    if(!splitToken(token, n, parts))
+    {
+        return false;
+    }
+    for(const std::string & part : parts)
+    {
+        if(!validToken(part))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* token must have passed validToken() */
+static int bindToken(sqlite3_stmt * stmt, int idx, const std::string & token)
+{
+    switch(token[0])
+    {
+    case 'i':
+        {
+            int64_t value = 0;
+            if(!parseIntToken(token, value))
+            {
+                return SQLITE_MISUSE;
+            }
+            return sqlite3_bind_int64(stmt, idx, value);
+        }
+    case 'f':
+        {
+            double d = 0;
+            token.copy(reinterpret_cast<char *>(&d), sizeof(d), 1);
+            return sqlite3_bind_double(stmt, idx, d);
+        }
+    case 't':
+        return sqlite3_bind_text(stmt, idx, token.data() + 1, token.size() - 1, SQLITE_TRANSIENT);
+    case 'b':
+    default:
+        return sqlite3_bind_blob(stmt, idx, token.data() + 1, token.size() - 1, SQLITE_TRANSIENT);
+    }
+}
+
+/* token must have passed validKeyToken(), column i is bound like bindKey() does */
+static int bindKeyToken(sqlite3_stmt * stmt, int idx, const std::string & token, int n)
+{
+    std::vector<std::string> parts;
+    if(!splitToken(token, n, parts))
+    {
+        return SQLITE_MISUSE;
+    }
+    int sqlRet = SQLITE_OK;
+    for(int i = 0; i < n && SQLITE_OK == sqlRet; i++)
+    {
+        sqlRet = bindToken(stmt, idx + i * keyParamStride, parts[i]);
+    }
+    return sqlRet;
+}
+
+template<typename K, typename V>
+class IteratorImpl
+{
+public:
+    typedef typename storage_traits<K>::type KeyType;
+    typedef typename storage_traits<V>::type ValueType;
+    struct Entry
+    {
+        KeyType key;
+        ValueType value;
+        std::string token;
+    };
+public:
+    Status prepare()
+    {
+        /*
+         * ?1 and ?2 bound the range, ?3 is the last key already read, so each
+         * page is an index seek followed by a short range scan. Expired keys
+         * are skipped with ?5 bound to the current time. A prefix of a tuple
+         * key is bound to ?1 and matched on the leading key columns.
+         */
+        std::string where;
+        if(prefixComponents > 0)
+        {
+            where += " AND " + dbImpl->keyPrefixEquals(prefixComponents, 1);
+        }
+        else if(hasLower)
+        {
+            where += " AND " + dbImpl->keyCompare(">=", 1);
+        }
+        if(hasUpper)
+        {
+            where += " AND " + dbImpl->keyCompare("<", 2);
+        }
+        if(dbImpl->ttl)
+        {
+            where += " AND (expire IS NULL OR expire > ?5)";
+        }
+
+        const std::string keyColumns = dbImpl->keyColumns();
+        const std::string select = "SELECT " + keyColumns + ", " + dbImpl->valueColumns() + " FROM " + dbImpl->table() + " WHERE 1" + where;
+        Status status = prepareSQL(dbImpl->db, select + " ORDER BY " + keyColumns + " LIMIT ?4", &firstSQL);
+        if(!status.ok())
+        {
+            return status;
+        }
+        /* Within a prefix the leading columns are fixed, comparing the others keeps the seek narrow */
+        return prepareSQL(dbImpl->db, select + " AND " + dbImpl->keyCompare(">", 3, prefixComponents) + " ORDER BY " + keyColumns + " LIMIT ?4", &nextSQL);
+    }
+
+    /* Read the next page of entries, must be called with dbImpl->mutex held */
+    Status fetch()
+    {
+        page.clear();
+        pos = 0;
+
+        int count = options.prefetch > 0 ? options.prefetch : 1;
+        if(options.limit > 0)
+        {
+            count = std::min(count, options.limit - fetched);
+        }
+
+        sqlite3_stmt * stmt = after.empty() ? firstSQL : nextSQL;
+        if(dbImpl->ttl)
+        {
+            Status status = dbImpl->bindNow(stmt, 5);
+            if(!status.ok())
+            {
+                return status;
+            }
+        }
+
+        int sqlRet = sqlite3_reset(stmt);
+        if(SQLITE_OK == sqlRet && hasLower)
+        {
+            int components = (prefixComponents > 0) ? prefixComponents : key_traits<K>::components;
+            sqlRet = dbImpl->bindKey<K>(stmt, 1, storage_traits<K>::view(lower), components);
+        }
+        if(SQLITE_OK == sqlRet && hasUpper)
+        {
+            sqlRet = dbImpl->bindKey<K>(stmt, 2, storage_traits<K>::view(upper));
+        }
+        if(SQLITE_OK == sqlRet && !after.empty())
+        {
+            sqlRet = bindKeyToken(stmt, 3, after, dbImpl->keyComponents);
+        }
+        if(SQLITE_OK == sqlRet)
+        {
+            sqlRet = sqlite3_bind_int(stmt, 4, count);
+        }
+        if(SQLITE_OK != sqlRet)
+        {
+            std::string databaseErr = "Fail to bind key.";
+            return Status(sqlite3_errmsg(dbImpl->db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+        }
+
+        while(SQLITE_ROW == (sqlRet = sqlite3_step(stmt)))
+        {
+            Entry entry;
+            K key;
+            if(!dbImpl->columnKey(stmt, 0, key))
+            {
+                sqlite3_reset(stmt);
+                page.clear();
+                return Status("", "Malformed encoded key.", Status::UnknownError, "0");
+            }
+            V value = mapping_traits<V>::getColumn(stmt, dbImpl->keyComponents);
+            if(dbImpl->framedValues)
+            {
+                Status status = dbImpl->resolveValue(stmt, dbImpl->keyComponents, value, valueLogBuffer);
+                if(!status.ok())
+                {
+                    sqlite3_reset(stmt);
+                    page.clear();
+                    return status;
+                }
+            }
+            entry.key = storage_traits<K>::store(key);
+            entry.value = storage_traits<V>::store(value);
+            entry.token = encodeKeyToken(stmt, dbImpl->keyComponents);
+            page.push_back(entry);
+        }
+        if(SQLITE_DONE != sqlRet)
+        {
+            std::string databaseErr = std::string("Fail to exec:") + sqlite3_sql(stmt);
+            Status status(sqlite3_errmsg(dbImpl->db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+            sqlite3_reset(stmt);
+            page.clear();
+            return status;
+        }
+        sqlite3_reset(stmt);
+
+        fetched += page.size();
+        exhausted = ((int)page.size() < count);
+        limitReached = (options.limit > 0 && fetched >= options.limit);
+        if(!page.empty())
+        {
+            after = page.back().token;
+        }
+        return Status();
+    }
+public:
+    DBImpl * dbImpl = nullptr;
+    ReadOptions options;
+    bool hasLower = false;
+    bool hasUpper = false;
+    int prefixComponents = 0;
+    KeyType lower = KeyType();
+    KeyType upper = KeyType();
+    sqlite3_stmt * firstSQL = nullptr;
+    sqlite3_stmt * nextSQL = nullptr;
+    std::vector<Entry> page;
+    size_t pos = 0;
+    int fetched = 0;
+    bool exhausted = false;
+    bool limitReached = false;
+    /* Token of the last entry read from the database, the next page starts after it */
+    std::string after;
+    /* Token of the last entry the iterator moved past */
+    std::string last;
+    /* A value read from the value log, copied into its entry right away */
+    std::string valueLogBuffer;
+    Status status;
+};
+
+template<typename K, typename V>
+Iterator<K, V>::Iterator(DBImpl * pDBImpl, const ReadOptions & options, const K * lower, const K * upper, int prefixComponents)
+{
+    m_impl = new IteratorImpl<K, V>();
+    m_impl->dbImpl = pDBImpl;
+    m_impl->options = options;
+    m_impl->prefixComponents = prefixComponents;
+    if(nullptr != lower)
+    {
+        m_impl->hasLower = true;
+        m_impl->lower = storage_traits<K>::store(*lower);
+    }
+    if(nullptr != upper)
+    {
+        m_impl->hasUpper = true;
+        m_impl->upper = storage_traits<K>::store(*upper);
+    }
+}
+
+template<typename K, typename V>
+Iterator<K, V>::~Iterator()
+{
+    {
+        std::lock_guard<std::mutex> locker(m_impl->dbImpl->mutex);
+        sqlite3_finalize(m_impl->firstSQL);
+        sqlite3_finalize(m_impl->nextSQL);
+    }
+    delete m_impl;
+    m_impl = nullptr;
+}
+
+template<typename K, typename V>
+Status Iterator<K, V>::start()
+{
+    if(!m_impl->options.continuation.empty())
+    {
+        if(!validKeyToken(m_impl->options.continuation, m_impl->dbImpl->keyComponents))
+        {
+            return Status("", "Invalid argument, malformed continuation token.", Status::InvalidArgument, "0");
+        }
+        m_impl->after = m_impl->options.continuation;
+        m_impl->last = m_impl->after;
+    }
+
+    std::lock_guard<std::mutex> locker(m_impl->dbImpl->mutex);
+    Status status = m_impl->prepare();
+    if(!status.ok())
+    {
+        return status;
+    }
+    return m_impl->fetch();
+}
+
+template<typename K, typename V>
+bool Iterator<K, V>::valid() const
+{
+    return m_impl->pos < m_impl->page.size();
+}
+
+template<typename K, typename V>
+void Iterator<K, V>::next()
+{
+    if(!valid())
+    {
+        return;
+    }
+
+    m_impl->last = m_impl->page[m_impl->pos].token;
+    m_impl->pos++;
+    if(m_impl->pos == m_impl->page.size() && !m_impl->exhausted && !m_impl->limitReached)
+    {
+        std::lock_guard<std::mutex> locker(m_impl->dbImpl->mutex);
+        m_impl->status = m_impl->fetch();
+    }
+}
+
+template<typename K, typename V>
+K Iterator<K, V>::key() const
+{
+    return storage_traits<K>::view(m_impl->page[m_impl->pos].key);
+}
+
+template<typename K, typename V>
+V Iterator<K, V>::value() const
+{
+    return storage_traits<V>::view(m_impl->page[m_impl->pos].value);
+}
+
+template<typename K, typename V>
+Status Iterator<K, V>::status() const
+{
+    return m_impl->status;
+}
+
+template<typename K, typename V>
+std::string Iterator<K, V>::continuationToken() const
+{
+    if(valid())
+    {
+        return m_impl->page[m_impl->pos].token;
+    }
+    if(m_impl->exhausted && m_impl->status.ok())
+    {
+        return std::string();
+    }
+    return m_impl->last;
+}
+
+/* Explicit instantiations, see DB.cpp */
+template class Iterator<int, int>;
+template class Iterator<int, int64_t>;
+template class Iterator<int, double>;
+template class Iterator<int, std::string>;
+template class Iterator<int, Slice>;
+
+template class Iterator<int64_t, int>;
+template class Iterator<int64_t, int64_t>;
+template class Iterator<int64_t, double>;
+template class Iterator<int64_t, std::string>;
+template class Iterator<int64_t, Slice>;
+
+template class Iterator<double, int>;
+template class Iterator<double, int64_t>;
+template class Iterator<double, double>;
+template class Iterator<double, std::string>;
+template class Iterator<double, Slice>;
+
+template class Iterator<std::string, int>;
+template class Iterator<std::string, int64_t>;
+template class Iterator<std::string, double>;
+template class Iterator<std::string, std::string>;
+template class Iterator<std::string, Slice>;
+
+template class Iterator<Slice, int>;
+template class Iterator<Slice, int64_t>;
+template class Iterator<Slice, double>;
+template class Iterator<Slice, std::string>;
+template class Iterator<Slice, Slice>;
+
+template class Iterator<std::tuple<int64_t, int64_t>, int>;
+template class Iterator<std::tuple<int64_t, int64_t>, int64_t>;
+template class Iterator<std::tuple<int64_t, int64_t>, double>;
+template class Iterator<std::tuple<int64_t, int64_t>, std::string>;
+template class Iterator<std::tuple<int64_t, int64_t>, Slice>;
+
+template class Iterator<std::tuple<int64_t, double>, int>;
+template class Iterator<std::tuple<int64_t, double>, int64_t>;
+template class Iterator<std::tuple<int64_t, double>, double>;
+template class Iterator<std::tuple<int64_t, double>, std::string>;
+template class Iterator<std::tuple<int64_t, double>, Slice>;
+
+template class Iterator<std::tuple<int64_t, std::string>, int>;
+template class Iterator<std::tuple<int64_t, std::string>, int64_t>;
+template class Iterator<std::tuple<int64_t, std::string>, double>;
+template class Iterator<std::tuple<int64_t, std::string>, std::string>;
+template class Iterator<std::tuple<int64_t, std::string>, Slice>;
+
+template class Iterator<std::tuple<double, int64_t>, int>;
+template class Iterator<std::tuple<double, int64_t>, int64_t>;
+template class Iterator<std::tuple<double, int64_t>, double>;
+template class Iterator<std::tuple<double, int64_t>, std::string>;
+template class Iterator<std::tuple<double, int64_t>, Slice>;
+
+template class Iterator<std::tuple<double, double>, int>;
+template class Iterator<std::tuple<double, double>, int64_t>;
+template class Iterator<std::tuple<double, double>, double>;
+template class Iterator<std::tuple<double, double>, std::string>;
+template class Iterator<std::tuple<double, double>, Slice>;
+
+template class Iterator<std::tuple<double, std::string>, int>;
+template class Iterator<std::tuple<double, std::string>, int64_t>;
+template class Iterator<std::tuple<double, std::string>, double>;
+template class Iterator<std::tuple<double, std::string>, std::string>;
+template class Iterator<std::tuple<double, std::string>, Slice>;
+
+template class Iterator<std::tuple<std::string, int64_t>, int>;
+template class Iterator<std::tuple<std::string, int64_t>, int64_t>;
+template class Iterator<std::tuple<std::string, int64_t>, double>;
+template class Iterator<std::tuple<std::string, int64_t>, std::string>;
+template class Iterator<std::tuple<std::string, int64_t>, Slice>;
+
+template class Iterator<std::tuple<std::string, double>, int>;
+template class Iterator<std::tuple<std::string, double>, int64_t>;
+template class Iterator<std::tuple<std::string, double>, double>;
+template class Iterator<std::tuple<std::string, double>, std::string>;
+template class Iterator<std::tuple<std::string, double>, Slice>;
+
+template class Iterator<std::tuple<std::string, std::string>, int>;
+template class Iterator<std::tuple<std::string, std::string>, int64_t>;
+template class Iterator<std::tuple<std::string, std::string>, double>;
+template class Iterator<std::tuple<std::string, std::string>, std::string>;
+template class Iterator<std::tuple<std::string, std::string>, Slice>;
+
+}/* end of namespace KVSQLite */
@@ -0,0 +1,170 @@
+/**
+ * @file KeyEncoding.h
+ * @brief Order-preserving binary encoding of keys, see Options::encode_keys. Not installed.
+ *
+ * Every key type is turned into bytes whose memcmp() order is the order of
+ * the keys, and stored as a BLOB. SQLite compares blobs with memcmp(), so
+ * the key index then sorts by these bytes.
+ */
+
+#ifndef _KVSQLITE_KEY_ENCODING_H_
+#define _KVSQLITE_KEY_ENCODING_H_
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include "KVSQLite/Slice.h"
+
+namespace KVSQLite
+{
+
+/* Signed integers: 8 bytes big endian with the sign bit flipped */
+static inline void encodeInt64(int64_t val, std::string & out)
+{
+    uint64_t u = (uint64_t)val ^ (((uint64_t)1) << 63);
+    char buf[8];
+    for(int i = 7; i >= 0; i--)
+    {
+        buf[i] = (char)(u & 0xff);
+        u >>= 8;
+    }
+    out.assign(buf, sizeof(buf));
+}
+
+static inline bool decodeInt64(const char * data, size_t size, int64_t & val)
+{
+    if(8 != size)
+    {
+        return false;
+    }
+    uint64_t u = 0;
+    for(int i = 0; i < 8; i++)
+    {
+        u = (u << 8) | (unsigned char)data[i];
+    }
+    val = (int64_t)(u ^ (((uint64_t)1) << 63));
+    return true;
+}
+
+template<typename K>
+struct key_encoding
+{
+};
+
+template<>
+struct key_encoding<int>
+{
+    static void encode(const int & key, std::string & out)
+    {
+        encodeInt64(key, out);
+    }
+    static bool decode(const char * data, size_t size, int & key)
+    {
+        int64_t val = 0;
+        if(!decodeInt64(data, size, val))
+        {
+            return false;
+        }
+        key = (int)val;
+        return true;
+    }
+};
+
+template<>
+struct key_encoding<int64_t>
+{
+    static void encode(const int64_t & key, std::string & out)
+    {
+        encodeInt64(key, out);
+    }
+    static bool decode(const char * data, size_t size, int64_t & key)
+    {
+        return decodeInt64(data, size, key);
+    }
+};
+
+/*
+ * Doubles: the IEEE 754 bits, all flipped for negative numbers and only the
+ * sign bit flipped otherwise, which orders them as numbers. -0.0 is stored as
+ * 0.0, since they compare equal. Every NaN is stored as the same quiet NaN,
+ * which sorts after +infinity.
+ */
+template<>
+struct key_encoding<double>
+{
+    static void encode(const double & key, std::string & out)
+    {
+        double d = key;
+        if(0.0 == d)
+        {
+            d = 0.0;
+        }
+        else if(std::isnan(d))
+        {
+            d = std::numeric_limits<double>::quiet_NaN();
+        }
+
+        uint64_t u = 0;
+        memcpy(&u, &d, sizeof(u));
+        u = (u & (((uint64_t)1) << 63)) ? ~u : (u | (((uint64_t)1) << 63));
+
+        char buf[8];
+        for(int i = 7; i >= 0; i--)
+        {
+            buf[i] = (char)(u & 0xff);
+            u >>= 8;
+        }
+        out.assign(buf, sizeof(buf));
+    }
+    static bool decode(const char * data, size_t size, double & key)
+    {
+        if(8 != size)
+        {
+            return false;
+        }
+        uint64_t u = 0;
+        for(int i = 0; i < 8; i++)
+        {
+            u = (u << 8) | (unsigned char)data[i];
+        }
+        u = (u & (((uint64_t)1) << 63)) ? (u & ~(((uint64_t)1) << 63)) : ~u;
+        memcpy(&key, &u, sizeof(u));
+        return true;
+    }
+};
+
+/* Strings are their own bytes, without the terminating NUL of the native form */
+template<>
+struct key_encoding<std::string>
+{
+    static void encode(const std::string & key, std::string & out)
+    {
+        out = key;
+    }
+    static bool decode(const char * data, size_t size, std::string & key)
+    {
+        key.assign(data, size);
+        return true;
+    }
+};
+
+template<>
+struct key_encoding<Slice>
+{
+    static void encode(const Slice & key, std::string & out)
+    {
+        out.assign(key.data(), key.size());
+    }
+    /* key points into data */
+    static bool decode(const char * data, size_t size, Slice & key)
+    {
+        key = Slice(data, size);
+        return true;
+    }
+};
+
+}/* end of namespace KVSQLite */
+
+#endif
@@ -0,0 +1,1155 @@
+#include "PageCompression.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <vector>
+#include "sqlite3.h"
+
+namespace KVSQLite
+{
+
+namespace
+{
+
+/*
+ * Layout of a compressed database file. SQLite reads and writes the file as
+ * if it were plain, in pages of the size it chose; each page, or unit, is
+ * stored compressed in an extent of whole sectors anywhere in the file, and
+ * a page map tells where:
+ *
+ * - sector 0: fileMagic, then the format version and the unit size, both
+ *   32 bits little-endian
+ * - sectors 1 and 2: two root records, the valid one with the highest
+ *   sequence number wins. A root holds the size of the file as SQLite sees
+ *   it and the extent and checksum of the directory.
+ * - the directory: the extent and checksum of each chunk of the map
+ * - a chunk: offset, size and codec of chunkEntries consecutive units,
+ *   codec 0 meaning stored as is and offset 0 a unit never written
+ *
+ * Nothing is overwritten in place. A written unit goes to a new extent, and
+ * the map is saved copy-on-write as well: its changed chunks and the
+ * directory to new extents, then the older of the two root records. The
+ * extents the last saved map uses are only reused once the next map is
+ * saved, so that after a crash every page the saved map names is found as
+ * it was, and SQLite's journal or WAL replays what came later as it does
+ * on a plain file.
+ *
+ * The map is saved when SQLite commits to the file (SQLITE_FCNTL_SYNC,
+ * sent whatever PRAGMA synchronous says), after a checkpoint, and when the
+ * file is unlocked or closed. On xSync the units are synced before the map
+ * is written, and the map before its root record.
+ */
+const char fileMagic[16] = "KVSQLite pages";
+const uint32_t fileVersion = 1;
+const char rootMagic[8] = {'K', 'V', 'S', 'Q', 'R', 'O', 'O', 'T'};
+const int64_t sectorSize = 512;
+const int64_t rootOffsets[2] = {512, 1024};
+const int rootSize = 48;
+const int64_t dataStart = 1536;
+const size_t chunkEntries = 256;
+const size_t entrySize = 16;
+/* SQLite locks bytes of this range, which Windows then forbids to read or write */
+const int64_t lockStart = 0x40000000;
+const int64_t lockEnd = lockStart + sectorSize;
+
+void put32(unsigned char * p, uint32_t value)
+{
+    for(int i = 0; i < 4; i++)
+    {
+        p[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+void put64(unsigned char * p, uint64_t value)
+{
+    put32(p, (uint32_t)value);
+    put32(p + 4, (uint32_t)(value >> 32));
+}
+
+uint32_t get32(const unsigned char * p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+uint64_t get64(const unsigned char * p)
+{
+    return (uint64_t)get32(p) | ((uint64_t)get32(p + 4) << 32);
+}
+
+/* FNV-1a, enough to tell a saved structure from a torn one */
+uint32_t checksum(const unsigned char * data, size_t size)
+{
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < size; i++)
+    {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+int64_t sectors(int64_t bytes)
+{
+    return (bytes + sectorSize - 1) / sectorSize * sectorSize;
+}
+
+/* Part of the file used by a unit or a piece of the map, written during epoch */
+struct Extent
+{
+    int64_t offset = 0;
+    int64_t size = 0;
+    uint32_t codec = 0;
+    uint32_t checksum = 0;
+    uint64_t epoch = 0;
+};
+
+/*
+ * The page map of one file, shared by every connection of the process that
+ * has it open. Each call does its I/O through the file handle of the
+ * connection making it.
+ */
+class PageStore
+{
+public:
+    PageStore(const std::string & path, const Compressor * compressor)
+        : path(path), m_compressor(compressor)
+    {
+    }
+
+    /* Read the map of a file that is not empty */
+    int load(sqlite3_file * real)
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        unsigned char header[24];
+        int rc = real->pMethods->xRead(real, header, sizeof(header), 0);
+        if(SQLITE_OK != rc)
+        {
+            return (SQLITE_IOERR_SHORT_READ == rc) ? SQLITE_NOTADB : rc;
+        }
+        m_unit = get32(header + 20);
+        if(0 != std::memcmp(header, fileMagic, sizeof(fileMagic)) || fileVersion != get32(header + 16) ||
+            m_unit < 512 || m_unit > 65536 || 0 != (m_unit & (m_unit - 1)))
+        {
+            return SQLITE_NOTADB;
+        }
+
+        /* The newest root whose map is whole, none at all before the first save */
+        unsigned char roots[2][rootSize];
+        int order[2] = {0, 1};
+        bool valid[2] = {false, false};
+        for(int i = 0; i < 2; i++)
+        {
+            valid[i] = (SQLITE_OK == real->pMethods->xRead(real, roots[i], rootSize, rootOffsets[i])) &&
+                0 == std::memcmp(roots[i], rootMagic, sizeof(rootMagic)) &&
+                get32(roots[i] + 44) == checksum(roots[i], 44);
+        }
+        if(valid[0] && valid[1] && get64(roots[1] + 8) > get64(roots[0] + 8))
+        {
+            std::swap(order[0], order[1]);
+        }
+        rc = SQLITE_OK;
+        for(int i : order)
+        {
+            if(valid[i])
+            {
+                rc = loadMap(real, roots[i]);
+                if(SQLITE_OK == rc)
+                {
+                    break;
+                }
+            }
+        }
+        if(SQLITE_OK != rc)
+        {
+            return rc;
+        }
+
+        /* Whatever no unit or piece of the map uses is free */
+        std::vector<std::pair<int64_t, int64_t>> used;
+        for(const Extent & extent : m_pages)
+        {
+            if(0 != extent.offset)
+            {
+                used.push_back(std::make_pair(extent.offset, sectors(extent.size)));
+            }
+        }
+        for(const Extent & extent : m_chunks)
+        {
+            used.push_back(std::make_pair(extent.offset, sectors(extent.size)));
+        }
+        if(0 != m_directory.offset)
+        {
+            used.push_back(std::make_pair(m_directory.offset, sectors(m_directory.size)));
+        }
+        std::sort(used.begin(), used.end());
+        m_tail = dataStart;
+        for(const auto & extent : used)
+        {
+            if(extent.first > m_tail)
+            {
+                addFree(m_tail, extent.first - m_tail);
+            }
+            m_tail = std::max(m_tail, extent.first + extent.second);
+        }
+        return SQLITE_OK;
+    }
+
+    int read(sqlite3_file * real, void * buffer, int amount, int64_t offset)
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        unsigned char * out = (unsigned char *)buffer;
+        const int64_t end = offset + amount;
+        const int64_t readable = (0 == m_unit) ? offset : std::max(offset, std::min(end, m_size));
+        for(int64_t position = offset; position < readable; )
+        {
+            const int64_t index = position / m_unit;
+            const int64_t inUnit = position % m_unit;
+            const int64_t count = std::min(m_unit - inUnit, readable - position);
+            int rc = SQLITE_OK;
+            if(0 == inUnit && count == m_unit)
+            {
+                rc = readUnit(real, index, out + (position - offset));
+            }
+            else
+            {
+                m_unitBuffer.resize((size_t)m_unit);
+                rc = readUnit(real, index, &m_unitBuffer[0]);
+                std::memcpy(out + (position - offset), &m_unitBuffer[(size_t)inUnit], (size_t)count);
+            }
+            if(SQLITE_OK != rc)
+            {
+                return rc;
+            }
+            position += count;
+        }
+        if(readable < end)
+        {
+            /* SQLite expects the missing part zeroed */
+            std::memset(out + (readable - offset), 0, (size_t)(end - readable));
+            return SQLITE_IOERR_SHORT_READ;
+        }
+        return SQLITE_OK;
+    }
+
+    int write(sqlite3_file * real, const void * buffer, int amount, int64_t offset)
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        if(0 == m_unit)
+        {
+            int rc = start(real, amount, offset);
+            if(SQLITE_OK != rc)
+            {
+                return rc;
+            }
+        }
+
+        const unsigned char * in = (const unsigned char *)buffer;
+        const int64_t end = offset + amount;
+        for(int64_t position = offset; position < end; )
+        {
+            const int64_t index = position / m_unit;
+            const int64_t inUnit = position % m_unit;
+            const int64_t count = std::min(m_unit - inUnit, end - position);
+            int rc = SQLITE_OK;
+            if(0 == inUnit && count == m_unit)
+            {
+                rc = writeUnit(real, index, in + (position - offset));
+            }
+            else
+            {
+                /* Only seen when SQLite's page size is not the unit */
+                m_unitBuffer.resize((size_t)m_unit);
+                rc = readUnit(real, index, &m_unitBuffer[0]);
+                if(SQLITE_OK == rc)
+                {
+                    std::memcpy(&m_unitBuffer[(size_t)inUnit], in + (position - offset), (size_t)count);
+                    rc = writeUnit(real, index, &m_unitBuffer[0]);
+                }
+            }
+            if(SQLITE_OK != rc)
+            {
+                return rc;
+            }
+            position += count;
+        }
+        m_size = std::max(m_size, end);
+        m_dirty = true;
+        return SQLITE_OK;
+    }
+
+    int truncate(int64_t size)
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        if(m_unit > 0)
+        {
+            const size_t keep = (size_t)((size + m_unit - 1) / m_unit);
+            for(size_t i = keep; i < m_pages.size(); i++)
+            {
+                release(m_pages[i]);
+            }
+            if(keep < m_pages.size())
+            {
+                m_pages.resize(keep);
+                markDirty(keep);
+            }
+        }
+        m_size = size;
+        m_dirty = true;
+        return SQLITE_OK;
+    }
+
+    int64_t size()
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        return m_size;
+    }
+
+    /*
+     * Save the map if it changed. With syncFlags, the units are on disk
+     * before the map, the map before its root, and the root on return.
+     */
+    int save(sqlite3_file * real, int syncFlags)
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        if(!m_dirty)
+        {
+            return (0 != syncFlags) ? real->pMethods->xSync(real, syncFlags) : SQLITE_OK;
+        }
+
+        int rc = SQLITE_OK;
+        if(0 != syncFlags)
+        {
+            rc = real->pMethods->xSync(real, syncFlags);
+        }
+
+        const size_t chunkCount = (m_pages.size() + chunkEntries - 1) / chunkEntries;
+        for(size_t i = chunkCount; i < m_chunks.size(); i++)
+        {
+            release(m_chunks[i]);
+        }
+        m_chunks.resize(chunkCount);
+        m_dirtyChunks.resize(chunkCount, true);
+
+        std::vector<unsigned char> buffer(chunkEntries * entrySize);
+        for(size_t i = 0; i < chunkCount && SQLITE_OK == rc; i++)
+        {
+            if(!m_dirtyChunks[i])
+            {
+                continue;
+            }
+            std::fill(buffer.begin(), buffer.end(), 0);
+            for(size_t k = 0; k < chunkEntries && i * chunkEntries + k < m_pages.size(); k++)
+            {
+                const Extent & page = m_pages[i * chunkEntries + k];
+                put64(&buffer[k * entrySize], (uint64_t)page.offset);
+                put32(&buffer[k * entrySize + 8], (uint32_t)page.size);
+                put32(&buffer[k * entrySize + 12], page.codec);
+            }
+            Extent chunk;
+            rc = writeExtent(real, &buffer[0], buffer.size(), chunk);
+            if(SQLITE_OK == rc)
+            {
+                release(m_chunks[i]);
+                m_chunks[i] = chunk;
+                m_dirtyChunks[i] = false;
+            }
+        }
+
+        Extent directory;
+        if(SQLITE_OK == rc)
+        {
+            buffer.assign(std::max<size_t>(chunkCount, 1) * entrySize, 0);
+            for(size_t i = 0; i < chunkCount; i++)
+            {
+                put64(&buffer[i * entrySize], (uint64_t)m_chunks[i].offset);
+                put32(&buffer[i * entrySize + 8], (uint32_t)m_chunks[i].size);
+                put32(&buffer[i * entrySize + 12], m_chunks[i].checksum);
+            }
+            rc = writeExtent(real, &buffer[0], chunkCount * entrySize, directory);
+        }
+        if(SQLITE_OK == rc && 0 != syncFlags)
+        {
+            rc = real->pMethods->xSync(real, syncFlags);
+        }
+        if(SQLITE_OK != rc)
+        {
+            if(0 != directory.offset)
+            {
+                addFree(directory.offset, sectors(directory.size));
+            }
+            return rc;
+        }
+
+        unsigned char root[rootSize] = {};
+        std::memcpy(root, rootMagic, sizeof(rootMagic));
+        put64(root + 8, m_sequence + 1);
+        put64(root + 16, (uint64_t)m_size);
+        put64(root + 24, (uint64_t)directory.offset);
+        put32(root + 32, (uint32_t)directory.size);
+        put32(root + 36, directory.checksum);
+        put32(root + 40, (uint32_t)chunkCount);
+        put32(root + 44, checksum(root, 44));
+        rc = real->pMethods->xWrite(real, root, rootSize, rootOffsets[(m_sequence + 1) % 2]);
+        if(SQLITE_OK == rc && 0 != syncFlags)
+        {
+            rc = real->pMethods->xSync(real, syncFlags);
+        }
+        if(SQLITE_OK != rc)
+        {
+            addFree(directory.offset, sectors(directory.size));
+            return rc;
+        }
+
+        /* The new map is the one found after a crash, the extents of the old one can go */
+        m_sequence++;
+        release(m_directory);
+        m_directory = directory;
+        m_durableEpoch = m_epoch++;
+        for(const auto & extent : m_pending)
+        {
+            addFree(extent.first, extent.second);
+        }
+        m_pending.clear();
+        m_dirty = false;
+        return trimTail(real);
+    }
+private:
+    /* Must be called with m_mutex held, for the first write to a new file */
+    int start(sqlite3_file * real, int amount, int64_t offset)
+    {
+        /* The page size SQLite writes page 1 with, if it looks like one */
+        m_unit = (0 == offset && amount >= 512 && amount <= 65536 && 0 == (amount & (amount - 1))) ? amount : 4096;
+        unsigned char header[sectorSize] = {};
+        std::memcpy(header, fileMagic, sizeof(fileMagic));
+        put32(header + 16, fileVersion);
+        put32(header + 20, (uint32_t)m_unit);
+        m_tail = dataStart;
+        return real->pMethods->xWrite(real, header, sectorSize, 0);
+    }
+
+    /* Must be called with m_mutex held */
+    int loadMap(sqlite3_file * real, const unsigned char * root)
+    {
+        const int64_t size = (int64_t)get64(root + 16);
+        Extent directory;
+        directory.offset = (int64_t)get64(root + 24);
+        directory.size = get32(root + 32);
+        directory.checksum = get32(root + 36);
+        const size_t chunkCount = get32(root + 40);
+        if(size < 0 || directory.size != (int64_t)(chunkCount * entrySize))
+        {
+            return SQLITE_IOERR_CORRUPTFS;
+        }
+
+        std::vector<unsigned char> buffer((size_t)directory.size);
+        if(!buffer.empty() && (SQLITE_OK != real->pMethods->xRead(real, &buffer[0], (int)buffer.size(), directory.offset) ||
+            checksum(&buffer[0], buffer.size()) != directory.checksum))
+        {
+            return SQLITE_IOERR_CORRUPTFS;
+        }
+        std::vector<Extent> chunks(chunkCount);
+        for(size_t i = 0; i < chunkCount; i++)
+        {
+            chunks[i].offset = (int64_t)get64(&buffer[i * entrySize]);
+            chunks[i].size = get32(&buffer[i * entrySize + 8]);
+            chunks[i].checksum = get32(&buffer[i * entrySize + 12]);
+        }
+
+        std::vector<Extent> pages(chunkCount * chunkEntries);
+        std::vector<unsigned char> chunk(chunkEntries * entrySize);
+        for(size_t i = 0; i < chunkCount; i++)
+        {
+            if(chunks[i].size != (int64_t)chunk.size() ||
+                SQLITE_OK != real->pMethods->xRead(real, &chunk[0], (int)chunk.size(), chunks[i].offset) ||
+                checksum(&chunk[0], chunk.size()) != chunks[i].checksum)
+            {
+                return SQLITE_IOERR_CORRUPTFS;
+            }
+            for(size_t k = 0; k < chunkEntries; k++)
+            {
+                Extent & page = pages[i * chunkEntries + k];
+                page.offset = (int64_t)get64(&chunk[k * entrySize]);
+                page.size = get32(&chunk[k * entrySize + 8]);
+                page.codec = get32(&chunk[k * entrySize + 12]);
+            }
+        }
+
+        pages.resize(std::min(pages.size(), (size_t)((size + m_unit - 1) / m_unit)));
+        m_pages.swap(pages);
+        m_chunks.swap(chunks);
+        m_dirtyChunks.assign(m_chunks.size(), false);
+        m_directory = (0 == chunkCount) ? Extent() : directory;
+        m_size = size;
+        m_sequence = get64(root + 8);
+        return SQLITE_OK;
+    }
+
+    /* Must be called with m_mutex held */
+    const Compressor * codecFor(uint32_t id) const
+    {
+        if(m_compressor->id() == (int)id)
+        {
+            return m_compressor;
+        }
+        return (1 == id) ? Compressor::lz() : nullptr;
+    }
+
+    /* Must be called with m_mutex held. A unit never written reads as zeros. */
+    int readUnit(sqlite3_file * real, int64_t index, unsigned char * out)
+    {
+        if(index >= (int64_t)m_pages.size() || 0 == m_pages[(size_t)index].offset)
+        {
+            std::memset(out, 0, (size_t)m_unit);
+            return SQLITE_OK;
+        }
+
+        const Extent & page = m_pages[(size_t)index];
+        if(0 == page.codec)
+        {
+            int rc = (page.size == m_unit) ? real->pMethods->xRead(real, out, (int)m_unit, page.offset) : SQLITE_IOERR_CORRUPTFS;
+            return (SQLITE_IOERR_SHORT_READ == rc) ? SQLITE_IOERR_CORRUPTFS : rc;
+        }
+
+        m_stored.resize((size_t)page.size);
+        int rc = real->pMethods->xRead(real, &m_stored[0], (int)page.size, page.offset);
+        if(SQLITE_OK != rc)
+        {
+            return (SQLITE_IOERR_SHORT_READ == rc) ? SQLITE_IOERR_CORRUPTFS : rc;
+        }
+        const Compressor * codec = codecFor(page.codec);
+        m_plain.clear();
+        if(nullptr == codec || !codec->uncompress(m_stored.data(), m_stored.size(), m_plain) || (int64_t)m_plain.size() != m_unit)
+        {
+            return SQLITE_IOERR_CORRUPTFS;
+        }
+        std::memcpy(out, m_plain.data(), (size_t)m_unit);
+        return SQLITE_OK;
+    }
+
+    /* Must be called with m_mutex held. Kept as it is unless compressing saves a sector. */
+    int writeUnit(sqlite3_file * real, int64_t index, const unsigned char * data)
+    {
+        Extent page;
+        const void * bytes = data;
+        page.size = m_unit;
+        m_stored.clear();
+        if(m_compressor->compress((const char *)data, (size_t)m_unit, m_stored) && sectors((int64_t)m_stored.size()) < m_unit)
+        {
+            bytes = m_stored.data();
+            page.size = (int64_t)m_stored.size();
+            page.codec = (uint32_t)m_compressor->id();
+        }
+        page.offset = allocate(sectors(page.size));
+        page.epoch = m_epoch;
+        int rc = real->pMethods->xWrite(real, bytes, (int)page.size, page.offset);
+        if(SQLITE_OK != rc)
+        {
+            addFree(page.offset, sectors(page.size));
+            return rc;
+        }
+
+        if(index >= (int64_t)m_pages.size())
+        {
+            m_pages.resize((size_t)index + 1);
+        }
+        release(m_pages[(size_t)index]);
+        m_pages[(size_t)index] = page;
+        markDirty((size_t)index);
+        return SQLITE_OK;
+    }
+
+    /* Must be called with m_mutex held, for the pieces of the map */
+    int writeExtent(sqlite3_file * real, const unsigned char * data, size_t size, Extent & extent)
+    {
+        extent = Extent();
+        if(0 == size)
+        {
+            return SQLITE_OK;
+        }
+        extent.size = (int64_t)size;
+        extent.checksum = checksum(data, size);
+        extent.offset = allocate(sectors(extent.size));
+        extent.epoch = m_epoch;
+        int rc = real->pMethods->xWrite(real, data, (int)size, extent.offset);
+        if(SQLITE_OK != rc)
+        {
+            addFree(extent.offset, sectors(extent.size));
+            extent = Extent();
+        }
+        return rc;
+    }
+
+    /* Must be called with m_mutex held */
+    void markDirty(size_t index)
+    {
+        const size_t chunk = index / chunkEntries;
+        if(chunk >= m_dirtyChunks.size())
+        {
+            m_dirtyChunks.resize(chunk + 1, true);
+        }
+        m_dirtyChunks[chunk] = true;
+        m_dirty = true;
+    }
+
+    /* Must be called with m_mutex held. length is a whole number of sectors. */
+    int64_t allocate(int64_t length)
+    {
+        auto best = m_freeBySize.lower_bound(length);
+        if(best != m_freeBySize.end())
+        {
+            const int64_t offset = best->second;
+            const int64_t size = best->first;
+            removeFree(offset, size);
+            if(size > length)
+            {
+                addFree(offset + length, size - length);
+            }
+            return offset;
+        }
+
+        int64_t offset = m_tail;
+        if(offset < lockEnd && offset + length > lockStart)
+        {
+            if(offset < lockStart)
+            {
+                addFree(offset, lockStart - offset);
+            }
+            offset = lockEnd;
+        }
+        m_tail = offset + length;
+        return offset;
+    }
+
+    /* Must be called with m_mutex held. What the saved map uses waits for the next one. */
+    void release(Extent & extent)
+    {
+        if(0 != extent.offset)
+        {
+            if(extent.epoch <= m_durableEpoch)
+            {
+                m_pending.push_back(std::make_pair(extent.offset, sectors(extent.size)));
+            }
+            else
+            {
+                addFree(extent.offset, sectors(extent.size));
+            }
+        }
+        extent = Extent();
+    }
+
+    /* Must be called with m_mutex held */
+    void addFree(int64_t offset, int64_t length)
+    {
+        if(offset < lockEnd && offset + length > lockStart)
+        {
+            if(offset < lockStart)
+            {
+                addFree(offset, lockStart - offset);
+            }
+            if(offset + length > lockEnd)
+            {
+                addFree(lockEnd, offset + length - lockEnd);
+            }
+            return;
+        }
+
+        /* Merge with the free extents right before and after */
+        auto next = m_freeByOffset.lower_bound(offset);
+        if(next != m_freeByOffset.end() && next->first == offset + length)
+        {
+            length += next->second;
+            removeFree(next->first, next->second);
+        }
+        next = m_freeByOffset.lower_bound(offset);
+        if(next != m_freeByOffset.begin())
+        {
+            auto previous = std::prev(next);
+            if(previous->first + previous->second == offset)
+            {
+                offset = previous->first;
+                length += previous->second;
+                removeFree(previous->first, previous->second);
+            }
+        }
+        m_freeByOffset[offset] = length;
+        m_freeBySize.insert(std::make_pair(length, offset));
+    }
+
+    /* Must be called with m_mutex held */
+    void removeFree(int64_t offset, int64_t length)
+    {
+        m_freeByOffset.erase(offset);
+        auto range = m_freeBySize.equal_range(length);
+        for(auto iter = range.first; iter != range.second; ++iter)
+        {
+            if(iter->second == offset)
+            {
+                m_freeBySize.erase(iter);
+                break;
+            }
+        }
+    }
+
+    /* Must be called with m_mutex held. Give the free space at the end back to the file system. */
+    int trimTail(sqlite3_file * real)
+    {
+        while(!m_freeByOffset.empty())
+        {
+            auto last = std::prev(m_freeByOffset.end());
+            if(last->first + last->second != m_tail)
+            {
+                break;
+            }
+            m_tail = last->first;
+            removeFree(last->first, last->second);
+        }
+        sqlite3_int64 physical = 0;
+        int rc = real->pMethods->xFileSize(real, &physical);
+        if(SQLITE_OK == rc && physical > m_tail)
+        {
+            rc = real->pMethods->xTruncate(real, m_tail);
+        }
+        return rc;
+    }
+public:
+    std::string path;
+    int refs = 0;
+private:
+    std::mutex m_mutex;
+    const Compressor * m_compressor = nullptr;
+    /* Bytes per unit, 0 until the first write to a new file */
+    int64_t m_unit = 0;
+    /* Size of the file as SQLite sees it */
+    int64_t m_size = 0;
+    std::vector<Extent> m_pages;
+    std::vector<Extent> m_chunks;
+    std::vector<bool> m_dirtyChunks;
+    Extent m_directory;
+    uint64_t m_sequence = 0;
+    /* Extents written during an epoch up to m_durableEpoch are used by the saved map */
+    uint64_t m_epoch = 1;
+    uint64_t m_durableEpoch = 0;
+    bool m_dirty = false;
+    std::map<int64_t, int64_t> m_freeByOffset;
+    std::multimap<int64_t, int64_t> m_freeBySize;
+    std::vector<std::pair<int64_t, int64_t>> m_pending;
+    /* End of the used part of the file */
+    int64_t m_tail = dataStart;
+    std::string m_stored;
+    std::string m_plain;
+    std::vector<unsigned char> m_unitBuffer;
+};
+
+struct CompressedVfs
+{
+    sqlite3_vfs base;
+    sqlite3_vfs * real;
+    const Compressor * compressor;
+    std::string name;
+};
+
+/* A main database file. The file of the underlying VFS follows it in memory. */
+struct CompressedFile
+{
+    sqlite3_file base;
+    PageStore * store;
+    sqlite3_file * real;
+};
+
+std::mutex & registryMutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+/* Page maps of the files open in the process, by full path */
+std::map<std::string, PageStore *> & openStores()
+{
+    static std::map<std::string, PageStore *> stores;
+    return stores;
+}
+
+int acquireStore(const char * path, const Compressor * compressor, sqlite3_file * real, bool empty, PageStore ** ppStore)
+{
+    std::lock_guard<std::mutex> locker(registryMutex());
+    auto iter = openStores().find(path);
+    if(iter != openStores().end())
+    {
+        iter->second->refs++;
+        *ppStore = iter->second;
+        return SQLITE_OK;
+    }
+
+    PageStore * store = new(std::nothrow) PageStore(path, compressor);
+    if(nullptr == store)
+    {
+        return SQLITE_NOMEM;
+    }
+    int rc = empty ? SQLITE_OK : store->load(real);
+    if(SQLITE_OK != rc)
+    {
+        delete store;
+        return rc;
+    }
+    store->refs = 1;
+    openStores()[path] = store;
+    *ppStore = store;
+    return SQLITE_OK;
+}
+
+void releaseStore(PageStore * store)
+{
+    std::lock_guard<std::mutex> locker(registryMutex());
+    if(0 == --store->refs)
+    {
+        openStores().erase(store->path);
+        delete store;
+    }
+}
+
+int fileClose(sqlite3_file * pFile)
+{
+    CompressedFile * p = (CompressedFile *)pFile;
+    int rc = p->store->save(p->real, 0);
+    releaseStore(p->store);
+    int closeRc = p->real->pMethods->xClose(p->real);
+    return (SQLITE_OK != rc) ? rc : closeRc;
+}
+
+int fileRead(sqlite3_file * pFile, void * buffer, int amount, sqlite3_int64 offset)
+{
+    CompressedFile * p = (CompressedFile *)pFile;
+    return p->store->read(p->real, buffer, amount, offset);
+}
+
+int fileWrite(sqlite3_file * pFile, const void * buffer, int amount, sqlite3_int64 offset)
+{
+    CompressedFile * p = (CompressedFile *)pFile;
+    return p->store->write(p->real, buffer, amount, offset);
+}
+
+int fileTruncate(sqlite3_file * pFile, sqlite3_int64 size)
+{
+    CompressedFile * p = (CompressedFile *)pFile;
+    return p->store->truncate(size);
+}
+
+int fileSync(sqlite3_file * pFile, int flags)
+{
+    CompressedFile * p = (CompressedFile *)pFile;
+    return p->store->save(p->real, flags);
+}
+
+int fileSize(sqlite3_file * pFile, sqlite3_int64 * pSize)
+{
+    CompressedFile * p = (CompressedFile *)pFile;
+    *pSize = p->store->size();
+    return SQLITE_OK;
+}
+
+int fileLock(sqlite3_file * pFile, int lock)
+{
+    CompressedFile * p = (CompressedFile *)pFile;
+    return p->real->pMethods->xLock(p->real, lock);
+}
+
+int fileUnlock(sqlite3_file * pFile, int lock)
+{
+    CompressedFile * p = (CompressedFile *)pFile;
+    /* The map of a transaction is saved by its commit already, this covers the others */
+    if(lock <= SQLITE_LOCK_SHARED)
+    {
+        int rc = p->store->save(p->real, 0);
+        if(SQLITE_OK != rc)
+        {
+            return rc;
+        }
+    }
+    return p->real->pMethods->xUnlock(p->real, lock);
+}
+
+int fileCheckReservedLock(sqlite3_file * pFile, int * pResOut)
+{
+    CompressedFile * p = (CompressedFile *)pFile;
+    return p->real->pMethods->xCheckReservedLock(p->real, pResOut);
+}
+
+int fileControl(sqlite3_file * pFile, int op, void * pArg)
+{
+    CompressedFile * p = (CompressedFile *)pFile;
+    switch(op)
+    {
+    case SQLITE_FCNTL_SYNC:
+    case SQLITE_FCNTL_CKPT_DONE:
+        {
+            int rc = p->store->save(p->real, 0);
+            if(SQLITE_OK != rc)
+            {
+                return rc;
+            }
+        }
+        break;
+    case SQLITE_FCNTL_SIZE_HINT:
+    case SQLITE_FCNTL_CHUNK_SIZE:
+        /* About the size SQLite sees, which is not the size of the file */
+        return SQLITE_OK;
+    default:
+        break;
+    }
+    return p->real->pMethods->xFileControl(p->real, op, pArg);
+}
+
+int fileSectorSize(sqlite3_file * pFile)
+{
+    CompressedFile * p = (CompressedFile *)pFile;
+    return p->real->pMethods->xSectorSize(p->real);
+}
+
+int fileDeviceCharacteristics(sqlite3_file * pFile)
+{
+    CompressedFile * p = (CompressedFile *)pFile;
+    /* A page write is never atomic: it goes to a new place and the map follows later */
+    const int atomic = SQLITE_IOCAP_ATOMIC | SQLITE_IOCAP_ATOMIC512 | SQLITE_IOCAP_ATOMIC1K | SQLITE_IOCAP_ATOMIC2K |
+        SQLITE_IOCAP_ATOMIC4K | SQLITE_IOCAP_ATOMIC8K | SQLITE_IOCAP_ATOMIC16K | SQLITE_IOCAP_ATOMIC32K |
+        SQLITE_IOCAP_ATOMIC64K | SQLITE_IOCAP_SAFE_APPEND | SQLITE_IOCAP_SEQUENTIAL | SQLITE_IOCAP_BATCH_ATOMIC;
+    return p->real->pMethods->xDeviceCharacteristics(p->real) & ~atomic;
+}
+
+/* The wal-index lives in the -shm file, which is not compressed */
+int fileShmMap(sqlite3_file * pFile, int region, int size, int extend, void volatile ** pp)
+{
+    CompressedFile * p = (CompressedFile *)pFile;
+    if(p->real->pMethods->iVersion < 2)
+    {
+        return SQLITE_IOERR_SHMMAP;
+    }
+    return p->real->pMethods->xShmMap(p->real, region, size, extend, pp);
+}
+
+int fileShmLock(sqlite3_file * pFile, int offset, int n, int flags)
+{
+    CompressedFile * p = (CompressedFile *)pFile;
+    return p->real->pMethods->xShmLock(p->real, offset, n, flags);
+}
+
+void fileShmBarrier(sqlite3_file * pFile)
+{
+    CompressedFile * p = (CompressedFile *)pFile;
+    p->real->pMethods->xShmBarrier(p->real);
+}
+
+int fileShmUnmap(sqlite3_file * pFile, int deleteFlag)
+{
+    CompressedFile * p = (CompressedFile *)pFile;
+    return p->real->pMethods->xShmUnmap(p->real, deleteFlag);
+}
+
+/* Version 2: no xFetch, SQLite must not map the file into memory */
+const sqlite3_io_methods compressedMethods = {
+    2,
+    fileClose,
+    fileRead,
+    fileWrite,
+    fileTruncate,
+    fileSync,
+    fileSize,
+    fileLock,
+    fileUnlock,
+    fileCheckReservedLock,
+    fileControl,
+    fileSectorSize,
+    fileDeviceCharacteristics,
+    fileShmMap,
+    fileShmLock,
+    fileShmBarrier,
+    fileShmUnmap,
+    nullptr,
+    nullptr
+};
+
+int vfsOpen(sqlite3_vfs * pVfs, const char * zName, sqlite3_file * pFile, int flags, int * pOutFlags)
+{
+    CompressedVfs * vfs = (CompressedVfs *)pVfs;
+    sqlite3_vfs * real = vfs->real;
+    /* Journals, WAL and temporary files are left to the underlying VFS, in place */
+    if(nullptr == zName || 0 == (flags & SQLITE_OPEN_MAIN_DB))
+    {
+        return real->xOpen(real, zName, pFile, flags, pOutFlags);
+    }
+
+    CompressedFile * p = (CompressedFile *)pFile;
+    p->base.pMethods = nullptr;
+    p->store = nullptr;
+    p->real = (sqlite3_file *)(p + 1);
+    int rc = real->xOpen(real, zName, p->real, flags, pOutFlags);
+    if(SQLITE_OK != rc)
+    {
+        return rc;
+    }
+
+    /* A file with data and without the magic is a plain database, it stays one */
+    sqlite3_int64 size = 0;
+    unsigned char magic[sizeof(fileMagic)] = {};
+    rc = p->real->pMethods->xFileSize(p->real, &size);
+    bool compressed = (SQLITE_OK == rc) && (0 == size ||
+        (SQLITE_OK == p->real->pMethods->xRead(p->real, magic, sizeof(magic), 0) && 0 == std::memcmp(magic, fileMagic, sizeof(magic))));
+    {
+        std::lock_guard<std::mutex> locker(registryMutex());
+        compressed = compressed || openStores().count(zName) > 0;
+    }
+    if(!compressed)
+    {
+        p->real->pMethods->xClose(p->real);
+        return (SQLITE_OK == rc) ? real->xOpen(real, zName, pFile, flags, pOutFlags) : rc;
+    }
+
+    rc = acquireStore(zName, vfs->compressor, p->real, 0 == size, &p->store);
+    if(SQLITE_OK != rc)
+    {
+        p->real->pMethods->xClose(p->real);
+        return rc;
+    }
+    p->base.pMethods = &compressedMethods;
+    return SQLITE_OK;
+}
+
+int vfsDelete(sqlite3_vfs * pVfs, const char * zName, int syncDir)
+{
+    sqlite3_vfs * real = ((CompressedVfs *)pVfs)->real;
+    return real->xDelete(real, zName, syncDir);
+}
+
+int vfsAccess(sqlite3_vfs * pVfs, const char * zName, int flags, int * pResOut)
+{
+    sqlite3_vfs * real = ((CompressedVfs *)pVfs)->real;
+    return real->xAccess(real, zName, flags, pResOut);
+}
+
+int vfsFullPathname(sqlite3_vfs * pVfs, const char * zName, int nOut, char * zOut)
+{
+    sqlite3_vfs * real = ((CompressedVfs *)pVfs)->real;
+    return real->xFullPathname(real, zName, nOut, zOut);
+}
+
+void * vfsDlOpen(sqlite3_vfs * pVfs, const char * zFilename)
+{
+    sqlite3_vfs * real = ((CompressedVfs *)pVfs)->real;
+    return real->xDlOpen(real, zFilename);
+}
+
+void vfsDlError(sqlite3_vfs * pVfs, int nByte, char * zErrMsg)
+{
+    sqlite3_vfs * real = ((CompressedVfs *)pVfs)->real;
+    real->xDlError(real, nByte, zErrMsg);
+}
+
+void (*vfsDlSym(sqlite3_vfs * pVfs, void * pHandle, const char * zSymbol))(void)
+{
+    sqlite3_vfs * real = ((CompressedVfs *)pVfs)->real;
+    return real->xDlSym(real, pHandle, zSymbol);
+}
+
+void vfsDlClose(sqlite3_vfs * pVfs, void * pHandle)
+{
+    sqlite3_vfs * real = ((CompressedVfs *)pVfs)->real;
+    real->xDlClose(real, pHandle);
+}
+
+int vfsRandomness(sqlite3_vfs * pVfs, int nByte, char * zOut)
+{
+    sqlite3_vfs * real = ((CompressedVfs *)pVfs)->real;
+    return real->xRandomness(real, nByte, zOut);
+}
+
+int vfsSleep(sqlite3_vfs * pVfs, int microseconds)
+{
+    sqlite3_vfs * real = ((CompressedVfs *)pVfs)->real;
+    return real->xSleep(real, microseconds);
+}
+
+int vfsCurrentTime(sqlite3_vfs * pVfs, double * pTime)
+{
+    sqlite3_vfs * real = ((CompressedVfs *)pVfs)->real;
+    return real->xCurrentTime(real, pTime);
+}
+
+int vfsGetLastError(sqlite3_vfs * pVfs, int nByte, char * zOut)
+{
+    sqlite3_vfs * real = ((CompressedVfs *)pVfs)->real;
+    return real->xGetLastError ? real->xGetLastError(real, nByte, zOut) : 0;
+}
+
+int vfsCurrentTimeInt64(sqlite3_vfs * pVfs, sqlite3_int64 * pTime)
+{
+    sqlite3_vfs * real = ((CompressedVfs *)pVfs)->real;
+    if(real->iVersion >= 2 && real->xCurrentTimeInt64)
+    {
+        return real->xCurrentTimeInt64(real, pTime);
+    }
+    double now = 0;
+    int rc = real->xCurrentTime(real, &now);
+    *pTime = (sqlite3_int64)(now * 86400000.0);
+    return rc;
+}
+
+}/* end of anonymous namespace */
+
+Status pageCompressionVfs(const Compressor * compressor, std::string & name)
+{
+    std::lock_guard<std::mutex> locker(registryMutex());
+    static std::map<const Compressor *, CompressedVfs *> registered;
+    auto iter = registered.find(compressor);
+    if(iter != registered.end())
+    {
+        name = iter->second->name;
+        return Status();
+    }
+
+    sqlite3_vfs * real = sqlite3_vfs_find(nullptr);
+    if(nullptr == real)
+    {
+        return Status("", "No default VFS to compress pages on.", Status::UnknownError, "0");
+    }
+    CompressedVfs * vfs = new(std::nothrow) CompressedVfs();
+    if(nullptr == vfs)
+    {
+        return Status("", "Fail to new.", Status::UnknownError, "0");
+    }
+    vfs->real = real;
+    vfs->compressor = compressor;
+    vfs->name = "kvsqlite-pages-" + std::to_string(registered.size() + 1);
+
+    sqlite3_vfs & base = vfs->base;
+    std::memset(&base, 0, sizeof(base));
+    base.iVersion = 2;
+    base.szOsFile = (int)sizeof(CompressedFile) + real->szOsFile;
+    base.mxPathname = real->mxPathname;
+    base.zName = vfs->name.c_str();
+    base.xOpen = vfsOpen;
+    base.xDelete = vfsDelete;
+    base.xAccess = vfsAccess;
+    base.xFullPathname = vfsFullPathname;
+    base.xDlOpen = vfsDlOpen;
+    base.xDlError = vfsDlError;
+    base.xDlSym = vfsDlSym;
+    base.xDlClose = vfsDlClose;
+    base.xRandomness = vfsRandomness;
+    base.xSleep = vfsSleep;
+    base.xCurrentTime = vfsCurrentTime;
+    base.xGetLastError = vfsGetLastError;
+    base.xCurrentTimeInt64 = vfsCurrentTimeInt64;
+
+    int sqlRet = sqlite3_vfs_register(&base, 0);
+    if(SQLITE_OK != sqlRet)
+    {
+        delete vfs;
+        return Status("", "Fail to register the page compression VFS.", Status::UnknownError, std::to_string(sqlRet));
+    }
+    registered[compressor] = vfs;
+    name = vfs->name;
+    return Status();
+}
+
+}/* end of namespace KVSQLite */
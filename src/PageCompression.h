@@ -0,0 +1,25 @@
+/**
+ * @file PageCompression.h
+ * @brief SQLite VFS storing the pages of database files compressed, see Options::page_compressor. Not installed.
+ */
+
+#ifndef _KVSQLITE_PAGE_COMPRESSION_H_
+#define _KVSQLITE_PAGE_COMPRESSION_H_
+
+#include <string>
+#include "KVSQLite/Compressor.h"
+#include "KVSQLite/Status.h"
+
+namespace KVSQLite
+{
+
+/*
+ * Name of the VFS that compresses the database files it opens with
+ * compressor, registered with SQLite the first time it is asked for. It
+ * stays registered, and so in use of compressor, until the process exits.
+ */
+Status pageCompressionVfs(const Compressor * compressor, std::string & name);
+
+}/* end of namespace KVSQLite */
+
+#endif
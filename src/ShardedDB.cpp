@@ -0,0 +1,1092 @@
+#include "KVSQLite/ShardedDB.h"
+#include "KVSQLite/Slice.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <set>
+#include <thread>
+#include "KeyEncoding.h"
+
+namespace KVSQLite
+{
+
+/* Keys of the shards are merged in the order SQLite sorts them */
+template<typename K>
+static inline bool keyLess(const K & a, const K & b)
+{
+    return a < b;
+}
+
+static inline bool keyLess(const Slice & a, const Slice & b)
+{
+    return a.compare(b) < 0;
+}
+
+template<typename K, typename V>
+ShardedIterator<K, V>::ShardedIterator(const std::vector<Iterator<K, V> *> & iters, int limit)
+    : m_iters(iters), m_keys(iters.size()), m_limit(limit)
+{
+    for(size_t i = 0; i < m_iters.size(); i++)
+    {
+        push(i);
+    }
+}
+
+template<typename K, typename V>
+ShardedIterator<K, V>::~ShardedIterator()
+{
+    for(auto iter : m_iters)
+    {
+        delete iter;
+    }
+}
+
+/* Put shard back on the heap if its iterator has an entry left */
+template<typename K, typename V>
+void ShardedIterator<K, V>::push(int shard)
+{
+    Iterator<K, V> * iter = m_iters[shard];
+    if(!iter->valid())
+    {
+        if(!iter->status().ok() && m_status.ok())
+        {
+            m_status = iter->status();
+        }
+        return;
+    }
+    m_keys[shard] = iter->key();
+    m_heap.push_back(shard);
+    std::push_heap(m_heap.begin(), m_heap.end(), [this](int a, int b) { return keyLess(m_keys[b], m_keys[a]); });
+}
+
+template<typename K, typename V>
+bool ShardedIterator<K, V>::valid() const
+{
+    return m_status.ok() && !m_heap.empty() && (0 == m_limit || m_returned < m_limit);
+}
+
+template<typename K, typename V>
+void ShardedIterator<K, V>::next()
+{
+    std::pop_heap(m_heap.begin(), m_heap.end(), [this](int a, int b) { return keyLess(m_keys[b], m_keys[a]); });
+    int shard = m_heap.back();
+    m_heap.pop_back();
+    m_returned++;
+    m_iters[shard]->next();
+    push(shard);
+}
+
+template<typename K, typename V>
+K ShardedIterator<K, V>::key() const
+{
+    return m_keys[m_heap.front()];
+}
+
+template<typename K, typename V>
+V ShardedIterator<K, V>::value() const
+{
+    return m_iters[m_heap.front()]->value();
+}
+
+template<typename K, typename V>
+Status ShardedIterator<K, V>::status() const
+{
+    return m_status;
+}
+
+/*
+ * FNV-1a of the order-preserving form of the key, which is the same for int
+ * and int64_t and for 0.0 and -0.0, then a final mix so that every bit counts
+ * whatever the number of shards. Changing it would move keys to other shards
+ * of existing databases.
+ */
+template<typename K>
+static uint64_t hashKey(const K & key)
+{
+    std::string bytes;
+    key_encoding<K>::encode(key, bytes);
+    uint64_t h = 14695981039346656037ULL;
+    for(unsigned char c : bytes)
+    {
+        h = (h ^ c) * 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* Sizes counted by the throttling of reshard() */
+template<typename T>
+static inline size_t valueSize(const T &)
+{
+    return sizeof(T);
+}
+
+static inline size_t valueSize(const std::string & value)
+{
+    return value.size();
+}
+
+/* A Slice key of an iterator only lives until its next(), the copy keeps its bytes in storage */
+template<typename K>
+static inline K keepKey(const K & key, std::list<std::string> &)
+{
+    return key;
+}
+
+static inline Slice keepKey(const Slice & key, std::list<std::string> & storage)
+{
+    storage.emplace_back(key.data(), key.size());
+    return Slice(storage.back().data(), storage.back().size());
+}
+
+/*
+ * State of a ShardedDB. Every call runs as an Operation, which keeps the
+ * shards from being switched under it. While reshard() copies, the calls that
+ * write record their keys before their Operation ends, so that the copier
+ * picks them up again before the switch. Without a reshard an Operation only
+ * counts itself in "bypassing", and takes no lock.
+ */
+template<typename K, typename V>
+class ShardedDBImpl
+{
+public:
+    class Operation
+    {
+    public:
+        explicit Operation(ShardedDBImpl * impl) : m_impl(impl)
+        {
+            /* reshard() sets gated then waits for bypassing to drop to 0, one of the two sees the other */
+            m_impl->bypassing++;
+            if(!m_impl->gated)
+            {
+                return;
+            }
+            m_impl->bypassing--;
+            m_gated = true;
+            std::unique_lock<std::mutex> locker(m_impl->mutex);
+            m_impl->wakeup.wait(locker, [this]() { return !m_impl->switching; });
+            m_impl->active++;
+        }
+        ~Operation()
+        {
+            if(!m_gated)
+            {
+                m_impl->bypassing--;
+                return;
+            }
+            std::lock_guard<std::mutex> locker(m_impl->mutex);
+            m_impl->active--;
+            if(m_impl->switching && 0 == m_impl->active)
+            {
+                m_impl->wakeup.notify_all();
+            }
+        }
+    private:
+        ShardedDBImpl * m_impl;
+        bool m_gated = false;
+    };
+public:
+    ~ShardedDBImpl();
+
+    int shardOf(const K & key) const
+    {
+        return (int)(hashKey(key) % shards.size());
+    }
+
+    /* Run fn(shard) for each of "shards", the calling thread taking the first and the workers the others */
+    Status forEachShard(const std::vector<int> & shards, const std::function<Status(int)> & fn);
+    /* Body of the worker threads */
+    void work();
+
+    /* Record written keys for the copier, from within an Operation */
+    void track(const K & key);
+    void track(const WriteBatch<K, V> & batch);
+
+    /* Body of the copier thread */
+    void run();
+    Status copyAll();
+    /* Copy the current state of keys from the shards to the target, deleting the missing ones */
+    Status syncKeys(const std::set<std::string> & keys, bool throttled);
+    Status flush(std::vector<WriteBatch<K, V>> & batches, std::list<std::string> & storage, int64_t bytes, bool throttled);
+public:
+    Options options;
+    std::string name;
+    std::vector<DB<K, V> *> shards;
+    /* Shards replaced by a reshard, kept open for the iterators still reading them */
+    std::vector<DB<K, V> *> retired;
+
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    int active = 0;
+    bool switching = false;
+    /* Set by reshard() until the end of the copy, Operations count in active meanwhile */
+    std::atomic<bool> gated{false};
+    /* Operations running without the mutex */
+    std::atomic<int> bypassing{0};
+
+    ReshardOptions reshardOptions;
+    std::string targetName;
+    std::vector<DB<K, V> *> target;
+    std::thread copier;
+    /* Held to start or join the copier; taken before mutex, never by the copier */
+    std::mutex copierMutex;
+    /* Set from the start of reshard() to the end of the copy, at most one runs */
+    bool copying = false;
+    bool tracking = false;
+    bool stopping = false;
+    /* Encoded keys written since the copier last looked */
+    std::set<std::string> dirty;
+    Status reshardStatus;
+    int64_t copiedBytes = 0;
+    std::chrono::steady_clock::time_point copyStart;
+
+    /* Worker threads of forEachShard(), started as fan-outs need them and kept until the end */
+    std::mutex poolMutex;
+    std::condition_variable poolWakeup;
+    std::deque<std::function<void()>> tasks;
+    std::vector<std::thread> workers;
+    bool poolStopping = false;
+};
+
+template<typename K, typename V>
+ShardedDBImpl<K, V>::~ShardedDBImpl()
+{
+    {
+        std::lock_guard<std::mutex> locker(mutex);
+        stopping = true;
+        wakeup.notify_all();
+    }
+    if(copier.joinable())
+    {
+        copier.join();
+    }
+    {
+        std::lock_guard<std::mutex> locker(poolMutex);
+        poolStopping = true;
+        poolWakeup.notify_all();
+    }
+    for(auto & worker : workers)
+    {
+        worker.join();
+    }
+
+    for(auto db : target)
+    {
+        delete db;
+    }
+    for(auto db : shards)
+    {
+        delete db;
+    }
+    for(auto db : retired)
+    {
+        delete db;
+    }
+}
+
+template<typename K, typename V>
+Status ShardedDBImpl<K, V>::forEachShard(const std::vector<int> & shards, const std::function<Status(int)> & fn)
+{
+    if(shards.empty())
+    {
+        return Status();
+    }
+    if(1 == shards.size())
+    {
+        return fn(shards[0]);
+    }
+
+    std::vector<Status> results(shards.size());
+    /* Shards not done yet besides the first, under poolMutex */
+    size_t pending = shards.size() - 1;
+    std::condition_variable done;
+    {
+        std::lock_guard<std::mutex> locker(poolMutex);
+        while(workers.size() < shards.size() - 1)
+        {
+            workers.emplace_back(&ShardedDBImpl::work, this);
+        }
+        for(size_t i = 1; i < shards.size(); i++)
+        {
+            tasks.emplace_back([&, i]()
+            {
+                results[i] = fn(shards[i]);
+                std::lock_guard<std::mutex> finished(poolMutex);
+                if(0 == --pending)
+                {
+                    done.notify_all();
+                }
+            });
+        }
+        poolWakeup.notify_all();
+    }
+    results[0] = fn(shards[0]);
+    {
+        /* Tasks no worker has picked yet, of this call or of another, run here rather than wait */
+        std::unique_lock<std::mutex> locker(poolMutex);
+        while(pending > 0)
+        {
+            if(tasks.empty())
+            {
+                done.wait(locker);
+                continue;
+            }
+            std::function<void()> task = std::move(tasks.front());
+            tasks.pop_front();
+            locker.unlock();
+            task();
+            locker.lock();
+        }
+    }
+
+    for(const auto & result : results)
+    {
+        if(!result.ok())
+        {
+            return result;
+        }
+    }
+    return Status();
+}
+
+template<typename K, typename V>
+void ShardedDBImpl<K, V>::work()
+{
+    std::unique_lock<std::mutex> locker(poolMutex);
+    while(true)
+    {
+        poolWakeup.wait(locker, [this]() { return poolStopping || !tasks.empty(); });
+        if(tasks.empty())
+        {
+            return;
+        }
+        std::function<void()> task = std::move(tasks.front());
+        tasks.pop_front();
+        locker.unlock();
+        task();
+        locker.lock();
+    }
+}
+
+template<typename K, typename V>
+void ShardedDBImpl<K, V>::track(const K & key)
+{
+    if(!gated)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> locker(mutex);
+    if(tracking)
+    {
+        std::string bytes;
+        key_encoding<K>::encode(key, bytes);
+        dirty.insert(bytes);
+    }
+}
+
+template<typename K, typename V>
+void ShardedDBImpl<K, V>::track(const WriteBatch<K, V> & batch)
+{
+    if(!gated)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> locker(mutex);
+    if(tracking)
+    {
+        const auto & list = batch.getList();
+        for(auto iter = list.begin(); iter != list.end(); ++iter)
+        {
+            std::string bytes;
+            key_encoding<K>::encode(iter->key, bytes);
+            dirty.insert(bytes);
+        }
+    }
+}
+
+template<typename K, typename V>
+Status ShardedDBImpl<K, V>::flush(std::vector<WriteBatch<K, V>> & batches, std::list<std::string> & storage, int64_t bytes, bool throttled)
+{
+    std::vector<int> nonEmpty;
+    for(size_t i = 0; i < batches.size(); i++)
+    {
+        if(!batches[i].getList().empty())
+        {
+            nonEmpty.push_back(i);
+        }
+    }
+    Status status = forEachShard(nonEmpty, [&](int shard) { return target[shard]->write(WriteOptions(), &batches[shard]); });
+    for(auto & batch : batches)
+    {
+        batch.clear();
+    }
+    storage.clear();
+    if(!status.ok())
+    {
+        return status;
+    }
+
+    /* Sleep until the bytes copied so far fit in the bandwidth, or until the ShardedDB is deleted */
+    std::unique_lock<std::mutex> locker(mutex);
+    copiedBytes += bytes;
+    if(throttled && reshardOptions.bytes_per_second > 0)
+    {
+        auto due = copyStart + std::chrono::microseconds(copiedBytes * 1000000 / reshardOptions.bytes_per_second);
+        wakeup.wait_until(locker, due, [this]() { return stopping; });
+    }
+    if(stopping)
+    {
+        return Status("", "Reshard stopped, the ShardedDB is deleted.", Status::UnknownError, "0");
+    }
+    return Status();
+}
+
+template<typename K, typename V>
+Status ShardedDBImpl<K, V>::copyAll()
+{
+    ReadOptions readOptions;
+    readOptions.prefetch = reshardOptions.batch_size;
+    std::vector<WriteBatch<K, V>> batches(target.size());
+    std::list<std::string> storage;
+    std::string bytes;
+
+    Status status;
+    for(size_t i = 0; i < shards.size() && status.ok(); i++)
+    {
+        /* Unbounded, whatever the key type */
+        Iterator<K, V> * iter = nullptr;
+        status = shards[i]->newIterator(readOptions, nullptr, nullptr, 0, &iter);
+        if(!status.ok())
+        {
+            break;
+        }
+
+        int64_t batchBytes = 0;
+        int entries = 0;
+        for(; iter->valid() && status.ok(); iter->next())
+        {
+            K key = keepKey(iter->key(), storage);
+            V value = iter->value();
+            key_encoding<K>::encode(key, bytes);
+            batches[hashKey(key) % target.size()].put(key, value);
+            batchBytes += bytes.size() + valueSize(value);
+            if(++entries == reshardOptions.batch_size)
+            {
+                status = flush(batches, storage, batchBytes, true);
+                batchBytes = 0;
+                entries = 0;
+            }
+        }
+        if(status.ok())
+        {
+            status = iter->status();
+        }
+        if(status.ok())
+        {
+            status = flush(batches, storage, batchBytes, true);
+        }
+        delete iter;
+    }
+    return status;
+}
+
+template<typename K, typename V>
+Status ShardedDBImpl<K, V>::syncKeys(const std::set<std::string> & keys, bool throttled)
+{
+    std::vector<WriteBatch<K, V>> batches(target.size());
+    std::list<std::string> storage;
+    int64_t batchBytes = 0;
+    int entries = 0;
+    Status status;
+    for(auto iter = keys.begin(); iter != keys.end() && status.ok(); ++iter)
+    {
+        /* A decoded Slice points into keys, which outlives the batches */
+        K key;
+        key_encoding<K>::decode(iter->data(), iter->size(), key);
+        V value;
+        status = shards[shardOf(key)]->get(key, value);
+        if(status.ok())
+        {
+            batches[hashKey(key) % target.size()].put(key, value);
+            batchBytes += iter->size() + valueSize(value);
+        }
+        else if(status.type() == Status::NotFound)
+        {
+            batches[hashKey(key) % target.size()].del(key);
+            batchBytes += iter->size();
+            status = Status();
+        }
+        if(status.ok() && ++entries == reshardOptions.batch_size)
+        {
+            status = flush(batches, storage, batchBytes, throttled);
+            batchBytes = 0;
+            entries = 0;
+        }
+    }
+    if(status.ok())
+    {
+        status = flush(batches, storage, batchBytes, throttled);
+    }
+    return status;
+}
+
+template<typename K, typename V>
+void ShardedDBImpl<K, V>::run()
+{
+    Status status = copyAll();
+
+    /* Keys written during the copy are copied again, until few enough are left to hold writers back */
+    while(status.ok())
+    {
+        std::set<std::string> keys;
+        {
+            std::lock_guard<std::mutex> locker(mutex);
+            if(dirty.size() <= (size_t)reshardOptions.batch_size)
+            {
+                break;
+            }
+            keys.swap(dirty);
+        }
+        status = syncKeys(keys, true);
+    }
+
+    std::unique_lock<std::mutex> locker(mutex);
+    if(status.ok())
+    {
+        /* No call runs from here to the switch, the last keys are copied without throttling */
+        switching = true;
+        wakeup.wait(locker, [this]() { return 0 == active; });
+        std::set<std::string> keys;
+        keys.swap(dirty);
+        locker.unlock();
+        status = syncKeys(keys, false);
+        locker.lock();
+
+        if(status.ok())
+        {
+            retired.insert(retired.end(), shards.begin(), shards.end());
+            shards.swap(target);
+            target.clear();
+            name = targetName;
+        }
+        switching = false;
+        wakeup.notify_all();
+    }
+
+    /* The new files are left as they are, the next reshard() to them clears them */
+    for(auto db : target)
+    {
+        delete db;
+    }
+    target.clear();
+    tracking = false;
+    dirty.clear();
+    copying = false;
+    gated = false;
+    reshardStatus = status;
+}
+
+/* Each shard records the number of shards and its own index, in a keyspace of its own */
+static Status checkShard(DB<std::string, int64_t> * meta, int index, int & shards)
+{
+    int64_t recorded = 0;
+    Status status = meta->get("shards", recorded);
+    if(status.type() == Status::NotFound)
+    {
+        if(shards <= 0)
+        {
+            return Status("", "Invalid argument, the number of shards of a new sharded database must be given.", Status::InvalidArgument, "0");
+        }
+        WriteBatch<std::string, int64_t> batch;
+        batch.put("shards", shards);
+        batch.put("index", index);
+        return meta->write(WriteOptions(), &batch);
+    }
+    if(!status.ok())
+    {
+        return status;
+    }
+
+    int64_t recordedIndex = -1;
+    status = meta->get("index", recordedIndex);
+    if(!status.ok())
+    {
+        return status;
+    }
+    if((shards > 0 && recorded != shards) || recordedIndex != index)
+    {
+        std::string databaseErr = "Invalid argument, the shard " + std::to_string(index) + " belongs to shard " +
+            std::to_string(recordedIndex) + " of " + std::to_string(recorded) + ".";
+        return Status("", databaseErr, Status::InvalidArgument, "0");
+    }
+    shards = (int)recorded;
+    return Status();
+}
+
+/* Drop the shard count and index recorded in filename, so that it can become a shard of another count */
+template<typename K, typename V>
+static Status forgetShard(const Options & options, const std::string & filename)
+{
+    DB<K, V> * db = nullptr;
+    Status status = DB<K, V>::open(options, filename, &db);
+    if(!status.ok())
+    {
+        return status;
+    }
+    Options metaOptions;
+    metaOptions.keyspace = "kvsqlite_shards";
+    DB<std::string, int64_t> * meta = nullptr;
+    status = DB<std::string, int64_t>::open(metaOptions, db, &meta);
+    if(status.ok())
+    {
+        status = meta->clear(WriteOptions());
+        delete meta;
+    }
+    delete db;
+    return status;
+}
+
+template<typename K, typename V>
+ShardedDB<K, V>::ShardedDB() : m_impl(new ShardedDBImpl<K, V>())
+{
+}
+
+template<typename K, typename V>
+Status ShardedDB<K, V>::open(const Options & options, const std::string & name, int shards, ShardedDB ** ppDB)
+{
+    if(nullptr == ppDB)
+    {
+        return Status("", "Invalid argument, ppDB is null.", Status::InvalidArgument, "0");
+    }
+
+    ShardedDB * & pDB = *ppDB;
+    pDB = new(std::nothrow) ShardedDB();
+    if(nullptr == pDB)
+    {
+        return Status("", "Fail to new.", Status::UnknownError, "0");
+    }
+    pDB->m_impl->options = options;
+    pDB->m_impl->name = name;
+
+    /* The first shard tells how many there are when opening an existing database */
+    Status status;
+    const bool inMemory = name.empty() || ":memory:" == name;
+    for(int i = 0; 0 == i || i < shards; i++)
+    {
+        /* An in-memory or temporary database gets a private database per shard */
+        const std::string filename = inMemory ? name : name + "." + std::to_string(i);
+        Options shardOptions = options;
+        /* Without a number of shards, nothing is created before the first shard's meta is read */
+        const bool mustExist = (shards <= 0 && !inMemory);
+        if(mustExist)
+        {
+            shardOptions.create_if_missing = false;
+        }
+        DB<K, V> * shard = nullptr;
+        status = DB<K, V>::open(shardOptions, filename, &shard);
+        if(!status.ok())
+        {
+            if(mustExist)
+            {
+                status = Status(status.driverText(), "Invalid argument, the number of shards of a new sharded database must be given, "
+                    "and no database could be opened:" + filename, Status::InvalidArgument, status.nativeErrorCode());
+            }
+            break;
+        }
+        pDB->m_impl->shards.push_back(shard);
+
+        Options metaOptions;
+        metaOptions.keyspace = "kvsqlite_shards";
+        DB<std::string, int64_t> * meta = nullptr;
+        status = DB<std::string, int64_t>::open(metaOptions, shard, &meta);
+        if(!status.ok())
+        {
+            break;
+        }
+        status = checkShard(meta, i, shards);
+        delete meta;
+        if(!status.ok())
+        {
+            break;
+        }
+    }
+
+    if(!status.ok())
+    {
+        delete pDB;
+        pDB = nullptr;
+    }
+    return status;
+}
+
+template<typename K, typename V>
+ShardedDB<K, V>::~ShardedDB()
+{
+    delete m_impl;
+    m_impl = nullptr;
+}
+
+template<typename K, typename V>
+int ShardedDB<K, V>::shardCount() const
+{
+    typename ShardedDBImpl<K, V>::Operation operation(m_impl);
+    return (int)m_impl->shards.size();
+}
+
+template<typename K, typename V>
+int ShardedDB<K, V>::shardOf(const K & key) const
+{
+    typename ShardedDBImpl<K, V>::Operation operation(m_impl);
+    return m_impl->shardOf(key);
+}
+
+template<typename K, typename V>
+DB<K, V> * ShardedDB<K, V>::shard(int index) const
+{
+    typename ShardedDBImpl<K, V>::Operation operation(m_impl);
+    if(index < 0 || index >= (int)m_impl->shards.size())
+    {
+        return nullptr;
+    }
+    return m_impl->shards[index];
+}
+
+template<typename K, typename V>
+Status ShardedDB<K, V>::put(const WriteOptions & options, const K & key, const V & value)
+{
+    typename ShardedDBImpl<K, V>::Operation operation(m_impl);
+    Status status = m_impl->shards[m_impl->shardOf(key)]->put(options, key, value);
+    m_impl->track(key);
+    return status;
+}
+
+template<typename K, typename V>
+Status ShardedDB<K, V>::get(const K & key, V & value)
+{
+    typename ShardedDBImpl<K, V>::Operation operation(m_impl);
+    return m_impl->shards[m_impl->shardOf(key)]->get(key, value);
+}
+
+template<typename K, typename V>
+Status ShardedDB<K, V>::del(const WriteOptions & options, const K & key)
+{
+    typename ShardedDBImpl<K, V>::Operation operation(m_impl);
+    Status status = m_impl->shards[m_impl->shardOf(key)]->del(options, key);
+    m_impl->track(key);
+    return status;
+}
+
+template<typename K, typename V>
+Status ShardedDB<K, V>::write(const WriteOptions & options, WriteBatch<K, V> * updates)
+{
+    if(nullptr == updates)
+    {
+        return Status("", "Invalid argument, updates is null.", Status::InvalidArgument, "0");
+    }
+
+    typename ShardedDBImpl<K, V>::Operation operation(m_impl);
+    std::vector<WriteBatch<K, V>> batches(m_impl->shards.size());
+    const auto & list = updates->getList();
+    for(auto iter = list.begin(); iter != list.end(); ++iter)
+    {
+        WriteBatch<K, V> & batch = batches[m_impl->shardOf(iter->key)];
+        if(WriteBatch<K, V>::NodeType::PUT == iter->type)
+        {
+            batch.put(iter->key, iter->value);
+        }
+        else if(WriteBatch<K, V>::NodeType::DEL == iter->type)
+        {
+            batch.del(iter->key);
+        }
+        else
+        {
+            batch.merge(iter->key, iter->value, iter->mergeOperator);
+        }
+    }
+
+    std::vector<int> shards;
+    for(size_t i = 0; i < batches.size(); i++)
+    {
+        if(!batches[i].getList().empty())
+        {
+            shards.push_back(i);
+        }
+    }
+    Status status = m_impl->forEachShard(shards, [&](int shard) { return m_impl->shards[shard]->write(options, &batches[shard]); });
+    m_impl->track(*updates);
+    return status;
+}
+
+template<typename K, typename V>
+Status ShardedDB<K, V>::multiGet(const std::vector<K> & keys, std::vector<V> & values, std::vector<Status> & statuses)
+{
+    typename ShardedDBImpl<K, V>::Operation operation(m_impl);
+    values.assign(keys.size(), V());
+    statuses.assign(keys.size(), Status());
+
+    std::vector<std::vector<size_t>> positions(m_impl->shards.size());
+    for(size_t i = 0; i < keys.size(); i++)
+    {
+        positions[m_impl->shardOf(keys[i])].push_back(i);
+    }
+
+    std::vector<int> shards;
+    for(size_t i = 0; i < positions.size(); i++)
+    {
+        if(!positions[i].empty())
+        {
+            shards.push_back(i);
+        }
+    }
+
+    /* Each thread only writes the slots of the keys of its shard */
+    return m_impl->forEachShard(shards, [&](int shard)
+    {
+        Status result;
+        for(size_t i : positions[shard])
+        {
+            statuses[i] = m_impl->shards[shard]->get(keys[i], values[i]);
+            if(!statuses[i].ok() && statuses[i].type() != Status::NotFound && result.ok())
+            {
+                result = statuses[i];
+            }
+        }
+        return result;
+    });
+}
+
+template<typename K, typename V>
+Status ShardedDB<K, V>::count(const K & begin, const K & end, int64_t & count)
+{
+    typename ShardedDBImpl<K, V>::Operation operation(m_impl);
+    std::vector<int64_t> counts(m_impl->shards.size(), 0);
+    std::vector<int> shards;
+    for(size_t i = 0; i < m_impl->shards.size(); i++)
+    {
+        shards.push_back(i);
+    }
+
+    Status status = m_impl->forEachShard(shards, [&](int shard) { return m_impl->shards[shard]->count(begin, end, counts[shard]); });
+    if(status.ok())
+    {
+        count = 0;
+        for(int64_t n : counts)
+        {
+            count += n;
+        }
+    }
+    return status;
+}
+
+template<typename K, typename V>
+Status ShardedDB<K, V>::newIterator(const ReadOptions & options, const std::function<Status(DB<K, V> *, Iterator<K, V> **)> & scan, ShardedIterator<K, V> ** ppIter)
+{
+    if(nullptr == ppIter)
+    {
+        return Status("", "Invalid argument, ppIter is null.", Status::InvalidArgument, "0");
+    }
+    *ppIter = nullptr;
+    if(!options.continuation.empty())
+    {
+        return Status("", "Invalid argument, a sharded scan can not be continued.", Status::InvalidArgument, "0");
+    }
+
+    /* Every shard starts its scan, and reads its first page, at the same time */
+    typename ShardedDBImpl<K, V>::Operation operation(m_impl);
+    std::vector<Iterator<K, V> *> iters(m_impl->shards.size(), nullptr);
+    std::vector<int> shards;
+    for(size_t i = 0; i < m_impl->shards.size(); i++)
+    {
+        shards.push_back(i);
+    }
+    Status status = m_impl->forEachShard(shards, [&](int shard) { return scan(m_impl->shards[shard], &iters[shard]); });
+    if(!status.ok())
+    {
+        for(auto iter : iters)
+        {
+            delete iter;
+        }
+        return status;
+    }
+
+    *ppIter = new(std::nothrow) ShardedIterator<K, V>(iters, options.limit);
+    if(nullptr == *ppIter)
+    {
+        for(auto iter : iters)
+        {
+            delete iter;
+        }
+        return Status("", "Fail to new.", Status::UnknownError, "0");
+    }
+    return Status();
+}
+
+template<typename K, typename V>
+Status ShardedDB<K, V>::scanRange(const ReadOptions & options, const K & begin, const K & end, ShardedIterator<K, V> ** ppIter)
+{
+    return newIterator(options, [&](DB<K, V> * db, Iterator<K, V> ** ppShardIter)
+    {
+        return db->scanRange(options, begin, end, ppShardIter);
+    }, ppIter);
+}
+
+template<typename K, typename V>
+Status ShardedDB<K, V>::scanPrefix(const ReadOptions & options, const K & prefix, ShardedIterator<K, V> ** ppIter)
+{
+    return newIterator(options, [&](DB<K, V> * db, Iterator<K, V> ** ppShardIter)
+    {
+        return db->scanPrefix(options, prefix, ppShardIter);
+    }, ppIter);
+}
+
+template<typename K, typename V>
+Status ShardedDB<K, V>::reshard(const ReshardOptions & options, const std::string & name, int shards)
+{
+    if(shards <= 0 || name.empty() || ":memory:" == name)
+    {
+        return Status("", "Invalid argument, a reshard needs a number of shards and a file name.", Status::InvalidArgument, "0");
+    }
+    {
+        std::lock_guard<std::mutex> locker(m_impl->mutex);
+        if(m_impl->copying)
+        {
+            return Status("", "Invalid argument, a reshard is already running.", Status::InvalidArgument, "0");
+        }
+        if(name == m_impl->name)
+        {
+            return Status("", "Invalid argument, a reshard can not write to the current files.", Status::InvalidArgument, "0");
+        }
+        m_impl->copying = true;
+        m_impl->gated = true;
+    }
+
+    /* The copier of the last reshard has finished, waitForReshard() may still be joining it */
+    std::lock_guard<std::mutex> joiner(m_impl->copierMutex);
+    if(m_impl->copier.joinable())
+    {
+        m_impl->copier.join();
+    }
+
+    Options targetOptions = m_impl->options;
+    targetOptions.create_if_missing = true;
+    targetOptions.error_if_exists = false;
+    /* Files left over by an earlier reshard that did not complete may record another shard count, and hold stale data */
+    Status status;
+    for(int i = 0; status.ok() && i < shards; i++)
+    {
+        status = forgetShard<K, V>(targetOptions, name + "." + std::to_string(i));
+    }
+    ShardedDB * pTarget = nullptr;
+    if(status.ok())
+    {
+        status = open(targetOptions, name, shards, &pTarget);
+    }
+
+    for(size_t i = 0; status.ok() && i < pTarget->m_impl->shards.size(); i++)
+    {
+        status = pTarget->m_impl->shards[i]->clear(WriteOptions());
+    }
+
+    if(!status.ok())
+    {
+        delete pTarget;
+        std::lock_guard<std::mutex> locker(m_impl->mutex);
+        m_impl->copying = false;
+        m_impl->gated = false;
+        return status;
+    }
+
+    /* The calls that started before gated was set end before the copy, the others record their keys */
+    while(m_impl->bypassing > 0)
+    {
+        std::this_thread::yield();
+    }
+    std::lock_guard<std::mutex> locker(m_impl->mutex);
+    m_impl->target.swap(pTarget->m_impl->shards);
+    delete pTarget;
+    m_impl->reshardOptions = options;
+    m_impl->reshardOptions.batch_size = std::max(options.batch_size, 1);
+    m_impl->targetName = name;
+    m_impl->tracking = true;
+    m_impl->dirty.clear();
+    m_impl->reshardStatus = Status();
+    m_impl->copiedBytes = 0;
+    m_impl->copyStart = std::chrono::steady_clock::now();
+    m_impl->copier = std::thread(&ShardedDBImpl<K, V>::run, m_impl);
+    return Status();
+}
+
+template<typename K, typename V>
+Status ShardedDB<K, V>::waitForReshard()
+{
+    {
+        std::lock_guard<std::mutex> joiner(m_impl->copierMutex);
+        if(m_impl->copier.joinable())
+        {
+            m_impl->copier.join();
+        }
+    }
+    std::lock_guard<std::mutex> locker(m_impl->mutex);
+    return m_impl->reshardStatus;
+}
+
+/* Those stupid code in order to put template class implementation in .cpp file.
+ * ref : https://isocpp.org/wiki/faq/templates#separate-template-fn-defn-from-decl
+ */
+template class ShardedDB<int, int>;
+template class ShardedDB<int, int64_t>;
+template class ShardedDB<int, double>;
+template class ShardedDB<int, std::string>;
+
+template class ShardedDB<int64_t, int>;
+template class ShardedDB<int64_t, int64_t>;
+template class ShardedDB<int64_t, double>;
+template class ShardedDB<int64_t, std::string>;
+
+template class ShardedDB<double, int>;
+template class ShardedDB<double, int64_t>;
+template class ShardedDB<double, double>;
+template class ShardedDB<double, std::string>;
+
+template class ShardedDB<std::string, int>;
+template class ShardedDB<std::string, int64_t>;
+template class ShardedDB<std::string, double>;
+template class ShardedDB<std::string, std::string>;
+
+template class ShardedDB<Slice, int>;
+template class ShardedDB<Slice, int64_t>;
+template class ShardedDB<Slice, double>;
+template class ShardedDB<Slice, std::string>;
+
+template class ShardedIterator<int, int>;
+template class ShardedIterator<int, int64_t>;
+template class ShardedIterator<int, double>;
+template class ShardedIterator<int, std::string>;
+
+template class ShardedIterator<int64_t, int>;
+template class ShardedIterator<int64_t, int64_t>;
+template class ShardedIterator<int64_t, double>;
+template class ShardedIterator<int64_t, std::string>;
+
+template class ShardedIterator<double, int>;
+template class ShardedIterator<double, int64_t>;
+template class ShardedIterator<double, double>;
+template class ShardedIterator<double, std::string>;
+
+template class ShardedIterator<std::string, int>;
+template class ShardedIterator<std::string, int64_t>;
+template class ShardedIterator<std::string, double>;
+template class ShardedIterator<std::string, std::string>;
+
+template class ShardedIterator<Slice, int>;
+template class ShardedIterator<Slice, int64_t>;
+template class ShardedIterator<Slice, double>;
+template class ShardedIterator<Slice, std::string>;
+
+}/* end of namespace KVSQLite */
@@ -0,0 +1,354 @@
+#include "KVSQLite/Transaction.h"
+#include "KVSQLite/Slice.h"
+#include "DBImpl.h"
+#include <map>
+
+namespace KVSQLite
+{
+
+/* What a key looked like in the database when a transaction read it. */
+struct RowVersion
+{
+    bool exists = false;
+    int type = SQLITE_NULL;
+    std::string bytes;
+
+    bool operator==(const RowVersion & other) const
+    {
+        return (exists == other.exists) && (type == other.type) && (bytes == other.bytes);
+    }
+};
+
+static RowVersion captureRow(sqlite3_stmt * stmt, int idx)
+{
+    RowVersion version;
+    version.exists = true;
+    version.type = sqlite3_column_type(stmt, idx);
+    switch(version.type)
+    {
+    case SQLITE_INTEGER:
+        version.bytes = std::to_string(sqlite3_column_int64(stmt, idx));
+        break;
+    case SQLITE_FLOAT:
+        {
+            double d = sqlite3_column_double(stmt, idx);
+            version.bytes.assign(reinterpret_cast<const char *>(&d), sizeof(d));
+        }
+        break;
+    case SQLITE_TEXT:
+    case SQLITE_BLOB:
+        {
+            const char * p = (const char *)sqlite3_column_blob(stmt, idx);
+            int size = sqlite3_column_bytes(stmt, idx);
+            if(p)
+            {
+                version.bytes.assign(p, size);
+            }
+        }
+        break;
+    default:
+        break;
+    }
+    return version;
+}
+
+template<typename K, typename V>
+class TransactionImpl
+{
+public:
+    typedef typename storage_traits<K>::type KeyType;
+    typedef typename storage_traits<V>::type ValueType;
+    struct Write
+    {
+        bool del;
+        ValueType value;
+    };
+public:
+    /* Must be called with dbImpl->mutex held. */
+    Status readRow(const K & key, V & value, RowVersion & version)
+    {
+        Status status = dbImpl->getRow(key, value);
+        if(status.ok())
+        {
+            version = captureRow(dbImpl->getSQL, 0);
+        }
+        else if(Status::NotFound == status.type())
+        {
+            version = RowVersion();
+        }
+        return status;
+    }
+
+    /* Must be called with dbImpl->mutex held, inside a database transaction. */
+    Status validate()
+    {
+        for(auto iter = reads.begin(); iter != reads.end(); ++iter)
+        {
+            V value;
+            RowVersion current;
+            Status status = readRow(storage_traits<K>::view(iter->first), value, current);
+            if(!status.ok() && Status::NotFound != status.type())
+            {
+                return status;
+            }
+            if(!(current == iter->second))
+            {
+                return Status("", "Transaction conflict, a key read by it has been changed.", Status::Busy, "0");
+            }
+        }
+        return Status();
+    }
+
+    /* Must be called with dbImpl->mutex held, inside a database transaction. */
+    Status apply()
+    {
+        Status status;
+        for(auto iter = writes.begin(); iter != writes.end(); ++iter)
+        {
+            if(iter->second.del)
+            {
+                status = dbImpl->delRow(storage_traits<K>::view(iter->first));
+            }
+            else
+            {
+                status = dbImpl->putRow(storage_traits<K>::view(iter->first), storage_traits<V>::view(iter->second.value));
+            }
+            if(!status.ok())
+            {
+                break;
+            }
+        }
+        return status;
+    }
+public:
+    DBImpl * dbImpl = nullptr;
+    std::mutex mutex;
+    std::map<KeyType, Write> writes;
+    std::map<KeyType, RowVersion> reads;
+    bool finished = false;
+};
+
+static inline Status finishedStatus()
+{
+    return Status("", "Transaction already committed or rolled back.", Status::InvalidArgument, "0");
+}
+
+template<typename K, typename V>
+Transaction<K, V>::Transaction(DBImpl * pDBImpl)
+{
+    m_impl = new TransactionImpl<K, V>();
+    m_impl->dbImpl = pDBImpl;
+}
+
+template<typename K, typename V>
+Transaction<K, V>::~Transaction()
+{
+    delete m_impl;
+    m_impl = nullptr;
+}
+
+template<typename K, typename V>
+Status Transaction<K, V>::get(const K & key, V & value)
+{
+    std::lock_guard<std::mutex> locker(m_impl->mutex);
+    if(m_impl->finished)
+    {
+        return finishedStatus();
+    }
+
+    auto iter = m_impl->writes.find(storage_traits<K>::store(key));
+    if(iter != m_impl->writes.end())
+    {
+        if(iter->second.del)
+        {
+            return Status("", "Not found.", Status::NotFound, "0");
+        }
+        value = storage_traits<V>::view(iter->second.value);
+        return Status();
+    }
+
+    std::lock_guard<std::mutex> dbLocker(m_impl->dbImpl->mutex);
+    RowVersion version;
+    Status status = m_impl->readRow(key, value, version);
+    if(status.ok() || Status::NotFound == status.type())
+    {
+        /* Validate against the first value seen, a later change is a conflict anyway. */
+        m_impl->reads.insert(std::make_pair(storage_traits<K>::store(key), version));
+    }
+    return status;
+}
+
+template<typename K, typename V>
+Status Transaction<K, V>::put(const K & key, const V & value)
+{
+    std::lock_guard<std::mutex> locker(m_impl->mutex);
+    if(m_impl->finished)
+    {
+        return finishedStatus();
+    }
+
+    typename TransactionImpl<K, V>::Write & write = m_impl->writes[storage_traits<K>::store(key)];
+    write.del = false;
+    write.value = storage_traits<V>::store(value);
+    return Status();
+}
+
+template<typename K, typename V>
+Status Transaction<K, V>::del(const K & key)
+{
+    std::lock_guard<std::mutex> locker(m_impl->mutex);
+    if(m_impl->finished)
+    {
+        return finishedStatus();
+    }
+
+    typename TransactionImpl<K, V>::Write & write = m_impl->writes[storage_traits<K>::store(key)];
+    write.del = true;
+    write.value = typename TransactionImpl<K, V>::ValueType();
+    return Status();
+}
+
+template<typename K, typename V>
+Status Transaction<K, V>::commit(const WriteOptions & options)
+{
+    std::lock_guard<std::mutex> locker(m_impl->mutex);
+    if(m_impl->finished)
+    {
+        return finishedStatus();
+    }
+    m_impl->finished = true;
+
+    DBImpl * dbImpl = m_impl->dbImpl;
+    std::lock_guard<std::mutex> dbLocker(dbImpl->mutex);
+
+    Status status = dbImpl->applyWriteOptions(options);
+    if(!status.ok())
+    {
+        return status;
+    }
+
+    status = stepSQL(dbImpl->db, dbImpl->beginSQL);
+    if(!status.ok())
+    {
+        return status;
+    }
+
+    status = m_impl->validate();
+    if(status.ok())
+    {
+        status = m_impl->apply();
+    }
+    if(!status.ok())
+    {
+        stepSQL(dbImpl->db, dbImpl->rollbackSQL);
+        return status;
+    }
+
+    status = stepSQL(dbImpl->db, dbImpl->commitSQL);
+    if(!status.ok())
+    {
+        stepSQL(dbImpl->db, dbImpl->rollbackSQL);
+    }
+    return status;
+}
+
+template<typename K, typename V>
+Status Transaction<K, V>::rollback()
+{
+    std::lock_guard<std::mutex> locker(m_impl->mutex);
+    if(m_impl->finished)
+    {
+        return finishedStatus();
+    }
+    m_impl->finished = true;
+    m_impl->writes.clear();
+    m_impl->reads.clear();
+    return Status();
+}
+
+/* Explicit instantiations, see DB.cpp */
+template class Transaction<int, int>;
+template class Transaction<int, int64_t>;
+template class Transaction<int, double>;
+template class Transaction<int, std::string>;
+template class Transaction<int, Slice>;
+
+template class Transaction<int64_t, int>;
+template class Transaction<int64_t, int64_t>;
+template class Transaction<int64_t, double>;
+template class Transaction<int64_t, std::string>;
+template class Transaction<int64_t, Slice>;
+
+template class Transaction<double, int>;
+template class Transaction<double, int64_t>;
+template class Transaction<double, double>;
+template class Transaction<double, std::string>;
+template class Transaction<double, Slice>;
+
+template class Transaction<std::string, int>;
+template class Transaction<std::string, int64_t>;
+template class Transaction<std::string, double>;
+template class Transaction<std::string, std::string>;
+template class Transaction<std::string, Slice>;
+
+template class Transaction<Slice, int>;
+template class Transaction<Slice, int64_t>;
+template class Transaction<Slice, double>;
+template class Transaction<Slice, std::string>;
+template class Transaction<Slice, Slice>;
+
+template class Transaction<std::tuple<int64_t, int64_t>, int>;
+template class Transaction<std::tuple<int64_t, int64_t>, int64_t>;
+template class Transaction<std::tuple<int64_t, int64_t>, double>;
+template class Transaction<std::tuple<int64_t, int64_t>, std::string>;
+template class Transaction<std::tuple<int64_t, int64_t>, Slice>;
+
+template class Transaction<std::tuple<int64_t, double>, int>;
+template class Transaction<std::tuple<int64_t, double>, int64_t>;
+template class Transaction<std::tuple<int64_t, double>, double>;
+template class Transaction<std::tuple<int64_t, double>, std::string>;
+template class Transaction<std::tuple<int64_t, double>, Slice>;
+
+template class Transaction<std::tuple<int64_t, std::string>, int>;
+template class Transaction<std::tuple<int64_t, std::string>, int64_t>;
+template class Transaction<std::tuple<int64_t, std::string>, double>;
+template class Transaction<std::tuple<int64_t, std::string>, std::string>;
+template class Transaction<std::tuple<int64_t, std::string>, Slice>;
+
+template class Transaction<std::tuple<double, int64_t>, int>;
+template class Transaction<std::tuple<double, int64_t>, int64_t>;
+template class Transaction<std::tuple<double, int64_t>, double>;
+template class Transaction<std::tuple<double, int64_t>, std::string>;
+template class Transaction<std::tuple<double, int64_t>, Slice>;
+
+template class Transaction<std::tuple<double, double>, int>;
+template class Transaction<std::tuple<double, double>, int64_t>;
+template class Transaction<std::tuple<double, double>, double>;
+template class Transaction<std::tuple<double, double>, std::string>;
+template class Transaction<std::tuple<double, double>, Slice>;
+
+template class Transaction<std::tuple<double, std::string>, int>;
+template class Transaction<std::tuple<double, std::string>, int64_t>;
+template class Transaction<std::tuple<double, std::string>, double>;
+template class Transaction<std::tuple<double, std::string>, std::string>;
+template class Transaction<std::tuple<double, std::string>, Slice>;
+
+template class Transaction<std::tuple<std::string, int64_t>, int>;
+template class Transaction<std::tuple<std::string, int64_t>, int64_t>;
+template class Transaction<std::tuple<std::string, int64_t>, double>;
+template class Transaction<std::tuple<std::string, int64_t>, std::string>;
+template class Transaction<std::tuple<std::string, int64_t>, Slice>;
+
+template class Transaction<std::tuple<std::string, double>, int>;
+template class Transaction<std::tuple<std::string, double>, int64_t>;
+template class Transaction<std::tuple<std::string, double>, double>;
+template class Transaction<std::tuple<std::string, double>, std::string>;
+template class Transaction<std::tuple<std::string, double>, Slice>;
+
+template class Transaction<std::tuple<std::string, std::string>, int>;
+template class Transaction<std::tuple<std::string, std::string>, int64_t>;
+template class Transaction<std::tuple<std::string, std::string>, double>;
+template class Transaction<std::tuple<std::string, std::string>, std::string>;
+template class Transaction<std::tuple<std::string, std::string>, Slice>;
+
+}/* end of namespace KVSQLite */
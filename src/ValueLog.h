@@ -0,0 +1,399 @@
+/**
+ * @file ValueLog.h
+ * @brief Append-only files holding the large values of a table, see Options::value_log_threshold. Not installed.
+ *
+ * A table with a value log keeps a position instead of each large value: the
+ * number of the file, or segment, shifted left by 40 bits, plus the offset of
+ * the record in it. A record is the size of the value and a checksum of it,
+ * both 32 bits little-endian, followed by the value. Records are only ever
+ * appended; the table, not the log, knows which of them are still in use.
+ */
+
+#ifndef _KVSQLITE_VALUE_LOG_H_
+#define _KVSQLITE_VALUE_LOG_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <share.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+#include "KVSQLite/Status.h"
+
+namespace KVSQLite
+{
+
+class ValueLog
+{
+public:
+    static const int headerSize = 8;
+    static const int offsetBits = 40;
+
+    ValueLog(const std::string & prefix, int64_t segmentSize)
+        : m_prefix(prefix), m_segmentSize(segmentSize)
+    {
+    }
+
+    ~ValueLog()
+    {
+        for(auto & item : m_files)
+        {
+            fclose(item.second);
+        }
+        for(int64_t segment : m_removed)
+        {
+            std::remove(fileName(segment).c_str());
+        }
+        if(m_lockFd >= 0)
+        {
+#ifdef _WIN32
+            _close(m_lockFd);
+#else
+            close(m_lockFd);
+#endif
+        }
+    }
+
+    static int64_t segmentOf(int64_t position)
+    {
+        return position >> offsetBits;
+    }
+
+    static int64_t firstPosition(int64_t segment)
+    {
+        return segment << offsetBits;
+    }
+
+    std::string fileName(int64_t segment) const
+    {
+        return m_prefix + "." + std::to_string(segment);
+    }
+
+    /*
+     * Start appending to a new segment. Only one writer may own the log, the
+     * lock file "<prefix>.lock" is held until the object is destroyed, and
+     * Status::Busy is returned if another DB object or process holds it.
+     * Segments from "segment" on are then not known to the table: they were
+     * left by a run that stopped before committing anything to them, and
+     * are removed.
+     */
+    Status open(int64_t segment)
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        Status status = lockLog();
+        if(!status.ok())
+        {
+            return status;
+        }
+        for(int64_t next = segment; ; next++)
+        {
+            FILE * pF = openFile(fileName(next), "rb");
+            if(nullptr == pF)
+            {
+                break;
+            }
+            fclose(pF);
+            std::remove(fileName(next).c_str());
+        }
+        m_first = segment;
+        return startSegment(segment);
+    }
+
+    /* Segments created by this object, the older ones all being known to the table */
+    int64_t firstSegment() const
+    {
+        return m_first;
+    }
+
+    int64_t activeSegment()
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        return m_active;
+    }
+
+    /* Append a value and return its position. With sync, the record is on disk on return. */
+    Status append(const char * data, size_t size, bool sync, int64_t & position)
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        if(m_activeSize > 0 && m_activeSize + headerSize + (int64_t)size > m_segmentSize)
+        {
+            Status status = startSegment(m_active + 1);
+            if(!status.ok())
+            {
+                return status;
+            }
+        }
+
+        unsigned char header[headerSize];
+        putUint32(header, (uint32_t)size);
+        putUint32(header + 4, checksum(data, size));
+        FILE * pF = m_files[m_active];
+        /* A stream switching from reading to writing must be positioned first */
+        seekFile(pF, 0, SEEK_END);
+        if(headerSize != fwrite(header, 1, headerSize, pF) || size != fwrite(data, 1, size, pF) || 0 != fflush(pF))
+        {
+            /* Whatever part got written is garbage, later records go after it */
+            seekFile(pF, 0, SEEK_END);
+            m_activeSize = tellFile(pF);
+            return Status("", "Fail to write the value log:" + fileName(m_active), Status::IOError, "0");
+        }
+        if(sync)
+        {
+            Status status = syncFile(pF);
+            if(!status.ok())
+            {
+                return status;
+            }
+        }
+
+        position = firstPosition(m_active) + m_activeSize;
+        m_activeSize += headerSize + size;
+        return Status();
+    }
+
+    /* Make every record appended so far durable */
+    Status sync()
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        return syncFile(m_files[m_active]);
+    }
+
+    Status read(int64_t position, int64_t size, std::string & value)
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        FILE * pF = nullptr;
+        Status status = segmentFile(segmentOf(position), &pF);
+        if(!status.ok())
+        {
+            return status;
+        }
+
+        unsigned char header[headerSize];
+        value.resize((size_t)size);
+        if(0 != seekFile(pF, position - firstPosition(segmentOf(position)), SEEK_SET) ||
+            headerSize != fread(header, 1, headerSize, pF) ||
+            getUint32(header) != (uint32_t)size ||
+            (size > 0 && (size_t)size != fread(&value[0], 1, (size_t)size, pF)) ||
+            getUint32(header + 4) != checksum(value.data(), value.size()))
+        {
+            value.clear();
+            return Status("", "Corrupted value log record in:" + fileName(segmentOf(position)), Status::IOError, "0");
+        }
+        return Status();
+    }
+
+    /* Size of a segment file, 0 if it does not exist */
+    int64_t fileSize(int64_t segment)
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        FILE * pF = nullptr;
+        if(!segmentFile(segment, &pF).ok() || 0 != seekFile(pF, 0, SEEK_END))
+        {
+            return 0;
+        }
+        return tellFile(pF);
+    }
+
+    /* Delete a segment no row refers to any more, once no snapshot may read it */
+    void remove(int64_t segment)
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        auto iter = m_files.find(segment);
+        if(iter != m_files.end())
+        {
+            fclose(iter->second);
+            m_files.erase(iter);
+        }
+        if(m_pins > 0)
+        {
+            m_removed.push_back(segment);
+        }
+        else
+        {
+            std::remove(fileName(segment).c_str());
+        }
+    }
+
+    /* Snapshots pin the segments: they may still read positions the table has moved away from */
+    void pin()
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        m_pins++;
+    }
+
+    void unpin()
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        if(0 == --m_pins)
+        {
+            for(int64_t segment : m_removed)
+            {
+                std::remove(fileName(segment).c_str());
+            }
+            m_removed.clear();
+        }
+    }
+private:
+    static FILE * openFile(const std::string & filename, const char * mode)
+    {
+#ifdef _WIN32
+        FILE * pF = nullptr;
+        return (0 == fopen_s(&pF, filename.c_str(), mode)) ? pF : nullptr;
+#else
+        return fopen(filename.c_str(), mode);
+#endif
+    }
+
+    static int seekFile(FILE * pF, int64_t offset, int origin)
+    {
+#ifdef _WIN32
+        return _fseeki64(pF, offset, origin);
+#else
+        return fseeko(pF, (off_t)offset, origin);
+#endif
+    }
+
+    static int64_t tellFile(FILE * pF)
+    {
+#ifdef _WIN32
+        return _ftelli64(pF);
+#else
+        return (int64_t)ftello(pF);
+#endif
+    }
+
+    static Status syncFile(FILE * pF)
+    {
+        int ret = fflush(pF);
+        if(0 == ret)
+        {
+#ifdef _WIN32
+            ret = _commit(_fileno(pF));
+#else
+            ret = fsync(fileno(pF));
+#endif
+        }
+        if(0 != ret)
+        {
+            return Status("", "Fail to sync the value log.", Status::IOError, "0");
+        }
+        return Status();
+    }
+
+    static void putUint32(unsigned char * p, uint32_t value)
+    {
+        for(int i = 0; i < 4; i++)
+        {
+            p[i] = (unsigned char)(value >> (8 * i));
+        }
+    }
+
+    static uint32_t getUint32(const unsigned char * p)
+    {
+        return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+
+    /* FNV-1a, enough to tell a record from leftovers of a failed write */
+    static uint32_t checksum(const char * data, size_t size)
+    {
+        uint32_t hash = 2166136261u;
+        for(size_t i = 0; i < size; i++)
+        {
+            hash ^= (unsigned char)data[i];
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
+    /* Must be called with m_mutex held. The lock goes with the descriptor, and with the process. */
+    Status lockLog()
+    {
+        const std::string filename = m_prefix + ".lock";
+#ifdef _WIN32
+        /* Opened without sharing, a second open fails until it is closed */
+        int fd = -1;
+        if(0 != _sopen_s(&fd, filename.c_str(), _O_RDWR | _O_CREAT | _O_BINARY, _SH_DENYRW, _S_IREAD | _S_IWRITE))
+        {
+            fd = -1;
+        }
+        const bool locked = (fd >= 0);
+#else
+        int fd = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+        if(fd < 0)
+        {
+            return Status("", "Fail to open:" + filename, Status::IOError, "0");
+        }
+        const bool locked = (0 == flock(fd, LOCK_EX | LOCK_NB));
+        if(!locked)
+        {
+            close(fd);
+        }
+#endif
+        if(!locked)
+        {
+            return Status("", "Value log in use by another DB object or process:" + m_prefix, Status::Busy, "0");
+        }
+        m_lockFd = fd;
+        return Status();
+    }
+
+    /* Must be called with m_mutex held */
+    Status startSegment(int64_t segment)
+    {
+        /* "a+b": reads anywhere, writes always at the end */
+        FILE * pF = openFile(fileName(segment), "a+b");
+        if(nullptr == pF)
+        {
+            return Status("", "Fail to open:" + fileName(segment), Status::IOError, "0");
+        }
+        seekFile(pF, 0, SEEK_END);
+        m_files[segment] = pF;
+        m_active = segment;
+        m_activeSize = tellFile(pF);
+        return Status();
+    }
+
+    /* Must be called with m_mutex held. Older segments are opened on their first read. */
+    Status segmentFile(int64_t segment, FILE ** ppF)
+    {
+        auto iter = m_files.find(segment);
+        if(iter != m_files.end())
+        {
+            *ppF = iter->second;
+            return Status();
+        }
+        FILE * pF = openFile(fileName(segment), "rb");
+        if(nullptr == pF)
+        {
+            return Status("", "Missing value log file:" + fileName(segment), Status::IOError, "0");
+        }
+        m_files[segment] = pF;
+        *ppF = pF;
+        return Status();
+    }
+private:
+    std::mutex m_mutex;
+    std::string m_prefix;
+    int64_t m_segmentSize = 0;
+    std::map<int64_t, FILE *> m_files;
+    int64_t m_first = 0;
+    int64_t m_active = 0;
+    int64_t m_activeSize = 0;
+    int m_pins = 0;
+    std::vector<int64_t> m_removed;
+    int m_lockFd = -1;
+};
+
+}/* end of namespace KVSQLite */
+
+#endif
@@ -0,0 +1,124 @@
+#include "KVSQLite/ValueStream.h"
+#include "DBImpl.h"
+#include <algorithm>
+
+namespace KVSQLite
+{
+
+ValueReader::ValueReader(DBImpl * pDBImpl, sqlite3_blob * blob, int64_t size)
+    : m_DBImpl(pDBImpl), m_blob(blob), m_size(size)
+{
+}
+
+ValueReader::~ValueReader()
+{
+    std::lock_guard<std::mutex> locker(m_DBImpl->mutex);
+    sqlite3_blob_close(m_blob);
+    m_blob = nullptr;
+}
+
+int64_t ValueReader::size() const
+{
+    return m_size;
+}
+
+Status ValueReader::read(int64_t offset, int length, std::string & data)
+{
+    if(offset < 0 || offset > m_size || length < 0)
+    {
+        return Status("", "Invalid argument, read out of the value.", Status::InvalidArgument, "0");
+    }
+
+    data.resize((size_t)std::min<int64_t>(length, m_size - offset));
+    if(data.empty())
+    {
+        return Status();
+    }
+
+    std::lock_guard<std::mutex> locker(m_DBImpl->mutex);
+    int sqlRet = sqlite3_blob_read(m_blob, &data[0], (int)data.size(), (int)offset);
+    if(SQLITE_OK != sqlRet)
+    {
+        data.clear();
+        /* The handle expires when the row is updated or deleted */
+        std::string databaseErr = (SQLITE_ABORT == sqlRet) ? "Value changed since the reader was opened." : "Fail to read the value.";
+        return Status(sqlite3_errmsg(m_DBImpl->db), databaseErr, (SQLITE_ABORT == sqlRet) ? Status::ConditionNotMet : Status::UnknownError, std::to_string(sqlRet));
+    }
+    return Status();
+}
+
+ValueWriter::ValueWriter(DBImpl * pDBImpl, const WriteOptions & options, int64_t rowid, int64_t size)
+    : m_DBImpl(pDBImpl), m_options(options), m_rowid(rowid), m_size(size)
+{
+}
+
+ValueWriter::~ValueWriter()
+{
+}
+
+int64_t ValueWriter::size() const
+{
+    return m_size;
+}
+
+int64_t ValueWriter::position() const
+{
+    return m_position;
+}
+
+Status ValueWriter::write(int64_t offset, const Slice & data)
+{
+    if(offset < 0 || offset + (int64_t)data.size() > m_size)
+    {
+        return Status("", "Invalid argument, write out of the value.", Status::InvalidArgument, "0");
+    }
+
+    std::lock_guard<std::mutex> locker(m_DBImpl->mutex);
+    Status status = m_DBImpl->applyWriteOptions(m_options);
+    if(!status.ok())
+    {
+        return status;
+    }
+
+    /*
+     * An open write handle would keep its transaction, and every write of
+     * the connection with it, from committing: the handle only lives for
+     * one call, and closing it commits the piece.
+     */
+    sqlite3_blob * blob = nullptr;
+    status = m_DBImpl->openBlob(m_rowid, true, &blob);
+    if(!status.ok())
+    {
+        return status;
+    }
+    if(sqlite3_blob_bytes(blob) != m_size)
+    {
+        sqlite3_blob_close(blob);
+        return Status("", "Value changed since the writer was opened.", Status::ConditionNotMet, "0");
+    }
+
+    int sqlRet = sqlite3_blob_write(blob, data.data(), (int)data.size(), (int)offset);
+    int closeRet = sqlite3_blob_close(blob);
+    if(SQLITE_OK == sqlRet)
+    {
+        sqlRet = closeRet;
+    }
+    if(SQLITE_OK != sqlRet)
+    {
+        std::string databaseErr = "Fail to write the value.";
+        return Status(sqlite3_errmsg(m_DBImpl->db), databaseErr, Status::UnknownError, std::to_string(sqlRet));
+    }
+    return Status();
+}
+
+Status ValueWriter::append(const Slice & data)
+{
+    Status status = write(m_position, data);
+    if(status.ok())
+    {
+        m_position += data.size();
+    }
+    return status;
+}
+
+}/* end of namespace KVSQLite */
@@ -1,7 +1,15 @@
 #include "gtest/gtest.h"
 #include "KVSQLite/DB.h"
+#include "KVSQLite/ShardedDB.h"
 #include "KVSQLite/Slice.h"
+#include "sqlite3.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <limits>
 #include <thread>
+#include <tuple>
+#include <vector>
 
 /**
  * @brief 
@@ -358,6 +366,2223 @@ TEST(KVSQLite, Slice)
     }
 }
 
+/**
+ * @brief
+ */
+TEST(KVSQLite, writeTransactionMode)
+{
+    const KVSQLite::Options::TransactionMode modes[] = {
+        KVSQLite::Options::Deferred,
+        KVSQLite::Options::Immediate,
+        KVSQLite::Options::Exclusive
+    };
+
+    for(auto mode : modes)
+    {
+        KVSQLite::DB<int, int> * pDB = nullptr;
+        KVSQLite::Options opt;
+        opt.transaction_mode = mode;
+        KVSQLite::Status status = KVSQLite::DB<int, int>::open(opt, ":memory:", &pDB);
+        ASSERT_EQ(status.ok(), true);
+
+        /* The prepared BEGIN/COMMIT statements must be reusable across batches */
+        for(int round = 0; round < 3; round++)
+        {
+            KVSQLite::WriteBatch<int, int> batch;
+            batch.put(round, round * 10);
+            batch.put(round + 100, round);
+            batch.del(round + 100);
+            status = pDB->write(KVSQLite::WriteOptions(), &batch);
+            EXPECT_EQ(status.ok(), true);
+        }
+
+        for(int round = 0; round < 3; round++)
+        {
+            int val = 0;
+            status = pDB->get(round, val);
+            EXPECT_EQ(status.ok(), true);
+            EXPECT_EQ(val, round * 10);
+            status = pDB->get(round + 100, val);
+            EXPECT_EQ(status.type(), KVSQLite::Status::NotFound);
+        }
+        delete pDB;
+    }
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, writeTransactionLock)
+{
+    const char * dbName = "KVSQLiteTransactionLock.db";
+    const KVSQLite::Options::TransactionMode modes[] = {
+        KVSQLite::Options::Deferred,
+        KVSQLite::Options::Immediate,
+        KVSQLite::Options::Exclusive
+    };
+
+    for(auto mode : modes)
+    {
+        std::remove(dbName);
+        KVSQLite::DB<int, int> * pDB = nullptr;
+        KVSQLite::Options opt;
+        opt.transaction_mode = mode;
+        KVSQLite::Status status = KVSQLite::DB<int, int>::open(opt, dbName, &pDB);
+        ASSERT_EQ(status.ok(), true);
+
+        /* Another connection takes the write lock */
+        sqlite3 * other = nullptr;
+        ASSERT_EQ(sqlite3_open(dbName, &other), SQLITE_OK);
+        ASSERT_EQ(sqlite3_exec(other, "BEGIN IMMEDIATE", nullptr, nullptr, nullptr), SQLITE_OK);
+
+        KVSQLite::WriteBatch<int, int> batch;
+        batch.put(1, 10);
+        batch.put(2, 20);
+        status = pDB->write(KVSQLite::WriteOptions(), &batch);
+        EXPECT_EQ(status.ok(), false);
+        EXPECT_EQ(status.nativeErrorCode(), std::to_string(SQLITE_BUSY));
+        /* IMMEDIATE and EXCLUSIVE wait for the lock at BEGIN, DEFERRED only at the first write */
+        bool failedAtBegin = (std::string::npos != status.databaseText().find("BEGIN"));
+        EXPECT_EQ(failedAtBegin, KVSQLite::Options::Deferred != mode);
+
+        int val = 0;
+        EXPECT_EQ(pDB->get(1, val).type(), KVSQLite::Status::NotFound);
+
+        /* Once the lock is released, the same prepared statements run the batch */
+        ASSERT_EQ(sqlite3_exec(other, "ROLLBACK", nullptr, nullptr, nullptr), SQLITE_OK);
+        status = pDB->write(KVSQLite::WriteOptions(), &batch);
+        EXPECT_EQ(status.ok(), true);
+        /* And the lock is let go after the batch */
+        EXPECT_EQ(sqlite3_exec(other, "BEGIN IMMEDIATE; ROLLBACK", nullptr, nullptr, nullptr), SQLITE_OK);
+        EXPECT_EQ(pDB->get(2, val).ok(), true);
+        EXPECT_EQ(val, 20);
+        sqlite3_close(other);
+        delete pDB;
+    }
+    std::remove(dbName);
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, transaction)
+{
+    KVSQLite::DB<std::string, std::string> * pDB = nullptr;
+    KVSQLite::Options opt;
+    KVSQLite::Status status = KVSQLite::DB<std::string, std::string>::open(opt, ":memory:", &pDB);
+    ASSERT_EQ(status.ok(), true);
+
+    status = pDB->put(KVSQLite::WriteOptions(), "a", "1");
+    ASSERT_EQ(status.ok(), true);
+
+    KVSQLite::Transaction<std::string, std::string> * pTxn = nullptr;
+    status = pDB->beginTransaction(&pTxn);
+    ASSERT_EQ(status.ok(), true);
+
+    /* Reads see the transaction's own writes, the database does not until commit */
+    std::string val;
+    EXPECT_EQ(pTxn->put("b", "2").ok(), true);
+    EXPECT_EQ(pTxn->del("a").ok(), true);
+    EXPECT_EQ(pTxn->get("b", val).ok(), true);
+    EXPECT_EQ(val, "2");
+    EXPECT_EQ(pTxn->get("a", val).type(), KVSQLite::Status::NotFound);
+    EXPECT_EQ(pDB->get("a", val).ok(), true);
+    EXPECT_EQ(pDB->get("b", val).type(), KVSQLite::Status::NotFound);
+
+    status = pTxn->commit(KVSQLite::WriteOptions());
+    EXPECT_EQ(status.ok(), true);
+    EXPECT_EQ(pDB->get("a", val).type(), KVSQLite::Status::NotFound);
+    EXPECT_EQ(pDB->get("b", val).ok(), true);
+    EXPECT_EQ(val, "2");
+
+    /* A finished transaction can not be used again */
+    EXPECT_EQ(pTxn->put("c", "3").type(), KVSQLite::Status::InvalidArgument);
+    delete pTxn;
+
+    /* Rollback discards buffered writes */
+    status = pDB->beginTransaction(&pTxn);
+    ASSERT_EQ(status.ok(), true);
+    EXPECT_EQ(pTxn->put("c", "3").ok(), true);
+    EXPECT_EQ(pTxn->rollback().ok(), true);
+    EXPECT_EQ(pDB->get("c", val).type(), KVSQLite::Status::NotFound);
+    delete pTxn;
+
+    delete pDB;
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, transactionConflict)
+{
+    KVSQLite::DB<int, int> * pDB = nullptr;
+    KVSQLite::Options opt;
+    KVSQLite::Status status = KVSQLite::DB<int, int>::open(opt, ":memory:", &pDB);
+    ASSERT_EQ(status.ok(), true);
+
+    KVSQLite::Transaction<int, int> * pTxn = nullptr;
+    status = pDB->beginTransaction(&pTxn);
+    ASSERT_EQ(status.ok(), true);
+
+    /* The transaction saw key 1 missing, then somebody else created it */
+    int val = 0;
+    EXPECT_EQ(pTxn->get(1, val).type(), KVSQLite::Status::NotFound);
+    EXPECT_EQ(pTxn->put(2, 20).ok(), true);
+    EXPECT_EQ(pDB->put(KVSQLite::WriteOptions(), 1, 10).ok(), true);
+
+    status = pTxn->commit(KVSQLite::WriteOptions());
+    EXPECT_EQ(status.type(), KVSQLite::Status::Busy);
+    EXPECT_EQ(pDB->get(2, val).type(), KVSQLite::Status::NotFound);
+    delete pTxn;
+
+    delete pDB;
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, transactionConcurrentIncrement)
+{
+    KVSQLite::DB<int, int64_t> * pDB = nullptr;
+    KVSQLite::Options opt;
+    KVSQLite::Status status = KVSQLite::DB<int, int64_t>::open(opt, ":memory:", &pDB);
+    ASSERT_EQ(status.ok(), true);
+
+    const int threadCount = 4;
+    const int increments = 200;
+    std::vector<std::thread> threads;
+    for(int t = 0; t < threadCount; t++)
+    {
+        threads.push_back(std::thread([pDB, increments]() {
+            for(int i = 0; i < increments; i++)
+            {
+                while(true)
+                {
+                    KVSQLite::Transaction<int, int64_t> * pTxn = nullptr;
+                    if(!pDB->beginTransaction(&pTxn).ok())
+                    {
+                        return;
+                    }
+                    int64_t counter = 0;
+                    pTxn->get(0, counter);
+                    pTxn->put(0, counter + 1);
+                    KVSQLite::Status s = pTxn->commit(KVSQLite::WriteOptions());
+                    delete pTxn;
+                    if(s.type() != KVSQLite::Status::Busy)
+                    {
+                        break;
+                    }
+                }
+            }
+        }));
+    }
+    for(auto & thread : threads)
+    {
+        thread.join();
+    }
+
+    int64_t counter = 0;
+    status = pDB->get(0, counter);
+    EXPECT_EQ(status.ok(), true);
+    EXPECT_EQ(counter, threadCount * increments);
+
+    delete pDB;
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, writeBatchWithIndex)
+{
+    KVSQLite::DB<std::string, int> * pDB = nullptr;
+    KVSQLite::Options opt;
+    KVSQLite::Status status = KVSQLite::DB<std::string, int>::open(opt, ":memory:", &pDB);
+    ASSERT_EQ(status.ok(), true);
+
+    status = pDB->put(KVSQLite::WriteOptions(), "stored", 1);
+    ASSERT_EQ(status.ok(), true);
+    status = pDB->put(KVSQLite::WriteOptions(), "deleted", 2);
+    ASSERT_EQ(status.ok(), true);
+
+    KVSQLite::WriteBatchWithIndex<std::string, int> batch;
+    batch.put("staged", 3);
+    batch.put("staged", 4);
+    batch.del("deleted");
+    batch.del("stored");
+    batch.put("stored", 5);
+
+    int val = 0;
+    EXPECT_EQ(batch.getFromBatch("staged", val), batch.FOUND);
+    EXPECT_EQ(val, 4);
+    EXPECT_EQ(batch.getFromBatch("deleted", val), batch.DELETED);
+    EXPECT_EQ(batch.getFromBatch("other", val), batch.NOT_FOUND);
+
+    /* Staged updates win over the database, untouched keys fall back to it */
+    EXPECT_EQ(pDB->get(batch, "staged", val).ok(), true);
+    EXPECT_EQ(val, 4);
+    EXPECT_EQ(pDB->get(batch, "stored", val).ok(), true);
+    EXPECT_EQ(val, 5);
+    EXPECT_EQ(pDB->get(batch, "deleted", val).type(), KVSQLite::Status::NotFound);
+    status = pDB->put(KVSQLite::WriteOptions(), "other", 6);
+    EXPECT_EQ(pDB->get(batch, "other", val).ok(), true);
+    EXPECT_EQ(val, 6);
+
+    status = pDB->write(KVSQLite::WriteOptions(), &batch);
+    EXPECT_EQ(status.ok(), true);
+    EXPECT_EQ(pDB->get("stored", val).ok(), true);
+    EXPECT_EQ(val, 5);
+    EXPECT_EQ(pDB->get("deleted", val).type(), KVSQLite::Status::NotFound);
+
+    /* A copy indexes its own updates, and outlives the original's */
+    KVSQLite::WriteBatchWithIndex<std::string, int> copy(batch);
+    KVSQLite::WriteBatchWithIndex<std::string, int> assigned;
+    assigned.put("assigned", 7);
+    assigned = batch;
+    batch.clear();
+    EXPECT_EQ(batch.getFromBatch("staged", val), batch.NOT_FOUND);
+    EXPECT_EQ(batch.getList().empty(), true);
+    for(auto * other : {&copy, &assigned})
+    {
+        EXPECT_EQ(other->getFromBatch("staged", val), batch.FOUND);
+        EXPECT_EQ(val, 4);
+        EXPECT_EQ(other->getFromBatch("deleted", val), batch.DELETED);
+        EXPECT_EQ(other->getFromBatch("assigned", val), batch.NOT_FOUND);
+        EXPECT_EQ(other->getList().size(), 5);
+    }
+
+    delete pDB;
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, merge)
+{
+    {
+        KVSQLite::DB<std::string, int64_t> * pDB = nullptr;
+        KVSQLite::Status status = KVSQLite::DB<std::string, int64_t>::open(KVSQLite::Options(), ":memory:", &pDB);
+        ASSERT_EQ(status.ok(), true);
+
+        KVSQLite::WriteOptions options;
+        for(int i = 1; i <= 10; i++)
+        {
+            EXPECT_EQ(pDB->merge(options, "counter", i, KVSQLite::MERGE_ADD).ok(), true);
+            EXPECT_EQ(pDB->merge(options, "min", 10 - i, KVSQLite::MERGE_MIN).ok(), true);
+            EXPECT_EQ(pDB->merge(options, "max", i, KVSQLite::MERGE_MAX).ok(), true);
+        }
+        int64_t val = 0;
+        EXPECT_EQ(pDB->get("counter", val).ok(), true);
+        EXPECT_EQ(val, 55);
+        EXPECT_EQ(pDB->get("min", val).ok(), true);
+        EXPECT_EQ(val, 0);
+        EXPECT_EQ(pDB->get("max", val).ok(), true);
+        EXPECT_EQ(val, 10);
+
+        status = pDB->merge(options, "counter", 1, KVSQLite::MERGE_APPEND);
+        EXPECT_EQ(status.type(), KVSQLite::Status::InvalidArgument);
+
+        /* Merges go through a batch too */
+        KVSQLite::WriteBatch<std::string, int64_t> batch;
+        batch.merge("counter", 5, KVSQLite::MERGE_ADD);
+        batch.merge("counter", -10, KVSQLite::MERGE_ADD);
+        EXPECT_EQ(pDB->write(options, &batch).ok(), true);
+        EXPECT_EQ(pDB->get("counter", val).ok(), true);
+        EXPECT_EQ(val, 50);
+        delete pDB;
+    }
+    {
+        KVSQLite::DB<int, double> * pDB = nullptr;
+        KVSQLite::Status status = KVSQLite::DB<int, double>::open(KVSQLite::Options(), ":memory:", &pDB);
+        ASSERT_EQ(status.ok(), true);
+
+        EXPECT_EQ(pDB->merge(KVSQLite::WriteOptions(), 1, 0.5, KVSQLite::MERGE_ADD).ok(), true);
+        EXPECT_EQ(pDB->merge(KVSQLite::WriteOptions(), 1, 0.25, KVSQLite::MERGE_ADD).ok(), true);
+        double val = 0;
+        EXPECT_EQ(pDB->get(1, val).ok(), true);
+        EXPECT_EQ(val, 0.75);
+        delete pDB;
+    }
+    {
+        KVSQLite::DB<int, std::string> * pDB = nullptr;
+        KVSQLite::Status status = KVSQLite::DB<int, std::string>::open(KVSQLite::Options(), ":memory:", &pDB);
+        ASSERT_EQ(status.ok(), true);
+
+        EXPECT_EQ(pDB->merge(KVSQLite::WriteOptions(), 1, "ab", KVSQLite::MERGE_APPEND).ok(), true);
+        EXPECT_EQ(pDB->merge(KVSQLite::WriteOptions(), 1, "cd", KVSQLite::MERGE_APPEND).ok(), true);
+        EXPECT_EQ(pDB->merge(KVSQLite::WriteOptions(), 1, "e", KVSQLite::MERGE_APPEND).ok(), true);
+        std::string val;
+        EXPECT_EQ(pDB->get(1, val).ok(), true);
+        EXPECT_EQ(val, "abcde");
+        EXPECT_EQ(pDB->merge(KVSQLite::WriteOptions(), 1, "x", KVSQLite::MERGE_ADD).type(), KVSQLite::Status::InvalidArgument);
+        delete pDB;
+    }
+    {
+        KVSQLite::DB<int, KVSQLite::Slice> * pDB = nullptr;
+        KVSQLite::Status status = KVSQLite::DB<int, KVSQLite::Slice>::open(KVSQLite::Options(), ":memory:", &pDB);
+        ASSERT_EQ(status.ok(), true);
+
+        const char first[] = {0x01, 0x00, 0x02};
+        const char second[] = {0x00, 0x03};
+        EXPECT_EQ(pDB->merge(KVSQLite::WriteOptions(), 1, KVSQLite::Slice(first, sizeof(first)), KVSQLite::MERGE_APPEND).ok(), true);
+        EXPECT_EQ(pDB->merge(KVSQLite::WriteOptions(), 1, KVSQLite::Slice(second, sizeof(second)), KVSQLite::MERGE_APPEND).ok(), true);
+        KVSQLite::Slice val;
+        EXPECT_EQ(pDB->get(1, val).ok(), true);
+        const char expected[] = {0x01, 0x00, 0x02, 0x00, 0x03};
+        EXPECT_EQ(val, KVSQLite::Slice(expected, sizeof(expected)));
+        delete pDB;
+    }
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, mergeCustomOperator)
+{
+    KVSQLite::DB<std::string, std::string> * pDB = nullptr;
+    KVSQLite::Status status = KVSQLite::DB<std::string, std::string>::open(KVSQLite::Options(), ":memory:", &pDB);
+    ASSERT_EQ(status.ok(), true);
+
+    status = pDB->registerMergeOperator("csv", [](const std::string * existing, const std::string & operand) {
+        return existing ? *existing + "," + operand : "[" + operand;
+    });
+    ASSERT_EQ(status.ok(), true);
+    EXPECT_EQ(pDB->registerMergeOperator("bad name", nullptr).type(), KVSQLite::Status::InvalidArgument);
+
+    EXPECT_EQ(pDB->merge(KVSQLite::WriteOptions(), "list", "a", "csv").ok(), true);
+    EXPECT_EQ(pDB->merge(KVSQLite::WriteOptions(), "list", "b", "csv").ok(), true);
+    std::string val;
+    EXPECT_EQ(pDB->get("list", val).ok(), true);
+    EXPECT_EQ(val, "[a,b");
+    EXPECT_EQ(pDB->merge(KVSQLite::WriteOptions(), "list", "c", "unknown").type(), KVSQLite::Status::InvalidArgument);
+
+    delete pDB;
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, mergeWriteBatchWithIndex)
+{
+    KVSQLite::DB<int, int> * pDB = nullptr;
+    KVSQLite::Status status = KVSQLite::DB<int, int>::open(KVSQLite::Options(), ":memory:", &pDB);
+    ASSERT_EQ(status.ok(), true);
+    EXPECT_EQ(pDB->put(KVSQLite::WriteOptions(), 1, 100).ok(), true);
+
+    KVSQLite::WriteBatchWithIndex<int, int> batch;
+    batch.merge(1, 5, KVSQLite::MERGE_ADD);
+    batch.merge(2, 7, KVSQLite::MERGE_ADD);
+    batch.put(3, 1);
+    batch.merge(3, 9, KVSQLite::MERGE_MAX);
+
+    int val = 0;
+    EXPECT_EQ(batch.getFromBatch(1, val), batch.MERGED);
+    EXPECT_EQ(pDB->get(batch, 1, val).ok(), true);
+    EXPECT_EQ(val, 105);
+    EXPECT_EQ(pDB->get(batch, 2, val).ok(), true);
+    EXPECT_EQ(val, 7);
+    EXPECT_EQ(pDB->get(batch, 3, val).ok(), true);
+    EXPECT_EQ(val, 9);
+
+    /* The database computes the same values */
+    EXPECT_EQ(pDB->write(KVSQLite::WriteOptions(), &batch).ok(), true);
+    const int expected[] = {105, 7, 9};
+    for(int key = 1; key <= 3; key++)
+    {
+        EXPECT_EQ(pDB->get(key, val).ok(), true);
+        EXPECT_EQ(val, expected[key - 1]);
+    }
+
+    delete pDB;
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, conditionalWrites)
+{
+    KVSQLite::DB<std::string, std::string> * pDB = nullptr;
+    KVSQLite::Status status = KVSQLite::DB<std::string, std::string>::open(KVSQLite::Options(), ":memory:", &pDB);
+    ASSERT_EQ(status.ok(), true);
+    KVSQLite::WriteOptions options;
+    std::string val;
+
+    EXPECT_EQ(pDB->putIfAbsent(options, "lock", "owner1").ok(), true);
+    EXPECT_EQ(pDB->putIfAbsent(options, "lock", "owner2").type(), KVSQLite::Status::ConditionNotMet);
+    EXPECT_EQ(pDB->get("lock", val).ok(), true);
+    EXPECT_EQ(val, "owner1");
+
+    EXPECT_EQ(pDB->compareAndSwap(options, "lock", "owner2", "owner3").type(), KVSQLite::Status::ConditionNotMet);
+    EXPECT_EQ(pDB->compareAndSwap(options, "lock", "owner1", "owner3").ok(), true);
+    EXPECT_EQ(pDB->get("lock", val).ok(), true);
+    EXPECT_EQ(val, "owner3");
+    EXPECT_EQ(pDB->compareAndSwap(options, "missing", "", "x").type(), KVSQLite::Status::ConditionNotMet);
+
+    bool existed = true;
+    std::string old = "untouched";
+    EXPECT_EQ(pDB->getAndSet(options, "lease", "a", old, &existed).ok(), true);
+    EXPECT_EQ(existed, false);
+    EXPECT_EQ(old, "untouched");
+    EXPECT_EQ(pDB->getAndSet(options, "lease", "b", old, &existed).ok(), true);
+    EXPECT_EQ(existed, true);
+    EXPECT_EQ(old, "a");
+    EXPECT_EQ(pDB->get("lease", val).ok(), true);
+    EXPECT_EQ(val, "b");
+
+    delete pDB;
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, conditionalWritesConcurrent)
+{
+    KVSQLite::DB<int, KVSQLite::Slice> * pDB = nullptr;
+    KVSQLite::Status status = KVSQLite::DB<int, KVSQLite::Slice>::open(KVSQLite::Options(), ":memory:", &pDB);
+    ASSERT_EQ(status.ok(), true);
+
+    /* Exactly one thread acquires the lock */
+    std::atomic<int> winners(0);
+    std::vector<std::thread> threads;
+    for(int t = 0; t < 8; t++)
+    {
+        threads.push_back(std::thread([pDB, &winners]() {
+            if(pDB->putIfAbsent(KVSQLite::WriteOptions(), 1, KVSQLite::Slice("held")).ok())
+            {
+                winners++;
+            }
+        }));
+    }
+    for(auto & thread : threads)
+    {
+        thread.join();
+    }
+    EXPECT_EQ(winners.load(), 1);
+
+    KVSQLite::Slice old;
+    bool existed = false;
+    status = pDB->getAndSet(KVSQLite::WriteOptions(), 1, KVSQLite::Slice("free"), old, &existed);
+    EXPECT_EQ(status.ok(), true);
+    EXPECT_EQ(existed, true);
+    EXPECT_EQ(old, KVSQLite::Slice("held"));
+
+    delete pDB;
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, ttl)
+{
+    KVSQLite::DB<std::string, KVSQLite::Slice> * pDB = nullptr;
+    KVSQLite::Options opt;
+    KVSQLite::Status status = KVSQLite::DB<std::string, KVSQLite::Slice>::open(opt, ":memory:", &pDB);
+    ASSERT_EQ(status.ok(), true);
+    KVSQLite::WriteOptions options;
+    KVSQLite::Slice val;
+    EXPECT_EQ(pDB->put(options, "session", KVSQLite::Slice("a"), std::chrono::milliseconds(1000)).type(), KVSQLite::Status::InvalidArgument);
+    EXPECT_EQ(pDB->purgeExpired().type(), KVSQLite::Status::InvalidArgument);
+    delete pDB;
+
+    opt.enable_ttl = true;
+    opt.ttl_purge_interval_ms = 0;
+    opt.ttl_purge_batch_size = 2;
+    status = KVSQLite::DB<std::string, KVSQLite::Slice>::open(opt, ":memory:", &pDB);
+    ASSERT_EQ(status.ok(), true);
+
+    auto past = std::chrono::system_clock::now() - std::chrono::seconds(1);
+    EXPECT_EQ(pDB->put(options, "live", KVSQLite::Slice("1"), std::chrono::hours(1)).ok(), true);
+    EXPECT_EQ(pDB->put(options, "forever", KVSQLite::Slice("2")).ok(), true);
+    for(int i = 0; i < 5; i++)
+    {
+        EXPECT_EQ(pDB->put(options, "expired" + std::to_string(i), KVSQLite::Slice("3"), past).ok(), true);
+    }
+
+    EXPECT_EQ(pDB->get("live", val).ok(), true);
+    EXPECT_EQ(pDB->get("forever", val).ok(), true);
+    EXPECT_EQ(pDB->get("expired0", val).type(), KVSQLite::Status::NotFound);
+
+    /* Expired keys count as missing for conditional writes and merges */
+    EXPECT_EQ(pDB->putIfAbsent(options, "expired0", KVSQLite::Slice("new")).ok(), true);
+    EXPECT_EQ(pDB->get("expired0", val).ok(), true);
+    EXPECT_EQ(val, KVSQLite::Slice("new"));
+    EXPECT_EQ(pDB->putIfAbsent(options, "live", KVSQLite::Slice("new")).type(), KVSQLite::Status::ConditionNotMet);
+    EXPECT_EQ(pDB->compareAndSwap(options, "expired1", KVSQLite::Slice("3"), KVSQLite::Slice("4")).type(), KVSQLite::Status::ConditionNotMet);
+    EXPECT_EQ(pDB->merge(options, "expired2", KVSQLite::Slice("x"), KVSQLite::MERGE_APPEND).ok(), true);
+    EXPECT_EQ(pDB->get("expired2", val).ok(), true);
+    EXPECT_EQ(val, KVSQLite::Slice("x"));
+    bool existed = true;
+    KVSQLite::Slice old;
+    EXPECT_EQ(pDB->getAndSet(options, "expired3", KVSQLite::Slice("y"), old, &existed).ok(), true);
+    EXPECT_EQ(existed, false);
+
+    /* Only expired1 and expired4 are left to purge, in batches of two */
+    int64_t purged = 0;
+    EXPECT_EQ(pDB->purgeExpired(&purged).ok(), true);
+    EXPECT_EQ(purged, 2);
+    EXPECT_EQ(pDB->purgeExpired(&purged).ok(), true);
+    EXPECT_EQ(purged, 0);
+    EXPECT_EQ(pDB->get("live", val).ok(), true);
+
+    delete pDB;
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, ttlBackgroundPurge)
+{
+    std::remove("KVSQLiteTTL.db");
+
+    /* A database created without TTL is upgraded when opened with it */
+    KVSQLite::DB<int, int> * pDB = nullptr;
+    KVSQLite::Status status = KVSQLite::DB<int, int>::open(KVSQLite::Options(), "KVSQLiteTTL.db", &pDB);
+    ASSERT_EQ(status.ok(), true);
+    EXPECT_EQ(pDB->put(KVSQLite::WriteOptions(), 1, 1).ok(), true);
+    delete pDB;
+
+    KVSQLite::Options opt;
+    opt.enable_ttl = true;
+    opt.ttl_purge_interval_ms = 10;
+    status = KVSQLite::DB<int, int>::open(opt, "KVSQLiteTTL.db", &pDB);
+    ASSERT_EQ(status.ok(), true);
+    auto past = std::chrono::system_clock::now() - std::chrono::seconds(1);
+    for(int i = 2; i <= 100; i++)
+    {
+        EXPECT_EQ(pDB->put(KVSQLite::WriteOptions(), i, i, past).ok(), true);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    delete pDB;
+
+    /* Without TTL expired rows would still be visible, unless the purger removed them */
+    status = KVSQLite::DB<int, int>::open(KVSQLite::Options(), "KVSQLiteTTL.db", &pDB);
+    ASSERT_EQ(status.ok(), true);
+    int val = 0;
+    EXPECT_EQ(pDB->get(1, val).ok(), true);
+    for(int i = 2; i <= 100; i++)
+    {
+        EXPECT_EQ(pDB->get(i, val).type(), KVSQLite::Status::NotFound);
+    }
+    delete pDB;
+    std::remove("KVSQLiteTTL.db");
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, deleteRange)
+{
+    KVSQLite::DB<int, int> * pDB = nullptr;
+    KVSQLite::Status status = KVSQLite::DB<int, int>::open(KVSQLite::Options(), ":memory:", &pDB);
+    ASSERT_EQ(status.ok(), true);
+    KVSQLite::WriteOptions options;
+    int val = 0;
+
+    for(int i = 0; i < 100; i++)
+    {
+        EXPECT_EQ(pDB->put(options, i, i).ok(), true);
+    }
+    EXPECT_EQ(pDB->deleteRange(options, 10, 20).ok(), true);
+    EXPECT_EQ(pDB->get(9, val).ok(), true);
+    EXPECT_EQ(pDB->get(10, val).type(), KVSQLite::Status::NotFound);
+    EXPECT_EQ(pDB->get(19, val).type(), KVSQLite::Status::NotFound);
+    EXPECT_EQ(pDB->get(20, val).ok(), true);
+
+    options.delete_chunk_size = 7;
+    EXPECT_EQ(pDB->deleteRange(options, 30, 90).ok(), true);
+    EXPECT_EQ(pDB->get(29, val).ok(), true);
+    EXPECT_EQ(pDB->get(89, val).type(), KVSQLite::Status::NotFound);
+    EXPECT_EQ(pDB->get(90, val).ok(), true);
+
+    EXPECT_EQ(pDB->deletePrefix(options, 1).type(), KVSQLite::Status::InvalidArgument);
+
+    options.delete_chunk_size = 0;
+    EXPECT_EQ(pDB->clear(options).ok(), true);
+    EXPECT_EQ(pDB->get(0, val).type(), KVSQLite::Status::NotFound);
+    EXPECT_EQ(pDB->get(99, val).type(), KVSQLite::Status::NotFound);
+
+    delete pDB;
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, deletePrefix)
+{
+    KVSQLite::DB<std::string, int> * pDB = nullptr;
+    KVSQLite::Status status = KVSQLite::DB<std::string, int>::open(KVSQLite::Options(), ":memory:", &pDB);
+    ASSERT_EQ(status.ok(), true);
+    KVSQLite::WriteOptions options;
+    int val = 0;
+
+    const char * keys[] = {"tenant", "tenant/a", "tenant/a/1", "tenant/a/\xff", "tenant/b", "tenant0"};
+    for(const char * key : keys)
+    {
+        EXPECT_EQ(pDB->put(options, key, 1).ok(), true);
+    }
+    EXPECT_EQ(pDB->deletePrefix(options, "tenant/a").ok(), true);
+    EXPECT_EQ(pDB->get("tenant", val).ok(), true);
+    EXPECT_EQ(pDB->get("tenant/a", val).type(), KVSQLite::Status::NotFound);
+    EXPECT_EQ(pDB->get("tenant/a/1", val).type(), KVSQLite::Status::NotFound);
+    EXPECT_EQ(pDB->get("tenant/a/\xff", val).type(), KVSQLite::Status::NotFound);
+    EXPECT_EQ(pDB->get("tenant/b", val).ok(), true);
+    EXPECT_EQ(pDB->get("tenant0", val).ok(), true);
+    delete pDB;
+
+    /* A prefix without successor has no upper bound */
+    KVSQLite::DB<KVSQLite::Slice, int> * pSliceDB = nullptr;
+    status = KVSQLite::DB<KVSQLite::Slice, int>::open(KVSQLite::Options(), ":memory:", &pSliceDB);
+    ASSERT_EQ(status.ok(), true);
+    EXPECT_EQ(pSliceDB->put(options, KVSQLite::Slice("\xfe"), 1).ok(), true);
+    EXPECT_EQ(pSliceDB->put(options, KVSQLite::Slice("\xff"), 1).ok(), true);
+    EXPECT_EQ(pSliceDB->put(options, KVSQLite::Slice("\xff\xff\x01"), 1).ok(), true);
+    EXPECT_EQ(pSliceDB->deletePrefix(options, KVSQLite::Slice("\xff")).ok(), true);
+    EXPECT_EQ(pSliceDB->get(KVSQLite::Slice("\xfe"), val).ok(), true);
+    EXPECT_EQ(pSliceDB->get(KVSQLite::Slice("\xff"), val).type(), KVSQLite::Status::NotFound);
+    EXPECT_EQ(pSliceDB->get(KVSQLite::Slice("\xff\xff\x01"), val).type(), KVSQLite::Status::NotFound);
+    delete pSliceDB;
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, scanPrefix)
+{
+    KVSQLite::DB<std::string, KVSQLite::Slice> * pDB = nullptr;
+    KVSQLite::Status status = KVSQLite::DB<std::string, KVSQLite::Slice>::open(KVSQLite::Options(), ":memory:", &pDB);
+    ASSERT_EQ(status.ok(), true);
+    KVSQLite::WriteOptions options;
+
+    EXPECT_EQ(pDB->put(options, "tenant", KVSQLite::Slice("root")).ok(), true);
+    EXPECT_EQ(pDB->put(options, "tenant0/user", KVSQLite::Slice("other")).ok(), true);
+    for(int i = 0; i < 25; i++)
+    {
+        char key[32];
+        snprintf(key, sizeof(key), "tenant/user%02d", i);
+        EXPECT_EQ(pDB->put(options, key, KVSQLite::Slice(std::to_string(i))).ok(), true);
+    }
+
+    /* Read the prefix in pages of 10, each page starting from the previous token */
+    KVSQLite::ReadOptions readOptions;
+    readOptions.limit = 10;
+    readOptions.prefetch = 4;
+    std::vector<std::string> keys;
+    int pages = 0;
+    do
+    {
+        KVSQLite::Iterator<std::string, KVSQLite::Slice> * pIter = nullptr;
+        ASSERT_EQ(pDB->scanPrefix(readOptions, "tenant/", &pIter).ok(), true);
+        for(; pIter->valid(); pIter->next())
+        {
+            EXPECT_EQ(pIter->value(), KVSQLite::Slice(std::to_string(keys.size())));
+            keys.push_back(pIter->key());
+        }
+        EXPECT_EQ(pIter->status().ok(), true);
+        readOptions.continuation = pIter->continuationToken();
+        delete pIter;
+        pages++;
+    }while(!readOptions.continuation.empty());
+
+    EXPECT_EQ(pages, 3);
+    ASSERT_EQ(keys.size(), 25u);
+    EXPECT_EQ(keys.front(), "tenant/user00");
+    EXPECT_EQ(keys.back(), "tenant/user24");
+
+    KVSQLite::Iterator<std::string, KVSQLite::Slice> * pIter = nullptr;
+    for(const char * token : {"x", "i", "i-", "i1-2", "i--1", "i99999999999999999999", "i-99999999999999999999"})
+    {
+        readOptions.continuation = token;
+        EXPECT_EQ(pDB->scanPrefix(readOptions, "tenant/", &pIter).type(), KVSQLite::Status::InvalidArgument);
+        EXPECT_EQ(pIter, nullptr);
+    }
+
+    delete pDB;
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, scanRange)
+{
+    KVSQLite::DB<int, double> * pDB = nullptr;
+    KVSQLite::Status status = KVSQLite::DB<int, double>::open(KVSQLite::Options(), ":memory:", &pDB);
+    ASSERT_EQ(status.ok(), true);
+    for(int i = 100; i > 0; i--)
+    {
+        EXPECT_EQ(pDB->put(KVSQLite::WriteOptions(), i, i / 2.0).ok(), true);
+    }
+
+    KVSQLite::Iterator<int, double> * pIter = nullptr;
+    ASSERT_EQ(pDB->scanRange(KVSQLite::ReadOptions(), 10, 60, &pIter).ok(), true);
+    int expected = 10;
+    for(; pIter->valid(); pIter->next())
+    {
+        EXPECT_EQ(pIter->key(), expected);
+        EXPECT_EQ(pIter->value(), expected / 2.0);
+        expected++;
+    }
+    EXPECT_EQ(expected, 60);
+    EXPECT_EQ(pIter->continuationToken(), "");
+    delete pIter;
+
+    EXPECT_EQ(pDB->scanPrefix(KVSQLite::ReadOptions(), 1, &pIter).type(), KVSQLite::Status::InvalidArgument);
+
+    delete pDB;
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, countAndApproximateSize)
+{
+    std::remove("KVSQLiteCount.db");
+    KVSQLite::DB<int, std::string> * pDB = nullptr;
+    KVSQLite::Status status = KVSQLite::DB<int, std::string>::open(KVSQLite::Options(), "KVSQLiteCount.db", &pDB);
+    ASSERT_EQ(status.ok(), true);
+
+    KVSQLite::WriteBatch<int, std::string> batch;
+    for(int i = 0; i < 20000; i++)
+    {
+        batch.put(i, std::string(100, 'v'));
+    }
+    ASSERT_EQ(pDB->write(KVSQLite::WriteOptions(), &batch).ok(), true);
+
+    int64_t count = 0;
+    EXPECT_EQ(pDB->count(5000, 15000, count).ok(), true);
+    EXPECT_EQ(count, 10000);
+
+    /* Estimates come from the B-tree pages, allow a coarse error */
+    EXPECT_EQ(pDB->approximateCount(5000, 15000, count).ok(), true);
+    EXPECT_GT(count, 7000);
+    EXPECT_LT(count, 13000);
+    EXPECT_EQ(pDB->approximateCount(30000, 40000, count).ok(), true);
+    EXPECT_EQ(count, 0);
+
+    int64_t size = 0;
+    EXPECT_EQ(pDB->approximateSize(0, 10000, size).ok(), true);
+    EXPECT_GT(size, 10000 * 100 / 2);
+    EXPECT_LT(size, 10000 * 100 * 3);
+
+    EXPECT_EQ(pDB->getProperty("kvsqlite.estimate-num-keys", count).ok(), true);
+    EXPECT_GT(count, 10000);
+    EXPECT_LT(count, 40000);
+    EXPECT_EQ(pDB->getProperty("kvsqlite.num-keys", count).type(), KVSQLite::Status::InvalidArgument);
+
+    delete pDB;
+    std::remove("KVSQLiteCount.db");
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, stats)
+{
+    KVSQLite::Options opt;
+    opt.enable_stats = true;
+    KVSQLite::DB<std::string, std::string> * pDB = nullptr;
+    KVSQLite::Status status = KVSQLite::DB<std::string, std::string>::open(opt, ":memory:", &pDB);
+    ASSERT_EQ(status.ok(), true);
+    KVSQLite::WriteOptions options;
+
+    EXPECT_EQ(pDB->put(options, "a", "123").ok(), true);
+    EXPECT_EQ(pDB->put(options, "bb", "45").ok(), true);
+    EXPECT_EQ(pDB->put(options, "a", "123456").ok(), true);
+    EXPECT_EQ(pDB->merge(options, "bb", "6", KVSQLite::MERGE_APPEND).ok(), true);
+    EXPECT_EQ(pDB->put(options, "ccc", "7").ok(), true);
+    EXPECT_EQ(pDB->del(options, "ccc").ok(), true);
+
+    int64_t value = 0;
+    EXPECT_EQ(pDB->getProperty("kvsqlite.num-keys", value).ok(), true);
+    EXPECT_EQ(value, 2);
+    EXPECT_EQ(pDB->getProperty("kvsqlite.total-key-bytes", value).ok(), true);
+    EXPECT_EQ(value, 3);
+    EXPECT_EQ(pDB->getProperty("kvsqlite.total-value-bytes", value).ok(), true);
+    EXPECT_EQ(value, 9);
+    EXPECT_EQ(pDB->getProperty("kvsqlite.unknown", value).type(), KVSQLite::Status::InvalidArgument);
+
+    /* Without readable pages the estimates are exact */
+    EXPECT_EQ(pDB->approximateCount("a", "b", value).ok(), true);
+    EXPECT_EQ(value, 1);
+    EXPECT_EQ(pDB->approximateSize("a", "z", value).ok(), true);
+    EXPECT_EQ(value, 12);
+
+    EXPECT_EQ(pDB->clear(options).ok(), true);
+    EXPECT_EQ(pDB->getProperty("kvsqlite.total-value-bytes", value).ok(), true);
+    EXPECT_EQ(value, 0);
+
+    delete pDB;
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, encodeKeys)
+{
+    std::remove("KVSQLiteEncoded.db");
+    KVSQLite::Options opt;
+    opt.encode_keys = true;
+    KVSQLite::DB<double, int> * pDB = nullptr;
+    KVSQLite::Status status = KVSQLite::DB<double, int>::open(opt, "KVSQLiteEncoded.db", &pDB);
+    ASSERT_EQ(status.ok(), true);
+
+    const double keys[] = {-std::numeric_limits<double>::infinity(), -1e300, -2.5, -1e-300, 0.0, 1e-300, 3, 1e300,
+        std::numeric_limits<double>::infinity(), std::numeric_limits<double>::quiet_NaN()};
+    for(int i = 9; i >= 0; i--)
+    {
+        EXPECT_EQ(pDB->put(KVSQLite::WriteOptions(), keys[i], i).ok(), true);
+    }
+    int val = 0;
+    EXPECT_EQ(pDB->get(-0.0, val).ok(), true);
+    EXPECT_EQ(val, 4);
+    EXPECT_EQ(pDB->get(-std::numeric_limits<double>::quiet_NaN(), val).ok(), true);
+    EXPECT_EQ(val, 9);
+
+    /* Every key sorts numerically, NaN last */
+    KVSQLite::Iterator<double, int> * pIter = nullptr;
+    ASSERT_EQ(pDB->scanRange(KVSQLite::ReadOptions(), -std::numeric_limits<double>::infinity(),
+        std::numeric_limits<double>::quiet_NaN(), &pIter).ok(), true);
+    int expected = 0;
+    for(; pIter->valid(); pIter->next())
+    {
+        EXPECT_EQ(pIter->value(), expected);
+        expected++;
+    }
+    EXPECT_EQ(expected, 9);
+    delete pIter;
+    delete pDB;
+
+    /* The encoding is recorded in the file */
+    status = KVSQLite::DB<double, int>::open(KVSQLite::Options(), "KVSQLiteEncoded.db", &pDB);
+    ASSERT_EQ(status.ok(), true);
+    EXPECT_EQ(pDB->get(-2.5, val).ok(), true);
+    EXPECT_EQ(val, 2);
+    delete pDB;
+    std::remove("KVSQLiteEncoded.db");
+
+    KVSQLite::DB<int, int> * pIntDB = nullptr;
+    ASSERT_EQ((KVSQLite::DB<int, int>::open(KVSQLite::Options(), "KVSQLiteEncoded.db", &pIntDB)).ok(), true);
+    EXPECT_EQ(pIntDB->put(KVSQLite::WriteOptions(), 1, 1).ok(), true);
+    delete pIntDB;
+    status = KVSQLite::DB<int, int>::open(opt, "KVSQLiteEncoded.db", &pIntDB);
+    EXPECT_EQ(status.type(), KVSQLite::Status::InvalidArgument);
+    std::remove("KVSQLiteEncoded.db");
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, encodeKeysRanges)
+{
+    KVSQLite::Options opt;
+    opt.encode_keys = true;
+    KVSQLite::DB<int, int> * pIntDB = nullptr;
+    ASSERT_EQ((KVSQLite::DB<int, int>::open(opt, ":memory:", &pIntDB)).ok(), true);
+    for(int i = -50; i < 50; i++)
+    {
+        EXPECT_EQ(pIntDB->put(KVSQLite::WriteOptions(), i, i).ok(), true);
+    }
+    int64_t count = 0;
+    EXPECT_EQ(pIntDB->count(-10, 10, count).ok(), true);
+    EXPECT_EQ(count, 20);
+    EXPECT_EQ(pIntDB->deleteRange(KVSQLite::WriteOptions(), -50, 0).ok(), true);
+    EXPECT_EQ(pIntDB->count(-100, 100, count).ok(), true);
+    EXPECT_EQ(count, 50);
+    delete pIntDB;
+
+    KVSQLite::DB<std::string, std::string> * pDB = nullptr;
+    ASSERT_EQ((KVSQLite::DB<std::string, std::string>::open(opt, ":memory:", &pDB)).ok(), true);
+    const char * keys[] = {"a", "a/1", "a/2", "b"};
+    for(const char * key : keys)
+    {
+        EXPECT_EQ(pDB->put(KVSQLite::WriteOptions(), key, key).ok(), true);
+    }
+    KVSQLite::Iterator<std::string, std::string> * pIter = nullptr;
+    ASSERT_EQ(pDB->scanPrefix(KVSQLite::ReadOptions(), "a/", &pIter).ok(), true);
+    std::vector<std::string> found;
+    for(; pIter->valid(); pIter->next())
+    {
+        EXPECT_EQ(pIter->key(), pIter->value());
+        found.push_back(pIter->key());
+    }
+    delete pIter;
+    EXPECT_EQ(found, std::vector<std::string>({"a/1", "a/2"}));
+    delete pDB;
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, tupleKeys)
+{
+    typedef std::tuple<std::string, int64_t> SeriesKey;
+    KVSQLite::DB<SeriesKey, double> * pDB = nullptr;
+    ASSERT_EQ((KVSQLite::DB<SeriesKey, double>::open(KVSQLite::Options(), ":memory:", &pDB)).ok(), true);
+
+    const char * series[] = {"cpu", "disk", "mem"};
+    for(const char * name : series)
+    {
+        for(int64_t ts = 10; ts > 0; ts--)
+        {
+            EXPECT_EQ(pDB->put(KVSQLite::WriteOptions(), SeriesKey(name, ts * 1000), ts / 10.0).ok(), true);
+        }
+    }
+    double val = 0;
+    EXPECT_EQ(pDB->get(SeriesKey("disk", 3000), val).ok(), true);
+    EXPECT_EQ(val, 0.3);
+    EXPECT_EQ(pDB->get(SeriesKey("disk", 3001), val).type(), KVSQLite::Status::NotFound);
+
+    /* Every timestamp of one series, in order, across several pages */
+    KVSQLite::ReadOptions options;
+    options.prefetch = 3;
+    options.limit = 7;
+    KVSQLite::Iterator<SeriesKey, double> * pIter = nullptr;
+    ASSERT_EQ(pDB->scanPrefix(options, SeriesKey("disk", 0), 1, &pIter).ok(), true);
+    int64_t expected = 1000;
+    for(; pIter->valid(); pIter->next())
+    {
+        EXPECT_EQ(std::get<0>(pIter->key()), "disk");
+        EXPECT_EQ(std::get<1>(pIter->key()), expected);
+        expected += 1000;
+    }
+    EXPECT_EQ(expected, 8000);
+    options.continuation = pIter->continuationToken();
+    delete pIter;
+
+    options.limit = 0;
+    ASSERT_EQ(pDB->scanPrefix(options, SeriesKey("disk", 0), 1, &pIter).ok(), true);
+    for(; pIter->valid(); pIter->next())
+    {
+        EXPECT_EQ(std::get<1>(pIter->key()), expected);
+        expected += 1000;
+    }
+    EXPECT_EQ(expected, 11000);
+    EXPECT_EQ(pIter->continuationToken(), "");
+    delete pIter;
+
+    /* Ranges compare the components in order */
+    int64_t count = 0;
+    EXPECT_EQ(pDB->count(SeriesKey("cpu", 5000), SeriesKey("disk", 3000), count).ok(), true);
+    EXPECT_EQ(count, 8);
+    EXPECT_EQ(pDB->deleteRange(KVSQLite::WriteOptions(), SeriesKey("mem", 0), SeriesKey("mem", 5000)).ok(), true);
+    EXPECT_EQ(pDB->count(SeriesKey("mem", 0), SeriesKey("mem", 100000), count).ok(), true);
+    EXPECT_EQ(count, 6);
+
+    EXPECT_EQ(pDB->scanPrefix(KVSQLite::ReadOptions(), SeriesKey("mem", 0), 2, &pIter).type(), KVSQLite::Status::InvalidArgument);
+    delete pDB;
+
+    /* Each key column is declared with the type of its component */
+    typedef std::tuple<double, std::string> PointKey;
+    std::remove("KVSQLiteTuple.db");
+    KVSQLite::DB<PointKey, int64_t> * pPoints = nullptr;
+    ASSERT_EQ((KVSQLite::DB<PointKey, int64_t>::open(KVSQLite::Options(), "KVSQLiteTuple.db", &pPoints)).ok(), true);
+    EXPECT_EQ(pPoints->put(KVSQLite::WriteOptions(), PointKey(2.0, "x"), 1).ok(), true);
+    delete pPoints;
+    sqlite3 * other = nullptr;
+    ASSERT_EQ(sqlite3_open("KVSQLiteTuple.db", &other), SQLITE_OK);
+    sqlite3_stmt * stmt = nullptr;
+    ASSERT_EQ(sqlite3_prepare_v2(other, "SELECT name, type FROM pragma_table_info('KVTable') ORDER BY cid", -1, &stmt, nullptr), SQLITE_OK);
+    std::vector<std::string> columns;
+    while(SQLITE_ROW == sqlite3_step(stmt))
+    {
+        columns.push_back(std::string((const char *)sqlite3_column_text(stmt, 0)) + " " + (const char *)sqlite3_column_text(stmt, 1));
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_close(other);
+    EXPECT_EQ(columns, std::vector<std::string>({"key REAL", "key_1 TEXT", "value "}));
+    std::remove("KVSQLiteTuple.db");
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, keyspaces)
+{
+    std::remove("KVSQLiteKeyspaces.db");
+    KVSQLite::DB<std::string, std::string> * pUsers = nullptr;
+    ASSERT_EQ((KVSQLite::DB<std::string, std::string>::open(KVSQLite::Options(), "KVSQLiteKeyspaces.db", &pUsers)).ok(), true);
+
+    KVSQLite::Options options;
+    options.keyspace = "scores";
+    KVSQLite::DB<int64_t, double> * pScores = nullptr;
+    ASSERT_EQ((KVSQLite::DB<int64_t, double>::open(options, pUsers, &pScores)).ok(), true);
+
+    options.keyspace = "bad name";
+    KVSQLite::DB<int64_t, double> * pBad = nullptr;
+    EXPECT_EQ((KVSQLite::DB<int64_t, double>::open(options, pUsers, &pBad)).type(), KVSQLite::Status::InvalidArgument);
+    /* Names of the tables kept next to a keyspace */
+    for(const char * name : {"scoresMeta", "scoresstats", "scores_expire", "vlog", "scores_vlog_position"})
+    {
+        options.keyspace = name;
+        EXPECT_EQ((KVSQLite::DB<int64_t, double>::open(options, pUsers, &pBad)).type(), KVSQLite::Status::InvalidArgument);
+        EXPECT_EQ(pBad, nullptr);
+    }
+
+    /* Both keyspaces are written in one transaction, or not at all */
+    KVSQLite::WriteBatch<std::string, std::string> userBatch;
+    userBatch.put("alice", "1");
+    KVSQLite::WriteBatch<int64_t, double> scoreBatch;
+    scoreBatch.put(1, 99.5);
+    KVSQLite::MultiWriteBatch batch;
+    batch.add(pUsers, &userBatch);
+    batch.add(pScores, &scoreBatch);
+    EXPECT_EQ(pScores->write(KVSQLite::WriteOptions(), &batch).ok(), true);
+
+    userBatch.clear();
+    userBatch.put("bob", "2");
+    scoreBatch.clear();
+    scoreBatch.merge(2, 1.0, KVSQLite::MERGE_APPEND);
+    EXPECT_EQ(pUsers->write(KVSQLite::WriteOptions(), &batch).type(), KVSQLite::Status::InvalidArgument);
+
+    std::string user;
+    double score = 0;
+    EXPECT_EQ(pUsers->get("alice", user).ok(), true);
+    EXPECT_EQ(pUsers->get("bob", user).type(), KVSQLite::Status::NotFound);
+    EXPECT_EQ(pScores->get(1, score).ok(), true);
+    EXPECT_EQ(score, 99.5);
+    EXPECT_EQ(pScores->get(2, score).type(), KVSQLite::Status::NotFound);
+
+    /* A DB on its own connection can not join the transaction */
+    KVSQLite::DB<int64_t, double> * pOther = nullptr;
+    ASSERT_EQ((KVSQLite::DB<int64_t, double>::open(KVSQLite::Options(), ":memory:", &pOther)).ok(), true);
+    KVSQLite::MultiWriteBatch otherBatch;
+    otherBatch.add(pOther, &scoreBatch);
+    EXPECT_EQ(pUsers->write(KVSQLite::WriteOptions(), &otherBatch).type(), KVSQLite::Status::InvalidArgument);
+    delete pOther;
+
+    /* The connection stays open while a keyspace uses it */
+    delete pUsers;
+    EXPECT_EQ(pScores->put(KVSQLite::WriteOptions(), 3, 1.5).ok(), true);
+    delete pScores;
+
+    options.keyspace = "scores";
+    ASSERT_EQ((KVSQLite::DB<int64_t, double>::open(options, "KVSQLiteKeyspaces.db", &pScores)).ok(), true);
+    EXPECT_EQ(pScores->get(3, score).ok(), true);
+    EXPECT_EQ(score, 1.5);
+    EXPECT_EQ(pScores->get(1, score).ok(), true);
+    delete pScores;
+    std::remove("KVSQLiteKeyspaces.db");
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, attachedFiles)
+{
+    std::remove("KVSQLiteShard0.db");
+    std::remove("KVSQLiteShard1.db");
+    std::remove("KVSQLiteShardMissing.db");
+
+    /* Data written before the file is attached stays usable in place */
+    KVSQLite::DB<std::string, int64_t> * pShard1 = nullptr;
+    ASSERT_EQ((KVSQLite::DB<std::string, int64_t>::open(KVSQLite::Options(), "KVSQLiteShard1.db", &pShard1)).ok(), true);
+    EXPECT_EQ(pShard1->put(KVSQLite::WriteOptions(), "bob", 10).ok(), true);
+    delete pShard1;
+
+    KVSQLite::DB<std::string, int64_t> * pShard0 = nullptr;
+    ASSERT_EQ((KVSQLite::DB<std::string, int64_t>::open(KVSQLite::Options(), "KVSQLiteShard0.db", &pShard0)).ok(), true);
+    KVSQLite::Options options;
+    options.enable_stats = true;
+    ASSERT_EQ((KVSQLite::DB<std::string, int64_t>::open(options, pShard0, "KVSQLiteShard1.db", &pShard1)).ok(), true);
+
+    KVSQLite::Options missing;
+    missing.create_if_missing = false;
+    KVSQLite::DB<std::string, int64_t> * pMissing = nullptr;
+    EXPECT_EQ((KVSQLite::DB<std::string, int64_t>::open(missing, pShard0, "KVSQLiteShardMissing.db", &pMissing)).type(), KVSQLite::Status::IOError);
+
+    int64_t value = 0;
+    EXPECT_EQ(pShard1->get("bob", value).ok(), true);
+    EXPECT_EQ(value, 10);
+    EXPECT_EQ(pShard0->get("bob", value).type(), KVSQLite::Status::NotFound);
+
+    /* Move 5 from bob in one file to alice in the other, atomically */
+    KVSQLite::WriteBatch<std::string, int64_t> batch0;
+    batch0.put("alice", 5);
+    KVSQLite::WriteBatch<std::string, int64_t> batch1;
+    batch1.put("bob", 5);
+    KVSQLite::MultiWriteBatch batch;
+    batch.add(pShard0, &batch0);
+    batch.add(pShard1, &batch1);
+    EXPECT_EQ(pShard0->write(KVSQLite::WriteOptions(), &batch).ok(), true);
+
+    /* A failing batch leaves both files alone */
+    batch0.clear();
+    batch0.put("carol", 1);
+    batch1.clear();
+    batch1.merge("bob", 1, KVSQLite::MERGE_APPEND);
+    EXPECT_EQ(pShard1->write(KVSQLite::WriteOptions(), &batch).type(), KVSQLite::Status::InvalidArgument);
+    EXPECT_EQ(pShard0->get("carol", value).type(), KVSQLite::Status::NotFound);
+
+    int64_t keys = 0;
+    EXPECT_EQ(pShard1->getProperty("kvsqlite.num-keys", keys).ok(), true);
+    EXPECT_EQ(keys, 1);
+
+    /* A keyspace opened on the attached DB lives in the attached file */
+    options.keyspace = "audit";
+    KVSQLite::DB<int64_t, std::string> * pAudit = nullptr;
+    ASSERT_EQ((KVSQLite::DB<int64_t, std::string>::open(options, pShard1, &pAudit)).ok(), true);
+    EXPECT_EQ(pAudit->put(KVSQLite::WriteOptions(), 1, "bob -5").ok(), true);
+    delete pAudit;
+    delete pShard1;
+    delete pShard0;
+
+    std::string entry;
+    options.keyspace = "";
+    ASSERT_EQ((KVSQLite::DB<std::string, int64_t>::open(options, "KVSQLiteShard1.db", &pShard1)).ok(), true);
+    EXPECT_EQ(pShard1->get("bob", value).ok(), true);
+    EXPECT_EQ(value, 5);
+    options.keyspace = "audit";
+    ASSERT_EQ((KVSQLite::DB<int64_t, std::string>::open(options, pShard1, &pAudit)).ok(), true);
+    EXPECT_EQ(pAudit->get(1, entry).ok(), true);
+    EXPECT_EQ(entry, "bob -5");
+    delete pAudit;
+    delete pShard1;
+
+    ASSERT_EQ((KVSQLite::DB<std::string, int64_t>::open(KVSQLite::Options(), "KVSQLiteShard0.db", &pShard0)).ok(), true);
+    EXPECT_EQ(pShard0->get("alice", value).ok(), true);
+    EXPECT_EQ(value, 5);
+    delete pShard0;
+
+    std::remove("KVSQLiteShard0.db");
+    std::remove("KVSQLiteShard1.db");
+    std::remove("KVSQLiteShardMissing.db");
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, shardedDB)
+{
+    for(int i = 0; i < 4; i++)
+    {
+        std::remove(("KVSQLiteSharded.db." + std::to_string(i)).c_str());
+    }
+
+    KVSQLite::ShardedDB<std::string, int64_t> * pDB = nullptr;
+    EXPECT_EQ((KVSQLite::ShardedDB<std::string, int64_t>::open(KVSQLite::Options(), "KVSQLiteSharded.db", 0, &pDB)).type(), KVSQLite::Status::InvalidArgument);
+    /* No file is left behind by the failed open */
+    FILE * pF = fopen("KVSQLiteSharded.db.0", "rb");
+    EXPECT_EQ(pF, nullptr);
+    if(pF)
+    {
+        fclose(pF);
+    }
+    ASSERT_EQ((KVSQLite::ShardedDB<std::string, int64_t>::open(KVSQLite::Options(), "KVSQLiteSharded.db", 4, &pDB)).ok(), true);
+    EXPECT_EQ(pDB->shardCount(), 4);
+
+    KVSQLite::WriteBatch<std::string, int64_t> batch;
+    std::vector<std::string> keys;
+    for(int i = 0; i < 100; i++)
+    {
+        char key[16];
+        std::snprintf(key, sizeof(key), "key%03d", i);
+        keys.push_back(key);
+        batch.put(key, i);
+    }
+    EXPECT_EQ(pDB->write(KVSQLite::WriteOptions(), &batch).ok(), true);
+    EXPECT_EQ(pDB->del(KVSQLite::WriteOptions(), "key050").ok(), true);
+
+    /* Every shard got some of the keys, each key only in its own shard */
+    for(int i = 0; i < 4; i++)
+    {
+        int64_t n = 0;
+        EXPECT_EQ(pDB->shard(i)->count("", "z", n).ok(), true);
+        EXPECT_GT(n, 0);
+    }
+    int64_t value = 0;
+    EXPECT_EQ(pDB->shard(pDB->shardOf("key007"))->get("key007", value).ok(), true);
+    EXPECT_EQ(pDB->shard((pDB->shardOf("key007") + 1) % 4)->get("key007", value).type(), KVSQLite::Status::NotFound);
+
+    std::vector<int64_t> values;
+    std::vector<KVSQLite::Status> statuses;
+    EXPECT_EQ(pDB->multiGet(keys, values, statuses).ok(), true);
+    ASSERT_EQ(values.size(), keys.size());
+    for(int i = 0; i < 100; i++)
+    {
+        EXPECT_EQ(statuses[i].ok(), 50 != i);
+        EXPECT_EQ(values[i], (50 != i) ? i : 0);
+    }
+
+    int64_t count = 0;
+    EXPECT_EQ(pDB->count("key010", "key020", count).ok(), true);
+    EXPECT_EQ(count, 10);
+
+    /* The shards are merged back in key order */
+    KVSQLite::ReadOptions options;
+    options.limit = 60;
+    KVSQLite::ShardedIterator<std::string, int64_t> * pIter = nullptr;
+    ASSERT_EQ(pDB->scanPrefix(options, "key0", &pIter).ok(), true);
+    int expected = 0;
+    for(; pIter->valid(); pIter->next(), expected++)
+    {
+        expected += (50 == expected) ? 1 : 0;
+        EXPECT_EQ(pIter->key(), keys[expected]);
+        EXPECT_EQ(pIter->value(), expected);
+    }
+    EXPECT_EQ(pIter->status().ok(), true);
+    EXPECT_EQ(expected, 61);
+    delete pIter;
+    delete pDB;
+
+    /* The number of shards is fixed at creation */
+    EXPECT_EQ((KVSQLite::ShardedDB<std::string, int64_t>::open(KVSQLite::Options(), "KVSQLiteSharded.db", 2, &pDB)).type(), KVSQLite::Status::InvalidArgument);
+    ASSERT_EQ((KVSQLite::ShardedDB<std::string, int64_t>::open(KVSQLite::Options(), "KVSQLiteSharded.db", 0, &pDB)).ok(), true);
+    EXPECT_EQ(pDB->shardCount(), 4);
+    EXPECT_EQ(pDB->get("key099", value).ok(), true);
+    EXPECT_EQ(value, 99);
+    delete pDB;
+
+    for(int i = 0; i < 4; i++)
+    {
+        std::remove(("KVSQLiteSharded.db." + std::to_string(i)).c_str());
+    }
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, reshard)
+{
+    for(int i = 0; i < 3; i++)
+    {
+        std::remove(("KVSQLiteReshardOld.db." + std::to_string(i)).c_str());
+        std::remove(("KVSQLiteReshardNew.db." + std::to_string(i)).c_str());
+    }
+
+    KVSQLite::ShardedDB<int64_t, std::string> * pDB = nullptr;
+    ASSERT_EQ((KVSQLite::ShardedDB<int64_t, std::string>::open(KVSQLite::Options(), "KVSQLiteReshardOld.db", 2, &pDB)).ok(), true);
+    KVSQLite::WriteBatch<int64_t, std::string> batch;
+    for(int64_t i = 0; i < 1000; i++)
+    {
+        batch.put(i, "v" + std::to_string(i));
+    }
+    EXPECT_EQ(pDB->write(KVSQLite::WriteOptions(), &batch).ok(), true);
+
+    /* A slow copy, so that the writes below happen while it runs */
+    KVSQLite::ReshardOptions options;
+    options.batch_size = 50;
+    options.bytes_per_second = 20000;
+    EXPECT_EQ(pDB->reshard(options, "KVSQLiteReshardOld.db", 3).type(), KVSQLite::Status::InvalidArgument);
+
+    /* Leftovers of a reshard to 2 shards that did not complete */
+    KVSQLite::ShardedDB<int64_t, std::string> * pLeftover = nullptr;
+    ASSERT_EQ((KVSQLite::ShardedDB<int64_t, std::string>::open(KVSQLite::Options(), "KVSQLiteReshardNew.db", 2, &pLeftover)).ok(), true);
+    EXPECT_EQ(pLeftover->put(KVSQLite::WriteOptions(), 5000, "stale").ok(), true);
+    delete pLeftover;
+
+    ASSERT_EQ(pDB->reshard(options, "KVSQLiteReshardNew.db", 3).ok(), true);
+    EXPECT_EQ(pDB->reshard(options, "KVSQLiteReshardNew.db", 3).type(), KVSQLite::Status::InvalidArgument);
+
+    std::string value;
+    for(int64_t i = 0; i < 1000; i += 10)
+    {
+        EXPECT_EQ(pDB->put(KVSQLite::WriteOptions(), i, "w" + std::to_string(i)).ok(), true);
+        EXPECT_EQ(pDB->del(KVSQLite::WriteOptions(), i + 1).ok(), true);
+        EXPECT_EQ(pDB->get(i + 2, value).ok(), true);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_EQ(pDB->put(KVSQLite::WriteOptions(), 1000, "new").ok(), true);
+    EXPECT_EQ(pDB->waitForReshard().ok(), true);
+    EXPECT_EQ(pDB->shardCount(), 3);
+    delete pDB;
+
+    ASSERT_EQ((KVSQLite::ShardedDB<int64_t, std::string>::open(KVSQLite::Options(), "KVSQLiteReshardNew.db", 0, &pDB)).ok(), true);
+    EXPECT_EQ(pDB->shardCount(), 3);
+    int64_t count = 0;
+    EXPECT_EQ(pDB->count(0, 2000, count).ok(), true);
+    EXPECT_EQ(count, 901);
+    for(int64_t i = 0; i < 1000; i++)
+    {
+        KVSQLite::Status status = pDB->get(i, value);
+        if(1 == i % 10)
+        {
+            EXPECT_EQ(status.type(), KVSQLite::Status::NotFound);
+        }
+        else
+        {
+            EXPECT_EQ(status.ok(), true);
+            EXPECT_EQ(value, ((0 == i % 10) ? "w" : "v") + std::to_string(i));
+        }
+    }
+    EXPECT_EQ(pDB->get(1000, value).ok(), true);
+    EXPECT_EQ(pDB->get(5000, value).type(), KVSQLite::Status::NotFound);
+    delete pDB;
+
+    for(int i = 0; i < 3; i++)
+    {
+        std::remove(("KVSQLiteReshardOld.db." + std::to_string(i)).c_str());
+        std::remove(("KVSQLiteReshardNew.db." + std::to_string(i)).c_str());
+    }
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, reshardConcurrent)
+{
+    for(int i = 0; i < 3; i++)
+    {
+        std::remove(("KVSQLiteReshardRace.db." + std::to_string(i)).c_str());
+        std::remove(("KVSQLiteReshardRaceNew.db." + std::to_string(i)).c_str());
+    }
+
+    KVSQLite::ShardedDB<int64_t, std::string> * pDB = nullptr;
+    ASSERT_EQ((KVSQLite::ShardedDB<int64_t, std::string>::open(KVSQLite::Options(), "KVSQLiteReshardRace.db", 2, &pDB)).ok(), true);
+    KVSQLite::WriteBatch<int64_t, std::string> batch;
+    for(int64_t i = 0; i < 500; i++)
+    {
+        batch.put(i, "v" + std::to_string(i));
+    }
+    EXPECT_EQ(pDB->write(KVSQLite::WriteOptions(), &batch).ok(), true);
+
+    /* Only one of the reshards starts, every caller waits for it */
+    std::atomic<int> started(0);
+    std::atomic<int> failed(0);
+    std::vector<std::thread> threads;
+    for(int t = 0; t < 4; t++)
+    {
+        threads.emplace_back([&]() {
+            if(pDB->reshard(KVSQLite::ReshardOptions(), "KVSQLiteReshardRaceNew.db", 3).ok())
+            {
+                started++;
+            }
+            if(!pDB->waitForReshard().ok())
+            {
+                failed++;
+            }
+        });
+    }
+    for(auto & thread : threads)
+    {
+        thread.join();
+    }
+    EXPECT_EQ(started, 1);
+    EXPECT_EQ(failed, 0);
+    EXPECT_EQ(pDB->shardCount(), 3);
+    int64_t count = 0;
+    EXPECT_EQ(pDB->count(0, 1000, count).ok(), true);
+    EXPECT_EQ(count, 500);
+    delete pDB;
+
+    for(int i = 0; i < 3; i++)
+    {
+        std::remove(("KVSQLiteReshardRace.db." + std::to_string(i)).c_str());
+        std::remove(("KVSQLiteReshardRaceNew.db." + std::to_string(i)).c_str());
+    }
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, snapshots)
+{
+    std::remove("KVSQLiteSnapshot.db");
+    std::remove("KVSQLiteSnapshot.db-wal");
+    std::remove("KVSQLiteSnapshot.db-shm");
+
+    KVSQLite::DB<std::string, KVSQLite::Slice> * pMemory = nullptr;
+    ASSERT_EQ((KVSQLite::DB<std::string, KVSQLite::Slice>::open(KVSQLite::Options(), ":memory:", &pMemory)).ok(), true);
+    const KVSQLite::Snapshot * snapshot = nullptr;
+    EXPECT_EQ(pMemory->getSnapshot(&snapshot).type(), KVSQLite::Status::InvalidArgument);
+    delete pMemory;
+
+    KVSQLite::Options options;
+    options.wal_mode = true;
+    KVSQLite::DB<std::string, KVSQLite::Slice> * pDB = nullptr;
+    ASSERT_EQ((KVSQLite::DB<std::string, KVSQLite::Slice>::open(options, "KVSQLiteSnapshot.db", &pDB)).ok(), true);
+    for(int i = 0; i < 10; i++)
+    {
+        EXPECT_EQ(pDB->put(KVSQLite::WriteOptions(), "key" + std::to_string(i), "v" + std::to_string(i)).ok(), true);
+    }
+    ASSERT_EQ(pDB->getSnapshot(&snapshot).ok(), true);
+
+    /* Writes made after the snapshot neither wait for it nor show through it */
+    EXPECT_EQ(pDB->put(KVSQLite::WriteOptions(), "key0", "changed").ok(), true);
+    EXPECT_EQ(pDB->del(KVSQLite::WriteOptions(), "key1").ok(), true);
+    EXPECT_EQ(pDB->put(KVSQLite::WriteOptions(), "key10", "new").ok(), true);
+
+    KVSQLite::ReadOptions readOptions;
+    readOptions.snapshot = snapshot;
+    KVSQLite::Slice value;
+    EXPECT_EQ(pDB->get(readOptions, "key0", value).ok(), true);
+    EXPECT_EQ(value.toString(), "v0");
+    EXPECT_EQ(pDB->get(readOptions, "key10", value).type(), KVSQLite::Status::NotFound);
+    EXPECT_EQ(pDB->get(KVSQLite::ReadOptions(), "key0", value).ok(), true);
+    EXPECT_EQ(value.toString(), "changed");
+
+    std::vector<std::string> keys = {"key0", "key1", "key10"};
+    std::vector<KVSQLite::Slice> values;
+    std::vector<KVSQLite::Status> statuses;
+    EXPECT_EQ(pDB->multiGet(readOptions, keys, values, statuses).ok(), true);
+    EXPECT_EQ(values[0].toString(), "v0");
+    EXPECT_EQ(values[1].toString(), "v1");
+    EXPECT_EQ(statuses[2].type(), KVSQLite::Status::NotFound);
+    EXPECT_EQ(pDB->multiGet(KVSQLite::ReadOptions(), keys, values, statuses).ok(), true);
+    EXPECT_EQ(values[0].toString(), "changed");
+    EXPECT_EQ(statuses[1].type(), KVSQLite::Status::NotFound);
+    EXPECT_EQ(values[2].toString(), "new");
+
+    /* A small prefetch makes the iterator read several times from the snapshot */
+    readOptions.prefetch = 3;
+    KVSQLite::Iterator<std::string, KVSQLite::Slice> * pIter = nullptr;
+    ASSERT_EQ(pDB->scanPrefix(readOptions, "key", &pIter).ok(), true);
+    EXPECT_EQ(pDB->put(KVSQLite::WriteOptions(), "key9", "changed").ok(), true);
+    int count = 0;
+    for(; pIter->valid(); pIter->next())
+    {
+        EXPECT_EQ(pIter->value().toString(), "v" + pIter->key().substr(3));
+        count++;
+    }
+    EXPECT_EQ(pIter->status().ok(), true);
+    EXPECT_EQ(count, 10);
+    delete pIter;
+    pDB->releaseSnapshot(snapshot);
+
+    /* A snapshot only serves the DB it was taken from */
+    KVSQLite::Options keyspace;
+    keyspace.keyspace = "other";
+    KVSQLite::DB<std::string, KVSQLite::Slice> * pOther = nullptr;
+    ASSERT_EQ((KVSQLite::DB<std::string, KVSQLite::Slice>::open(keyspace, pDB, &pOther)).ok(), true);
+    ASSERT_EQ(pDB->getSnapshot(&snapshot).ok(), true);
+    readOptions.snapshot = snapshot;
+    EXPECT_EQ(pOther->get(readOptions, "key0", value).type(), KVSQLite::Status::InvalidArgument);
+    pDB->releaseSnapshot(snapshot);
+    delete pOther;
+    delete pDB;
+
+    std::remove("KVSQLiteSnapshot.db");
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, valueStreams)
+{
+    KVSQLite::DB<std::string, KVSQLite::Slice> * pDB = nullptr;
+    ASSERT_EQ((KVSQLite::DB<std::string, KVSQLite::Slice>::open(KVSQLite::Options(), ":memory:", &pDB)).ok(), true);
+
+    /* Fill a value of 1 MB in pieces of 64 KB */
+    const int chunk = 64 * 1024;
+    const int size = 16 * chunk;
+    KVSQLite::ValueWriter * pWriter = nullptr;
+    ASSERT_EQ(pDB->openValueWriter(KVSQLite::WriteOptions(), "blob", size, &pWriter).ok(), true);
+    for(int i = 0; i < size / chunk; i++)
+    {
+        EXPECT_EQ(pWriter->append(std::string(chunk, (char)('a' + i))).ok(), true);
+    }
+    EXPECT_EQ(pWriter->position(), size);
+    EXPECT_EQ(pWriter->append("x").type(), KVSQLite::Status::InvalidArgument);
+    EXPECT_EQ(pWriter->write(chunk - 1, "XY").ok(), true);
+
+    KVSQLite::Slice value;
+    EXPECT_EQ(pDB->get("blob", value).ok(), true);
+    EXPECT_EQ(value.size(), (size_t)size);
+
+    KVSQLite::ValueReader * pReader = nullptr;
+    EXPECT_EQ(pDB->openValueReader("missing", &pReader).type(), KVSQLite::Status::NotFound);
+    ASSERT_EQ(pDB->openValueReader("blob", &pReader).ok(), true);
+    EXPECT_EQ(pReader->size(), size);
+    std::string data;
+    EXPECT_EQ(pReader->read(chunk - 2, 4, data).ok(), true);
+    EXPECT_EQ(data, "aXYb");
+    int64_t offset = 0;
+    int chunks = 0;
+    for(; pReader->read(offset, chunk, data).ok() && !data.empty(); offset += data.size())
+    {
+        EXPECT_EQ(data[chunk / 2], (char)('a' + chunks));
+        chunks++;
+    }
+    EXPECT_EQ(chunks, size / chunk);
+    EXPECT_EQ(pReader->read(size + 1, 1, data).type(), KVSQLite::Status::InvalidArgument);
+
+    /* Replacing the value stops both the reader and the writer */
+    EXPECT_EQ(pDB->put(KVSQLite::WriteOptions(), "blob", "small").ok(), true);
+    EXPECT_EQ(pReader->read(0, 1, data).type(), KVSQLite::Status::ConditionNotMet);
+    EXPECT_EQ(pWriter->write(0, "z").type(), KVSQLite::Status::ConditionNotMet);
+    EXPECT_EQ(pDB->del(KVSQLite::WriteOptions(), "blob").ok(), true);
+    EXPECT_EQ(pWriter->write(0, "z").type(), KVSQLite::Status::ConditionNotMet);
+    delete pReader;
+    delete pWriter;
+    delete pDB;
+
+    KVSQLite::DB<std::string, std::string> * pText = nullptr;
+    ASSERT_EQ((KVSQLite::DB<std::string, std::string>::open(KVSQLite::Options(), ":memory:", &pText)).ok(), true);
+    EXPECT_EQ(pText->openValueWriter(KVSQLite::WriteOptions(), "key", 10, &pWriter).type(), KVSQLite::Status::InvalidArgument);
+    delete pText;
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, valueLog)
+{
+    const std::string logFile = "KVSQLiteValueLog.db-KVTable.vlog.";
+    std::remove("KVSQLiteValueLog.db");
+    for(int i = 1; i < 100; i++)
+    {
+        std::remove((logFile + std::to_string(i)).c_str());
+    }
+    std::remove((logFile + "lock").c_str());
+
+    KVSQLite::Options options;
+    options.wal_mode = true;
+    options.value_log_threshold = 100;
+    options.value_log_segment_size = 4096;
+    options.value_log_gc_interval_ms = 0;
+    options.value_log_gc_batch_size = 10;
+    KVSQLite::DB<std::string, std::string> * pDB = nullptr;
+    ASSERT_EQ((KVSQLite::DB<std::string, std::string>::open(options, "KVSQLiteValueLog.db", &pDB)).ok(), true);
+
+    /* 50 values of 500 bytes fill several files of 4 KB, the small ones stay in the table */
+    KVSQLite::WriteBatch<std::string, std::string> batch;
+    for(int i = 0; i < 50; i++)
+    {
+        batch.put("large" + std::to_string(i), std::string(500, (char)('a' + i % 26)));
+        batch.put("small" + std::to_string(i), std::to_string(i));
+    }
+    EXPECT_EQ(pDB->write(KVSQLite::WriteOptions(), &batch).ok(), true);
+
+    std::string value;
+    EXPECT_EQ(pDB->get("large7", value).ok(), true);
+    EXPECT_EQ(value, std::string(500, 'h'));
+    EXPECT_EQ(pDB->get("small7", value).ok(), true);
+    EXPECT_EQ(value, "7");
+    EXPECT_EQ(pDB->merge(KVSQLite::WriteOptions(), "small7", "x", KVSQLite::MergeOperator::MERGE_APPEND).type(), KVSQLite::Status::InvalidArgument);
+
+    /* The log has one writer: a second one is refused and leaves the files of the first alone */
+    KVSQLite::DB<std::string, std::string> * pSecond = nullptr;
+    EXPECT_EQ((KVSQLite::DB<std::string, std::string>::open(options, "KVSQLiteValueLog.db", &pSecond)).type(), KVSQLite::Status::Busy);
+    EXPECT_EQ(pSecond, nullptr);
+    EXPECT_EQ(pDB->get("large49", value).ok(), true);
+    EXPECT_EQ(value, std::string(500, 'x'));
+
+    std::vector<KVSQLite::ValueLogSegment> segments;
+    EXPECT_EQ(pDB->getValueLogStats(segments).ok(), true);
+    ASSERT_EQ(segments.size() > 1, true);
+    int64_t records = 0;
+    for(const KVSQLite::ValueLogSegment & segment : segments)
+    {
+        records += segment.records;
+        EXPECT_EQ(segment.deadRecords, 0);
+    }
+    EXPECT_EQ(records, 50);
+
+    /* Overwrite or delete most of the large values, while a snapshot still reads the old ones */
+    const KVSQLite::Snapshot * snapshot = nullptr;
+    ASSERT_EQ(pDB->getSnapshot(&snapshot).ok(), true);
+    for(int i = 0; i < 40; i++)
+    {
+        if(0 == i % 2)
+        {
+            EXPECT_EQ(pDB->del(KVSQLite::WriteOptions(), "large" + std::to_string(i)).ok(), true);
+        }
+        else
+        {
+            EXPECT_EQ(pDB->put(KVSQLite::WriteOptions(), "large" + std::to_string(i), "short").ok(), true);
+        }
+    }
+    int64_t liveBytes = 0;
+    EXPECT_EQ(pDB->getProperty("kvsqlite.value-log-live-bytes", liveBytes).ok(), true);
+    EXPECT_EQ(liveBytes, 10 * 501);
+
+    int64_t reclaimed = 0;
+    EXPECT_EQ(pDB->collectValueLogGarbage(&reclaimed).ok(), true);
+    EXPECT_EQ(reclaimed > 0, true);
+    EXPECT_EQ(pDB->getValueLogStats(segments).ok(), true);
+    for(const KVSQLite::ValueLogSegment & segment : segments)
+    {
+        EXPECT_EQ(segment.deadRecords, 0);
+    }
+
+    KVSQLite::ReadOptions readOptions;
+    readOptions.snapshot = snapshot;
+    EXPECT_EQ(pDB->get(readOptions, "large0", value).ok(), true);
+    EXPECT_EQ(value, std::string(500, 'a'));
+    pDB->releaseSnapshot(snapshot);
+
+    KVSQLite::Iterator<std::string, std::string> * pIter = nullptr;
+    ASSERT_EQ(pDB->scanPrefix(KVSQLite::ReadOptions(), "large", &pIter).ok(), true);
+    int count = 0;
+    for(; pIter->valid(); pIter->next())
+    {
+        int i = std::stoi(pIter->key().substr(5));
+        EXPECT_EQ(pIter->value(), (i < 40) ? std::string("short") : std::string(500, (char)('a' + i % 26)));
+        count++;
+    }
+    EXPECT_EQ(count, 30);
+    delete pIter;
+    delete pDB;
+
+    /* The table keeps reading its value log without the option */
+    ASSERT_EQ((KVSQLite::DB<std::string, std::string>::open(KVSQLite::Options(), "KVSQLiteValueLog.db", &pDB)).ok(), true);
+    EXPECT_EQ(pDB->get("large45", value).ok(), true);
+    EXPECT_EQ(value, std::string(500, 't'));
+    delete pDB;
+
+    std::remove("KVSQLiteValueLog.db");
+    for(int i = 1; i < 100; i++)
+    {
+        std::remove((logFile + std::to_string(i)).c_str());
+    }
+    std::remove((logFile + "lock").c_str());
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, compression)
+{
+    std::string json;
+    for(int i = 0; i < 20; i++)
+    {
+        json += "{\"id\":" + std::to_string(i) + ",\"name\":\"item\",\"tags\":[\"a\",\"b\"]},";
+    }
+
+    /* The built-in codec alone */
+    const KVSQLite::Compressor * lz = KVSQLite::Compressor::lz();
+    std::string compressed;
+    std::string restored;
+    ASSERT_EQ(lz->compress(json.data(), json.size(), compressed), true);
+    EXPECT_EQ(compressed.size() < json.size() / 2, true);
+    EXPECT_EQ(lz->uncompress(compressed.data(), compressed.size(), restored), true);
+    EXPECT_EQ(restored, json);
+    EXPECT_EQ(lz->uncompress(compressed.data(), compressed.size() - 1, restored), false);
+    std::string noise;
+    for(int i = 0; i < 1000; i++)
+    {
+        noise.push_back((char)((i * 7919) >> 3));
+    }
+    std::string none;
+    if(lz->compress(noise.data(), noise.size(), none))
+    {
+        restored.clear();
+        EXPECT_EQ(lz->uncompress(none.data(), none.size(), restored), true);
+        EXPECT_EQ(restored, noise);
+    }
+
+    /* A plain value written before compression is turned on stays readable next to compressed ones */
+    std::remove("KVSQLiteCompression.db");
+    KVSQLite::Options options;
+    options.enable_stats = true;
+    KVSQLite::DB<std::string, std::string> * pDB = nullptr;
+    ASSERT_EQ((KVSQLite::DB<std::string, std::string>::open(options, "KVSQLiteCompression.db", &pDB)).ok(), true);
+    EXPECT_EQ(pDB->put(KVSQLite::WriteOptions(), "plain", json).ok(), true);
+    delete pDB;
+
+    options.compressor = lz;
+    options.compression_threshold = 64;
+    ASSERT_EQ((KVSQLite::DB<std::string, std::string>::open(options, "KVSQLiteCompression.db", &pDB)).ok(), true);
+    KVSQLite::WriteBatch<std::string, std::string> batch;
+    for(int i = 0; i < 10; i++)
+    {
+        batch.put("json" + std::to_string(i), json + std::to_string(i));
+    }
+    batch.put("small", "{}");
+    batch.put("noise", noise);
+    EXPECT_EQ(pDB->write(KVSQLite::WriteOptions(), &batch).ok(), true);
+
+    std::string value;
+    EXPECT_EQ(pDB->get("plain", value).ok(), true);
+    EXPECT_EQ(value, json);
+    EXPECT_EQ(pDB->get("json3", value).ok(), true);
+    EXPECT_EQ(value, json + "3");
+    EXPECT_EQ(pDB->get("small", value).ok(), true);
+    EXPECT_EQ(value, "{}");
+    EXPECT_EQ(pDB->get("noise", value).ok(), true);
+    EXPECT_EQ(value, noise);
+    EXPECT_EQ(pDB->merge(KVSQLite::WriteOptions(), "small", "x", KVSQLite::MergeOperator::MERGE_APPEND).type(), KVSQLite::Status::InvalidArgument);
+
+    /* Stored sizes are those of the compressed values */
+    int64_t valueBytes = 0;
+    EXPECT_EQ(pDB->getProperty("kvsqlite.total-value-bytes", valueBytes).ok(), true);
+    EXPECT_EQ(valueBytes < (int64_t)(json.size() * 11 / 2), true);
+
+    KVSQLite::Iterator<std::string, std::string> * pIter = nullptr;
+    ASSERT_EQ(pDB->scanPrefix(KVSQLite::ReadOptions(), "json", &pIter).ok(), true);
+    int count = 0;
+    for(; pIter->valid(); pIter->next())
+    {
+        EXPECT_EQ(pIter->value(), json + pIter->key().substr(4));
+        count++;
+    }
+    EXPECT_EQ(count, 10);
+    delete pIter;
+    delete pDB;
+
+    /* Values of the built-in compressor are read without the option */
+    ASSERT_EQ((KVSQLite::DB<std::string, std::string>::open(KVSQLite::Options(), "KVSQLiteCompression.db", &pDB)).ok(), true);
+    EXPECT_EQ(pDB->get("json9", value).ok(), true);
+    EXPECT_EQ(value, json + "9");
+    delete pDB;
+    std::remove("KVSQLiteCompression.db");
+
+    /* Compressed values moved to the value log */
+    std::remove("KVSQLiteCompressionLog.db");
+    std::remove("KVSQLiteCompressionLog.db-KVTable.vlog.1");
+    KVSQLite::Options logOptions;
+    logOptions.compressor = lz;
+    logOptions.value_log_threshold = 100;
+    logOptions.value_log_gc_interval_ms = 0;
+    KVSQLite::DB<std::string, KVSQLite::Slice> * pLogDB = nullptr;
+    ASSERT_EQ((KVSQLite::DB<std::string, KVSQLite::Slice>::open(logOptions, "KVSQLiteCompressionLog.db", &pLogDB)).ok(), true);
+    EXPECT_EQ(pLogDB->put(KVSQLite::WriteOptions(), "json", json).ok(), true);
+    KVSQLite::Slice slice;
+    EXPECT_EQ(pLogDB->get("json", slice).ok(), true);
+    EXPECT_EQ(slice.toString(), json);
+    std::vector<KVSQLite::ValueLogSegment> segments;
+    EXPECT_EQ(pLogDB->getValueLogStats(segments).ok(), true);
+    ASSERT_EQ(segments.size(), 1u);
+    EXPECT_EQ(segments[0].bytes < (int64_t)json.size() / 2, true);
+    delete pLogDB;
+    std::remove("KVSQLiteCompressionLog.db");
+    std::remove("KVSQLiteCompressionLog.db-KVTable.vlog.1");
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, pageCompression)
+{
+    const char * files[] = {"KVSQLitePages.db", "KVSQLitePlainPages.db", "KVSQLitePagesWal.db", "KVSQLitePagesWal.db-wal", "KVSQLitePagesWal.db-shm"};
+    for(const char * file : files)
+    {
+        std::remove(file);
+    }
+    std::string row;
+    for(int i = 0; i < 10; i++)
+    {
+        row += "{\"kind\":\"sample\",\"state\":\"ok\"}";
+    }
+
+    /* The same rows in a plain and in a compressed file */
+    KVSQLite::Options options;
+    KVSQLite::Options pageOptions;
+    pageOptions.page_compressor = KVSQLite::Compressor::lz(5);
+    long sizes[2] = {0, 0};
+    for(int pass = 0; pass < 2; pass++)
+    {
+        const char * file = (0 == pass) ? "KVSQLitePlainPages.db" : "KVSQLitePages.db";
+        KVSQLite::DB<std::string, std::string> * pDB = nullptr;
+        ASSERT_EQ((KVSQLite::DB<std::string, std::string>::open((0 == pass) ? options : pageOptions, file, &pDB)).ok(), true);
+        KVSQLite::WriteBatch<std::string, std::string> batch;
+        for(int i = 0; i < 2000; i++)
+        {
+            batch.put("key" + std::to_string(i), row + std::to_string(i));
+        }
+        EXPECT_EQ(pDB->write(KVSQLite::WriteOptions(), &batch).ok(), true);
+        KVSQLite::WriteOptions syncOptions;
+        syncOptions.sync = true;
+        EXPECT_EQ(pDB->deleteRange(syncOptions, "key1", "key2").ok(), true);
+        delete pDB;
+
+        FILE * pF = fopen(file, "rb");
+        ASSERT_NE(pF, nullptr);
+        fseek(pF, 0, SEEK_END);
+        sizes[pass] = ftell(pF);
+        fclose(pF);
+    }
+    EXPECT_EQ(sizes[1] < sizes[0] / 2, true);
+
+    /* Read back after reopening; plain files stay readable with the option, compressed ones need it */
+    KVSQLite::DB<std::string, std::string> * pDB = nullptr;
+    std::string value;
+    ASSERT_EQ((KVSQLite::DB<std::string, std::string>::open(pageOptions, "KVSQLitePages.db", &pDB)).ok(), true);
+    EXPECT_EQ(pDB->get("key999", value).ok(), true);
+    EXPECT_EQ(value, row + "999");
+    EXPECT_EQ(pDB->get("key1500", value).type(), KVSQLite::Status::NotFound);
+    delete pDB;
+    ASSERT_EQ((KVSQLite::DB<std::string, std::string>::open(pageOptions, "KVSQLitePlainPages.db", &pDB)).ok(), true);
+    EXPECT_EQ(pDB->get("key42", value).ok(), true);
+    EXPECT_EQ(value, row + "42");
+    delete pDB;
+    pDB = nullptr;
+    EXPECT_EQ((KVSQLite::DB<std::string, std::string>::open(options, "KVSQLitePages.db", &pDB)).ok(), false);
+    delete pDB;
+
+    /* WAL mode, checkpoints and snapshots */
+    KVSQLite::Options walOptions = pageOptions;
+    walOptions.wal_mode = true;
+    ASSERT_EQ((KVSQLite::DB<std::string, std::string>::open(walOptions, "KVSQLitePagesWal.db", &pDB)).ok(), true);
+    EXPECT_EQ(pDB->put(KVSQLite::WriteOptions(), "key", row).ok(), true);
+    const KVSQLite::Snapshot * snapshot = nullptr;
+    ASSERT_EQ(pDB->getSnapshot(&snapshot).ok(), true);
+    for(int i = 0; i < 500; i++)
+    {
+        EXPECT_EQ(pDB->put(KVSQLite::WriteOptions(), "key", row + std::to_string(i)).ok(), true);
+    }
+    KVSQLite::ReadOptions readOptions;
+    readOptions.snapshot = snapshot;
+    EXPECT_EQ(pDB->get(readOptions, "key", value).ok(), true);
+    EXPECT_EQ(value, row);
+    pDB->releaseSnapshot(snapshot);
+    delete pDB;
+    ASSERT_EQ((KVSQLite::DB<std::string, std::string>::open(walOptions, "KVSQLitePagesWal.db", &pDB)).ok(), true);
+    EXPECT_EQ(pDB->get("key", value).ok(), true);
+    EXPECT_EQ(value, row + "499");
+    delete pDB;
+
+    for(const char * file : files)
+    {
+        std::remove(file);
+    }
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, ioStats)
+{
+    std::remove("KVSQLiteIo.db");
+    std::remove("KVSQLiteIo.db-journal");
+    KVSQLite::Options options;
+    options.enable_io_stats = true;
+    KVSQLite::DB<std::string, std::string> * pDB = nullptr;
+    ASSERT_EQ((KVSQLite::DB<std::string, std::string>::open(options, "KVSQLiteIo.db", &pDB)).ok(), true);
+
+    /* Synchronous commits write the journal and the file, and sync both */
+    KVSQLite::WriteOptions syncOptions;
+    syncOptions.sync = true;
+    const std::string value(1000, 'v');
+    for(int i = 0; i < 20; i++)
+    {
+        EXPECT_EQ(pDB->put(syncOptions, "key" + std::to_string(i), value).ok(), true);
+    }
+    int64_t writeBytes = 0;
+    int64_t journalWrites = 0;
+    int64_t syncs = 0;
+    int64_t p99 = 0;
+    int64_t max = 0;
+    EXPECT_EQ(pDB->getProperty("kvsqlite.io.db.write-bytes", writeBytes).ok(), true);
+    EXPECT_EQ(writeBytes >= 20 * 1000, true);
+    EXPECT_EQ(pDB->getProperty("kvsqlite.io.journal.writes", journalWrites).ok(), true);
+    EXPECT_EQ(journalWrites > 0, true);
+    EXPECT_EQ(pDB->getProperty("kvsqlite.io.all.syncs", syncs).ok(), true);
+    EXPECT_EQ(syncs >= 40, true);
+    EXPECT_EQ(pDB->getProperty("kvsqlite.io.db.sync-p99-micros", p99).ok(), true);
+    EXPECT_EQ(pDB->getProperty("kvsqlite.io.db.sync-max-micros", max).ok(), true);
+    EXPECT_EQ(p99 > 0 && p99 <= max, true);
+
+    /* Asynchronous commits do not sync */
+    EXPECT_EQ(pDB->put(KVSQLite::WriteOptions(), "async", value).ok(), true);
+    int64_t after = 0;
+    EXPECT_EQ(pDB->getProperty("kvsqlite.io.all.syncs", after).ok(), true);
+    EXPECT_EQ(after, syncs);
+
+    EXPECT_EQ(pDB->getProperty("kvsqlite.io.db.unknown", after).type(), KVSQLite::Status::InvalidArgument);
+    EXPECT_EQ(pDB->getProperty("kvsqlite.io.disk.reads", after).type(), KVSQLite::Status::InvalidArgument);
+    delete pDB;
+
+    /* Not counted by default */
+    ASSERT_EQ((KVSQLite::DB<std::string, std::string>::open(KVSQLite::Options(), "KVSQLiteIo.db", &pDB)).ok(), true);
+    EXPECT_EQ(pDB->getProperty("kvsqlite.io.db.reads", after).type(), KVSQLite::Status::InvalidArgument);
+    delete pDB;
+    std::remove("KVSQLiteIo.db");
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, mmapAndWarmUp)
+{
+    std::remove("KVSQLiteMmap.db");
+    KVSQLite::Options options;
+    options.mmap_size = 64 * 1024 * 1024;
+    options.mmap_chunk_size = 1024 * 1024;
+    options.cache_size = 256 * 1024;
+    KVSQLite::DB<std::string, std::string> * pDB = nullptr;
+    ASSERT_EQ((KVSQLite::DB<std::string, std::string>::open(options, "KVSQLiteMmap.db", &pDB)).ok(), true);
+    int64_t mapped = 0;
+    EXPECT_EQ(pDB->getProperty("kvsqlite.mmap-size", mapped).ok(), true);
+    EXPECT_EQ(mapped, options.mmap_size);
+
+    KVSQLite::WriteBatch<std::string, std::string> batch;
+    for(int i = 0; i < 2000; i++)
+    {
+        batch.put("key" + std::to_string(i), std::string(500, 'a' + i % 26));
+    }
+    EXPECT_EQ(pDB->write(KVSQLite::WriteOptions(), &batch).ok(), true);
+    std::string value;
+    EXPECT_EQ(pDB->get("key1234", value).ok(), true);
+    EXPECT_EQ(value, std::string(500, 'a' + 1234 % 26));
+
+    /* The file grows by whole chunks */
+    FILE * pF = fopen("KVSQLiteMmap.db", "rb");
+    ASSERT_NE(pF, nullptr);
+    fseek(pF, 0, SEEK_END);
+    const long fileSize = ftell(pF);
+    fclose(pF);
+    EXPECT_EQ(fileSize % options.mmap_chunk_size, 0);
+
+    int64_t bytesRead = 0;
+    EXPECT_EQ(pDB->warmUp(0, &bytesRead).ok(), true);
+    EXPECT_EQ(bytesRead, fileSize);
+    EXPECT_EQ(pDB->warmUp(100000, &bytesRead).ok(), true);
+    EXPECT_EQ(bytesRead, 100000);
+    delete pDB;
+    std::remove("KVSQLiteMmap.db");
+
+    /* Nothing to read in memory */
+    ASSERT_EQ((KVSQLite::DB<std::string, std::string>::open(options, ":memory:", &pDB)).ok(), true);
+    EXPECT_EQ(pDB->warmUp(0, &bytesRead).ok(), true);
+    EXPECT_EQ(bytesRead, 0);
+    delete pDB;
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, warmUpTrace)
+{
+    std::remove("KVSQLiteWarm.db");
+    std::remove("KVSQLiteWarm.db-pagetrace");
+    KVSQLite::Options options;
+    options.warm_up_bytes = 64 * 1024;
+    KVSQLite::DB<std::string, std::string> * pDB = nullptr;
+    ASSERT_EQ((KVSQLite::DB<std::string, std::string>::open(options, "KVSQLiteWarm.db", &pDB)).ok(), true);
+    KVSQLite::WriteBatch<std::string, std::string> batch;
+    for(int i = 0; i < 2000; i++)
+    {
+        batch.put("key" + std::to_string(i), std::string(500, 'a' + i % 26));
+    }
+    EXPECT_EQ(pDB->write(KVSQLite::WriteOptions(), &batch).ok(), true);
+    std::string value;
+    for(int i = 0; i < 100; i++)
+    {
+        EXPECT_EQ(pDB->get("key" + std::to_string(i * 7), value).ok(), true);
+    }
+    /* The I/O counters stay off without Options::enable_io_stats */
+    int64_t bytes = 0;
+    EXPECT_EQ(pDB->getProperty("kvsqlite.io.db.reads", bytes).ok(), false);
+    delete pDB;
+
+    FILE * pF = fopen("KVSQLiteWarm.db-pagetrace", "rb");
+    ASSERT_NE(pF, nullptr);
+    fclose(pF);
+
+    /* The trace is read back within the budget, before open returns or in the background */
+    ASSERT_EQ((KVSQLite::DB<std::string, std::string>::open(options, "KVSQLiteWarm.db", &pDB)).ok(), true);
+    EXPECT_EQ(pDB->getProperty("kvsqlite.warm-up-bytes", bytes).ok(), true);
+    EXPECT_GT(bytes, 0);
+    EXPECT_LE(bytes, options.warm_up_bytes);
+    EXPECT_EQ(pDB->get("key1234", value).ok(), true);
+    EXPECT_EQ(value, std::string(500, 'a' + 1234 % 26));
+    delete pDB;
+
+    options.warm_up_in_background = true;
+    ASSERT_EQ((KVSQLite::DB<std::string, std::string>::open(options, "KVSQLiteWarm.db", &pDB)).ok(), true);
+    EXPECT_EQ(pDB->get("key42", value).ok(), true);
+    EXPECT_EQ(value, std::string(500, 'a' + 42 % 26));
+    delete pDB;
+
+    /* Without a trace, the pages of the key index are loaded */
+    std::remove("KVSQLiteWarm.db-pagetrace");
+    options.warm_up_in_background = false;
+    ASSERT_EQ((KVSQLite::DB<std::string, std::string>::open(options, "KVSQLiteWarm.db", &pDB)).ok(), true);
+    EXPECT_EQ(pDB->getProperty("kvsqlite.warm-up-bytes", bytes).ok(), true);
+    EXPECT_GT(bytes, 0);
+    EXPECT_LE(bytes, options.warm_up_bytes);
+    delete pDB;
+    std::remove("KVSQLiteWarm.db");
+    std::remove("KVSQLiteWarm.db-pagetrace");
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, readOnly)
+{
+    std::remove("KVSQLiteReadOnly.db");
+    KVSQLite::Options options;
+    options.enable_stats = true;
+    options.enable_ttl = true;
+    KVSQLite::DB<std::string, std::string> * pDB = nullptr;
+    ASSERT_EQ((KVSQLite::DB<std::string, std::string>::open(options, "KVSQLiteReadOnly.db", &pDB)).ok(), true);
+    for(int i = 0; i < 100; i++)
+    {
+        EXPECT_EQ(pDB->put(KVSQLite::WriteOptions(), "key" + std::to_string(i), "value" + std::to_string(i)).ok(), true);
+    }
+    EXPECT_EQ(pDB->put(KVSQLite::WriteOptions(), "gone", "x", std::chrono::milliseconds(-1)).ok(), true);
+    delete pDB;
+
+    /* Reads work, expired keys stay hidden, and writes are refused */
+    for(int immutable = 0; immutable < 2; immutable++)
+    {
+        KVSQLite::Options readOptions;
+        readOptions.read_only = !immutable;
+        readOptions.immutable = immutable;
+        readOptions.enable_stats = true;
+        readOptions.enable_ttl = true;
+        ASSERT_EQ((KVSQLite::DB<std::string, std::string>::open(readOptions, "KVSQLiteReadOnly.db", &pDB)).ok(), true);
+        std::string value;
+        EXPECT_EQ(pDB->get("key42", value).ok(), true);
+        EXPECT_EQ(value, "value42");
+        EXPECT_EQ(pDB->get("gone", value).type(), KVSQLite::Status::NotFound);
+        int64_t keys = 0;
+        EXPECT_EQ(pDB->getProperty("kvsqlite.num-keys", keys).ok(), true);
+        EXPECT_EQ(keys, 101);
+
+        KVSQLite::Iterator<std::string, std::string> * pIter = nullptr;
+        ASSERT_EQ(pDB->scanPrefix(KVSQLite::ReadOptions(), "key1", &pIter).ok(), true);
+        int count = 0;
+        for(; pIter->valid(); pIter->next())
+        {
+            count++;
+        }
+        EXPECT_EQ(count, 11);
+        delete pIter;
+
+        EXPECT_EQ(pDB->put(KVSQLite::WriteOptions(), "key1", "x").type(), KVSQLite::Status::InvalidArgument);
+        EXPECT_EQ(pDB->del(KVSQLite::WriteOptions(), "key1").type(), KVSQLite::Status::InvalidArgument);
+        KVSQLite::WriteBatch<std::string, std::string> batch;
+        batch.put("key1", "x");
+        EXPECT_EQ(pDB->write(KVSQLite::WriteOptions(), &batch).type(), KVSQLite::Status::InvalidArgument);
+        EXPECT_EQ(pDB->clear(KVSQLite::WriteOptions()).type(), KVSQLite::Status::InvalidArgument);
+        EXPECT_EQ(pDB->purgeExpired().type(), KVSQLite::Status::InvalidArgument);
+        EXPECT_EQ(pDB->get("key1", value).ok(), true);
+        EXPECT_EQ(value, "value1");
+        delete pDB;
+    }
+
+    /* A snapshot of an immutable file takes no lock either, even out of WAL mode */
+    KVSQLite::Options immutableOptions;
+    immutableOptions.immutable = true;
+    ASSERT_EQ((KVSQLite::DB<std::string, std::string>::open(immutableOptions, "KVSQLiteReadOnly.db", &pDB)).ok(), true);
+    sqlite3 * other = nullptr;
+    ASSERT_EQ(sqlite3_open("KVSQLiteReadOnly.db", &other), SQLITE_OK);
+    ASSERT_EQ(sqlite3_exec(other, "BEGIN EXCLUSIVE", nullptr, nullptr, nullptr), SQLITE_OK);
+    const KVSQLite::Snapshot * pSnapshot = nullptr;
+    ASSERT_EQ(pDB->getSnapshot(&pSnapshot).ok(), true);
+    KVSQLite::ReadOptions snapshotOptions;
+    snapshotOptions.snapshot = pSnapshot;
+    std::string value;
+    EXPECT_EQ(pDB->get(snapshotOptions, "key7", value).ok(), true);
+    EXPECT_EQ(value, "value7");
+    sqlite3_exec(other, "ROLLBACK", nullptr, nullptr, nullptr);
+    sqlite3_close(other);
+    pDB->releaseSnapshot(pSnapshot);
+    delete pDB;
+
+    /* Nothing is created: neither a missing file nor a missing keyspace */
+    KVSQLite::Options readOptions;
+    readOptions.read_only = true;
+    EXPECT_EQ((KVSQLite::DB<std::string, std::string>::open(readOptions, "KVSQLiteMissing.db", &pDB)).ok(), false);
+    EXPECT_EQ(pDB, nullptr);
+    FILE * pF = fopen("KVSQLiteMissing.db", "rb");
+    EXPECT_EQ(pF, nullptr);
+    readOptions.keyspace = "other";
+    EXPECT_EQ((KVSQLite::DB<std::string, std::string>::open(readOptions, "KVSQLiteReadOnly.db", &pDB)).type(), KVSQLite::Status::NotFound);
+    std::remove("KVSQLiteReadOnly.db");
+}
+
+/**
+ * @brief
+ */
+TEST(KVSQLite, directReads)
+{
+    std::remove("KVSQLiteDirect.db");
+    KVSQLite::Options options;
+    KVSQLite::DB<std::string, KVSQLite::Slice> * pDB = nullptr;
+    ASSERT_EQ((KVSQLite::DB<std::string, KVSQLite::Slice>::open(options, "KVSQLiteDirect.db", &pDB)).ok(), true);
+    KVSQLite::WriteBatch<std::string, KVSQLite::Slice> batch;
+    std::vector<std::string> values;
+    for(int i = 0; i < 3000; i++)
+    {
+        /* Every 100th value spills to overflow pages */
+        values.push_back(std::string((0 == i % 100) ? 10000 : 1 + i % 300, 'a' + i % 26));
+    }
+    for(int i = 0; i < 3000; i++)
+    {
+        batch.put("key" + std::to_string(i), values[i]);
+    }
+    EXPECT_EQ(pDB->write(KVSQLite::WriteOptions(), &batch).ok(), true);
+    delete pDB;
+
+    /* Direct reads need a file that can not change */
+    options.direct_reads = true;
+    EXPECT_EQ((KVSQLite::DB<std::string, KVSQLite::Slice>::open(options, "KVSQLiteDirect.db", &pDB)).type(), KVSQLite::Status::InvalidArgument);
+
+    options.immutable = true;
+    ASSERT_EQ((KVSQLite::DB<std::string, KVSQLite::Slice>::open(options, "KVSQLiteDirect.db", &pDB)).ok(), true);
+    KVSQLite::Options sqlOptions;
+    sqlOptions.immutable = true;
+    KVSQLite::DB<std::string, KVSQLite::Slice> * pSQL = nullptr;
+    ASSERT_EQ((KVSQLite::DB<std::string, KVSQLite::Slice>::open(sqlOptions, "KVSQLiteDirect.db", &pSQL)).ok(), true);
+    for(int i = 0; i < 3100; i++)
+    {
+        const std::string key = "key" + std::to_string(i);
+        KVSQLite::Slice direct;
+        KVSQLite::Slice expected;
+        KVSQLite::Status status = pDB->get(key, direct);
+        ASSERT_EQ(status.type(), pSQL->get(key, expected).type());
+        if(status.ok())
+        {
+            ASSERT_EQ(direct.toString(), expected.toString());
+            ASSERT_EQ(direct.toString(), values[i]);
+        }
+        else
+        {
+            EXPECT_GE(i, 3000);
+        }
+    }
+    int64_t lookups = 0;
+    int64_t fallbacks = 0;
+    EXPECT_EQ(pDB->getProperty("kvsqlite.direct-lookups", lookups).ok(), true);
+    EXPECT_EQ(pDB->getProperty("kvsqlite.direct-fallbacks", fallbacks).ok(), true);
+    EXPECT_EQ(fallbacks, 30);
+    EXPECT_EQ(lookups, 3100 - 30);
+    EXPECT_EQ(pSQL->getProperty("kvsqlite.direct-lookups", lookups).ok(), true);
+    EXPECT_EQ(lookups, 0);
+
+    /* An attached file is not immutable, its keys are read through SQLite */
+    std::remove("KVSQLiteDirectAttached.db");
+    KVSQLite::DB<std::string, KVSQLite::Slice> * pAttached = nullptr;
+    ASSERT_EQ((KVSQLite::DB<std::string, KVSQLite::Slice>::open(KVSQLite::Options(), "KVSQLiteDirectAttached.db", &pAttached)).ok(), true);
+    EXPECT_EQ(pAttached->put(KVSQLite::WriteOptions(), "attached", "1").ok(), true);
+    delete pAttached;
+    ASSERT_EQ((KVSQLite::DB<std::string, KVSQLite::Slice>::open(options, pDB, "KVSQLiteDirectAttached.db", &pAttached)).ok(), true);
+    KVSQLite::Slice attached;
+    EXPECT_EQ(pAttached->get("attached", attached).ok(), true);
+    EXPECT_EQ(attached.toString(), "1");
+    EXPECT_EQ(pAttached->getProperty("kvsqlite.direct-lookups", lookups).ok(), true);
+    EXPECT_EQ(lookups, 0);
+    delete pAttached;
+    std::remove("KVSQLiteDirectAttached.db");
+
+    delete pSQL;
+    delete pDB;
+    std::remove("KVSQLiteDirect.db");
+
+    /* Integer keys, in their native and encoded forms, and std::string values */
+    for(int encode = 0; encode < 2; encode++)
+    {
+        KVSQLite::Options intOptions;
+        intOptions.encode_keys = encode;
+        KVSQLite::DB<int64_t, std::string> * pIntDB = nullptr;
+        ASSERT_EQ((KVSQLite::DB<int64_t, std::string>::open(intOptions, "KVSQLiteDirect.db", &pIntDB)).ok(), true);
+        KVSQLite::WriteBatch<int64_t, std::string> intBatch;
+        for(int64_t i = -1000; i < 1000; i++)
+        {
+            intBatch.put(i * 7919, "value" + std::to_string(i));
+        }
+        EXPECT_EQ(pIntDB->write(KVSQLite::WriteOptions(), &intBatch).ok(), true);
+        delete pIntDB;
+
+        intOptions.immutable = true;
+        intOptions.direct_reads = true;
+        ASSERT_EQ((KVSQLite::DB<int64_t, std::string>::open(intOptions, "KVSQLiteDirect.db", &pIntDB)).ok(), true);
+        for(int64_t i = -1000; i < 1000; i++)
+        {
+            std::string value;
+            ASSERT_EQ(pIntDB->get(i * 7919, value).ok(), true);
+            ASSERT_EQ(value, "value" + std::to_string(i));
+        }
+        std::string value;
+        EXPECT_EQ(pIntDB->get(1, value).type(), KVSQLite::Status::NotFound);
+        EXPECT_EQ(pIntDB->getProperty("kvsqlite.direct-lookups", lookups).ok(), true);
+        EXPECT_EQ(lookups, 2001);
+        delete pIntDB;
+        std::remove("KVSQLiteDirect.db");
+    }
+}
+
 int main(int argc, char **argv)
 {
     testing::InitGoogleTest(&argc, argv);